@@ -7,6 +7,7 @@
 #   FFTW_FOUND               ... true if fftw is found on the system
 #   FFTW_LIBRARIES           ... full path to fftw library
 #   FFTW_INCLUDES            ... fftw include directory
+#   FFTW_THREADS_FOUND       ... true if the fftw threads library is found
 #
 # The following variables will be checked by the function
 #   FFTW_USE_STATIC_LIBS    ... if true, only static libraries are found
@@ -49,6 +50,14 @@ if( FFTW_ROOT )
     NO_DEFAULT_PATH
   )
 
+  find_library(
+    FFTW_THREADS_LIB
+    NAMES "fftw3_threads"
+    PATHS ${FFTW_ROOT}
+    PATH_SUFFIXES "lib" "lib64"
+    NO_DEFAULT_PATH
+  )
+
   find_library(
     FFTWF_LIB
     NAMES "fftw3f"
@@ -82,6 +91,12 @@ else()
     PATHS ${PKG_FFTW_LIBRARY_DIRS} ${LIB_INSTALL_DIR}
   )
 
+  find_library(
+    FFTW_THREADS_LIB
+    NAMES "fftw3_threads"
+    PATHS ${PKG_FFTW_LIBRARY_DIRS} ${LIB_INSTALL_DIR}
+  )
+
   find_library(
     FFTWF_LIB
     NAMES "fftw3f"
@@ -104,6 +119,13 @@ endif( FFTW_ROOT )
 
 set(FFTW_LIBRARIES ${FFTW_LIB})
 
+if(FFTW_THREADS_LIB)
+  set(FFTW_THREADS_FOUND TRUE)
+  set(FFTW_LIBRARIES ${FFTW_THREADS_LIB} ${FFTW_LIBRARIES})
+else()
+  set(FFTW_THREADS_FOUND FALSE)
+endif()
+
 if(FFTWF_LIB)
   set(FFTW_LIBRARIES ${FFTW_LIBRARIES} ${FFTWF_LIB})
 endif()
@@ -165,6 +165,9 @@ if(NOT VIF_FOUND)
     else()
         set(VIF_INCLUDE_DIRS ${VIF_INCLUDE_DIRS} ${FFTW_INCLUDES})
         set(VIF_LIBRARIES ${VIF_LIBRARIES} ${FFTW_LIBRARIES})
+        if (NOT FFTW_THREADS_FOUND)
+            add_definitions(-DNO_FFTW_THREADS)
+        endif()
     endif()
 
     # Handle conditional LibUnwind support
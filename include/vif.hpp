@@ -28,9 +28,11 @@
 #include "vif/math/base.hpp"
 #include "vif/math/interpolate.hpp"
 #include "vif/math/reduce.hpp"
+#include "vif/math/quantile.hpp"
 #include "vif/math/histogram.hpp"
 #include "vif/math/random.hpp"
 #include "vif/math/matrix.hpp"
+#include "vif/math/sparse.hpp"
 #include "vif/math/linfit.hpp"
 #include "vif/math/convex_hull.hpp"
 #include "vif/math/complex.hpp"
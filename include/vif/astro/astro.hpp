@@ -661,20 +661,218 @@ namespace astro {
         return field_area_h2d(ra, dec);
     }
 
+    struct angcorrel_params {
+        uint_t thread = 1u;
+        bool verbose = false;
+        bool brute_force = false;
+    };
+}
+
+namespace impl {
+    namespace astro_impl {
+        // Sky positions bucketed into a regular grid of 3D cells covering the unit sphere.
+        // Positions are stored sorted by cell, so that all the points of a given cell (and of
+        // consecutive cells along the 'z' axis) are contiguous in memory. With a cell size
+        // larger than the chord of the largest searched separation, all the neighbors of
+        // a point are found within the 3x3x3 block of cells surrounding it. Working with
+        // unit vectors avoids any issue with the RA wrap-around or the poles.
+        struct pair_grid {
+            static const uint_t nbit = 21;
+            static const uint_t ncell = uint_t(1) << nbit;
+
+            double cell_size = 0.0;
+            vec1u keys;           // cell key of each point, sorted
+            vec1u ids;            // original index of each point
+            vec1d ra, dec, cdec;  // coordinates in radian, cos(dec)
+            vec1d x, y, z;        // position on the unit sphere
+
+            pair_grid() = default;
+
+            template<std::size_t N, typename TR, typename TD>
+            pair_grid(const vec<N,TR>& tra, const vec<N,TD>& tdec, double cs) {
+                // Prevent overflowing the number of bits allocated per cell index
+                cell_size = std::max(cs, 2.0/(ncell - 2));
+
+                const double d2r = dpi/180.0;
+                const uint_t n = tra.size();
+
+                vec1u tkeys(n);
+                vec1d tx(n), ty(n), tz(n);
+                for (uint_t i : range(n)) {
+                    double r = d2r*tra.safe[i], d = d2r*tdec.safe[i];
+                    tx.safe[i] = cos(d)*cos(r);
+                    ty.safe[i] = cos(d)*sin(r);
+                    tz.safe[i] = sin(d);
+                    tkeys.safe[i] = key(cell(tx.safe[i]), cell(ty.safe[i]), cell(tz.safe[i]));
+                }
+
+                ids = sort(tkeys);
+                keys = tkeys.safe[ids];
+                x = tx.safe[ids];
+                y = ty.safe[ids];
+                z = tz.safe[ids];
+
+                ra.resize(n);
+                dec.resize(n);
+                cdec.resize(n);
+                for (uint_t i : range(n)) {
+                    ra.safe[i] = d2r*tra.safe[ids.safe[i]];
+                    dec.safe[i] = d2r*tdec.safe[ids.safe[i]];
+                    cdec.safe[i] = cos(dec.safe[i]);
+                }
+            }
+
+            uint_t size() const {
+                return keys.size();
+            }
+
+            uint_t cell(double c) const {
+                // Invalid coordinates (NaN) go to the first cell; they never form pairs
+                double f = floor((c + 1.0)/cell_size);
+                return f > 0.0 ? std::min(uint_t(f), ncell - 1) : 0;
+            }
+
+            static uint_t key(uint_t cx, uint_t cy, uint_t cz) {
+                return (cx << (2*nbit)) | (cy << nbit) | cz;
+            }
+
+            // Call 'f(j)' for all the points 'j' located in the 3x3x3 block of cells
+            // surrounding the position (px,py,pz) on the unit sphere.
+            template<typename F>
+            void for_each_neighbor(double px, double py, double pz, F&& f) const {
+                uint_t cx = cell(px), cy = cell(py), cz = cell(pz);
+                uint_t z0 = (cz == 0 ? 0 : cz - 1);
+                uint_t z1 = std::min(cz + 1, ncell - 1);
+
+                for (uint_t ix = (cx == 0 ? 0 : cx - 1); ix <= std::min(cx + 1, ncell - 1); ++ix)
+                for (uint_t iy = (cy == 0 ? 0 : cy - 1); iy <= std::min(cy + 1, ncell - 1); ++iy) {
+                    auto b = std::lower_bound(keys.data.begin(), keys.data.end(), key(ix, iy, z0));
+                    auto e = std::upper_bound(b, keys.data.end(), key(ix, iy, z1));
+                    for (uint_t j = b - keys.data.begin(), je = e - keys.data.begin(); j < je; ++j) {
+                        f(j);
+                    }
+                }
+            }
+        };
+
+        // Count the pairs between the points of 'g1' and those of 'g2' (or within 'g1' if 'g2'
+        // is null), in bins of angular separation. Each (ordered) pair is counted once, which
+        // reproduces exactly the counts of the brute force implementation, including the
+        // contribution of each point to itself (at zero separation). The distance is computed
+        // with the exact same arithmetic as 'angdist()', in the same argument order, so that
+        // pairs lying on a bin edge are assigned to the same bin.
+        template<typename TB>
+        vec1u angcorrel_count_pairs(const pair_grid& g1, const pair_grid* g2,
+            const vec<2,TB>& bins, double max_proxy, uint_t nthread,
+            std::atomic<uint_t>& iter) {
+
+            const uint_t nbin = bins.dims[1];
+            const double d2r = dpi/180.0;
+            const bool self = (g2 == nullptr);
+            const bin_finder<TB> find_bin(bins);
+            const pair_grid& gs = (self ? g1 : *g2);
+
+            auto to_dist = [d2r](double p) {
+                return 3600.0*2.0*asin(sqrt(p))/d2r;
+            };
+
+            auto work = [&](uint_t i0, uint_t i1, vec1u& counts) {
+                for (uint_t i : range(i0, i1)) {
+                    double px = g1.x.safe[i], py = g1.y.safe[i], pz = g1.z.safe[i];
+                    gs.for_each_neighbor(px, py, pz, [&](uint_t j) {
+                        if (self && j < i) return;
+
+                        // Quick rejection using the chord between the two points
+                        double chord = sqr(gs.x.safe[j] - px) + sqr(gs.y.safe[j] - py) +
+                            sqr(gs.z.safe[j] - pz);
+                        if (chord > max_proxy) return;
+
+                        // In angdist(), the point of 'g2' is the first argument,
+                        // and the point of 'g1' is the second.
+                        double sra = sin(0.5*(g1.ra.safe[i] - gs.ra.safe[j]));
+                        double sde = sin(0.5*(g1.dec.safe[i] - gs.dec.safe[j]));
+                        double p1 = sde*sde + sra*sra*g1.cdec.safe[i]*gs.cdec.safe[j];
+
+                        uint_t b = find_bin(to_dist(p1));
+                        if (b != npos) ++counts.safe[b];
+
+                        if (self && j != i) {
+                            // Count the reverse pair, which can differ by rounding only
+                            double p2 = sde*sde + sra*sra*gs.cdec.safe[j]*g1.cdec.safe[i];
+                            if (p2 != p1) {
+                                b = find_bin(to_dist(p2));
+                            }
+
+                            if (b != npos) ++counts.safe[b];
+                        }
+                    });
+                }
+            };
+
+            const uint_t n = g1.size();
+            const uint_t chunk = 256;
+
+            vec1u counts(nbin);
+            if (nthread <= 1) {
+                for (uint_t i0 = 0; i0 < n; i0 += chunk) {
+                    uint_t i1 = std::min(i0 + chunk, n);
+                    work(i0, i1, counts);
+                    iter += i1 - i0;
+                }
+            } else {
+                // Points are dispatched to the threads in small chunks, since the cost per
+                // point depends on the local density. Each thread has its own counts, which
+                // are summed at the end.
+                std::atomic<uint_t> next(0);
+                std::vector<vec1u> tcounts(nthread, vec1u(nbin));
+                auto pool = thread::pool(nthread);
+                for (uint_t t : range(nthread)) {
+                    pool[t].start([&, t]() {
+                        uint_t i0;
+                        while ((i0 = next.fetch_add(chunk)) < n) {
+                            uint_t i1 = std::min(i0 + chunk, n);
+                            work(i0, i1, tcounts[t]);
+                            iter += i1 - i0;
+                        }
+                    });
+                }
+
+                for (auto& t : pool) {
+                    t.join();
+                }
+
+                for (auto& c : tcounts) {
+                    counts += c;
+                }
+            }
+
+            return counts;
+        }
+    }
+}
+
+namespace astro {
+
     // Compute 2 point angular correlation function of a data set with positions 'ra' and 'dec'
     // against a set of random positions uniformly drawn in the same region of space 'rra' and
     // 'rdec'. For good results, there must be at least as many random positions as there are
     // input positions, and results get better the more random positions are given.
     // Compute the correlation in given bins of angular separation (in arcseconds).
-    // Uses the Landy-Szalay estimator, computed with a brute force approach.
+    // Uses the Landy-Szalay estimator. Pairs are counted using a grid of cells on the sphere,
+    // so that only the pairs closer than the largest bin are visited; the work can be split
+    // among multiple threads with 'params.thread'. The brute force approach is still available
+    // with 'params.brute_force', and gives identical results.
     template<std::size_t N1, typename TR1, typename TD1,
         std::size_t N2, typename TR2, typename TD2, typename TB>
     vec1d angcorrel(const vec<N1,TR1>& ra, const vec<N1,TD1>& dec,
-        const vec<N2,TR2>& rra, const vec<N2,TD2>& rdec, const vec<2,TB>& bins) {
+        const vec<N2,TR2>& rra, const vec<N2,TD2>& rdec, const vec<2,TB>& bins,
+        angcorrel_params params = angcorrel_params{}) {
         vif_check(ra.dims == dec.dims, "RA and Dec dimensions do not match for the "
             "input catalog (", ra.dims, " vs ", dec.dims, ")");
         vif_check(rra.dims == rdec.dims, "RA and Dec dimensions do not match for the "
             "random catalog (", rra.dims, " vs ", rdec.dims, ")");
+        vif_check(bins.dims[0] == 2, "can only be called with a bin vector (expected "
+            "dims=[2,...], got dims=[", bins.dims, "])");
 
         uint_t nbin = bins.dims[1];
 
@@ -682,17 +880,65 @@ namespace astro {
         vec1d dr(nbin);
         vec1d rr(nbin);
 
-        for (uint_t i : range(ra)) {
-            vec1d d = angdist(ra, dec, ra[i], dec[i]);
-            dd += histogram(d, bins);
+        if (params.brute_force) {
+            auto p = progress_start(2*ra.size() + rra.size());
+            for (uint_t i : range(ra)) {
+                vec1d d = angdist(ra, dec, ra[i], dec[i]);
+                dd += histogram(d, bins);
 
-            d = angdist(rra, rdec, ra[i], dec[i]);
-            dr += histogram(d, bins);
-        }
+                d = angdist(rra, rdec, ra[i], dec[i]);
+                dr += histogram(d, bins);
+
+                if (params.verbose) progress(p, 2);
+            }
+
+            for (uint_t i : range(rra)) {
+                vec1d d = angdist(rra, rdec, rra[i], rdec[i]);
+                rr += histogram(d, bins);
+
+                if (params.verbose) progress(p);
+            }
+        } else if (nbin != 0) {
+            // Only pairs closer than the largest bin need to be visited.
+            // Compute the corresponding chord on the unit sphere (with some margin to
+            // protect against round-off errors).
+            const double d2r = dpi/180.0;
+            double max_dist = max(bins.safe(1,_))/3600.0*d2r;
+            double max_chord = (max_dist >= dpi || !is_finite(max_dist) ?
+                2.0 : 2.0*sin(0.5*max_dist));
+            max_chord = std::min(2.0, max_chord*(1.0 + 1e-6) + 1e-12);
+
+            impl::astro_impl::pair_grid gd(ra, dec, max_chord);
+            impl::astro_impl::pair_grid gr(rra, rdec, max_chord);
+
+            std::atomic<uint_t> iter(0);
+            uint_t niter = 2*gd.size() + gr.size();
+
+            auto count_all = [&]() {
+                const double max_proxy = sqr(max_chord);
+                dd = impl::astro_impl::angcorrel_count_pairs(gd, nullptr, bins, max_proxy,
+                    params.thread, iter);
+                dr = impl::astro_impl::angcorrel_count_pairs(gd, &gr, bins, max_proxy,
+                    params.thread, iter);
+                rr = impl::astro_impl::angcorrel_count_pairs(gr, nullptr, bins, max_proxy,
+                    params.thread, iter);
+            };
+
+            if (params.verbose && niter > 0) {
+                // Do the work in a separate thread, while this one updates the progress bar
+                thread::thread_t worker;
+                worker.start(count_all);
 
-        for (uint_t i : range(rra)) {
-            vec1d d = angdist(rra, rdec, rra[i], rdec[i]);
-            rr += histogram(d, bins);
+                auto p = progress_start(niter);
+                while (iter < niter) {
+                    thread::sleep_for(0.2);
+                    print_progress(p, iter);
+                }
+
+                worker.join();
+            } else {
+                count_all();
+            }
         }
 
         double norm1 = rra.size()/double(ra.size());
@@ -1355,6 +1601,157 @@ namespace astro {
         return r;
     }
 
+    struct filter_response_params {
+        uint_t thread = 1; // number of threads, SEDs being split among them
+    };
+
+    // Linear operator giving the fluxes of many SEDs sampled on a common wavelength grid, through a
+    // set of filters. The trapezoidal integration of 'sed2flux' is expanded once per filter into
+    // weights on the contiguous range of SED wavelengths covered by the filter, and each flux then
+    // reduces to a short dot product. The result is that of 'sed2flux' up to rounding errors, and
+    // filters for which 'sed2flux' would return NaN give NaN fluxes.
+    struct filter_response {
+        uint_t nlam = 0;            // number of wavelengths in the SED grid
+        vec1u start;                // index of the first SED wavelength covered by each filter
+        std::vector<vec1d> weights; // weights of each filter, from 'start' (empty if invalid)
+
+        filter_response() = default;
+
+        template<typename TFi, typename TL>
+        filter_response(const vec<1,TFi>& filters, const vec<1,TL>& lam) : nlam(lam.size()) {
+            vif_check(!lam.empty(), "wavelength array cannot be empty");
+
+            const uint_t nfilter = filters.size();
+            start = replicate(npos, nfilter);
+            weights.resize(nfilter);
+
+            vec1d w(nlam);
+            for (uint_t f : range(nfilter)) {
+                const filter_t& fil = filters[f];
+                vif_check(fil.lam.dims == fil.res.dims, "incompatible dimensions for filter "
+                    "wavelength and response arrays (", fil.lam.dims, " vs. ", fil.res.dims, ")");
+                vif_check(!fil.lam.empty(), "filter arrays cannot be empty");
+
+                // Same walk as 'sed2flux', recording the coefficient of each SED value instead of
+                // accumulating the flux. A point on the curve is either a filter point, linear
+                // combination of SED values 'i' and 'i+1', or an SED point 'i'.
+                uint_t ised = lower_bound(lam, fil.lam.safe[0]);
+                if (ised == npos || ised == nlam-1) continue;
+                uint_t ifil = 0;
+                const uint_t nfil = fil.lam.size();
+                const uint_t i0 = ised;
+
+                auto lam_frac = [&](double x, uint_t i) {
+                    return (x - lam.safe[i])/(lam.safe[i+1] - lam.safe[i]);
+                };
+
+                double plam = fil.lam.safe[0];
+                uint_t pi = ised;
+                double pa = lam_frac(plam, ised);
+                double pw0 = fil.res.safe[0]*(1.0 - pa), pw1 = fil.res.safe[0]*pa;
+
+                w[i0] = 0.0;
+                w[i0+1] = 0.0;
+                while (ifil < nfil-1 && ised < nlam-1) {
+                    double tlam;
+                    uint_t ni;
+                    double nw0, nw1;
+
+                    if (fil.lam.safe[ifil+1] < lam.safe[ised+1]) {
+                        // Next point is from filter
+                        ++ifil;
+                        tlam = fil.lam.safe[ifil];
+                        double a = lam_frac(tlam, ised);
+                        ni = ised;
+                        nw0 = fil.res.safe[ifil]*(1.0 - a);
+                        nw1 = fil.res.safe[ifil]*a;
+                    } else {
+                        // Next point is from SED
+                        ++ised;
+                        tlam = lam.safe[ised];
+                        ni = ised;
+                        nw0 = sed2flux_interpolate(fil.lam, fil.res, tlam, ifil);
+                        nw1 = 0.0;
+                        if (ised < nlam-1) w[ised+1] = 0.0;
+                    }
+
+                    double dl = 0.5*(tlam - plam);
+                    w[pi] += pw0*dl;
+                    w[pi+1] += pw1*dl;
+                    w[ni] += nw0*dl;
+                    if (nw1 != 0.0) w[ni+1] += nw1*dl;
+
+                    plam = tlam;
+                    pi = ni;
+                    pw0 = nw0;
+                    pw1 = nw1;
+                }
+
+                if (ifil != nfil - 1) continue;
+
+                start[f] = i0;
+                weights[f] = w[i0-_-std::min(ised+1, nlam-1)];
+            }
+        }
+
+        uint_t size() const {
+            return start.size();
+        }
+
+        // Fluxes of a batch of SEDs (nsed x nlam), returned as (nsed x nfilter)
+        vec2d apply(const vec2d& sed, const filter_response_params& params =
+            filter_response_params{}) const {
+
+            vif_check(sed.dims[1] == nlam, "incompatible dimensions between SEDs and wavelength "
+                "grid (", sed.dims[1], " vs. ", nlam, ")");
+
+            const uint_t nsed = sed.dims[0];
+            const uint_t nfilter = size();
+            vec2d flux(nsed, nfilter);
+
+            auto process = [&](uint_t i0, uint_t i1) {
+                for (uint_t s = i0; s < i1; ++s) {
+                    const double* row = &sed.safe(s,0);
+                    double* out = &flux.safe(s,0);
+                    for (uint_t f = 0; f < nfilter; ++f) {
+                        out[f] = dot_(f, row);
+                    }
+                }
+            };
+
+            if (params.thread > 1 && nsed > 1) {
+                thread::task_pool pool(params.thread);
+                pool.execute_chunks(process, 0, nsed);
+            } else {
+                process(0, nsed);
+            }
+
+            return flux;
+        }
+
+        // Fluxes of a single SED through each filter
+        vec1d apply(const vec1d& sed) const {
+            vif_check(sed.size() == nlam, "incompatible dimensions between SED and wavelength "
+                "grid (", sed.size(), " vs. ", nlam, ")");
+
+            vec1d flux(size());
+            for (uint_t f : range(flux)) {
+                flux.safe[f] = dot_(f, sed.data.data());
+            }
+
+            return flux;
+        }
+
+    private :
+
+        double dot_(uint_t f, const double* row) const {
+            if (start.safe[f] == npos) return dnan;
+
+            return impl::simd_impl::dot(weights[f].data.data(), row + start.safe[f],
+                weights[f].size());
+        }
+    };
+
     template<typename TypeL, typename TypeS>
     double sed_convert(const filter_t& from, const filter_t& to, double z, double d,
         const vec<1,TypeL>& lam, const vec<1,TypeS>& sed) {
@@ -1384,6 +1781,37 @@ namespace astro {
         return sed_luminosity(lam, sed, 8.0, 1000.0);
     }
 
+#ifndef NO_CFITSIO
+    // Read a PSF from a FITS file, and trim it so that the peak is at the center and the
+    // dimensions are odd
+    inline vec2d read_psf_stamp(const std::string& filename) {
+        vec2d tpsf;
+        fits::read(filename, tpsf);
+
+        // Trim the tPSF, make sure that the peak is at the center, and that the dimensions
+        // are odds
+        vec1i idm = mult_ids(tpsf, max_id(tpsf));
+        int_t hsize = 0;
+        int_t imax = std::min(
+            std::min(idm[0], int_t(tpsf.dims[0])-1-idm[0]),
+            std::min(idm[1], int_t(tpsf.dims[1])-1-idm[1])
+        );
+
+        for (int_t i = 1; i <= imax; ++i) {
+            if (tpsf(idm[0]-i,idm[1]) == 0.0 &&
+                tpsf(idm[0]+i,idm[1]) == 0.0 &&
+                tpsf(idm[0],idm[1]-i) == 0.0 &&
+                tpsf(idm[0],idm[1]+i) == 0.0) {
+                hsize = i;
+                break;
+            }
+        }
+
+        if (hsize == 0) hsize = imax;
+        return subregion(tpsf, {idm[0]-hsize, idm[1]-hsize, idm[0]+hsize, idm[1]+hsize});
+    }
+#endif
+
     template <typename T>
     bool make_psf(const std::array<uint_t,2>& dims, double x0, double y0,
         const std::string& psf_model, vec<2,T>& psf) {
@@ -1447,30 +1875,8 @@ namespace astro {
                     params.size()-1, " are provided");
             }
 
-            vec2d tpsf;
-            fits::read(params[1], tpsf);
-
-            // Trim the tPSF, make sure that the peak is at the center, and that the dimensions
-            // are odds
-            vec1i idm = mult_ids(tpsf, max_id(tpsf));
-            int_t hsize = 0;
-            int_t imax = std::min(
-                std::min(idm[0], int_t(tpsf.dims[0])-1-idm[0]),
-                std::min(idm[1], int_t(tpsf.dims[1])-1-idm[1])
-            );
-
-            for (int_t i = 1; i <= imax; ++i) {
-                if (tpsf(idm[0]-i,idm[1]) == 0.0 &&
-                    tpsf(idm[0]+i,idm[1]) == 0.0 &&
-                    tpsf(idm[0],idm[1]-i) == 0.0 &&
-                    tpsf(idm[0],idm[1]+i) == 0.0) {
-                    hsize = i;
-                    break;
-                }
-            }
-
-            if (hsize == 0) hsize = imax;
-            tpsf = subregion(tpsf, {idm[0]-hsize, idm[1]-hsize, idm[0]+hsize, idm[1]+hsize});
+            vec2d tpsf = read_psf_stamp(params[1]);
+            int_t hsize = tpsf.dims[0]/2;
 
             int_t ix0 = round(x0), iy0 = round(y0);
             double dx = x0 - ix0;
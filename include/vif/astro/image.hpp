@@ -5,6 +5,7 @@
 #include "vif/core/error.hpp"
 #include "vif/core/range.hpp"
 #include "vif/utility/generic.hpp"
+#include "vif/utility/thread.hpp"
 #include "vif/math/base.hpp"
 #include "vif/math/fourier.hpp"
 #include "vif/astro/wcs.hpp"
@@ -154,6 +155,123 @@ namespace astro {
         return trs;
     }
 
+    struct psf_stamp_bank_params {
+        // Number of sub-pixel phases per pixel, along each axis. Zero disables the bank: the
+        // PSF is then shifted exactly for each offset, with no quantisation.
+        uint_t phases = 16;
+        // Use translate_bicubic() instead of translate() to shift the PSF
+        bool bicubic = false;
+    };
+
+    // Bank of PSF stamps shifted by sub-pixel offsets, precomputed on a regular grid of phases.
+    // Offsets follow the same convention as translate(): 'dx' shifts the first dimension, and
+    // 'dy' the second. They must lie in [-0.5,0.5], as obtained by subtracting the rounded
+    // position. Once built, the bank is read-only and can be shared between threads.
+    // With zero phases, no stamp is precomputed and shift() interpolates the PSF exactly.
+    struct psf_stamp_bank {
+        uint_t phases = 0;               // number of sub-pixel phases per pixel
+        double max_offset_error = dnan;  // maximum error on the offset (in pixels)
+        double max_error = dnan;         // maximum error on the stamps (relative to the peak)
+
+    private :
+        std::vector<vec2d> stamps_;
+        vec2d psf_;
+        bool bicubic_ = false;
+
+    public :
+        psf_stamp_bank() = default;
+
+        template<typename TypeV>
+        explicit psf_stamp_bank(const vec<2,TypeV>& psf,
+            const psf_stamp_bank_params& p = psf_stamp_bank_params{}) : phases(p.phases) {
+
+            if (phases == 0) {
+                psf_ = psf;
+                bicubic_ = p.bicubic;
+                max_offset_error = 0.0;
+                max_error = 0.0;
+                return;
+            }
+
+            const uint_t np = phases+1;
+            stamps_.resize(np*np);
+            for (uint_t ix : range(np))
+            for (uint_t iy : range(np)) {
+                double dx = double(ix)/phases - 0.5, dy = double(iy)/phases - 0.5;
+                stamps_[ix*np + iy] = (p.bicubic ?
+                    translate_bicubic(psf, dx, dy) : translate(psf, dx, dy));
+            }
+
+            // Offsets are rounded to the closest phase, and the resulting error on the stamps
+            // is at most half the difference between two neighboring phases along each axis
+            // (exactly so for bilinear interpolation, approximately for bicubic)
+            max_offset_error = 0.5/phases;
+            double ex = 0.0, ey = 0.0;
+            for (uint_t ix : range(np))
+            for (uint_t iy : range(np)) {
+                const vec2d& s = stamps_[ix*np + iy];
+                if (ix+1 < np) {
+                    ex = std::max(ex, max(abs(stamps_[(ix+1)*np + iy] - s)));
+                }
+                if (iy+1 < np) {
+                    ey = std::max(ey, max(abs(stamps_[ix*np + iy + 1] - s)));
+                }
+            }
+
+            double peak = max(abs(psf));
+            max_error = (peak > 0.0 ? 0.5*(ex + ey)/peak : 0.0);
+        }
+
+        // Index of the closest phase for a given offset
+        uint_t phase(double d) const {
+            vif_check(abs(d) <= 0.5 + 1e-6, "sub-pixel offset must be in [-0.5,0.5] "
+                "(got ", d, ")");
+
+            return std::min(phases, uint_t(std::max(0.0, round((d + 0.5)*phases))));
+        }
+
+        // PSF shifted by the closest phase to (dx,dy)
+        const vec2d& stamp(double dx, double dy) const {
+            vif_check(phases > 0, "PSF stamp bank has no phase, use shift() instead");
+            return stamps_[phase(dx)*(phases+1) + phase(dy)];
+        }
+
+        // PSF shifted by (dx,dy): exactly if the bank has no phase, or else a copy of the
+        // closest stamp
+        vec2d shift(double dx, double dy) const {
+            if (phases == 0) {
+                return bicubic_ ? translate_bicubic(psf_, dx, dy) : translate(psf_, dx, dy);
+            } else {
+                return stamp(dx, dy);
+            }
+        }
+
+        // PSF shifted by (dx,dy), as in shift(), and divided by the error map 'err',
+        // with the PSF centered on the pixel (ix,iy) of 'err'. Pixels that fall outside
+        // of the error map are set to zero.
+        template<typename TypeE>
+        vec2d weighted_stamp(const vec<2,TypeE>& err, int_t ix, int_t iy,
+            double dx, double dy) const {
+
+            vec2d exact;
+            if (phases == 0) exact = shift(dx, dy);
+            const vec2d& s = (phases == 0 ? exact : stamp(dx, dy));
+            vec2d ws(s.dims);
+
+            const int_t hx = s.dims[0]/2, hy = s.dims[1]/2;
+            const int_t nx = err.dims[0], ny = err.dims[1];
+            for (uint_t x : range(s.dims[0]))
+            for (uint_t y : range(s.dims[1])) {
+                int_t tx = ix - hx + int_t(x), ty = iy - hy + int_t(y);
+                if (tx >= 0 && tx < nx && ty >= 0 && ty < ny) {
+                    ws.safe(x,y) = s.safe(x,y)/err.safe(uint_t(tx),uint_t(ty));
+                }
+            }
+
+            return ws;
+        }
+    };
+
     template<typename TypeV>
     typename vec<2,TypeV>::effective_type flip_x(const vec<2,TypeV>& v) {
         auto r = v.concretise();
@@ -521,13 +639,13 @@ namespace astro {
         vec2d tkernel(tmap.dims);
 
         // TODO: optimize this and catch case where kernel is larger than image
-        vec1u px1 = hsx + indgen<uint_t>(hsx);
-        vec1u py1 = hsy + indgen<uint_t>(hsy);
+        vec1u px1 = hsx + indgen<uint_t>(hsx+1);
+        vec1u py1 = hsy + indgen<uint_t>(hsy+1);
         vec1u px2 = hsx - 1 - indgen<uint_t>(hsx);
         vec1u py2 = hsy - 1 - indgen<uint_t>(hsy);
 
-        vec1u ix1 = indgen<uint_t>(hsx);
-        vec1u iy1 = indgen<uint_t>(hsy);
+        vec1u ix1 = indgen<uint_t>(hsx+1);
+        vec1u iy1 = indgen<uint_t>(hsy+1);
         vec1u ix2 = tmap.dims[0] - 1 - indgen<uint_t>(hsx);
         vec1u iy2 = tmap.dims[1] - 1 - indgen<uint_t>(hsy);
 
@@ -549,8 +667,6 @@ namespace astro {
         const vec2d& kernel_normal;
         vec2cd kernel_fourier;
         uint_t hsx = 0, hsy = 0;
-        fftw_plan pf, pi;
-        bool pf_built = false, pi_built = false;
         vec2d tmap;
         vec2cd cimg;
 
@@ -566,44 +682,10 @@ namespace astro {
         convolver2d(convolver2d&&) = default;
         convolver2d& operator=(convolver2d&&) = default;
 
-        ~convolver2d() {
-            std::lock_guard<std::mutex> lock(impl::fftw_planner_mutex());
-            if (pf_built) {
-                fftw_destroy_plan(pf);
-            }
-            if (pi_built) {
-                fftw_destroy_plan(pi);
-            }
-        }
-
     private :
-        void make_plan(const vec2d& v, vec2cd& r) {
-            if (!pf_built) {
-                std::lock_guard<std::mutex> lock(impl::fftw_planner_mutex());
-                pf = fftw_plan_dft_r2c_2d(v.dims[0], v.dims[1],
-                    const_cast<double*>(v.raw_data()),
-                    reinterpret_cast<fftw_complex*>(r.raw_data()), FFTW_ESTIMATE);
-                pf_built = true;
-            }
-        }
-
-        void make_plan(vec2cd& v, vec2d& r) {
-            if (!pi_built) {
-                std::lock_guard<std::mutex> lock(impl::fftw_planner_mutex());
-                pi = fftw_plan_dft_c2r_2d(v.dims[0], v.dims[1],
-                    reinterpret_cast<fftw_complex*>(v.raw_data()),
-                    r.raw_data(), FFTW_ESTIMATE);
-                pi_built = true;
-            }
-        }
-
+        // FFTW plans are shared with all other FFTs through the plan cache of fourier.hpp
         void fft(const vec2d& v, vec2cd& r) {
-            make_plan(v, r);
-
-            fftw_execute_dft_r2c(pf,
-                const_cast<double*>(v.raw_data()),
-                reinterpret_cast<fftw_complex*>(r.raw_data())
-            );
+            impl::fourier_impl::execute_r2c(v, r);
         }
 
         vec2cd fft(const vec2d& v) {
@@ -612,21 +694,9 @@ namespace astro {
             return r;
         }
 
-        // Compute the Fast Fourier Transform (FFT) of the provided 2d array
+        // NB: the input array is destroyed
         void ifft(vec2cd& v, vec2d& r) {
-            make_plan(v, r);
-
-            fftw_execute_dft_c2r(pi,
-                reinterpret_cast<fftw_complex*>(v.raw_data()),
-                r.raw_data()
-            );
-        }
-
-        // Compute the Fast Fourier Transform (FFT) of the provided 2d array
-        vec2d ifft(vec2cd& v) {
-            vec2d r(v.dims);
-            ifft(v, r);
-            return r;
+            impl::fourier_impl::execute_c2r(v, r);
         }
 
     public :
@@ -733,6 +803,171 @@ namespace astro {
         return convolver2d(k);
     }
 
+    struct convolve2d_tiled_params {
+        uint_t tile_size = 1024; // size of the FFT tiles, including the kernel margins
+        uint_t thread = 1;       // number of threads
+        bool verbose = false;    // print progress in terminal
+    };
+}
+
+namespace impl {
+    namespace astro_impl {
+        // Smallest integer larger or equal to 'n' whose only prime factors are 2, 3, 5 and 7,
+        // for which FFTs are fast
+        inline uint_t fft_good_size(uint_t n) {
+            for (uint_t m = std::max(n, uint_t(1));; ++m) {
+                uint_t r = m;
+                for (uint_t f : {2, 3, 5, 7}) {
+                    while (r % f == 0) r /= f;
+                }
+
+                if (r == 1) return m;
+            }
+        }
+
+#ifndef NO_FFTW
+        // Convolve an image of dimensions 'dims' with 'kernel', processing the image in tiles
+        // with the overlap-save method. Each tile is convolved in Fourier space with a kernel
+        // spectrum computed only once, and only the central region of the tile, which is
+        // unaffected by the cyclic borders, is kept. Pixels outside of the image are zero.
+        // 'make_reader()' must return a function 'read(y0, y1, x0, x1, v)' that reads the
+        // pixels [y0,y1]x[x0,x1] of the image into 'v'; one reader is created for each group
+        // of tiles, and is used by only one thread. 'write(y0, x0, v)' is called once for each
+        // tile to store the convolved pixels starting at (y0,x0), never concurrently.
+        template<typename TypeK, typename R, typename W>
+        void convolve2d_tiled(const std::array<uint_t,2>& dims, const vec<2,TypeK>& kernel,
+            const astro::convolve2d_tiled_params& opts, R&& make_reader, W&& write) {
+
+            vif_check(kernel.dims[0]%2 == 1 && kernel.dims[1]%2 == 1,
+                "kernel must have odd dimensions (", kernel.dims, ")");
+
+            const uint_t ny = dims[0], nx = dims[1];
+            if (ny == 0 || nx == 0) return;
+
+            const uint_t hsy = kernel.dims[0]/2, hsx = kernel.dims[1]/2;
+
+            // Tiles must contain at least as many useful pixels as the kernel margins, but
+            // need not be larger than the image
+            auto tile_size = [&](uint_t n, uint_t hs) {
+                uint_t t = std::max(opts.tile_size, 4*hs + 1);
+                return fft_good_size(std::min(t, n + 2*hs));
+            };
+
+            const std::array<uint_t,2> tdims = {{tile_size(ny, hsy), tile_size(nx, hsx)}};
+            const uint_t by = tdims[0] - 2*hsy, bx = tdims[1] - 2*hsx;
+            const uint_t nty = (ny + by - 1)/by, ntx = (nx + bx - 1)/bx;
+            const uint_t ntile = nty*ntx;
+
+            // Put the kernel in Fourier space, with its center at (0,0)
+            vec2cd kspec;
+            {
+                vec2d tkernel = astro::enlarge(vec2d{kernel},
+                    {{0, 0, tdims[0]-kernel.dims[0], tdims[1]-kernel.dims[1]}});
+                astro::inplace_shift(tkernel, -int_t(hsy), -int_t(hsx));
+                kspec.resize(tdims);
+                fourier_impl::execute_r2c(tkernel, kspec);
+            }
+
+            const double norm = 1.0/(tdims[0]*tdims[1]);
+
+            std::mutex write_mutex;
+            std::atomic<uint_t> ndone(0);
+
+            auto process = [&](uint_t t0, uint_t t1) {
+                auto read = make_reader();
+
+                vec2d tmap(tdims);
+                vec2cd cimg(tdims);
+                vec2d sub, res;
+                for (uint_t t = t0; t < t1; ++t) {
+                    // Region of the image covered by this tile, and its useful pixels
+                    const int_t ty0 = int_t((t / ntx)*by) - int_t(hsy);
+                    const int_t tx0 = int_t((t % ntx)*bx) - int_t(hsx);
+                    const uint_t ry0 = ty0 + hsy, ry1 = std::min(ny, ry0 + by);
+                    const uint_t rx0 = tx0 + hsx, rx1 = std::min(nx, rx0 + bx);
+
+                    const uint_t iy0 = std::max(ty0, int_t(0));
+                    const uint_t ix0 = std::max(tx0, int_t(0));
+                    const uint_t iy1 = std::min(ty0 + int_t(tdims[0]), int_t(ny)) - 1;
+                    const uint_t ix1 = std::min(tx0 + int_t(tdims[1]), int_t(nx)) - 1;
+
+                    read(iy0, iy1, ix0, ix1, sub);
+
+                    tmap[_] = 0.0;
+                    for (uint_t y : range(sub.dims[0]))
+                    for (uint_t x : range(sub.dims[1])) {
+                        tmap.safe(iy0 - ty0 + y, ix0 - tx0 + x) = sub.safe(y,x);
+                    }
+
+                    // Perform the convolution in Fourier space
+                    fourier_impl::execute_r2c(tmap, cimg);
+                    cimg *= kspec;
+                    fourier_impl::execute_c2r(cimg, tmap);
+
+                    res.resize(ry1 - ry0, rx1 - rx0);
+                    for (uint_t y : range(res.dims[0]))
+                    for (uint_t x : range(res.dims[1])) {
+                        res.safe(y,x) = tmap.safe(hsy + y, hsx + x)*norm;
+                    }
+
+                    {
+                        std::lock_guard<std::mutex> lock(write_mutex);
+                        write(ry0, rx0, res);
+                    }
+
+                    ++ndone;
+                }
+            };
+
+            auto pg = progress_start(ntile);
+            if (opts.thread > 1) {
+                thread::task_pool pool(opts.thread);
+                pool.execute_chunks(process, 0, ntile, 1, [&]() {
+                    if (opts.verbose) print_progress(pg, ndone.load());
+                });
+            } else {
+                for (uint_t t : range(ntile)) {
+                    process(t, t+1);
+                    if (opts.verbose) print_progress(pg, ndone.load());
+                }
+            }
+
+            if (opts.verbose) print_progress(pg, ntile);
+        }
+#endif
+    }
+}
+
+namespace astro {
+    // Perform the convolution of two 2D arrays, assuming the second one is the kernel.
+    // The image is split in tiles which are convolved separately (see
+    // convolve2d_tiled_params), possibly in parallel. The result is the same as
+    // 'convolve2d()', but the memory needed for the Fourier transforms only depends on
+    // the size of the tiles and not on the size of the image.
+    template<typename TypeY1, typename TypeY2>
+    vec2d convolve2d_tiled(const vec<2,TypeY1>& map, const vec<2,TypeY2>& kernel,
+        const convolve2d_tiled_params& opts = convolve2d_tiled_params{}) {
+#ifdef NO_FFTW
+        static_assert(!std::is_same<TypeY1,TypeY1>::value, "this function requires the FFTW "
+            "library");
+        return vec2d();
+#else
+        vec2d res(map.dims);
+        impl::astro_impl::convolve2d_tiled(map.dims, kernel, opts,
+            [&]() {
+                return [&](uint_t y0, uint_t y1, uint_t x0, uint_t x1, vec2d& v) {
+                    v = map(y0-_-y1, x0-_-x1);
+                };
+            },
+            [&](uint_t y0, uint_t x0, const vec2d& v) {
+                res(y0-_-(y0+v.dims[0]-1), x0-_-(x0+v.dims[1]-1)) = v;
+            }
+        );
+
+        return res;
+#endif
+    }
+
     // Perform the convolution of two 2D arrays, assuming the second one is the kernel.
     // Note: If the FFTW library is not used, falls back to convolve2d_naive().
     template<typename T = void>
@@ -883,6 +1118,8 @@ namespace astro {
         uint_t min_area = 0u;
         // First ID used to place segments on the map
         uint_t first_id = 1u;
+        // Number of threads, the map being split into horizontal stripes among them
+        uint_t thread = 1u;
     };
 
     struct segment_output {
@@ -895,100 +1132,285 @@ namespace astro {
         // Flat index of the first value of a segment
         vec1u origin;
     };
+}
 
-    // Function to segment a binary or integer map into multiple contiguous components.
-    // Does no de-blending, use segment_deblend if you need it. Values of 0 in the
-    // input binary map are also 0 in the segmentation map.
-    template <typename T, typename enable = typename std::enable_if<!std::is_pointer<T>::value>::type>
-    vec2u segment(vec<2,T> map, segment_output& out, const segment_params& params = segment_params()) {
-        vec2u smap(map.dims);
+namespace impl {
+    namespace astro_impl {
+        // Number of pixels, sum of pixel coordinates and first pixel of a provisional label
+        struct segment_moments {
+            uint_t area = 0;
+            double sx = 0.0, sy = 0.0;
+            uint_t origin = npos;
+        };
 
-        vif_check(params.first_id > 0, "first ID must be > 0");
+        // First pass of a two-pass connected component labelling, fed one row at a time. Each
+        // pixel receives the provisional label of its left or top neighbor, or a new one, and
+        // labels that turn out to be connected are merged in a union-find forest. Labels are
+        // created in raster order, and the root of a tree is always its smallest label.
+        struct segment_labeler {
+            uint_t width = 0;
+            uint_t y = 0;                      // index of the next row in the full map
+            std::vector<uint_t> parent;        // union-find forest over labels (0-based)
+            std::vector<segment_moments> mom;  // moments of each label
+            std::vector<uint_t> prev;          // labels of the previous row (0: not set)
+
+            segment_labeler() = default;
+            segment_labeler(uint_t w, uint_t y0) : width(w), y(y0), prev(w, 0u) {}
+
+            uint_t find(uint_t i) {
+                while (parent[i] != i) {
+                    parent[i] = parent[parent[i]];
+                    i = parent[i];
+                }
 
-        uint_t id = params.first_id;
+                return i;
+            }
 
-        std::vector<uint_t> oy, ox;
-        for (uint_t y : range(map.dims[0]))
-        for (uint_t x : range(map.dims[1])) {
-            if (map.safe(y,x) == 0) continue;
+            void unite(uint_t i, uint_t j) {
+                i = find(i);
+                j = find(j);
+                if (i < j) {
+                    parent[j] = i;
+                } else if (j < i) {
+                    parent[i] = j;
+                }
+            }
 
-            // Found a guy, create entry in the output
-            out.id.push_back(id);
-            out.area.push_back(1u);
-            out.px.push_back(x);
-            out.py.push_back(y);
-            out.origin.push_back(flat_id(map, y, x));
+            // Label the next row, where pixels are set if 'is_set(x)' is true. Labels are written
+            // in 'lab' (1-based, 0 for pixels that are not set).
+            template<typename F>
+            void push_row(F&& is_set, uint_t* lab) {
+                for (uint_t x = 0; x < width; ++x) {
+                    if (!is_set(x)) {
+                        lab[x] = 0;
+                        continue;
+                    }
 
-            // Use an A* - like algorithm to navigate around and
-            // figure out its extents
-            oy.clear(); ox.clear();
+                    uint_t l = (x == 0 ? 0 : lab[x-1]);
+                    uint_t u = prev[x];
+                    if (l == 0) {
+                        if (u != 0) {
+                            l = u;
+                        } else {
+                            parent.push_back(parent.size());
+                            mom.push_back(segment_moments());
+                            mom.back().origin = y*width + x;
+                            l = parent.size();
+                        }
+                    } else if (u != 0 && u != l && prev[x-1] == 0) {
+                        // If the top-left pixel is set, left and top are already connected
+                        unite(l-1, u-1);
+                    }
 
-            // This function sets a point as belonging to the current segment
-            // and adds the neighboring points to a search list for inspection
-            auto process_point = [&ox,&oy,&map,&smap,&out,id](uint_t ty, uint_t tx) {
-                map.safe(ty,tx) = 0;
-                smap.safe(ty,tx) = id;
+                    lab[x] = l;
+                    segment_moments& m = mom[l-1];
+                    ++m.area;
+                    m.sx += x;
+                    m.sy += y;
+                }
 
-                auto check_add = [&ox,&oy,&map,&out](uint_t tty, uint_t ttx) {
-                    if (map.safe(tty,ttx) != 0) {
-                        out.area.back() += 1u;
-                        out.px.back() += ttx;
-                        out.py.back() += tty;
+                std::copy(lab, lab + width, prev.begin());
+                ++y;
+            }
 
-                        oy.push_back(tty);
-                        ox.push_back(ttx);
+            // Append the labels of another labeler, shifting them by the current number of labels
+            void append(const segment_labeler& l) {
+                const uint_t off = parent.size();
+                for (uint_t p : l.parent) {
+                    parent.push_back(p + off);
+                }
+
+                mom.insert(mom.end(), l.mom.begin(), l.mom.end());
+            }
+
+            // Gather the moments of each segment and give them final IDs, in order of their first
+            // pixel. Returns the final ID of each provisional label (0 if the segment is smaller
+            // than the minimum area).
+            std::vector<uint_t> resolve(astro::segment_output& out,
+                const astro::segment_params& params) {
+
+                const uint_t n = parent.size();
+                std::vector<uint_t> ids(n, 0u);
+
+                // Roots come before the other labels of their tree, and already hold the first
+                // pixel of the segment
+                for (uint_t i = 0; i < n; ++i) {
+                    uint_t r = find(i);
+                    if (r != i) {
+                        mom[r].area += mom[i].area;
+                        mom[r].sx += mom[i].sx;
+                        mom[r].sy += mom[i].sy;
                     }
-                };
+                }
 
-                if (ty != 0)             check_add(ty-1,tx);
-                if (ty != map.dims[0]-1) check_add(ty+1,tx);
-                if (tx != 0)             check_add(ty,tx-1);
-                if (tx != map.dims[1]-1) check_add(ty,tx+1);
-            };
+                uint_t id = params.first_id;
+                for (uint_t i = 0; i < n; ++i) {
+                    if (parent[i] != i) {
+                        ids[i] = ids[parent[i]];
+                        continue;
+                    }
 
-            // Add the first point to the segment
-            process_point(y, x);
+                    const segment_moments& m = mom[i];
+                    if (m.area >= params.min_area) {
+                        ids[i] = id;
+                        out.id.push_back(id);
+                        out.area.push_back(m.area);
+                        out.px.push_back(m.sx/m.area);
+                        out.py.push_back(m.sy/m.area);
+                        out.origin.push_back(m.origin);
+                    }
 
-            // While there are points to inspect, process them as well
-            while (!ox.empty()) {
-                uint_t ty = oy.back(); oy.pop_back();
-                uint_t tx = ox.back(); ox.pop_back();
-                process_point(ty, tx);
+                    ++id;
+                }
+
+                return ids;
             }
+        };
+    }
+}
 
-            // Average position
-            out.px.back() /= out.area.back();
-            out.py.back() /= out.area.back();
+namespace astro {
+    // Function to segment a binary or integer map into multiple contiguous components.
+    // Does no de-blending, use segment_deblend if you need it. Values of 0 in the
+    // input binary map are also 0 in the segmentation map.
+    // Segments are numbered in order of their first pixel; segments smaller than the minimum
+    // area are erased, and their ID is not reused.
+    template <typename T, typename enable = typename std::enable_if<!std::is_pointer<T>::value>::type>
+    vec2u segment(const vec<2,T>& map, segment_output& out,
+        const segment_params& params = segment_params()) {
+
+        vif_check(params.first_id > 0, "first ID must be > 0");
+
+        vec2u smap(map.dims);
+        out = segment_output();
+        if (map.empty()) return smap;
 
-            ++id;
+        const uint_t ny = map.dims[0];
+        const uint_t nx = map.dims[1];
+
+        // Label each stripe independently
+        const uint_t nstripe = clamp(params.thread, 1u, ny);
+        vec1u y0(nstripe+1);
+        for (uint_t k : range(y0)) {
+            y0.safe[k] = (k*ny)/nstripe;
         }
 
-        // Erase too small regions
-        if (count(out.area < params.min_area) != 0) {
-            vec1u eids;
-            foreach_segment(smap, out.origin, [&](uint_t i, vec1u ids) {
-                if (ids.size() < params.min_area) {
-                    smap[ids] = 0;
-                    eids.push_back(i);
+        std::vector<impl::astro_impl::segment_labeler> labs(nstripe);
+        auto run_stripes = [&](const std::function<void(uint_t,uint_t)>& f) {
+            if (nstripe > 1) {
+                thread::task_pool pool(nstripe);
+                pool.execute_chunks(f, 0, nstripe, 1);
+            } else {
+                f(0, 1);
+            }
+        };
+
+        run_stripes([&](uint_t k0, uint_t k1) {
+            for (uint_t k = k0; k < k1; ++k) {
+                labs[k] = impl::astro_impl::segment_labeler(nx, y0.safe[k]);
+                for (uint_t y = y0.safe[k]; y < y0.safe[k+1]; ++y) {
+                    const meta::dtype_t<T>* row = map.data.data() + y*nx;
+                    labs[k].push_row([row](uint_t x) {
+                        return row[x] != 0;
+                    }, &smap.safe(y,0));
                 }
-            });
+            }
+        });
 
-            inplace_remove(out.id, eids);
-            inplace_remove(out.origin, eids);
-            inplace_remove(out.px, eids);
-            inplace_remove(out.py, eids);
-            inplace_remove(out.area, eids);
+        // Merge the stripes, and connect labels across their boundaries
+        impl::astro_impl::segment_labeler all;
+        vec1u off(nstripe);
+        for (uint_t k : range(nstripe)) {
+            off.safe[k] = all.parent.size();
+            all.append(labs[k]);
+            labs[k] = impl::astro_impl::segment_labeler();
+        }
+
+        for (uint_t k = 1; k < nstripe; ++k) {
+            const uint_t y = y0.safe[k];
+            for (uint_t x : range(nx)) {
+                uint_t l = smap.safe(y,x);
+                uint_t u = smap.safe(y-1,x);
+                if (l != 0 && u != 0) {
+                    all.unite(off.safe[k] + l - 1, off.safe[k-1] + u - 1);
+                }
+            }
         }
 
+        std::vector<uint_t> ids = all.resolve(out, params);
+
+        // Second pass: replace provisional labels by final IDs
+        run_stripes([&](uint_t k0, uint_t k1) {
+            for (uint_t k = k0; k < k1; ++k)
+            for (uint_t y = y0.safe[k]; y < y0.safe[k+1]; ++y) {
+                uint_t* row = &smap.safe(y,0);
+                for (uint_t x = 0; x < nx; ++x) {
+                    if (row[x] != 0) {
+                        row[x] = ids[off.safe[k] + row[x] - 1];
+                    }
+                }
+            }
+        });
+
         return smap;
     }
 
     template <typename T, typename enable = typename std::enable_if<!std::is_pointer<T>::value>::type>
-    vec2u segment(vec<2,T> map) {
+    vec2u segment(const vec<2,T>& map) {
         segment_output sdo; segment_params sdp;
-        return segment(std::move(map), sdo, sdp);
+        return segment(map, sdo, sdp);
     }
 
+    // Streaming version of 'segment()', for maps that are too large to fit in memory and are read
+    // row by row (e.g., from a FITS file). Each call to 'push_row()' returns provisional labels
+    // for the row, which only need to be kept on disk. Once all rows have been pushed, 'finish()'
+    // builds the segment catalog, and 'relabel()' converts provisional labels into the IDs that
+    // 'segment()' would have given.
+    class segment_stream {
+        impl::astro_impl::segment_labeler lab_;
+        std::vector<uint_t> ids_;
+        bool finished_ = false;
+
+    public :
+
+        explicit segment_stream(uint_t width) : lab_(width, 0) {}
+
+        template<typename T>
+        vec1u push_row(const vec<1,T>& row) {
+            vif_check(!finished_, "cannot push new rows after calling finish()");
+            vif_check(row.size() == lab_.width, "incompatible row size (", row.size(),
+                " vs. ", lab_.width, ")");
+
+            vec1u lab(lab_.width);
+            lab_.push_row([&row](uint_t x) {
+                return row.safe[x] != 0;
+            }, lab.data.data());
+
+            return lab;
+        }
+
+        void finish(segment_output& out, const segment_params& params = segment_params()) {
+            vif_check(params.first_id > 0, "first ID must be > 0");
+            vif_check(!finished_, "finish() can only be called once");
+
+            out = segment_output();
+            ids_ = lab_.resolve(out, params);
+            finished_ = true;
+        }
+
+        vec1u relabel(vec1u lab) const {
+            vif_check(finished_, "finish() must be called before relabel()");
+
+            for (auto& l : lab) {
+                if (l != 0) {
+                    l = ids_[l-1];
+                }
+            }
+
+            return lab;
+        }
+    };
+
     struct segment_deblend_params {
         // Threshold value below which pixels will not be segmented
         double detect_threshold = 2.5;
@@ -1426,7 +1848,7 @@ namespace astro {
                 img(std::move(i.img)), hdr(std::move(i.hdr)), w(std::move(i.w)),
                 dims(std::move(i.dims)) {}
 
-            fits::input_image img;
+            fits::mapped_image img;
             fits::header      hdr;
             astro::wcs        w;
             vec1u             dims;
@@ -1866,153 +2288,700 @@ namespace astro {
         bool linearize = false;    // approximation: assume WCS transform is linear
     };
 
-    template<typename T = double>
-    vec2d regrid_interpolate(const vec<2,T>& imgs, const astro::wcs& astros, const astro::wcs& astrod,
-        regrid_interpolate_params opts = regrid_interpolate_params{}) {
+    struct regrid_drizzle_params {
+        bool verbose = false;      // print progress in terminal
+        double pixfrac = 1.0;      // fraction of pixel to drizzle (1 = simple projection)
+        bool linearize = false;    // approximation: assume WCS transform is linear
+        bool dest_pixfrac = false; // approximation: assume pixfrac is linear on destination grid
+        uint_t thread = 1;         // number of threads to use
+        uint_t tile_size = 256;    // size of the source image tiles drizzled by each thread
+    };
 
-        // Regridded image
-        vec2d res;
+    struct pixel_transform_params {
+        double tolerance = 1e-3; // maximum error on the transformed positions (in pixels)
+        double max_step = 64.0;  // initial spacing of the sampling grid (in pixels)
+        bool verbose = false;    // print progress in terminal
+    };
+
+    // Approximation of the mapping from the pixels of an image (the "source") to the pixels
+    // of another (the "destination"). The exact mapping is sampled on a coarse grid and
+    // interpolated with cubic (Catmull-Rom) splines; the grid is refined until the error,
+    // measured between the grid nodes, is below the requested tolerance. Pixel coordinates
+    // are zero-based, and the approximation is valid from -0.5 to N-0.5 on each axis of
+    // the source image.
+    // The transform can be reused for all images that share the same pair of WCS.
+    struct pixel_transform {
+        vec1u dims_from;          // dimensions of the source image (y, x)
+        vec1u dims_to;            // dimensions of the destination image (y, x)
+        double step = dnan;       // spacing of the sampling grid (in pixels)
+        double max_error = dnan;  // maximum error measured between the grid nodes
+
+        pixel_transform() = default;
+
+        // Build from an arbitrary transformation, called as 'func(x, y, tx, ty)' on
+        // vectors of zero-based pixel coordinates
+        template<typename F>
+        pixel_transform(F&& func, const vec1u& from, const vec1u& to,
+            const pixel_transform_params& p = pixel_transform_params{}) :
+            dims_from(from), dims_to(to) {
+
+            vif_check(dims_from.size() == 2 && dims_to.size() == 2,
+                "pixel transform needs two dimensional images");
+            vif_check(p.tolerance > 0.0, "pixel transform tolerance must be positive");
+
+            double h = std::max(1.0, p.max_step);
+            while (true) {
+                build_(func, h);
+
+                // Test points in between the grid nodes, where the error is largest
+                // (the cubic error term of the spline peaks at 0.5 +/- 0.5/sqrt(3) of a cell)
+                const double f1 = 0.5 - 0.5/sqrt(3.0), f2 = 1.0 - f1;
+                uint_t ncx = nx_-3, ncy = ny_-3;
+                vec1d tx(3*ncx*ncy), ty(3*ncx*ncy);
+                for (uint_t iy : range(ncy))
+                for (uint_t ix : range(ncx)) {
+                    uint_t i = 3*(iy*ncx + ix);
+                    double cx = x0_ + (ix + 1)*step, cy = y0_ + (iy + 1)*step;
+                    tx.safe[i+0] = cx + f1*step;  ty.safe[i+0] = cy + f1*step;
+                    tx.safe[i+1] = cx + f2*step;  ty.safe[i+1] = cy + f1*step;
+                    tx.safe[i+2] = cx + f1*step;  ty.safe[i+2] = cy + f2*step;
+                }
+
+                vec1d ex, ey;
+                func(tx, ty, ex, ey);
+
+                max_error = 0.0;
+                for (uint_t i : range(tx)) {
+                    if (!is_finite(ex.safe[i]) || !is_finite(ey.safe[i])) continue;
+
+                    double ax, ay;
+                    map(tx.safe[i], ty.safe[i], ax, ay);
+                    double err = sqrt(sqr(ax - ex.safe[i]) + sqr(ay - ey.safe[i]));
+                    if (!is_finite(err)) {
+                        // Approximation is undefined here (some nodes are invalid)
+                        err = dinf;
+                    }
+
+                    max_error = std::max(max_error, err);
+                }
+
+                if (p.verbose) {
+                    note("pixel transform: step=", step, " pixels, error=", max_error, " pixels");
+                }
+
+                if (max_error <= p.tolerance || step <= 1.0) break;
+
+                h = std::max(1.0, 0.5*step);
+            }
+
+            if (max_error > p.tolerance) {
+                warning("pixel transform: could not reach requested tolerance (",
+                    p.tolerance, " vs ", max_error, " pixels)");
+            }
+        }
+
+        // Build from a pair of WCS
+        template<typename Dummy = void>
+        pixel_transform(const astro::wcs& from, const astro::wcs& to,
+            const pixel_transform_params& p = pixel_transform_params{}) :
+            pixel_transform([&](const vec1d& x, const vec1d& y, vec1d& tx, vec1d& ty) {
+                vec1d ra, dec;
+                astro::xy2ad(from, x+1.0, y+1.0, ra, dec);
+                astro::ad2xy(to, ra, dec, tx, ty);
+                tx -= 1.0; ty -= 1.0;
+            }, wcs_dims_(from), wcs_dims_(to), p) {}
+
+        bool empty() const {
+            return gx_.empty();
+        }
+
+        // Transform the zero-based pixel coordinates (x,y) of the source image into
+        // the zero-based pixel coordinates (tx,ty) of the destination image
+        void map(double x, double y, double& tx, double& ty) const {
+            double fx = (x - x0_)/step, fy = (y - y0_)/step;
+            int_t ix = floor(fx), iy = floor(fy);
+            ix = std::min(std::max(ix, int_t(1)), int_t(nx_)-3);
+            iy = std::min(std::max(iy, int_t(1)), int_t(ny_)-3);
+
+            double wx[4], wy[4];
+            spline_weights_(fx - ix, wx);
+            spline_weights_(fy - iy, wy);
+
+            tx = ty = 0.0;
+            for (uint_t j : range(4)) {
+                uint_t k = (iy-1+j)*nx_ + ix-1;
+                double rx = 0.0, ry = 0.0;
+                for (uint_t i : range(4)) {
+                    rx += wx[i]*gx_.safe[k+i];
+                    ry += wx[i]*gy_.safe[k+i];
+                }
 
+                tx += wy[j]*rx;
+                ty += wy[j]*ry;
+            }
+        }
+
+    private :
+
+        uint_t nx_ = 0, ny_ = 0;   // number of grid nodes
+        double x0_ = 0, y0_ = 0;   // position of the first node
+        vec1d gx_, gy_;            // transformed position of the grid nodes
+
+        template<typename Dummy = void>
+        static vec1u wcs_dims_(const astro::wcs& w) {
 #ifdef NO_WCSLIB
-        static_assert(!std::is_same<T,T>::value, "WCS support is disabled, "
-            "please enable the WCSLib library to use this function");
+            static_assert(!std::is_same<Dummy,Dummy>::value, "WCS support is disabled, "
+                "please enable the WCSLib library to use this function");
+            return vec1u();
 #else
+            vif_check(w.is_valid(), "invalid WCS data");
+            return {w.dims[w.y_axis], w.dims[w.x_axis]};
+#endif
+        }
 
-        res = replicate(dnan, astrod.dims[astrod.y_axis], astrod.dims[astrod.x_axis]);
+        // Catmull-Rom weights of the four nodes around a point at fraction 't' of a cell
+        static void spline_weights_(double t, double (&w)[4]) {
+            double t2 = t*t, t3 = t2*t;
+            w[0] = 0.5*(-t3 + 2.0*t2 - t);
+            w[1] = 0.5*(3.0*t3 - 5.0*t2 + 2.0);
+            w[2] = 0.5*(-3.0*t3 + 4.0*t2 + t);
+            w[3] = 0.5*(t3 - t2);
+        }
+
+        // Sample the transformation on a regular grid, with one extra node on each side
+        template<typename F>
+        void build_(F& func, double h) {
+            step = h;
+            x0_ = -0.5 - step;
+            y0_ = -0.5 - step;
+            nx_ = std::max(ceil(dims_from[1]/step), 1.0) + 3;
+            ny_ = std::max(ceil(dims_from[0]/step), 1.0) + 3;
+
+            vec1d x(nx_*ny_), y(nx_*ny_);
+            for (uint_t iy : range(ny_))
+            for (uint_t ix : range(nx_)) {
+                x.safe[iy*nx_ + ix] = x0_ + ix*step;
+                y.safe[iy*nx_ + ix] = y0_ + iy*step;
+            }
 
-        uint_t nx = astrod.dims[astros.x_axis];
-        uint_t ny = astrod.dims[astros.y_axis];
+            func(x, y, gx_, gy_);
+        }
+    };
+}
 
-        // Precompute the projection of the new pixel grid on the old
-        // Note: for the horizontal pixel 'i' of line 'j' (x_i,y_j), the grid is:
-        //   (pux,puy)[i]     (pux,puy)[i+1]    # y_(j+0.5)
-        //   (plx,ply)[i]     (plx,ply)[i+1]    # y_(j-0.5)
-        //   # x_(i-0.5)      # x_(i+0.5)
-        // To avoid re-computing stuff, pux and puy are moved into plx and ply
-        // on each 'y' iteration for reuse.
+namespace impl {
+    namespace astro_impl {
+        template<typename T, typename F>
+        vec2d regrid_interpolate_grid(const vec<2,T>& imgs, uint_t nx, uint_t ny,
+            F&& s2d_exact, const astro::regrid_interpolate_params& opts) {
+
+            vec2d res = replicate(dnan, ny, nx);
+
+            // Precompute the projection of the new pixel grid on the old
+            // Note: for the horizontal pixel 'i' of line 'j' (x_i,y_j), the grid is:
+            //   (pux,puy)[i]     (pux,puy)[i+1]    # y_(j+0.5)
+            //   (plx,ply)[i]     (plx,ply)[i+1]    # y_(j-0.5)
+            //   # x_(i-0.5)      # x_(i+0.5)
+            // To avoid re-computing stuff, pux and puy are moved into plx and ply
+            // on each 'y' iteration for reuse.
+
+            // If "linearize" is set, build approximate transformation matrix from image center
+            double csx = nx/2;
+            double csy = ny/2;
+            double cdx, cdy, cdx1, cdy1, cdx2, cdy2;
+            double pixel_area;
+            if (opts.linearize) {
+                s2d_exact(csx, csy,     cdx,  cdy);
+                s2d_exact(csx+1.0, csy, cdx1, cdy1);
+                s2d_exact(csx, csy+1.0, cdx2, cdy2);
 
-        auto s2d_wcs = [&](double sx, double sy, double& dx, double& dy) {
-            double tra, tdec;
-            astro::xy2ad(astrod, sx+1, sy+1, tra, tdec);
-            astro::ad2xy(astros, tra, tdec, dx, dy);
-            dx -= 1.0; dy -= 1.0;
-        };
+                cdx1 -= cdx; cdy1 -= cdy; cdx2 -= cdx; cdy2 -= cdy;
+                pixel_area = sqrt(sqr(cdx1) + sqr(cdy1))*sqrt(sqr(cdx2) + sqr(cdy2));
 
-        // If "linearize" is set, build approximate transformation matrix from image center
-        double csx = nx/2;
-        double csy = ny/2;
-        double cdx, cdy, cdx1, cdy1, cdx2, cdy2;
-        double pixel_area;
-        if (opts.linearize) {
-            s2d_wcs(csx, csy,     cdx,  cdy);
-            s2d_wcs(csx+1.0, csy, cdx1, cdy1);
-            s2d_wcs(csx, csy+1.0, cdx2, cdy2);
+                if (abs(cdx-round(cdx)) < 1e-6 && abs(cdy-round(cdy)) < 1e-6 &&
+                    abs(cdx1 - 1.0) < 1e-6 && abs(cdy2 - 1.0) < 1e-6 &&
+                    abs(cdy1) < 1e-3 && abs(cdx2) < 1e-3) {
 
-            cdx1 -= cdx; cdy1 -= cdy; cdx2 -= cdx; cdy2 -= cdy;
-            pixel_area = sqrt(sqr(cdx1) + sqr(cdy1))*sqrt(sqr(cdx2) + sqr(cdy2));
+                    // This is a simple integer translation, let's optimize this
+                    int_t dx = round(cdx);
+                    int_t dy = round(cdy);
+                    int_t wx1 = nx/2;
+                    int_t wx2 = nx-1 - wx1;
+                    int_t wy1 = ny/2;
+                    int_t wy2 = ny-1 - wy1;
 
-            if (abs(cdx-round(cdx)) < 1e-6 && abs(cdy-round(cdy)) < 1e-6 &&
-                abs(cdx1 - 1.0) < 1e-6 && abs(cdy2 - 1.0) < 1e-6 &&
-                abs(cdy1) < 1e-3 && abs(cdx2) < 1e-3) {
+                    vec1u ids, idd;
+                    astro::subregion(res, {dy-wy1, dx-wx1, dy+wy2, dx+wx2}, idd, ids);
 
-                // This is a simple integer translation, let's optimize this
-                int_t dx = round(cdx);
-                int_t dy = round(cdy);
-                int_t wx1 = nx/2;
-                int_t wx2 = nx-1 - wx1;
-                int_t wy1 = ny/2;
-                int_t wy2 = ny-1 - wy1;
+                    res[_] = dnan;
+                    copy_subset(imgs, res, ids, idd);
 
-                vec1u ids, idd;
-                subregion(res, {dy-wy1, dx-wx1, dy+wy2, dx+wx2}, idd, ids);
+                    return res;
+                }
+            }
 
-                res[_] = dnan;
-                impl::astro_impl::copy_subset(imgs, res, ids, idd);
+            auto s2d = [&](double sx, double sy, double& dx, double& dy) {
+                if (opts.linearize) {
+                    dx = (sx-csx)*cdx1 + (sy-csy)*cdx2 + cdx;
+                    dy = (sx-csx)*cdy1 + (sy-csy)*cdy2 + cdy;
+                } else {
+                    s2d_exact(sx, sy, dx, dy);
+                }
+            };
 
-                return res;
+            auto pg = progress_start(res.size());
+            vec1d plx(nx+1);
+            vec1d ply(nx+1);
+            for (uint_t ix : range(nx+1)) {
+                s2d(ix-0.5, -0.5, plx.safe[ix], ply.safe[ix]);
             }
+
+            vec1d pux(nx+1);
+            vec1d puy(nx+1);
+            for (uint_t iy : range(ny)) {
+                for (uint_t ix : range(nx+1)) {
+                    s2d(ix-0.5, iy+0.5, pux.safe[ix], puy.safe[ix]);
+                }
+
+                for (uint_t ix : range(nx)) {
+                    // Find projection of each pixel of the new grid on the original image
+                    // NB: assumes the astrometry is such that this projection is
+                    // reasonably approximated by a 4-edge polygon (i.e.: varying pixel scales,
+                    // pixel offsets and rotations are fine, but weird things may happen close
+                    // to the poles of the projection where things become non-linear)
+
+                    double xps = 0.25*(plx.safe[ix] + plx.safe[ix+1] + pux.safe[ix+1] + pux.safe[ix]);
+                    double yps = 0.25*(ply.safe[ix] + ply.safe[ix+1] + puy.safe[ix+1] + puy.safe[ix]);
+
+                    double flx = 0.0;
+                    bool covered = false;
+
+                    switch (opts.method) {
+                    case astro::interpolation_method::nearest:
+                        covered = regrid_nearest(imgs, xps, yps, flx);
+                        break;
+                    case astro::interpolation_method::linear:
+                        covered = regrid_linear(imgs, xps, yps, flx);
+                        break;
+                    case astro::interpolation_method::cubic:
+                        covered = regrid_cubic(imgs, xps, yps, flx);
+                        break;
+                    }
+
+                    if (covered) {
+                        if (opts.conserve_flux) {
+                            if (!opts.linearize) {
+                                pixel_area = polyon_area(
+                                    {plx.safe[ix], plx.safe[ix+1], pux.safe[ix+1], pux.safe[ix]},
+                                    {ply.safe[ix], ply.safe[ix+1], puy.safe[ix+1], puy.safe[ix]}
+                                );
+                            }
+
+                            flx *= pixel_area;
+                        }
+
+                        res.safe(iy,ix) = flx;
+                    }
+
+                    if (opts.verbose) progress(pg, 31);
+                }
+
+                std::swap(plx, pux);
+                std::swap(ply, puy);
+            }
+            return res;
         }
 
-        auto s2d = [&](double sx, double sy, double& dx, double& dy) {
-            if (opts.linearize) {
-                dx = (sx-csx)*cdx1 + (sy-csy)*cdx2 + cdx;
-                dy = (sx-csx)*cdy1 + (sy-csy)*cdy2 + cdy;
+        // Drizzle the source pixels [ix0,ix1) x [iy0,iy1) onto 'res' and 'wei', whose first
+        // pixel is the pixel (dx0,dy0) of the destination image. 'on_row()' is called after
+        // each source row.
+        template<std::size_t D, typename T, typename F, typename R>
+        void regrid_drizzle_tile(const vec<D,T>& imgs, uint_t ix0, uint_t ix1, uint_t iy0,
+            uint_t iy1, F&& s2d_dest, double pixel_area, const astro::regrid_drizzle_params& opts,
+            vec<D,double>& res, vec2d& wei, uint_t dx0, uint_t dy0, R&& on_row) {
+
+            auto s2d = [&](double sx, double sy, double& dx, double& dy) {
+                s2d_dest(sx, sy, dx, dy);
+                dx -= dx0; dy -= dy0;
+            };
+
+            const uint_t nx = ix1 - ix0;
+
+            // Precompute the projection of the old pixel grid on the new
+            // In case pixfrac=1:
+            // For the horizontal pixel 'i' of line 'j' (x_i,y_j), the grid is:
+            //   (pux,puy)[i]     (pux,puy)[i+1]    # y_(j+0.5)
+            //   (plx,ply)[i]     (plx,ply)[i+1]    # y_(j-0.5)
+            //   # x_(i-0.5)      # x_(i+0.5)
+            // To avoid re-computing stuff, pux and puy are swapped into plx and ply
+            // on each 'y' iteration for reuse. Total of (Nx+1)*(Ny+1) WCS transforms.
+            //
+            // In case pixfrac!=1:
+            // If dest_pixfrac=true, then the projection's coordinates are
+            // computed by linearly interpolating the above.
+            // If dest_pixfrac=false:
+            // For the horizontal pixel 'i' of line 'j' (x_i,y_j), the grid is:
+            //   (plux,pluy)[i]   (prux,pruy)[i]    # y_(j+0.5*pf)
+            //   (pllx,plly)[i]   (prlx,prly)[i]    # y_(j-0.5*pf)
+            //   # x_(i-0.5*pf)   # x_(i+0.5*pf)
+            // Total of 4*Nx*Ny WCS transforms.
+
+            vec1d plx, ply;
+            vec1d pux, puy;
+            vec1d pllx, prlx, plux, prux;
+            vec1d plly, prly, pluy, pruy;
+            if (opts.pixfrac == 1 || opts.dest_pixfrac) {
+                plx.resize(nx+1);
+                ply.resize(nx+1);
+                for (uint_t ix : range(nx+1)) {
+                    s2d(ix0+ix-0.5, iy0-0.5, plx.safe[ix], ply.safe[ix]);
+                }
+
+                pux.resize(nx+1);
+                puy.resize(nx+1);
             } else {
-                s2d_wcs(sx, sy, dx, dy);
+                pllx.resize(nx); prlx.resize(nx);
+                plux.resize(nx); prux.resize(nx);
+                plly.resize(nx); prly.resize(nx);
+                pluy.resize(nx); pruy.resize(nx);
             }
-        };
 
-        auto pg = progress_start(res.size());
-        vec1d plx(nx+1);
-        vec1d ply(nx+1);
-        for (uint_t ix : range(nx+1)) {
-            s2d(ix-0.5, -0.5, plx.safe[ix], ply.safe[ix]);
+            for (uint_t iy = iy0; iy < iy1; ++iy) {
+                if (opts.pixfrac == 1 || opts.dest_pixfrac) {
+                    for (uint_t ix : range(nx+1)) {
+                        s2d(ix0+ix-0.5, iy+0.5, pux.safe[ix], puy.safe[ix]);
+                    }
+                } else {
+                    const double dp = 0.5*opts.pixfrac;
+                    for (uint_t ix : range(nx)) {
+                        s2d(ix0+ix-dp, iy-dp, pllx.safe[ix], plly.safe[ix]);
+                        s2d(ix0+ix+dp, iy-dp, prlx.safe[ix], prly.safe[ix]);
+                        s2d(ix0+ix-dp, iy+dp, plux.safe[ix], pluy.safe[ix]);
+                        s2d(ix0+ix+dp, iy+dp, prux.safe[ix], pruy.safe[ix]);
+                    }
+                }
+
+                for (uint_t ix : range(nx)) {
+                    // Find projection of each pixel of the original image on the new grid
+                    // NB: assumes the astrometry is such that this projection is
+                    // reasonably approximated by a 4-edge polygon (i.e.: varying pixel scales,
+                    // pixel offsets and rotations are fine, but weird things may happen close
+                    // to the poles of the projection where things become non-linear)
+
+                    vec1d xps, yps;
+                    if (opts.pixfrac == 1 || opts.dest_pixfrac) {
+                        xps = {plx.safe[ix], plx.safe[ix+1], pux.safe[ix+1], pux.safe[ix]};
+                        yps = {ply.safe[ix], ply.safe[ix+1], puy.safe[ix+1], puy.safe[ix]};
+
+                        if (opts.dest_pixfrac && opts.pixfrac != 1) {
+                            double mx = mean(xps);
+                            xps = mx + opts.pixfrac*(xps - mx);
+                            double my = mean(yps);
+                            yps = my + opts.pixfrac*(yps - my);
+                        }
+                    } else {
+                        xps = {pllx.safe[ix], prlx.safe[ix], prux.safe[ix], plux.safe[ix]};
+                        yps = {plly.safe[ix], prly.safe[ix], pruy.safe[ix], pluy.safe[ix]};
+                    }
+
+                    if (!opts.linearize) {
+                        pixel_area = polyon_area(xps, yps);
+                    }
+
+                    double flx_frac = sqr(opts.pixfrac);
+                    regrid_drizzle(imgs, ix0+ix, iy, flx_frac, xps, yps, pixel_area, res, wei);
+                }
+
+                if (opts.pixfrac == 1 || opts.dest_pixfrac) {
+                    std::swap(plx, pux);
+                    std::swap(ply, puy);
+                }
+
+                on_row();
+            }
         }
 
-        vec1d pux(nx+1);
-        vec1d puy(nx+1);
-        for (uint_t iy : range(ny)) {
-            for (uint_t ix : range(nx+1)) {
-                s2d(ix-0.5, iy+0.5, pux.safe[ix], puy.safe[ix]);
-            }
-
-            for (uint_t ix : range(nx)) {
-                // Find projection of each pixel of the new grid on the original image
-                // NB: assumes the astrometry is such that this projection is
-                // reasonably approximated by a 4-edge polygon (i.e.: varying pixel scales,
-                // pixel offsets and rotations are fine, but weird things may happen close
-                // to the poles of the projection where things become non-linear)
-
-                double xps = 0.25*(plx.safe[ix] + plx.safe[ix+1] + pux.safe[ix+1] + pux.safe[ix]);
-                double yps = 0.25*(ply.safe[ix] + ply.safe[ix+1] + puy.safe[ix+1] + puy.safe[ix]);
-
-                double flx = 0.0;
-                bool covered = false;
-
-                switch (opts.method) {
-                case interpolation_method::nearest:
-                    covered = impl::astro_impl::regrid_nearest(imgs, xps, yps, flx);
-                    break;
-                case interpolation_method::linear:
-                    covered = impl::astro_impl::regrid_linear(imgs, xps, yps, flx);
-                    break;
-                case interpolation_method::cubic:
-                    covered = impl::astro_impl::regrid_cubic(imgs, xps, yps, flx);
-                    break;
+        // Find the range of destination pixels that can receive flux from the source pixels
+        // [ix0,ix1) x [iy0,iy1), from the projection of the outline of this region.
+        // Returns false if the region falls outside of the destination image.
+        template<typename F>
+        bool regrid_drizzle_tile_bounds(uint_t ix0, uint_t ix1, uint_t iy0, uint_t iy1,
+            F&& s2d, const astro::regrid_drizzle_params& opts, uint_t dnx, uint_t dny,
+            uint_t& dx0, uint_t& dx1, uint_t& dy0, uint_t& dy1) {
+
+            // Drops can be larger than the pixels
+            const double dp = 0.5*std::max(opts.pixfrac, 1.0);
+
+            double xmin = dinf, xmax = -dinf, ymin = dinf, ymax = -dinf;
+            bool finite = true;
+            auto add_point = [&](double sx, double sy) {
+                double dx, dy;
+                s2d(sx, sy, dx, dy);
+                if (!is_finite(dx) || !is_finite(dy)) {
+                    finite = false;
+                    return;
                 }
 
-                if (covered) {
-                    if (opts.conserve_flux) {
-                        if (!opts.linearize) {
-                            pixel_area = impl::astro_impl::polyon_area(
-                                {plx.safe[ix], plx.safe[ix+1], pux.safe[ix+1], pux.safe[ix]},
-                                {ply.safe[ix], ply.safe[ix+1], puy.safe[ix+1], puy.safe[ix]}
-                            );
+                xmin = std::min(xmin, dx); xmax = std::max(xmax, dx);
+                ymin = std::min(ymin, dy); ymax = std::max(ymax, dy);
+            };
+
+            // Sample the outline once per source pixel
+            const uint_t nsx = ix1 - ix0, nsy = iy1 - iy0;
+            const double sx0 = ix0 - dp, sx1 = ix1 - 1.0 + dp;
+            const double sy0 = iy0 - dp, sy1 = iy1 - 1.0 + dp;
+            for (uint_t i : range(nsx+1)) {
+                double sx = sx0 + (sx1 - sx0)*i/double(nsx);
+                add_point(sx, sy0);
+                add_point(sx, sy1);
+            }
+            for (uint_t i : range(1, nsy)) {
+                double sy = sy0 + (sy1 - sy0)*i/double(nsy);
+                add_point(sx0, sy);
+                add_point(sx1, sy);
+            }
+
+            if (!finite) {
+                // Cannot tell, use the whole destination image
+                dx0 = 0; dx1 = dnx-1;
+                dy0 = 0; dy1 = dny-1;
+                return true;
+            }
+
+            // Margin of one pixel for the curvature of the projection between the samples
+            double txmin = floor(xmin+0.5) - 1.0, txmax = floor(xmax+0.5) + 1.0;
+            double tymin = floor(ymin+0.5) - 1.0, tymax = floor(ymax+0.5) + 1.0;
+            if (txmax < 0 || tymax < 0 || txmin > dnx-1.0 || tymin > dny-1.0) {
+                return false;
+            }
+
+            dx0 = std::max(txmin, 0.0); dx1 = std::min(txmax, dnx-1.0);
+            dy0 = std::max(tymin, 0.0); dy1 = std::min(tymax, dny-1.0);
+            return true;
+        }
+
+        template<std::size_t D>
+        struct regrid_drizzle_tile_t {
+            bool empty = true;
+            uint_t x0 = 0, x1 = 0, y0 = 0, y1 = 0;
+            vec<D,double> res;
+            vec2d wei;
+        };
+
+        // Add the drizzled tiles to the destination image, in order
+        template<std::size_t D>
+        void regrid_drizzle_merge(const std::vector<regrid_drizzle_tile_t<D>>& tiles, uint_t nt,
+            thread::task_pool& pool, vec<D,double>& res, vec2d& wei) {
+
+            const uint_t dnx = wei.dims[1];
+            const uint_t dny = wei.dims[0];
+            const uint_t nplane = res.size()/(dnx*dny);
+
+            uint_t y0 = npos, y1 = 0;
+            for (uint_t t : range(nt)) {
+                if (tiles[t].empty) continue;
+                y0 = std::min(y0, tiles[t].y0);
+                y1 = std::max(y1, tiles[t].y1);
+            }
+
+            if (y0 > y1) return;
+
+            // Each destination row is processed by a single thread, and receives the
+            // contributions of the tiles always in the same order
+            pool.execute([&](uint_t y) {
+                for (uint_t t : range(nt)) {
+                    const regrid_drizzle_tile_t<D>& tile = tiles[t];
+                    if (tile.empty || y < tile.y0 || y > tile.y1) continue;
+
+                    const uint_t tnx = tile.x1 - tile.x0 + 1;
+                    const uint_t tny = tile.y1 - tile.y0 + 1;
+                    for (uint_t p : range(nplane)) {
+                        const double* src = tile.res.raw_data() + (p*tny + y - tile.y0)*tnx;
+                        double* dst = res.raw_data() + (p*dny + y)*dnx + tile.x0;
+                        for (uint_t x : range(tnx)) {
+                            dst[x] += src[x];
                         }
+                    }
 
-                        flx *= pixel_area;
+                    const double* src = tile.wei.raw_data() + (y - tile.y0)*tnx;
+                    double* dst = wei.raw_data() + y*dnx + tile.x0;
+                    for (uint_t x : range(tnx)) {
+                        dst[x] += src[x];
                     }
+                }
+            }, y0, y1+1);
+        }
+
+        template<std::size_t D, typename T, typename F>
+        vec<D,double> regrid_drizzle_grid(const vec<D,T>& imgs, uint_t dnx, uint_t dny,
+            F&& s2d_exact, vec2d& wei, const astro::regrid_drizzle_params& opts) {
+
+            auto resd = imgs.dims;
+            resd[D-2] = dny;
+            resd[D-1] = dnx;
+            vec<D,double> res = replicate(0.0, resd);
+            wei = replicate(0.0, dny, dnx);
+
+            uint_t nx = imgs.dims[D-1];
+            uint_t ny = imgs.dims[D-2];
+
+            // If "linearize" is set, build approximate transformation matrix from image center
+            double csx = nx/2;
+            double csy = ny/2;
+            double cdx, cdy, cdx1, cdy1, cdx2, cdy2;
+            double pixel_area = dnan;
+            if (opts.linearize) {
+                s2d_exact(csx, csy,     cdx,  cdy);
+                s2d_exact(csx+1.0, csy, cdx1, cdy1);
+                s2d_exact(csx, csy+1.0, cdx2, cdy2);
+
+                cdx1 -= cdx; cdy1 -= cdy; cdx2 -= cdx; cdy2 -= cdy;
+                pixel_area = sqrt(sqr(cdx1) + sqr(cdy1))*sqrt(sqr(cdx2) + sqr(cdy2));
+
+                if (abs(cdx-round(cdx)) < 1e-6 && abs(cdy-round(cdy)) < 1e-6 &&
+                    abs(cdx1 - 1.0) < 1e-6 && abs(cdy2 - 1.0) < 1e-6 &&
+                    abs(cdy1) < 1e-3 && abs(cdx2) < 1e-3) {
+
+                    // This is a simple integer translation, let's optimize this
+                    int_t dx = round(cdx);
+                    int_t dy = round(cdy);
+                    int_t wx1 = nx/2;
+                    int_t wx2 = nx-1 - wx1;
+                    int_t wy1 = ny/2;
+                    int_t wy2 = ny-1 - wy1;
+
+                    vec1u ids, idd;
+                    astro::subregion(wei, {dy-wy1, dx-wx1, dy+wy2, dx+wx2}, idd, ids);
+
+                    res[_] = dnan;
+                    copy_subset(imgs, res, ids, idd);
+                    wei[idd] = 1.0;
 
-                    res.safe(iy,ix) = flx;
+                    return res;
                 }
+            }
+
+            auto s2d = [&](double sx, double sy, double& dx, double& dy) {
+                if (opts.linearize) {
+                    dx = (sx-csx)*cdx1 + (sy-csy)*cdx2 + cdx;
+                    dy = (sx-csx)*cdy1 + (sy-csy)*cdy2 + cdy;
+                } else {
+                    s2d_exact(sx, sy, dx, dy);
+                }
+            };
+
+            auto pg = progress_start(ny);
+            if (opts.thread <= 1) {
+                uint_t iy = 0;
+                regrid_drizzle_tile(imgs, 0, nx, 0, ny, s2d, pixel_area, opts, res, wei, 0, 0,
+                    [&]() {
+                    ++iy;
+                    if (opts.verbose) print_progress(pg, iy);
+                });
+            } else {
+                // Split the source image in tiles, each drizzled by one thread on its own
+                // copy of the destination pixels it overlaps. The tiles and their order
+                // do not depend on the number of threads, so neither does the result.
+                const uint_t tsize = std::max(opts.tile_size, uint_t(1));
+                const uint_t ntx = (nx + tsize - 1)/tsize;
+                const uint_t nty = (ny + tsize - 1)/tsize;
+                const uint_t ntile = ntx*nty;
+
+                // Tiles are processed in batches to limit memory usage
+                const uint_t nbatch = 4*opts.thread;
+                std::vector<regrid_drizzle_tile_t<D>> tiles(nbatch);
+                std::atomic<uint_t> nrow(0);
+
+                thread::task_pool pool(opts.thread);
+                for (uint_t t0 = 0; t0 < ntile; t0 += nbatch) {
+                    const uint_t t1 = std::min(ntile, t0 + nbatch);
+
+                    pool.execute_chunks([&](uint_t j0, uint_t j1) {
+                        for (uint_t t = j0; t < j1; ++t) {
+                            regrid_drizzle_tile_t<D>& tile = tiles[t-t0];
+                            const uint_t ix0 = (t % ntx)*tsize, ix1 = std::min(nx, ix0 + tsize);
+                            const uint_t iy0 = (t / ntx)*tsize, iy1 = std::min(ny, iy0 + tsize);
+
+                            tile.empty = !regrid_drizzle_tile_bounds(ix0, ix1, iy0, iy1, s2d,
+                                opts, dnx, dny, tile.x0, tile.x1, tile.y0, tile.y1);
+
+                            if (tile.empty) {
+                                tile.res.clear();
+                                tile.wei.clear();
+                                nrow += iy1 - iy0;
+                                continue;
+                            }
 
-                if (opts.verbose) progress(pg, 31);
+                            auto tdims = resd;
+                            tdims[D-2] = tile.y1 - tile.y0 + 1;
+                            tdims[D-1] = tile.x1 - tile.x0 + 1;
+                            tile.res = replicate(0.0, tdims);
+                            tile.wei = replicate(0.0, tdims[D-2], tdims[D-1]);
+
+                            regrid_drizzle_tile(imgs, ix0, ix1, iy0, iy1, s2d, pixel_area,
+                                opts, tile.res, tile.wei, tile.x0, tile.y0, [&]() { ++nrow; });
+                        }
+                    }, t0, t1, 1, [&]() {
+                        if (opts.verbose) print_progress(pg, nrow.load()/ntx);
+                    });
+
+                    regrid_drizzle_merge(tiles, t1 - t0, pool, res, wei);
+                }
+
+                if (opts.verbose) print_progress(pg, ny);
             }
 
-            std::swap(plx, pux);
-            std::swap(ply, puy);
+            apply_weights(res, wei);
+
+            return res;
         }
+    }
+}
+
+namespace astro {
+    template<typename T = double>
+    vec2d regrid_interpolate(const vec<2,T>& imgs, const astro::wcs& astros, const astro::wcs& astrod,
+        regrid_interpolate_params opts = regrid_interpolate_params{}) {
+
+        // Regridded image
+        vec2d res;
+
+#ifdef NO_WCSLIB
+        static_assert(!std::is_same<T,T>::value, "WCS support is disabled, "
+            "please enable the WCSLib library to use this function");
+#else
+
+        auto s2d_wcs = [&](double sx, double sy, double& dx, double& dy) {
+            double tra, tdec;
+            astro::xy2ad(astrod, sx+1, sy+1, tra, tdec);
+            astro::ad2xy(astros, tra, tdec, dx, dy);
+            dx -= 1.0; dy -= 1.0;
+        };
+
+        res = impl::astro_impl::regrid_interpolate_grid(imgs,
+            astrod.dims[astrod.x_axis], astrod.dims[astrod.y_axis], s2d_wcs, opts);
 #endif
 
         return res;
     }
 
-    struct regrid_drizzle_params {
-        bool verbose = false;      // print progress in terminal
-        double pixfrac = 1.0;      // fraction of pixel to drizzle (1 = simple projection)
-        bool linearize = false;    // approximation: assume WCS transform is linear
-        bool dest_pixfrac = false; // approximation: assume pixfrac is linear on destination grid
-    };
+    // Same as above, using a pre-computed transform from the destination to the source
+    // image pixels
+    template<typename T = double>
+    vec2d regrid_interpolate(const vec<2,T>& imgs, const pixel_transform& d2s,
+        regrid_interpolate_params opts = regrid_interpolate_params{}) {
+
+        vif_check(imgs.dims[0] == d2s.dims_to[0] && imgs.dims[1] == d2s.dims_to[1],
+            "mismatch between transform and image dimensions (", d2s.dims_to, " vs. ",
+            imgs.dims, ")");
+
+        auto s2d = [&](double sx, double sy, double& dx, double& dy) {
+            d2s.map(sx, sy, dx, dy);
+        };
+
+        return impl::astro_impl::regrid_interpolate_grid(imgs,
+            d2s.dims_from[1], d2s.dims_from[0], s2d, opts);
+    }
 
     template<std::size_t D, typename T = double>
     vec<D,double> regrid_drizzle(const vec<D,T>& imgs, const astro::wcs& astros, const astro::wcs& astrod,
@@ -2034,34 +3003,6 @@ namespace astro {
                 astros.dims, " vs. ", imgs.dims, ")");
         }
 
-        auto resd = imgs.dims;
-        resd[D-2] = astrod.dims[astrod.y_axis];
-        resd[D-1] = astrod.dims[astrod.x_axis];
-        res = replicate(0.0, resd);
-        wei = replicate(0.0, astrod.dims[astrod.y_axis], astrod.dims[astrod.x_axis]);
-
-        uint_t nx = astros.dims[astros.x_axis];
-        uint_t ny = astros.dims[astros.y_axis];
-
-        // Precompute the projection of the old pixel grid on the new
-        // In case pixfrac=1:
-        // For the horizontal pixel 'i' of line 'j' (x_i,y_j), the grid is:
-        //   (pux,puy)[i]     (pux,puy)[i+1]    # y_(j+0.5)
-        //   (plx,ply)[i]     (plx,ply)[i+1]    # y_(j-0.5)
-        //   # x_(i-0.5)      # x_(i+0.5)
-        // To avoid re-computing stuff, pux and puy are swapped into plx and ply
-        // on each 'y' iteration for reuse. Total of (Nx+1)*(Ny+1) WCS transforms.
-        //
-        // In case pixfrac!=1:
-        // If dest_pixfrac=true, then the projection's coordinates are
-        // computed by linearly interpolating the above.
-        // If dest_pixfrac=false:
-        // For the horizontal pixel 'i' of line 'j' (x_i,y_j), the grid is:
-        //   (plux,pluy)[i]   (prux,pruy)[i]    # y_(j+0.5*pf)
-        //   (pllx,plly)[i]   (prlx,prly)[i]    # y_(j-0.5*pf)
-        //   # x_(i-0.5*pf)   # x_(i+0.5*pf)
-        // Total of 4*Nx*Ny WCS transforms.
-
         auto s2d_wcs = [&](double sx, double sy, double& dx, double& dy) {
             double tra, tdec;
             astro::xy2ad(astros, sx+1, sy+1, tra, tdec);
@@ -2069,137 +3010,81 @@ namespace astro {
             dx -= 1.0; dy -= 1.0;
         };
 
-        // If "linearize" is set, build approximate transformation matrix from image center
-        double csx = nx/2;
-        double csy = ny/2;
-        double cdx, cdy, cdx1, cdy1, cdx2, cdy2;
-        double pixel_area;
-        if (opts.linearize) {
-            s2d_wcs(csx, csy,     cdx,  cdy);
-            s2d_wcs(csx+1.0, csy, cdx1, cdy1);
-            s2d_wcs(csx, csy+1.0, cdx2, cdy2);
-
-            cdx1 -= cdx; cdy1 -= cdy; cdx2 -= cdx; cdy2 -= cdy;
-            pixel_area = sqrt(sqr(cdx1) + sqr(cdy1))*sqrt(sqr(cdx2) + sqr(cdy2));
-
-            if (abs(cdx-round(cdx)) < 1e-6 && abs(cdy-round(cdy)) < 1e-6 &&
-                abs(cdx1 - 1.0) < 1e-6 && abs(cdy2 - 1.0) < 1e-6 &&
-                abs(cdy1) < 1e-3 && abs(cdx2) < 1e-3) {
+        res = impl::astro_impl::regrid_drizzle_grid(imgs,
+            astrod.dims[astrod.x_axis], astrod.dims[astrod.y_axis], s2d_wcs, wei, opts);
+#endif
 
-                // This is a simple integer translation, let's optimize this
-                int_t dx = round(cdx);
-                int_t dy = round(cdy);
-                int_t wx1 = nx/2;
-                int_t wx2 = nx-1 - wx1;
-                int_t wy1 = ny/2;
-                int_t wy2 = ny-1 - wy1;
+        return res;
+    }
 
-                vec1u ids, idd;
-                subregion(wei, {dy-wy1, dx-wx1, dy+wy2, dx+wx2}, idd, ids);
+    template<std::size_t D, typename T = double>
+    vec<D,double> regrid_drizzle(const vec<D,T>& imgs, const astro::wcs& astros, const astro::wcs& astrod,
+        regrid_drizzle_params opts = regrid_drizzle_params{}) {
+        vec2d wei;
+        return regrid_drizzle(imgs, astros, astrod, wei, opts);
+    }
 
-                res[_] = dnan;
-                impl::astro_impl::copy_subset(imgs, res, ids, idd);
-                wei[idd] = 1.0;
+    // Same as above, using a pre-computed transform from the source to the destination
+    // image pixels
+    template<std::size_t D, typename T = double>
+    vec<D,double> regrid_drizzle(const vec<D,T>& imgs, const pixel_transform& s2d,
+        vec2d& wei, regrid_drizzle_params opts = regrid_drizzle_params{}) {
 
-                return res;
-            }
-        }
+        vif_check(imgs.dims[D-2] == s2d.dims_from[0] && imgs.dims[D-1] == s2d.dims_from[1],
+            "mismatch between transform and image dimensions (", s2d.dims_from, " vs. ",
+            imgs.dims, ")");
 
-        auto s2d = [&](double sx, double sy, double& dx, double& dy) {
-            if (opts.linearize) {
-                dx = (sx-csx)*cdx1 + (sy-csy)*cdx2 + cdx;
-                dy = (sx-csx)*cdy1 + (sy-csy)*cdy2 + cdy;
-            } else {
-                s2d_wcs(sx, sy, dx, dy);
-            }
+        auto s2d_map = [&](double sx, double sy, double& dx, double& dy) {
+            s2d.map(sx, sy, dx, dy);
         };
 
-        auto pg = progress_start(nx*ny);
-        vec1d plx, ply;
-        vec1d pux, puy;
-        vec1d pllx, prlx, plux, prux;
-        vec1d plly, prly, pluy, pruy;
-        if (opts.pixfrac == 1 || opts.dest_pixfrac) {
-            plx.resize(nx+1);
-            ply.resize(nx+1);
-            for (uint_t ix : range(nx+1)) {
-                s2d(ix-0.5, -0.5, plx.safe[ix], ply.safe[ix]);
-            }
-
-            pux.resize(nx+1);
-            puy.resize(nx+1);
-        } else {
-            pllx.resize(nx); prlx.resize(nx);
-            plux.resize(nx); prux.resize(nx);
-            plly.resize(nx); prly.resize(nx);
-            pluy.resize(nx); pruy.resize(nx);
-        }
-
-        for (uint_t iy : range(ny)) {
-            if (opts.pixfrac == 1 || opts.dest_pixfrac) {
-                for (uint_t ix : range(nx+1)) {
-                    s2d(ix-0.5, iy+0.5, pux.safe[ix], puy.safe[ix]);
-                }
-            } else {
-                const double dp = 0.5*opts.pixfrac;
-                for (uint_t ix : range(nx)) {
-                    s2d(ix-dp, iy-dp, pllx.safe[ix], plly.safe[ix]);
-                    s2d(ix+dp, iy-dp, prlx.safe[ix], prly.safe[ix]);
-                    s2d(ix-dp, iy+dp, plux.safe[ix], pluy.safe[ix]);
-                    s2d(ix+dp, iy+dp, prux.safe[ix], pruy.safe[ix]);
-                }
-            }
-
-            for (uint_t ix : range(nx)) {
-                // Find projection of each pixel of the original image on the new grid
-                // NB: assumes the astrometry is such that this projection is
-                // reasonably approximated by a 4-edge polygon (i.e.: varying pixel scales,
-                // pixel offsets and rotations are fine, but weird things may happen close
-                // to the poles of the projection where things become non-linear)
-
-                vec1d xps, yps;
-                if (opts.pixfrac == 1 || opts.dest_pixfrac) {
-                    xps = {plx.safe[ix], plx.safe[ix+1], pux.safe[ix+1], pux.safe[ix]};
-                    yps = {ply.safe[ix], ply.safe[ix+1], puy.safe[ix+1], puy.safe[ix]};
-
-                    if (opts.dest_pixfrac && opts.pixfrac != 1) {
-                        double mx = mean(xps);
-                        xps = mx + opts.pixfrac*(xps - mx);
-                        double my = mean(yps);
-                        yps = my + opts.pixfrac*(yps - my);
-                    }
-                } else {
-                    xps = {pllx.safe[ix], prlx.safe[ix], prux.safe[ix], plux.safe[ix]};
-                    yps = {plly.safe[ix], prly.safe[ix], pruy.safe[ix], pluy.safe[ix]};
-                }
-
-                if (!opts.linearize) {
-                    pixel_area = impl::astro_impl::polyon_area(xps, yps);
-                }
-
-                double flx_frac = sqr(opts.pixfrac);
-                impl::astro_impl::regrid_drizzle(imgs, ix, iy, flx_frac, xps, yps, pixel_area, res, wei);
-
-                if (opts.verbose) progress(pg, 31);
-            }
-
-            if (opts.pixfrac == 1 || opts.dest_pixfrac) {
-                std::swap(plx, pux);
-                std::swap(ply, puy);
-            }
-        }
-#endif
-
-        impl::astro_impl::apply_weights(res, wei);
-
-        return res;
+        return impl::astro_impl::regrid_drizzle_grid(imgs,
+            s2d.dims_to[1], s2d.dims_to[0], s2d_map, wei, opts);
     }
 
     template<std::size_t D, typename T = double>
-    vec<D,double> regrid_drizzle(const vec<D,T>& imgs, const astro::wcs& astros, const astro::wcs& astrod,
+    vec<D,double> regrid_drizzle(const vec<D,T>& imgs, const pixel_transform& s2d,
         regrid_drizzle_params opts = regrid_drizzle_params{}) {
         vec2d wei;
-        return regrid_drizzle(imgs, astros, astrod, wei, opts);
+        return regrid_drizzle(imgs, s2d, wei, opts);
+    }
+
+    // Same as convolve2d_tiled(), reading the image from the FITS file 'in_file' and
+    // writing the result in 'out_file' (with the same header), one tile at a time. The
+    // image is never fully loaded in memory: peak memory usage is about 40*tile_size^2
+    // bytes per thread, plus 16*tile_size^2 bytes for the kernel. The output pixels are
+    // stored with the type 'TypeO'.
+    template<typename TypeO = double, typename TypeK = double>
+    void convolve2d_tiled(const std::string& in_file, const vec<2,TypeK>& kernel,
+        const std::string& out_file, const convolve2d_tiled_params& opts = convolve2d_tiled_params{}) {
+#ifdef NO_FFTW
+        static_assert(!std::is_same<TypeO,TypeO>::value, "this function requires the FFTW "
+            "library");
+#else
+        fits::input_image fimg(in_file);
+        vec1u idims = fimg.image_dims();
+        vif_check(idims.size() == 2, "image must be 2-dimensional (got ", idims.size(),
+            " dimensions)");
+
+        std::array<uint_t,2> dims = {{idims[0], idims[1]}};
+
+        fits::output_image fout(out_file);
+        fout.create<TypeO>(dims);
+        fout.write_header(fimg.read_header());
+        fimg.close();
+
+        impl::astro_impl::convolve2d_tiled(dims, kernel, opts,
+            [&]() {
+                auto img = std::make_shared<fits::mapped_image>(in_file);
+                return [img](uint_t y0, uint_t y1, uint_t x0, uint_t x1, vec2d& v) {
+                    img->read_subset(v, y0-_-y1, x0-_-x1);
+                };
+            },
+            [&](uint_t y0, uint_t x0, const vec2d& v) {
+                fout.write_subset(vec<2,TypeO>{v}, {{y0, x0}});
+            }
+        );
+#endif
     }
 }
 
@@ -7,6 +7,23 @@
 #include "vif/astro/wcs.hpp"
 
 namespace vif {
+namespace astro {
+    struct qstack_params {
+        bool keep_nan = false;
+        bool save_offsets = false;
+        bool save_section = false;
+        bool verbose = false;
+        uint_t thread = 1;
+        // Maximum amount of memory used to read image bands (in bytes, per thread)
+        uint_t buffer_size = 64*1024*1024;
+    };
+
+    struct qstack_output {
+        vec1d dx, dy;
+        vec1u sect;
+    };
+}
+
 namespace impl {
     namespace qstack_impl {
         struct image_workspace {
@@ -62,7 +79,7 @@ namespace impl {
 
             image_workspace(image_workspace&& i) : status(i.status), fptr(i.fptr),
                 width(i.width), height(i.height), astro(std::move(i.astro)),
-                x(std::move(x)), y(std::move(y)) {
+                x(std::move(i.x)), y(std::move(i.y)) {
                 i.fptr = nullptr;
             }
 
@@ -73,138 +90,758 @@ namespace impl {
                 fptr = nullptr;
             }
         };
-    }
-}
 
-namespace astro {
-    struct qstack_params {
-        bool keep_nan = false;
-        bool save_offsets = false;
-        bool save_section = false;
-        bool verbose = false;
-    };
+        // Bulk extraction of cutouts.
+        // Instead of reading each cutout separately, the cutouts are sorted by their first
+        // row and grouped into "bands" of consecutive rows. Each band is read from the disk
+        // with a single call to cfitsio, and shared by all the cutouts it contains. Bands
+        // only span the columns that are needed, and are closed when the requested pixels
+        // would only cover a small fraction of their area (for sparse catalogs).
 
-    struct qstack_output {
-        vec1d dx, dy;
-        vec1u sect;
-    };
+        struct cutout_t {
+            uint_t src;     // index of the source in the input catalog
+            long x0, y0;    // first pixel of the cutout (1-based, may be outside of the image)
+        };
 
-    template<typename Type>
-    qstack_output qstack(const vec1d& ra, const vec1d& dec, const std::string& filename,
-        uint_t hsize, vec<3,Type>& cube, vec1u& ids, qstack_params params = qstack_params()) {
+        struct band_t {
+            long x0, x1, y0, y1;  // region of the image to read (1-based, inclusive)
+            uint_t c0, c1;        // range of cutouts inside this band
+        };
 
-        vif_check(file::exists(filename), "cannot stack on inexistant file '"+filename+"'");
-        vif_check(ra.size() == dec.size(), "need ra.size() == dec.size()");
+        struct cutout_plan {
+            long width = 0, height = 0;
+            long size = 0;
+            std::vector<cutout_t> cuts;
+            std::vector<band_t> bands;
+        };
 
-        vec1s sects;
-        if (ends_with(filename, ".sectfits")) {
-            sects = fits::read_sectfits(filename);
-        } else {
-            sects.push_back(filename);
+        // Find the cutouts of size 2*hsize+1 centered on the pixels (x,y) (1-based) that
+        // overlap with an image of the given dimensions (or that are fully inside the image,
+        // if 'edges' is false), and group them into bands of at most 'max_rows' rows.
+        inline cutout_plan plan_cutouts(const vec1d& x, const vec1d& y, long width, long height,
+            uint_t hsize, uint_t max_rows, bool edges = true) {
+
+            cutout_plan p;
+            p.width = width;
+            p.height = height;
+            p.size = 2*hsize+1;
+
+            for (uint_t i : range(x)) {
+                if (!is_finite(x.safe[i]) || !is_finite(y.safe[i])) continue;
+
+                cutout_t c;
+                c.src = i;
+                c.x0 = round(x.safe[i]-hsize);
+                c.y0 = round(y.safe[i]-hsize);
+
+                // Discard any source that falls out of the boundaries of the image
+                if (c.x0 + p.size - 1 < 1 || c.x0 >= width || c.y0 + p.size - 1 < 1 || c.y0 >= height) {
+                    continue;
+                }
+
+                if (!edges && (c.x0 < 1 || c.x0 + p.size - 1 >= width ||
+                    c.y0 < 1 || c.y0 + p.size - 1 >= height)) {
+                    continue;
+                }
+
+                p.cuts.push_back(c);
+            }
+
+            std::sort(p.cuts.begin(), p.cuts.end(), [](const cutout_t& c1, const cutout_t& c2) {
+                return c1.y0 < c2.y0 || (c1.y0 == c2.y0 && c1.x0 < c2.x0);
+            });
+
+            const long mrows = std::max(long(max_rows), p.size);
+            const uint_t n = p.cuts.size();
+            uint_t c = 0;
+            while (c < n) {
+                band_t b;
+                b.c0 = c;
+                b.y0 = std::max(1l, p.cuts[c].y0);
+                b.y1 = b.y0;
+                b.x0 = width;
+                b.x1 = 1;
+
+                const long ylim = std::min(height, b.y0 + mrows - 1);
+                double covered = 0;
+                while (c < n) {
+                    const cutout_t& t = p.cuts[c];
+                    long y1 = std::min(height, t.y0 + p.size - 1);
+                    if (y1 > ylim) break;
+
+                    long nx0 = std::min(b.x0, std::max(1l, t.x0));
+                    long nx1 = std::max(b.x1, std::min(width, t.x0 + p.size - 1));
+                    long ny1 = std::max(b.y1, y1);
+                    double ncovered = covered + p.size*p.size;
+                    if (c != b.c0 && (nx1 - nx0 + 1)*double(ny1 - b.y0 + 1) > 4*ncovered) break;
+
+                    b.x0 = nx0;
+                    b.x1 = nx1;
+                    b.y1 = ny1;
+                    covered = ncovered;
+                    ++c;
+                }
+
+                b.c1 = c;
+                p.bands.push_back(b);
+            }
+
+            return p;
         }
 
-        std::vector<impl::qstack_impl::image_workspace> imgs;
-        imgs.reserve(sects.size());
-        for (auto& s : sects) {
-            imgs.emplace_back(s, ra, dec);
+        // Copy a cutout from the band, filling the pixels outside of the image with NaN
+        template<typename Type>
+        void copy_cutout(const cutout_plan& p, const band_t& b, const Type* band,
+            const cutout_t& c, Type* out) {
+
+            // Range of cutout columns [i0,i1) that fall inside the image. The source pointer
+            // is only formed for this range, which never starts before the band.
+            const long bw = b.x1 - b.x0 + 1;
+            const long i0 = std::min(p.size, std::max(0l, 1 - c.x0));
+            const long i1 = std::max(i0, std::min(p.size, p.width - c.x0 + 1));
+            for (long j = 0; j < p.size; ++j) {
+                Type* row = out + j*p.size;
+                long y = c.y0 + j;
+                if (y < 1 || y > p.height || i1 == i0) {
+                    std::fill(row, row + p.size, Type(fnan));
+                    continue;
+                }
+
+                const Type* src = band + (y - b.y0)*bw + (c.x0 + i0 - b.x0);
+                std::fill(row, row + i0, Type(fnan));
+                std::copy(src, src + (i1 - i0), row + i0);
+                std::fill(row + i1, row + p.size, Type(fnan));
+            }
         }
 
-        // Allocate memory to hold all the cutouts
-        if (cube.empty()) {
-            cube.dims[1] = cube.dims[2] = 2*hsize+1;
+        // Maximum number of rows per band, for bands of at most 'buffer_size' bytes
+        template<typename Type>
+        uint_t band_rows(long width, uint_t nfile, uint_t buffer_size) {
+            return std::max(uint_t(1), buffer_size/(sizeof(Type)*nfile*std::max(1l, width)));
         }
 
-        cube.reserve(cube.size() + (2*hsize+1)*(2*hsize+1)*ra.size());
-        ids.reserve(ids.size() + ra.size());
+        // Read all the cutouts of a plan from one or more images of identical dimensions
+        // (e.g., flux and weight maps), and call 'func(c, cuts)' for each cutout, with
+        // 'cuts[k]' pointing to the cutout of the k-th image. Bands are processed in parallel
+        // if 'pool' is not null, in which case 'func' must be thread-safe (it is never called
+        // concurrently for the same source). Each thread uses its own file handles; images
+        // that can be memory mapped are read directly from the file pages.
+        template<typename Type, typename F>
+        void extract_cutouts(const vec1s& files, const cutout_plan& p, thread::task_pool* pool,
+            bool verbose, F&& func) {
+
+            const uint_t nfile = files.size();
+            const uint_t npix = p.size*p.size;
+            const uint_t nband = p.bands.size();
+            std::atomic<uint_t> ndone(0);
+
+            auto process = [&](uint_t b0, uint_t b1) {
+                std::vector<fits::mapped_image> imgs;
+                imgs.reserve(nfile);
+                for (uint_t k : range(nfile)) {
+                    imgs.emplace_back(files[k]);
+                    imgs.back().allow_narrow();
+                }
 
-        vec1b found(ra.size());
+                std::vector<vec<2,Type>> bands(nfile);
+                std::vector<std::vector<Type>> cuts(nfile, std::vector<Type>(npix));
+                std::vector<Type*> pcuts(nfile);
+                for (uint_t k : range(nfile)) {
+                    pcuts[k] = cuts[k].data();
+                }
 
-        qstack_output out;
-        if (params.save_offsets) {
-            out.dx.reserve(ra.size());
-            out.dy.reserve(ra.size());
+                for (uint_t ib = b0; ib < b1; ++ib) {
+                    const band_t& b = p.bands[ib];
+                    for (uint_t k : range(nfile)) {
+                        imgs[k].read_subset(bands[k], uint_t(b.y0-1)-_-uint_t(b.y1-1),
+                            uint_t(b.x0-1)-_-uint_t(b.x1-1));
+                    }
+
+                    for (uint_t ic = b.c0; ic < b.c1; ++ic) {
+                        for (uint_t k : range(nfile)) {
+                            copy_cutout(p, b, bands[k].raw_data(), p.cuts[ic], pcuts[k]);
+                        }
+
+                        func(p.cuts[ic], const_cast<const Type* const*>(pcuts.data()));
+                    }
+
+                    ++ndone;
+                }
+            };
+
+            auto pg = progress_start(nband);
+            if (pool) {
+                pool->execute_chunks(process, 0, nband, 1, [&]() {
+                    if (verbose) print_progress(pg, ndone.load());
+                });
+            } else {
+                const uint_t chunk = 64;
+                for (uint_t b0 = 0; b0 < nband; b0 += chunk) {
+                    process(b0, std::min(nband, b0 + chunk));
+                    if (verbose) print_progress(pg, ndone.load());
+                }
+            }
         }
 
-        if (params.save_section) {
-            out.sect.reserve(ra.size());
+        template<typename Type>
+        bool is_cutout_finite(const Type* cut, uint_t npix) {
+            for (uint_t i : range(npix)) {
+                if (!is_finite(cut[i])) return false;
+            }
+
+            return true;
         }
 
-        // Loop over all images
-        auto pg = progress_start(ra.size()*imgs.size());
-        for (uint_t iimg : range(imgs.size())) {
-            auto& img = imgs[iimg];
+        // Reorder the last cutouts of a cube in place: the cutout 'n0+perm[k]' is moved
+        // to 'n0+k'
+        template<typename Type>
+        void permute_cutouts(vec<3,Type>& cube, uint_t n0, const vec1u& perm) {
+            const uint_t npix = cube.dims[1]*cube.dims[2];
+            const uint_t n = perm.size();
+            std::vector<Type> tmp(npix);
+            std::vector<bool> done(n, false);
+            auto slot = [&](uint_t k) {
+                return cube.data.begin() + (n0 + k)*npix;
+            };
+
+            for (uint_t k : range(n)) {
+                if (done[k]) continue;
+
+                done[k] = true;
+                if (perm.safe[k] == k) continue;
+
+                // Follow the cycle starting at 'k'
+                std::copy(slot(k), slot(k) + npix, tmp.begin());
+                uint_t j = k;
+                while (perm.safe[j] != k) {
+                    uint_t q = perm.safe[j];
+                    std::copy(slot(q), slot(q) + npix, slot(j));
+                    done[q] = true;
+                    j = q;
+                }
 
-            // Loop over all sources
-            for (uint_t i : range(ra)) {
-                if (params.verbose) progress(pg);
+                std::copy(tmp.begin(), tmp.end(), slot(j));
+            }
+        }
 
-                long p0[2] = {long(round(img.x[i]-hsize)), long(round(img.y[i]-hsize))};
-                long p1[2] = {long(round(img.x[i]+hsize)), long(round(img.y[i]+hsize))};
+        // Stack cutouts from one or several sections of an image, given the pixel positions
+        // of the sources in each section. The cutouts are written directly into 'cube'. For
+        // sources covered by several sections, pixels that are not finite in the first
+        // section are filled with the values from the following sections.
+        template<typename Type>
+        void stack_sections(const vec1s& sects, const std::vector<const vec1d*>& xs,
+            const std::vector<const vec1d*>& ys, const vec<1,long>& widths,
+            const vec<1,long>& heights, uint_t nsrc, uint_t hsize, vec<3,Type>& cube,
+            vec1u& ids, vec1u& sect, const astro::qstack_params& params) {
+
+            const uint_t nsect = sects.size();
+            const long size = 2*hsize+1;
+            const uint_t npix = size*size;
+
+            std::vector<cutout_plan> plans(nsect);
+            for (uint_t s : range(nsect)) {
+                plans[s] = plan_cutouts(*xs[s], *ys[s], widths[s], heights[s], hsize,
+                    band_rows<Type>(widths[s], 1, params.buffer_size));
+            }
 
-                // Discard any source that falls out of the boundaries of the image
-                if (p1[0] < 1 || p0[0] >= img.width || p1[1] < 1 || p0[1] >= img.height) {
-                    continue;
+            // Reserve one slot in the cube for each source that is covered at least
+            // once, in the order in which they will be found
+            vec1u slot = replicate(npos, nsrc);
+            vec1u slot_src;
+            vec1u slot_sect;
+            for (uint_t s : range(nsect)) {
+                vec1u srcs;
+                srcs.reserve(plans[s].cuts.size());
+                for (auto& c : plans[s].cuts) {
+                    if (slot.safe[c.src] == npos) srcs.push_back(c.src);
                 }
 
-                vec<2,Type> cut(2*hsize+1, 2*hsize+1);
+                inplace_sort(srcs);
+                for (uint_t i : srcs) {
+                    slot.safe[i] = slot_src.size();
+                    slot_src.push_back(i);
+                }
+            }
 
-                if (p0[0] < 1 || p1[0] >= img.width || p0[1] < 1 || p1[1] >= img.height) {
-                    // The source is overlapping with the edges of the map
-                    // Extract what we can
-                    cut[_] = fnan;
+            const uint_t nslot = slot_src.size();
+            slot_sect = replicate(npos, nslot);
 
-                    long p0b[2] = {max(1, p0[0]),         max(1, p0[1])};
-                    long p1b[2] = {min(img.width, p1[0]), min(img.height, p1[1])};
+            if (cube.empty()) {
+                cube.dims[1] = cube.dims[2] = size;
+            }
 
-                    vec<2,Type> subcut(p1b[0]-p0b[0]+1, p1b[1]-p0b[1]+1);
+            vif_check(cube.dims[1] == uint_t(size) && cube.dims[2] == uint_t(size),
+                "cannot append cutouts of size ", size, "x", size, " to a cube of cutouts of "
+                "size ", cube.dims[1], "x", cube.dims[2]);
 
-                    Type null = fnan;
-                    int anynul = 0;
-                    long inc[2] = {1, 1};
-                    fits_read_subset(img.fptr, impl::fits_impl::traits<Type>::ttype, p0b, p1b, inc, &null,
-                        subcut.raw_data(), &anynul, &img.status);
+            const uint_t n0 = cube.dims[0];
+            cube.dims[0] = n0 + nslot;
+            cube.resize();
 
-                    long x0 = p0b[0]-p0[0];
-                    long x1 = p1b[0]-p0[0];
-                    long y0 = p0b[1]-p0[1];
-                    long y1 = p1b[1]-p0[1];
-                    cut(y0-_-y1,x0-_-x1) = subcut;
-                } else {
-                    // The source is fully covered, easy
-                    Type null = fnan;
-                    int anynul = 0;
-                    long inc[2] = {1, 1};
-                    fits_read_subset(img.fptr, impl::fits_impl::traits<Type>::ttype, p0, p1, inc, &null,
-                        cut.raw_data(), &anynul, &img.status);
+            std::unique_ptr<thread::task_pool> pool;
+            if (params.thread > 1) {
+                pool.reset(new thread::task_pool(params.thread));
+            }
+
+            for (uint_t s : range(nsect)) {
+                extract_cutouts<Type>(vec1s{sects[s]}, plans[s], pool.get(), params.verbose,
+                    [&](const cutout_t& c, const Type* const* cuts) {
+
+                    // Discard any source that contains a bad pixel (either infinite or NaN)
+                    if (!params.keep_nan && !is_cutout_finite(cuts[0], npix)) return;
+
+                    uint_t k = slot.safe[c.src];
+                    auto out = cube.data.begin() + (n0 + k)*npix;
+                    if (slot_sect.safe[k] == npos) {
+                        // First time we find this source
+                        slot_sect.safe[k] = s;
+                        std::copy(cuts[0], cuts[0] + npix, out);
+                    } else {
+                        // We already found this source in another section, combine the two
+                        for (uint_t i : range(npix)) {
+                            if (!is_finite(out[i])) out[i] = cuts[0][i];
+                        }
+                    }
+                });
+            }
+
+            // Sort the cutouts by order of discovery and remove the sources that were not found
+            vec1u order = where(slot_sect != npos);
+            const uint_t nfound = order.size();
+            std::sort(order.begin(), order.end(), [&](uint_t k1, uint_t k2) {
+                return slot_sect.safe[k1] < slot_sect.safe[k2] ||
+                    (slot_sect.safe[k1] == slot_sect.safe[k2] && slot_src.safe[k1] < slot_src.safe[k2]);
+            });
+
+            append(order, where(slot_sect == npos));
+            permute_cutouts(cube, n0, order);
+
+            cube.dims[0] = n0 + nfound;
+            cube.resize();
+
+            order.resize(nfound);
+            append(ids, slot_src[order]);
+            sect = slot_sect[order];
+        }
+
+        // Stack cutouts from an image and its weight map, given the pixel positions of the
+        // sources. Only the sources that are fully covered are kept.
+        template<typename Type>
+        void stack_pair(const std::string& ffile, const std::string& wfile, const vec1d& x,
+            const vec1d& y, long width, long height, uint_t hsize, vec<3,Type>& cube,
+            vec<3,Type>& wcube, vec1u& ids, const astro::qstack_params& params) {
+
+            const long size = 2*hsize+1;
+            const uint_t npix = size*size;
+
+            cutout_plan plan = plan_cutouts(x, y, width, height, hsize,
+                band_rows<Type>(width, 2, params.buffer_size), false);
+
+            // One slot per source, in the order of the input catalog
+            vec1u slot = replicate(npos, x.size());
+            for (auto& c : plan.cuts) {
+                slot.safe[c.src] = 0;
+            }
+
+            vec1u slot_src = where(slot != npos);
+            const uint_t nslot = slot_src.size();
+            for (uint_t k : range(nslot)) {
+                slot.safe[slot_src.safe[k]] = k;
+            }
+
+            vec1b found(nslot);
+            uint_t n0 = 0;
+            for (auto* c : {&cube, &wcube}) {
+                if (c->empty()) {
+                    c->dims[1] = c->dims[2] = size;
                 }
 
+                vif_check(c->dims[1] == uint_t(size) && c->dims[2] == uint_t(size),
+                    "cannot append cutouts of size ", size, "x", size, " to a cube of cutouts of "
+                    "size ", c->dims[1], "x", c->dims[2]);
+
+                n0 = c->dims[0];
+                c->dims[0] = n0 + nslot;
+                c->resize();
+            }
+
+            vif_check(cube.dims[0] == wcube.dims[0], "image and weight cubes do not have the "
+                "same number of cutouts (", cube.dims[0] - nslot, " vs. ", wcube.dims[0] - nslot, ")");
+
+            std::unique_ptr<thread::task_pool> pool;
+            if (params.thread > 1) {
+                pool.reset(new thread::task_pool(params.thread));
+            }
+
+            extract_cutouts<Type>(vec1s{ffile, wfile}, plan, pool.get(), params.verbose,
+                [&](const cutout_t& c, const Type* const* cuts) {
+
                 // Discard any source that contains a bad pixel (either infinite or NaN)
-                if (!params.keep_nan && count(!is_finite(cut)) != 0) {
-                    continue;
+                if (!params.keep_nan && (!is_cutout_finite(cuts[0], npix) ||
+                    !is_cutout_finite(cuts[1], npix))) return;
+
+                uint_t k = slot.safe[c.src];
+                found.safe[k] = true;
+                std::copy(cuts[0], cuts[0] + npix, cube.data.begin() + (n0 + k)*npix);
+                std::copy(cuts[1], cuts[1] + npix, wcube.data.begin() + (n0 + k)*npix);
+            });
+
+            // Remove the sources that were not found
+            vec1u order = where(found);
+            const uint_t nfound = order.size();
+            append(order, where(!found));
+            for (auto* c : {&cube, &wcube}) {
+                permute_cutouts(*c, n0, order);
+                c->dims[0] = n0 + nfound;
+                c->resize();
+            }
+
+            order.resize(nfound);
+            append(ids, slot_src[order]);
+        }
+
+        // Same as 'stack_sections()', but instead of storing the cutouts in a cube, call
+        // 'func(src, s, flux)' once for each source that is found, with 's' the section where
+        // it was found. The IDs of these sources are appended to 'ids', in the same order as
+        // with 'stack_sections()'. Only the cutouts of the sources that are covered by several
+        // sections are kept in memory, if NaN pixels are kept (since they are then combined).
+        template<typename Type, typename F>
+        void stream_sections(const vec1s& sects, const std::vector<const vec1d*>& xs,
+            const std::vector<const vec1d*>& ys, const vec<1,long>& widths,
+            const vec<1,long>& heights, uint_t nsrc, uint_t hsize, vec1u& ids, vec1u& sect,
+            const astro::qstack_params& params, F&& func) {
+
+            const uint_t nsect = sects.size();
+            const long size = 2*hsize+1;
+            const uint_t npix = size*size;
+
+            std::vector<cutout_plan> plans(nsect);
+            vec1u ncover(nsrc);
+            for (uint_t s : range(nsect)) {
+                plans[s] = plan_cutouts(*xs[s], *ys[s], widths[s], heights[s], hsize,
+                    band_rows<Type>(widths[s], 1, params.buffer_size));
+
+                for (auto& c : plans[s].cuts) {
+                    ++ncover.safe[c.src];
+                }
+            }
+
+            vec1u slot = replicate(npos, nsrc);
+            uint_t nslot = 0;
+            if (params.keep_nan) {
+                for (uint_t i : range(nsrc)) {
+                    if (ncover.safe[i] > 1) slot.safe[i] = nslot++;
                 }
+            }
 
-                if (!found[i]) {
-                    // First time we find this source, add it to the output values
-                    found[i] = true;
+            std::vector<Type> buffer(nslot*npix);
+            vec1u found = replicate(npos, nsrc);
 
-                    ids.push_back(i);
-                    cube.push_back(cut);
+            std::unique_ptr<thread::task_pool> pool;
+            if (params.thread > 1) {
+                pool.reset(new thread::task_pool(params.thread));
+            }
 
-                    if (params.save_offsets) {
-                        out.dx.push_back(img.x[i] - round(img.x[i]));
-                        out.dy.push_back(img.y[i] - round(img.y[i]));
+            for (uint_t s : range(nsect)) {
+                extract_cutouts<Type>(vec1s{sects[s]}, plans[s], pool.get(), params.verbose,
+                    [&](const cutout_t& c, const Type* const* cuts) {
+
+                    uint_t k = slot.safe[c.src];
+                    if (k == npos) {
+                        // Discard any source that contains a bad pixel (either infinite or NaN),
+                        // or that was already found in a previous section
+                        if (found.safe[c.src] != npos) return;
+                        if (!params.keep_nan && !is_cutout_finite(cuts[0], npix)) return;
+
+                        found.safe[c.src] = s;
+                        func(c.src, s, cuts[0]);
+                    } else {
+                        Type* out = buffer.data() + k*npix;
+                        if (found.safe[c.src] == npos) {
+                            // First time we find this source
+                            found.safe[c.src] = s;
+                            std::copy(cuts[0], cuts[0] + npix, out);
+                        } else {
+                            // We already found this source in another section, combine the two
+                            for (uint_t i : range(npix)) {
+                                if (!is_finite(out[i])) out[i] = cuts[0][i];
+                            }
+                        }
                     }
+                });
+            }
+
+            // Pass on the combined cutouts
+            for (uint_t i : range(nsrc)) {
+                if (slot.safe[i] != npos && found.safe[i] != npos) {
+                    func(i, found.safe[i], const_cast<const Type*>(buffer.data() + slot.safe[i]*npix));
+                }
+            }
+
+            // Sort the sources by order of discovery
+            vec1u sid = where(found != npos);
+            std::stable_sort(sid.begin(), sid.end(), [&](uint_t i1, uint_t i2) {
+                return found.safe[i1] < found.safe[i2];
+            });
+
+            append(ids, sid);
+            sect = found[sid];
+        }
+
+        // Same as 'stack_pair()', but instead of storing the cutouts in cubes, call
+        // 'func(src, flux, weight)' once for each source that is fully covered.
+        template<typename Type, typename F>
+        void stream_pair(const std::string& ffile, const std::string& wfile, const vec1d& x,
+            const vec1d& y, long width, long height, uint_t hsize, vec1u& ids,
+            const astro::qstack_params& params, F&& func) {
+
+            const long size = 2*hsize+1;
+            const uint_t npix = size*size;
+
+            cutout_plan plan = plan_cutouts(x, y, width, height, hsize,
+                band_rows<Type>(width, 2, params.buffer_size), false);
 
-                    if (params.save_section) {
-                        out.sect.push_back(iimg);
+            std::unique_ptr<thread::task_pool> pool;
+            if (params.thread > 1) {
+                pool.reset(new thread::task_pool(params.thread));
+            }
+
+            vec1b found(x.size());
+            extract_cutouts<Type>(vec1s{ffile, wfile}, plan, pool.get(), params.verbose,
+                [&](const cutout_t& c, const Type* const* cuts) {
+
+                // Discard any source that contains a bad pixel (either infinite or NaN)
+                if (!params.keep_nan && (!is_cutout_finite(cuts[0], npix) ||
+                    !is_cutout_finite(cuts[1], npix))) return;
+
+                found.safe[c.src] = true;
+                func(c.src, cuts[0], cuts[1]);
+            });
+
+            append(ids, where(found));
+        }
+
+        // Open all the sections of an image ('.sectfits' files, or a single FITS image), and
+        // compute the pixel positions of the sources in each section
+        inline void open_sections(const std::string& filename, const vec1d& ra, const vec1d& dec,
+            vec1s& sects, std::vector<image_workspace>& imgs) {
+
+            vif_check(file::exists(filename), "cannot stack on inexistant file '"+filename+"'");
+            vif_check(ra.size() == dec.size(), "need ra.size() == dec.size()");
+
+            if (ends_with(filename, ".sectfits")) {
+                sects = fits::read_sectfits(filename);
+            } else {
+                sects.push_back(filename);
+            }
+
+            imgs.reserve(sects.size());
+            for (auto& s : sects) {
+                imgs.emplace_back(s, ra, dec);
+            }
+        }
+
+        // Open an image and its weight map, check that they match, and compute the pixel
+        // positions of the sources
+        inline void open_pair(const std::string& ffile, const std::string& wfile,
+            const vec1d& ra, const vec1d& dec, vec1d& x, vec1d& y, long& width, long& height) {
+
+            // Open the FITS file
+            fitsfile* fptr;
+            fitsfile* wfptr;
+            int status = 0;
+
+            fits_open_image(&fptr, ffile.c_str(), READONLY, &status);
+            fits::vif_check_cfitsio(status, "cannot open file '"+ffile+"'");
+            fits_open_image(&wfptr, wfile.c_str(), READONLY, &status);
+            fits::vif_check_cfitsio(status, "cannot open file '"+wfile+"'");
+
+            // Read the header as a string and read the WCS data
+            char* hstr = nullptr;
+            int nkeys  = 0;
+            fits_hdr2str(fptr, 0, nullptr, 0, &hstr, &nkeys, &status);
+            astro::wcs astro(hstr);
+            free(hstr);
+
+            // Get the dimensions of the image
+            int naxis = 0;
+            fits_get_img_dim(fptr, &naxis, &status);
+            vec<1,long> naxes(naxis);
+            fits_get_img_size(fptr, naxis, naxes.raw_data(), &status);
+            bool is2D = naxis == 2;
+            if (is2D) {
+                width = naxes[0];
+                height = naxes[1];
+            } else {
+                uint_t found = 0;
+                for (uint_t i : range(naxis)) {
+                    if (naxes[i] > 1) {
+                        if (found == 0) width = naxes[i];
+                        if (found == 1) height = naxes[i];
+                        ++found;
                     }
-                } else {
-                    // We already found this source in another image, combine the two
-                    uint_t id = where_last(ids == i);
-                    vec1u idb = where(!is_finite(cube(id,_,_)));
-                    cube(id,_,_)[idb] = cut[idb];
                 }
+
+                is2D = found == 2;
+            }
+
+            vif_check(is2D, "cannot stack on image cubes (image dimensions: ", naxes, ")");
+
+            vec<1,long> wnaxes(naxis);
+            fits_get_img_size(wfptr, naxis, wnaxes.raw_data(), &status);
+            vif_check(naxes[0] == wnaxes[0] && naxes[1] == wnaxes[1], "image and weight map do not match");
+
+            // Convert ra/dec to x/y
+            astro::ad2xy(astro, ra, dec, x, y);
+
+            fits_close_file(fptr, &status);
+            fits_close_file(wfptr, &status);
+        }
+
+        // Weight of a source in a bootstrap realization, drawn from a Poisson distribution of
+        // mean 'rate'. The random number only depends on the seed, the source and the
+        // realization, so the bootstrap does not depend on the order in which sources are added.
+        inline uint_t bootstrap_weight(std::uint64_t seed, uint_t id, uint_t b, double rate) {
+            auto mix = [](std::uint64_t h) {
+                // splitmix64 finalizer
+                h += 0x9e3779b97f4a7c15ull;
+                h = (h ^ (h >> 30))*0xbf58476d1ce4e5b9ull;
+                h = (h ^ (h >> 27))*0x94d049bb133111ebull;
+                return h ^ (h >> 31);
+            };
+
+            std::uint64_t h = mix(mix(seed ^ std::uint64_t(id)) ^ std::uint64_t(b));
+            double u = (h >> 11)/9007199254740992.0;
+
+            // Inverse of the cumulative distribution
+            double p = exp(-rate);
+            double f = p;
+            uint_t k = 0;
+            while (u > f && p > 0.0) {
+                ++k;
+                p *= rate/k;
+                f += p;
             }
+
+            return k;
+        }
+
+        // Set of reducers used by several threads: each thread of the task pool adds its
+        // cutouts to its own reducer, and the reducers are merged into the main one once the
+        // extraction is over, in order of thread index (so that the order of the merges does
+        // not depend on which thread finishes first). With a single thread, the main reducer
+        // is used directly; it is also used, under a lock, by threads that are not part of a
+        // task pool. Each reducer comes with scratch cutouts of (2*hsize+1)^2 pixels, allocated
+        // once, in which the pixels can be copied and transformed before they are added.
+        template<typename R, typename Type>
+        class reducer_pool {
+        public :
+            struct slot {
+                R* reducer = nullptr;
+                vec<2,Type> flux, weight;
+            };
+
+        private :
+            R& main_;
+            bool shared_;
+            uint_t size_;
+            std::mutex mutex_;
+            slot main_slot_;
+            std::vector<std::unique_ptr<R>> all_;
+            std::vector<std::unique_ptr<slot>> slots_;
+
+            void make_scratch_(slot& s) {
+                s.flux.resize(size_, size_);
+                s.weight.resize(size_, size_);
+            }
+
+        public :
+            reducer_pool(R& main, uint_t nthread) : main_(main), shared_(nthread <= 1),
+                size_(2*main.hsize()+1) {
+                main_slot_.reducer = &main_;
+                make_scratch_(main_slot_);
+
+                if (!shared_) {
+                    // One slot per thread, only ever accessed by that thread
+                    all_.resize(nthread);
+                    slots_.resize(nthread);
+                }
+            }
+
+            slot* acquire() {
+                if (shared_) return &main_slot_;
+
+                uint_t w = thread::task_pool::worker_index();
+                if (w >= slots_.size()) {
+                    mutex_.lock();
+                    return &main_slot_;
+                }
+
+                if (!slots_[w]) {
+                    all_[w].reset(new R(main_.empty_clone()));
+                    slots_[w].reset(new slot());
+                    slots_[w]->reducer = all_[w].get();
+                    make_scratch_(*slots_[w]);
+                }
+
+                return slots_[w].get();
+            }
+
+            void release(slot* s) {
+                if (!shared_ && s == &main_slot_) {
+                    mutex_.unlock();
+                }
+            }
+
+            void merge() {
+                for (auto& r : all_) {
+                    if (r) main_.merge(*r);
+                }
+
+                all_.clear();
+                slots_.clear();
+            }
+        };
+    }
+}
+
+namespace astro {
+    template<typename Type>
+    qstack_output qstack(const vec1d& ra, const vec1d& dec, const std::string& filename,
+        uint_t hsize, vec<3,Type>& cube, vec1u& ids, qstack_params params = qstack_params()) {
+
+        vec1s sects;
+        std::vector<impl::qstack_impl::image_workspace> imgs;
+        impl::qstack_impl::open_sections(filename, ra, dec, sects, imgs);
+
+        std::vector<const vec1d*> xs, ys;
+        vec<1,long> widths, heights;
+        for (auto& img : imgs) {
+            xs.push_back(&img.x);
+            ys.push_back(&img.y);
+            widths.push_back(img.width);
+            heights.push_back(img.height);
+        }
+
+        uint_t n0 = ids.size();
+        vec1u sect;
+        impl::qstack_impl::stack_sections(sects, xs, ys, widths, heights, ra.size(), hsize,
+            cube, ids, sect, params);
+
+        qstack_output out;
+        if (params.save_offsets) {
+            out.dx.resize(sect.size());
+            out.dy.resize(sect.size());
+            for (uint_t k : range(sect)) {
+                uint_t i = ids.safe[n0+k];
+                auto& img = imgs[sect.safe[k]];
+                out.dx.safe[k] = img.x.safe[i] - round(img.x.safe[i]);
+                out.dy.safe[k] = img.y.safe[i] - round(img.y.safe[i]);
+            }
+        }
+
+        if (params.save_section) {
+            out.sect = std::move(sect);
         }
 
         return out;
@@ -246,102 +883,19 @@ namespace astro {
             return out;
         }
 
-        // Open the FITS file
-        fitsfile* fptr;
-        fitsfile* wfptr;
-        int status = 0;
-
-        fits_open_image(&fptr, ffile.c_str(), READONLY, &status);
-        fits::vif_check_cfitsio(status, "cannot open file '"+ffile+"'");
-        fits_open_image(&wfptr, wfile.c_str(), READONLY, &status);
-        fits::vif_check_cfitsio(status, "cannot open file '"+wfile+"'");
-
-        // Read the header as a string and read the WCS data
-        char* hstr = nullptr;
-        int nkeys  = 0;
-        fits_hdr2str(fptr, 0, nullptr, 0, &hstr, &nkeys, &status);
-        astro::wcs astro(hstr);
-        free(hstr);
-
-        // Get the dimensions of the image
-        int naxis = 0;
-        fits_get_img_dim(fptr, &naxis, &status);
-        vec<1,long> naxes(naxis);
-        fits_get_img_size(fptr, naxis, naxes.raw_data(), &status);
-        bool is2D = naxis == 2;
-        long width, height;
-        if (is2D) {
-            width = naxes[0];
-            height = naxes[1];
-        } else {
-            uint_t found = 0;
-            for (uint_t i : range(naxis)) {
-                if (naxes[i] > 1) {
-                    if (found == 0) width = naxes[i];
-                    if (found == 1) height = naxes[i];
-                    ++found;
-                }
-            }
-
-            is2D = found == 2;
-        }
-
-        vif_check(is2D, "cannot stack on image cubes (image dimensions: ", naxes, ")");
-
-        vec<1,long> wnaxes(naxis);
-        fits_get_img_size(wfptr, naxis, wnaxes.raw_data(), &status);
-        vif_check(naxes[0] == wnaxes[0] && naxes[1] == wnaxes[1], "image and weight map do not match");
-
-        // Convert ra/dec to x/y
         vec1d x, y;
-        astro::ad2xy(astro, ra, dec, x, y);
-
-        // Allocate memory to hold all the cutouts
-        if (cube.empty()) {
-            cube.dims[1] = cube.dims[2] = 2*hsize+1;
-        }
-        if (wcube.empty()) {
-            wcube.dims[1] = wcube.dims[2] = 2*hsize+1;
-        }
-
-        cube.reserve(cube.size() + (2*hsize+1)*(2*hsize+1)*ra.size());
-        wcube.reserve(wcube.size() + (2*hsize+1)*(2*hsize+1)*ra.size());
-        ids.reserve(ids.size() + ra.size());
-
-        // Loop over all sources
-        for (uint_t i = 0; i < ra.size(); ++i) {
-            long p0[2] = {long(round(x[i]-hsize)), long(round(y[i]-hsize))};
-            long p1[2] = {long(round(x[i]+hsize)), long(round(y[i]+hsize))};
-
-            // Discard any source that falls out of the boundaries of the image
-            if (p0[0] < 1 || p1[0] >= width || p0[1] < 1 || p1[1] >= height) {
-                continue;
-            }
-
-            vec<2,Type> cut(2*hsize+1, 2*hsize+1);
-            vec<2,Type> wcut(2*hsize+1, 2*hsize+1);
-
-            Type null = fnan;
-            int anynul = 0;
-            long inc[2] = {1, 1};
-
-            fits_read_subset(fptr,  impl::fits_impl::traits<Type>::ttype, p0, p1, inc, &null,
-                cut.raw_data(),  &anynul, &status);
-            fits_read_subset(wfptr, impl::fits_impl::traits<Type>::ttype, p0, p1, inc, &null,
-                wcut.raw_data(), &anynul, &status);
-
-            // Discard any source that contains a bad pixel (either infinite or NaN)
-            if (!params.keep_nan && count(!is_finite(cut) || !is_finite(wcut)) != 0) {
-                continue;
-            }
+        long width, height;
+        impl::qstack_impl::open_pair(ffile, wfile, ra, dec, x, y, width, height);
 
-            ids.push_back(i);
-            cube.push_back(cut);
-            wcube.push_back(wcut);
+        uint_t n0 = ids.size();
+        impl::qstack_impl::stack_pair(ffile, wfile, x, y, width, height, hsize, cube, wcube,
+            ids, params);
 
+        for (uint_t k = n0; k < ids.size(); ++k) {
+            uint_t i = ids.safe[k];
             if (params.save_offsets) {
-                out.dx.push_back(x[i] - round(x[i]));
-                out.dy.push_back(y[i] - round(y[i]));
+                out.dx.push_back(x.safe[i] - round(x.safe[i]));
+                out.dy.push_back(y.safe[i] - round(y.safe[i]));
             }
 
             if (params.save_section) {
@@ -349,9 +903,6 @@ namespace astro {
             }
         }
 
-        fits_close_file(fptr, &status);
-        fits_close_file(wfptr, &status);
-
         return out;
     }
 
@@ -459,6 +1010,461 @@ namespace astro {
 
         return bs;
     }
+
+    // Streaming mean stacking.
+    // Cutouts are added one at a time, with optional pixel weights, and only the running
+    // statistics of each pixel are kept in memory: the weighted mean and variance are updated
+    // with Welford's algorithm. Non-finite pixels, and pixels with a weight that is not strictly
+    // positive, are ignored. This differs from 'qstack_mean(fcube, wcube)', where such pixels
+    // are included in the sums (a NaN pixel gives a NaN mean, and a negative weight reduces
+    // the total weight): the two only agree on cubes of finite pixels with weights >= 0.
+    // Bootstrap realizations are computed at the same time, by giving each cutout a random
+    // weight drawn from a Poisson distribution of mean 'bstrap_rate' (the average fraction of
+    // the sample that goes into each realization). This weight only depends on the source ID
+    // and on 'seed', so the result does not depend on the order in which the cutouts are
+    // added. The reducer is not thread-safe: use 'empty_clone()' to
+    // create one reducer per thread, and 'merge()' to combine them at the end.
+    class qstack_mean_reducer {
+        uint_t hsize_ = 0;
+        uint_t npix_ = 0;
+        uint_t nbstrap_ = 0;
+        double bstrap_rate_ = 0.5;
+        std::uint64_t seed_ = 42;
+        uint_t count_ = 0;
+
+        // Sum of weights, weighted mean and weighted sum of squared deviations of each pixel
+        std::vector<double> weight_, mean_, m2_;
+        // Sum of weights and weighted sum of each pixel in each bootstrap realization
+        std::vector<double> bs_weight_, bs_total_;
+
+        void check_dims_(const std::array<uint_t,2>& dims) const {
+            uint_t size = 2*hsize_+1;
+            vif_check(dims[0] == size && dims[1] == size, "cutout has wrong dimensions (expected ",
+                size, "x", size, ", got ", dims[0], "x", dims[1], ")");
+        }
+
+    public :
+
+        explicit qstack_mean_reducer(uint_t hsize, uint_t nbstrap = 0, double bstrap_rate = 0.5,
+            std::uint64_t seed = 42) : hsize_(hsize), npix_((2*hsize+1)*(2*hsize+1)),
+            nbstrap_(nbstrap), bstrap_rate_(bstrap_rate), seed_(seed),
+            weight_(npix_), mean_(npix_), m2_(npix_), bs_weight_(nbstrap*npix_),
+            bs_total_(nbstrap*npix_) {
+
+            vif_check(bstrap_rate > 0, "bootstrap rate must be strictly positive (got ",
+                bstrap_rate, ")");
+        }
+
+        // Create a reducer with the same configuration, but without any cutout
+        qstack_mean_reducer empty_clone() const {
+            return qstack_mean_reducer(hsize_, nbstrap_, bstrap_rate_, seed_);
+        }
+
+        uint_t hsize() const {
+            return hsize_;
+        }
+
+        // Add the cutout of source 'id' (an array of (2*hsize+1)^2 pixels), with optional
+        // pixel weights (can be null)
+        template<typename TypeF, typename TypeW>
+        void add(uint_t id, const TypeF* flux, const TypeW* weight) {
+            ++count_;
+
+            for (uint_t i = 0; i < npix_; ++i) {
+                double f = flux[i];
+                double w = (weight ? double(weight[i]) : 1.0);
+                if (!is_finite(f) || !is_finite(w) || w <= 0.0) continue;
+
+                weight_[i] += w;
+                double d = f - mean_[i];
+                mean_[i] += d*w/weight_[i];
+                m2_[i] += w*d*(f - mean_[i]);
+            }
+
+            for (uint_t b = 0; b < nbstrap_; ++b) {
+                uint_t k = impl::qstack_impl::bootstrap_weight(seed_, id, b, bstrap_rate_);
+                if (k == 0) continue;
+
+                double* totw = bs_weight_.data() + b*npix_;
+                double* tot = bs_total_.data() + b*npix_;
+                for (uint_t i = 0; i < npix_; ++i) {
+                    double f = flux[i];
+                    double w = (weight ? double(weight[i]) : 1.0);
+                    if (!is_finite(f) || !is_finite(w) || w <= 0.0) continue;
+
+                    totw[i] += k*w;
+                    tot[i] += k*w*f;
+                }
+            }
+        }
+
+        template<typename TypeF>
+        void add(uint_t id, const TypeF* flux) {
+            add(id, flux, static_cast<const TypeF*>(nullptr));
+        }
+
+        template<typename TypeF>
+        void add(uint_t id, const vec<2,TypeF>& flux) {
+            check_dims_(flux.dims);
+            add(id, flux.concretise().raw_data());
+        }
+
+        template<typename TypeF, typename TypeW>
+        void add(uint_t id, const vec<2,TypeF>& flux, const vec<2,TypeW>& weight) {
+            check_dims_(flux.dims);
+            check_dims_(weight.dims);
+            add(id, flux.concretise().raw_data(), weight.concretise().raw_data());
+        }
+
+        // Combine the cutouts of another reducer into this one
+        void merge(const qstack_mean_reducer& r) {
+            vif_check(r.hsize_ == hsize_ && r.nbstrap_ == nbstrap_, "cannot merge reducers "
+                "with different configurations");
+
+            count_ += r.count_;
+            for (uint_t i = 0; i < npix_; ++i) {
+                double w = weight_[i] + r.weight_[i];
+                if (w == 0.0) continue;
+
+                double d = r.mean_[i] - mean_[i];
+                m2_[i] += r.m2_[i] + d*d*weight_[i]*r.weight_[i]/w;
+                mean_[i] += d*r.weight_[i]/w;
+                weight_[i] = w;
+            }
+
+            for (uint_t i : range(bs_total_)) {
+                bs_weight_[i] += r.bs_weight_[i];
+                bs_total_[i] += r.bs_total_[i];
+            }
+        }
+
+        // Number of cutouts added so far
+        uint_t count() const {
+            return count_;
+        }
+
+        // Weighted mean of each pixel (NaN if no valid value)
+        vec2d mean() const {
+            vec2d r(2*hsize_+1, 2*hsize_+1);
+            for (uint_t i = 0; i < npix_; ++i) {
+                r.safe[i] = (weight_[i] > 0.0 ? mean_[i] : dnan);
+            }
+
+            return r;
+        }
+
+        // Weighted variance of each pixel among the cutouts (NaN if no valid value)
+        vec2d variance() const {
+            vec2d r(2*hsize_+1, 2*hsize_+1);
+            for (uint_t i = 0; i < npix_; ++i) {
+                r.safe[i] = (weight_[i] > 0.0 ? m2_[i]/weight_[i] : dnan);
+            }
+
+            return r;
+        }
+
+        // Sum of the weights of each pixel
+        vec2d weight() const {
+            vec2d r(2*hsize_+1, 2*hsize_+1);
+            std::copy(weight_.begin(), weight_.end(), r.data.begin());
+            return r;
+        }
+
+        // Weighted mean of each bootstrap realization, as a cube (same as
+        // 'qstack_mean_bootstrap()')
+        vec3d bootstrap() const {
+            vec3d r(nbstrap_, 2*hsize_+1, 2*hsize_+1);
+            for (uint_t i : range(r)) {
+                r.safe[i] = (bs_weight_[i] > 0.0 ? bs_total_[i]/bs_weight_[i] : dnan);
+            }
+
+            return r;
+        }
+    };
+
+    // Streaming median stacking.
+    // The values of each pixel are summarized with a 'quantile_sketch', so the median is
+    // approximate, but the memory usage does not depend on the number of cutouts. Larger
+    // values of 'compression' give more accurate results, at the expense of memory (about
+    // 200*compression bytes per pixel). Non-finite pixels are ignored. Like
+    // 'qstack_mean_reducer', the reducer is not thread-safe. The sketches depend on the order
+    // in which the values are added and merged: 'qstack_reduce()' merges the per-thread
+    // reducers in order of thread index, but which thread reads which cutout depends on the
+    // scheduling, so the approximate median can still vary slightly between multi-threaded
+    // runs. Use a single thread for reproducible results.
+    class qstack_median_reducer {
+        uint_t hsize_ = 0;
+        uint_t npix_ = 0;
+        double compression_ = 50.0;
+        uint_t count_ = 0;
+        std::vector<quantile_sketch> sketches_;
+
+        void check_dims_(const std::array<uint_t,2>& dims) const {
+            uint_t size = 2*hsize_+1;
+            vif_check(dims[0] == size && dims[1] == size, "cutout has wrong dimensions (expected ",
+                size, "x", size, ", got ", dims[0], "x", dims[1], ")");
+        }
+
+    public :
+
+        explicit qstack_median_reducer(uint_t hsize, double compression = 50.0) :
+            hsize_(hsize), npix_((2*hsize+1)*(2*hsize+1)), compression_(compression),
+            sketches_(npix_, quantile_sketch(compression)) {}
+
+        qstack_median_reducer empty_clone() const {
+            return qstack_median_reducer(hsize_, compression_);
+        }
+
+        uint_t hsize() const {
+            return hsize_;
+        }
+
+        // Add the cutout of source 'id' (an array of (2*hsize+1)^2 pixels), with optional
+        // pixel weights (can be null)
+        template<typename TypeF, typename TypeW>
+        void add(uint_t id, const TypeF* flux, const TypeW* weight) {
+            ++count_;
+
+            for (uint_t i = 0; i < npix_; ++i) {
+                double f = flux[i];
+                double w = (weight ? double(weight[i]) : 1.0);
+                if (!is_finite(f) || !is_finite(w)) continue;
+
+                sketches_[i].add(f, w);
+            }
+        }
+
+        template<typename TypeF>
+        void add(uint_t id, const TypeF* flux) {
+            add(id, flux, static_cast<const TypeF*>(nullptr));
+        }
+
+        template<typename TypeF>
+        void add(uint_t id, const vec<2,TypeF>& flux) {
+            check_dims_(flux.dims);
+            add(id, flux.concretise().raw_data());
+        }
+
+        template<typename TypeF, typename TypeW>
+        void add(uint_t id, const vec<2,TypeF>& flux, const vec<2,TypeW>& weight) {
+            check_dims_(flux.dims);
+            check_dims_(weight.dims);
+            add(id, flux.concretise().raw_data(), weight.concretise().raw_data());
+        }
+
+        void merge(const qstack_median_reducer& r) {
+            vif_check(r.hsize_ == hsize_, "cannot merge reducers with different configurations");
+
+            count_ += r.count_;
+            for (uint_t i = 0; i < npix_; ++i) {
+                sketches_[i].merge(r.sketches_[i]);
+            }
+        }
+
+        uint_t count() const {
+            return count_;
+        }
+
+        // Estimate of the value of each pixel below which lie a fraction 'p' of the cutouts
+        vec2d quantile(double p) const {
+            vec2d r(2*hsize_+1, 2*hsize_+1);
+            for (uint_t i = 0; i < npix_; ++i) {
+                r.safe[i] = sketches_[i].quantile(p);
+            }
+
+            return r;
+        }
+
+        vec2d median() const {
+            return quantile(0.5);
+        }
+    };
+
+    // Information about a cutout, given to the streaming stacking functions
+    struct qstack_cutout {
+        uint_t id = npos;  // index of the source in the input catalog
+        uint_t sect = 0;   // section of the image where the source was found
+        double dx = 0.0;   // sub-pixel offset of the source from the central pixel
+        double dy = 0.0;
+    };
+
+    // Streaming stacking.
+    // Extract the cutouts like 'qstack()', but instead of storing them into a cube, call
+    // 'func(c, flux)' for each source, with 'flux' pointing to the (2*hsize+1)^2 pixels of the
+    // cutout. The memory usage does not depend on the number of sources. The function is
+    // called exactly once for each source, and the IDs of these sources are appended to 'ids'
+    // in the same order as with 'qstack()'. If several threads are used, 'func' can be called
+    // concurrently for different sources.
+    template<typename Type = float, typename F>
+    qstack_output qstack_stream(const vec1d& ra, const vec1d& dec, const std::string& filename,
+        uint_t hsize, vec1u& ids, F&& func, qstack_params params = qstack_params()) {
+
+        vec1s sects;
+        std::vector<impl::qstack_impl::image_workspace> imgs;
+        impl::qstack_impl::open_sections(filename, ra, dec, sects, imgs);
+
+        std::vector<const vec1d*> xs, ys;
+        vec<1,long> widths, heights;
+        for (auto& img : imgs) {
+            xs.push_back(&img.x);
+            ys.push_back(&img.y);
+            widths.push_back(img.width);
+            heights.push_back(img.height);
+        }
+
+        auto make_cutout = [&](uint_t i, uint_t s) {
+            qstack_cutout c;
+            c.id = i;
+            c.sect = s;
+            c.dx = imgs[s].x.safe[i] - round(imgs[s].x.safe[i]);
+            c.dy = imgs[s].y.safe[i] - round(imgs[s].y.safe[i]);
+            return c;
+        };
+
+        uint_t n0 = ids.size();
+        vec1u sect;
+        impl::qstack_impl::stream_sections<Type>(sects, xs, ys, widths, heights, ra.size(), hsize,
+            ids, sect, params, [&](uint_t i, uint_t s, const Type* flux) {
+                func(make_cutout(i, s), flux);
+            });
+
+        qstack_output out;
+        if (params.save_offsets) {
+            out.dx.resize(sect.size());
+            out.dy.resize(sect.size());
+            for (uint_t k : range(sect)) {
+                qstack_cutout c = make_cutout(ids.safe[n0+k], sect.safe[k]);
+                out.dx.safe[k] = c.dx;
+                out.dy.safe[k] = c.dy;
+            }
+        }
+
+        if (params.save_section) {
+            out.sect = std::move(sect);
+        }
+
+        return out;
+    }
+
+    // Streaming stacking with a weight map, calling 'func(c, flux, weight)' for each source
+    // that is fully covered (see above). '.sectfits' files are not supported.
+    template<typename Type = float, typename F>
+    qstack_output qstack_stream(const vec1d& ra, const vec1d& dec, const std::string& ffile,
+        const std::string& wfile, uint_t hsize, vec1u& ids, F&& func,
+        qstack_params params = qstack_params()) {
+
+        vif_check(file::exists(ffile), "cannot stack on inexistant file '"+ffile+"'");
+        vif_check(file::exists(wfile), "cannot stack on inexistant file '"+wfile+"'");
+        vif_check(ra.size() == dec.size(), "need ra.size() == dec.size()");
+        vif_check(!ends_with(ffile, ".sectfits") && !ends_with(wfile, ".sectfits"),
+            "streaming stacking with a weight map does not support '.sectfits' files");
+
+        vec1d x, y;
+        long width, height;
+        impl::qstack_impl::open_pair(ffile, wfile, ra, dec, x, y, width, height);
+
+        auto make_cutout = [&](uint_t i) {
+            qstack_cutout c;
+            c.id = i;
+            c.dx = x.safe[i] - round(x.safe[i]);
+            c.dy = y.safe[i] - round(y.safe[i]);
+            return c;
+        };
+
+        uint_t n0 = ids.size();
+        impl::qstack_impl::stream_pair<Type>(ffile, wfile, x, y, width, height, hsize, ids, params,
+            [&](uint_t i, const Type* flux, const Type* weight) {
+                func(make_cutout(i), flux, weight);
+            });
+
+        qstack_output out;
+        uint_t nfound = ids.size() - n0;
+        if (params.save_offsets) {
+            out.dx.resize(nfound);
+            out.dy.resize(nfound);
+            for (uint_t k : range(nfound)) {
+                qstack_cutout c = make_cutout(ids.safe[n0+k]);
+                out.dx.safe[k] = c.dx;
+                out.dy.safe[k] = c.dy;
+            }
+        }
+
+        if (params.save_section) {
+            out.sect = replicate(0u, nfound);
+        }
+
+        return out;
+    }
+
+    // Streaming stacking into a reducer (e.g., 'qstack_mean_reducer' or
+    // 'qstack_median_reducer'), without ever storing all the cutouts in memory. If provided,
+    // 'transform(c, flux)' is applied to each cutout before it is added to the reducer (e.g.,
+    // to correct for the sub-pixel offset of the source). If several threads are used, each
+    // thread adds cutouts to its own copy of the reducer, and the copies are merged at the end.
+    template<typename Type = float, typename R, typename T>
+    qstack_output qstack_reduce(const vec1d& ra, const vec1d& dec, const std::string& filename,
+        uint_t hsize, R& reducer, vec1u& ids, T&& transform, qstack_params params = qstack_params()) {
+
+        vif_check(reducer.hsize() == hsize, "reducer was created for cutouts of half size ",
+            reducer.hsize(), ", not ", hsize);
+
+        impl::qstack_impl::reducer_pool<R,Type> reducers(reducer, params.thread);
+        qstack_output out = qstack_stream<Type>(ra, dec, filename, hsize, ids,
+            [&](const qstack_cutout& c, const Type* flux) {
+                auto* s = reducers.acquire();
+                std::copy(flux, flux + s->flux.size(), s->flux.data.begin());
+                transform(c, s->flux);
+                s->reducer->add(c.id, s->flux);
+                reducers.release(s);
+            }, params);
+
+        reducers.merge();
+
+        return out;
+    }
+
+    template<typename Type = float, typename R>
+    qstack_output qstack_reduce(const vec1d& ra, const vec1d& dec, const std::string& filename,
+        uint_t hsize, R& reducer, vec1u& ids, qstack_params params = qstack_params()) {
+
+        return qstack_reduce<Type>(ra, dec, filename, hsize, reducer, ids,
+            [](const qstack_cutout&, vec<2,Type>&) {}, params);
+    }
+
+    // Same as above, with a weight map. If provided, 'transform(c, flux, weight)' is applied to
+    // each pair of cutouts before they are added to the reducer.
+    template<typename Type = float, typename R, typename T>
+    qstack_output qstack_reduce(const vec1d& ra, const vec1d& dec, const std::string& ffile,
+        const std::string& wfile, uint_t hsize, R& reducer, vec1u& ids, T&& transform,
+        qstack_params params = qstack_params()) {
+
+        vif_check(reducer.hsize() == hsize, "reducer was created for cutouts of half size ",
+            reducer.hsize(), ", not ", hsize);
+
+        impl::qstack_impl::reducer_pool<R,Type> reducers(reducer, params.thread);
+        qstack_output out = qstack_stream<Type>(ra, dec, ffile, wfile, hsize, ids,
+            [&](const qstack_cutout& c, const Type* flux, const Type* weight) {
+                auto* s = reducers.acquire();
+                std::copy(flux, flux + s->flux.size(), s->flux.data.begin());
+                std::copy(weight, weight + s->weight.size(), s->weight.data.begin());
+                transform(c, s->flux, s->weight);
+                s->reducer->add(c.id, s->flux, s->weight);
+                reducers.release(s);
+            }, params);
+
+        reducers.merge();
+
+        return out;
+    }
+
+    template<typename Type = float, typename R>
+    qstack_output qstack_reduce(const vec1d& ra, const vec1d& dec, const std::string& ffile,
+        const std::string& wfile, uint_t hsize, R& reducer, vec1u& ids,
+        qstack_params params = qstack_params()) {
+
+        return qstack_reduce<Type>(ra, dec, ffile, wfile, hsize, reducer, ids,
+            [](const qstack_cutout&, vec<2,Type>&, vec<2,Type>&) {}, params);
+    }
 }
 }
 
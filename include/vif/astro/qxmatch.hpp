@@ -2,6 +2,7 @@
 #define VIF_ASTRO_QXMATCH_HPP
 
 #include "vif/astro/astro.hpp"
+#include "vif/astro/sky_index.hpp"
 
 namespace vif {
 namespace astro {
@@ -28,6 +29,25 @@ namespace astro {
     }
     #endif
 
+    // Result of a radius cross-match, in compressed sparse row format: the counterparts of
+    // the i-th position of the first catalog are 'id[start[i]]' to 'id[start[i+1]-1]', at
+    // distances 'd' (in arcsec), sorted by increasing distance. 'start' has one more
+    // element than the first catalog.
+    struct qxmatch_radius_res {
+        vec1u start;
+        vec1u id;
+        vec1d d;
+
+        // Number of counterparts of the i-th position of the first catalog
+        uint_t count(uint_t i) const {
+            return start.safe[i+1] - start.safe[i];
+        }
+
+        // Reflection data
+        MEMBERS1(start, id, d);
+        MEMBERS2("qxmatch_radius_res", MAKE_MEMBER(start), MAKE_MEMBER(id), MAKE_MEMBER(d));
+    };
+
     struct qxmatch_params {
         uint_t thread = 1u;
         uint_t nth = 1u;
@@ -41,6 +61,134 @@ namespace astro {
 
 namespace impl {
     namespace qxmatch_impl {
+        // Call 'func(i0,i1)' on chunks of [0,n), using 'nthread' threads, and show the
+        // progress if 'verbose' is set
+        template<typename F>
+        void run_chunks(uint_t n, uint_t nthread, bool verbose, F&& func) {
+            auto p = progress_start(n);
+            if (nthread <= 1) {
+                const uint_t chunk = 256;
+                for (uint_t i0 = 0; i0 < n; i0 += chunk) {
+                    uint_t i1 = std::min(i0 + chunk, n);
+                    func(i0, i1);
+                    if (verbose) print_progress(p, i1);
+                }
+            } else {
+                std::atomic<uint_t> iter(0);
+                thread::task_pool pool(nthread);
+                pool.execute_chunks([&](uint_t i0, uint_t i1) {
+                    func(i0, i1);
+                    iter += i1 - i0;
+                }, 0, n, 0, [&]() {
+                    if (verbose) print_progress(p, iter);
+                }, 0.2);
+
+                if (verbose) print_progress(p, n);
+            }
+        }
+
+        // Find the 'nth' nearest neighbors in 'index2' of each position of the first
+        // catalog, and store them in 'res.id' and 'res.d'. The distance is stored as a
+        // proxy: the squared sine of half the angular distance.
+        template<typename TypeR, typename TypeD>
+        void sky_nearest(const vec<1,TypeR>& ra1, const vec<1,TypeD>& dec1,
+            const astro::sky_index& index2, uint_t nth, const astro::qxmatch_params& params,
+            astro::qxmatch_res& res) {
+
+            run_chunks(ra1.size(), params.thread, params.verbose, [&](uint_t i0, uint_t i1) {
+                astro::sky_index::workspace w;
+                std::vector<uint_t> tid(nth);
+                std::vector<double> td(nth);
+                for (uint_t i = i0; i < i1; ++i) {
+                    index2.nearest_chord2(sky_index_impl::radec_to_point(ra1.safe[i], dec1.safe[i]),
+                        nth, tid.data(), td.data(), w, params.self ? i : npos);
+
+                    for (uint_t k : range(nth)) {
+                        res.id.safe(k,i) = tid[k];
+                        res.d.safe(k,i) = 0.25*td[k];
+                    }
+                }
+            });
+        }
+
+        // Find the nearest neighbor in the first catalog of each of the 'n2' positions of
+        // the second catalog, and store them in 'res.rid' and 'res.rd' (same proxy as above).
+        // The positions are obtained from 'get(j, p, id)', which must set the point 'p' and
+        // its index 'id' in the second catalog.
+        template<typename TypeR, typename TypeD, typename F>
+        void sky_mirror(const vec<1,TypeR>& ra1, const vec<1,TypeD>& dec1, uint_t n2,
+            const astro::qxmatch_params& params, astro::qxmatch_res& res, F&& get) {
+
+            astro::sky_index index1(ra1, dec1, params.thread);
+
+            run_chunks(n2, params.thread, params.verbose, [&](uint_t j0, uint_t j1) {
+                astro::sky_index::workspace w;
+                sky_index_impl::point p;
+                uint_t id, tid;
+                double td;
+                for (uint_t j = j0; j < j1; ++j) {
+                    get(j, p, id);
+                    index1.nearest_chord2(p, 1, &tid, &td, w);
+                    res.rid.safe[id] = tid;
+                    res.rd.safe[id] = 0.25*td;
+                }
+            });
+        }
+
+        // Find all the positions in 'index2' within a squared chord 'r2' of each position
+        // of the first catalog, and store them in 'res'. For self matches, the positions
+        // of the first catalog are assumed to start at 'offset' in the index.
+        template<typename TypeR, typename TypeD>
+        void sky_within(const vec<1,TypeR>& ra1, const vec<1,TypeD>& dec1,
+            const astro::sky_index& index2, double r2, const astro::qxmatch_params& params,
+            uint_t offset, astro::qxmatch_radius_res& res) {
+
+            const uint_t n1 = ra1.size();
+            res.start = vec1u(n1+1);
+
+            // Each chunk stores its counterparts in its own buffer, and they are gathered in
+            // order at the end
+            struct chunk_t {
+                uint_t i0;
+                std::vector<uint_t> id;
+                std::vector<double> d;
+            };
+
+            std::vector<chunk_t> chunks;
+            std::mutex mutex;
+
+            run_chunks(n1, params.thread, params.verbose, [&](uint_t i0, uint_t i1) {
+                astro::sky_index::workspace w;
+                chunk_t c;
+                c.i0 = i0;
+                for (uint_t i = i0; i < i1; ++i) {
+                    index2.within_chord2(sky_index_impl::radec_to_point(ra1.safe[i], dec1.safe[i]),
+                        r2, w, params.self ? i + offset : npos);
+
+                    res.start.safe[i+1] = w.best.size();
+                    for (auto& b : w.best) {
+                        c.id.push_back(b.id);
+                        c.d.push_back(sky_index_impl::chord2_to_arcsec(b.d));
+                    }
+                }
+
+                std::lock_guard<std::mutex> lock(mutex);
+                chunks.push_back(std::move(c));
+            });
+
+            // Convert the number of counterparts into offsets
+            for (uint_t i : range(n1)) {
+                res.start.safe[i+1] += res.start.safe[i];
+            }
+
+            res.id.resize(res.start.safe[n1]);
+            res.d.resize(res.start.safe[n1]);
+            for (auto& c : chunks) {
+                std::copy(c.id.begin(), c.id.end(), res.id.data.begin() + res.start.safe[c.i0]);
+                std::copy(c.d.begin(), c.d.end(), res.d.data.begin() + res.start.safe[c.i0]);
+            }
+        }
+
         struct depth_cache {
             struct depth_t {
                 vec1i bx, by;
@@ -126,6 +274,18 @@ namespace impl {
                 append(depth.by, -depth.by[idnew]);
             }
         };
+
+        #ifndef NO_CFITSIO
+        // Closes a cfitsio file when going out of scope, also when an exception is thrown
+        struct fits_file_closer {
+            void operator() (fitsfile* fptr) const {
+                int status = 0;
+                fits_close_file(fptr, &status);
+            }
+        };
+
+        using fits_file_ptr = std::unique_ptr<fitsfile, fits_file_closer>;
+        #endif
     }
 }
 
@@ -227,7 +387,27 @@ namespace astro {
             params.brute_force = false;
         }
 
-        if (!params.brute_force) {
+        if (!params.brute_force && !params.linear) {
+            // Sort the sources of each catalog on a hierarchical mesh of the sky, then find
+            // the nearest neighbors with a best-first search in this mesh.
+            astro::sky_index index2(ra2, dec2, params.thread);
+
+            if (n2 < nth) {
+                // We asked more neighbors than there are sources in the second catalog...
+                nth = n2;
+            }
+
+            impl::qxmatch_impl::sky_nearest(ra1, dec1, index2, nth, params, res);
+
+            if (!params.self && !params.no_mirror) {
+                impl::qxmatch_impl::sky_mirror(ra1, dec1, n2, params, res,
+                    [&](uint_t j, impl::sky_index_impl::point& p, uint_t& id) {
+                    p = impl::sky_index_impl::radec_to_point(ra2.safe[j], dec2.safe[j]);
+                    id = j;
+                });
+            }
+        } else if (!params.brute_force) {
+            // Linear coordinates: use a regular grid of buckets
             // Get bounds of the fields
             vec1d rra1  = {min(ra1),  max(ra1)};
             vec1d rra2  = {min(ra2),  max(ra2)};
@@ -615,6 +795,64 @@ namespace astro {
         return res;
     }
 
+    // Same as above, but the second catalog is given as a spatial index, which can be
+    // built once and reused for multiple cross-matches (or saved to the disk). Only
+    // spherical coordinates are supported, and the 'brute_force' and 'linear' options
+    // are ignored.
+    template<typename TypeR1, typename TypeD1>
+    qxmatch_res qxmatch(const vec<1,TypeR1>& ra1, const vec<1,TypeD1>& dec1,
+        const sky_index& index2, qxmatch_params params = qxmatch_params{}) {
+
+        qxmatch_res res;
+
+        vif_check(ra1.dims == dec1.dims, "first RA and Dec dimensions do not match (",
+            ra1.dims, " vs ", dec1.dims, ")");
+        vif_check(count(!is_finite(ra1) || !is_finite(dec1)) == 0,
+            "first RA and Dec coordinates contain invalid values (infinite or NaN)");
+
+        const uint_t n1 = ra1.size();
+        const uint_t n2 = index2.size();
+        uint_t nth = clamp(params.nth, 1u, npos);
+
+        res.id = replicate(npos, nth, n1);
+        res.d  = replicate(dinf, nth, n1);
+
+        if (!params.no_mirror) {
+            res.rid = replicate(npos, n2);
+            res.rd  = replicate(dinf, n2);
+        }
+
+        if (n1 == 0 || n2 == 0) {
+            return res;
+        }
+
+        if (n2 < nth) {
+            nth = n2;
+        }
+
+        impl::qxmatch_impl::sky_nearest(ra1, dec1, index2, nth, params, res);
+
+        if (!params.self && !params.no_mirror) {
+            impl::qxmatch_impl::sky_mirror(ra1, dec1, n2, params, res,
+                [&](uint_t j, impl::sky_index_impl::point& p, uint_t& id) {
+                p = index2.position(j);
+                id = index2.id(j);
+            });
+        }
+
+        // Convert the distance estimator to a real distance
+        auto proxy_to_true = vectorize_lambda([](double dist) {
+            return 3600.0*(180.0/dpi)*2*asin(sqrt(dist));
+        });
+
+        res.d = proxy_to_true(res.d);
+        if (!params.no_mirror) {
+            res.rd = proxy_to_true(res.rd);
+        }
+
+        return res;
+    }
+
     template<typename C1, typename C2,
         typename enable = typename std::enable_if<!meta::is_vec<C1>::value>::type>
     qxmatch_res qxmatch(const C1& cat1, const C2& cat2, qxmatch_params params = qxmatch_params{}) {
@@ -633,6 +871,182 @@ namespace astro {
         return qxmatch(ra1, dec1, ra1, dec1, params);
     }
 
+    // Find all the positions of the second catalog (given as a spatial index) within
+    // 'radius' (in arcsec) of each position of the first catalog. Only spherical
+    // coordinates are supported; the 'nth', 'brute_force', 'no_mirror' and 'linear' options
+    // are ignored.
+    template<typename TypeR1, typename TypeD1>
+    qxmatch_radius_res qxmatch_radius(const vec<1,TypeR1>& ra1, const vec<1,TypeD1>& dec1,
+        const sky_index& index2, double radius, qxmatch_params params = qxmatch_params{}) {
+
+        vif_check(ra1.dims == dec1.dims, "first RA and Dec dimensions do not match (",
+            ra1.dims, " vs ", dec1.dims, ")");
+        vif_check(count(!is_finite(ra1) || !is_finite(dec1)) == 0,
+            "first RA and Dec coordinates contain invalid values (infinite or NaN)");
+        vif_check(radius >= 0, "search radius must be positive (got ", radius, ")");
+
+        qxmatch_radius_res res;
+        impl::qxmatch_impl::sky_within(ra1, dec1, index2,
+            impl::sky_index_impl::arcsec_to_chord2(radius), params, 0, res);
+
+        return res;
+    }
+
+    template<typename TypeR1, typename TypeD1, typename TypeR2, typename TypeD2>
+    qxmatch_radius_res qxmatch_radius(const vec<1,TypeR1>& ra1, const vec<1,TypeD1>& dec1,
+        const vec<1,TypeR2>& ra2, const vec<1,TypeD2>& dec2, double radius,
+        qxmatch_params params = qxmatch_params{}) {
+
+        vif_check(ra2.dims == dec2.dims, "second RA and Dec dimensions do not match (",
+            ra2.dims, " vs ", dec2.dims, ")");
+        vif_check(count(!is_finite(ra2) || !is_finite(dec2)) == 0,
+            "second RA and Dec coordinates contain invalid values (infinite or NaN)");
+
+        return qxmatch_radius(ra1, dec1, sky_index(ra2, dec2, params.thread), radius, params);
+    }
+
+    template<typename TypeR1, typename TypeD1>
+    qxmatch_radius_res qxmatch_radius(const vec<1,TypeR1>& ra1, const vec<1,TypeD1>& dec1,
+        double radius, qxmatch_params params = qxmatch_params{}) {
+        params.self = true;
+        return qxmatch_radius(ra1, dec1, ra1, dec1, radius, params);
+    }
+
+    // Radius cross-match of a first catalog which is too large to fit in memory, and is
+    // processed in chunks of 'chunk_size' positions. 'read(i0, i1, ra, dec)' must load the
+    // positions 'i0' to 'i1-1' of the first catalog into 'ra' and 'dec', and
+    // 'write(i0, res)' receives the counterparts of these positions (the index 'i' in 'res'
+    // corresponds to the position 'i0+i' of the first catalog). Returns the total number of
+    // counterparts.
+    template<typename R, typename W>
+    uint_t qxmatch_radius_stream(uint_t n1, R&& read, const sky_index& index2, double radius,
+        W&& write, qxmatch_params params = qxmatch_params{}, uint_t chunk_size = 1000000) {
+
+        vif_check(radius >= 0, "search radius must be positive (got ", radius, ")");
+        vif_check(chunk_size > 0, "chunk size must be strictly positive");
+
+        const double r2 = impl::sky_index_impl::arcsec_to_chord2(radius);
+        const bool verbose = params.verbose;
+        params.verbose = false;
+
+        uint_t nmatch = 0;
+        vec1d ra, dec;
+        qxmatch_radius_res res;
+        auto p = progress_start(n1);
+        for (uint_t i0 = 0; i0 < n1; i0 += chunk_size) {
+            uint_t i1 = std::min(i0 + chunk_size, n1);
+
+            read(i0, i1, ra, dec);
+            vif_check(ra.size() == i1 - i0 && dec.size() == i1 - i0, "wrong number of positions "
+                "read for chunk ", i0, " to ", i1, " (got ", ra.size(), " and ", dec.size(), ")");
+
+            impl::qxmatch_impl::sky_within(ra, dec, index2, r2, params, i0, res);
+            write(i0, static_cast<const qxmatch_radius_res&>(res));
+            nmatch += res.id.size();
+
+            if (verbose) print_progress(p, i1);
+        }
+
+        return nmatch;
+    }
+
+    #ifndef NO_CFITSIO
+    // Same as above, reading the first catalog from the columns 'racol' and 'deccol' of the
+    // FITS table 'infile' (row or column oriented), and writing the counterparts to the FITS
+    // table 'outfile', with one row per pair and the columns ID1 (index in the first catalog),
+    // ID2 (index in the second catalog) and D (distance in arcsec).
+    inline uint_t qxmatch_radius_stream(const std::string& infile, const std::string& racol,
+        const std::string& deccol, const sky_index& index2, double radius,
+        const std::string& outfile, qxmatch_params params = qxmatch_params{},
+        uint_t chunk_size = 1000000) {
+
+        int status = 0;
+
+        // Open the input table and find the columns
+        // The files are closed automatically if an error is thrown
+        fitsfile* ifptr = nullptr;
+        fits_open_table(&ifptr, infile.c_str(), READONLY, &status);
+        impl::qxmatch_impl::fits_file_ptr iguard(ifptr);
+        fits::vif_check_cfitsio(status, "cannot open file '"+infile+"'");
+
+        auto get_column = [&](const std::string& name, int& cid, long& nelem) -> long {
+            fits_get_colnum(ifptr, CASEINSEN, const_cast<char*>(name.c_str()), &cid, &status);
+            fits::vif_check_cfitsio(status, "cannot find column '"+name+"' in '"+infile+"'");
+
+            int type;
+            long repeat, width, nrow;
+            fits_get_coltype(ifptr, cid, &type, &repeat, &width, &status);
+            fits_get_num_rows(ifptr, &nrow, &status);
+            fits::vif_check_cfitsio(status, "cannot read column '"+name+"' in '"+infile+"'");
+
+            nelem = nrow*repeat;
+            return repeat;
+        };
+
+        int cra, cdec;
+        long nra, ndec;
+        long repeat = get_column(racol, cra, nra);
+        vif_check(get_column(deccol, cdec, ndec) == repeat && nra == ndec, "RA and Dec "
+            "columns do not have the same dimensions in '", infile, "'");
+
+        // Create the output table
+        fitsfile* ofptr = nullptr;
+        fits_create_file(&ofptr, ("!"+outfile).c_str(), &status);
+        impl::qxmatch_impl::fits_file_ptr oguard(ofptr);
+        fits::vif_check_cfitsio(status, "cannot create file '"+outfile+"'");
+
+        char ttype1[] = "ID1", ttype2[] = "ID2", ttype3[] = "D";
+        std::string fu = std::string("1")+impl::fits_impl::traits<uint_t>::tform;
+        std::string fd = std::string("1")+impl::fits_impl::traits<double>::tform;
+        char* ttype[] = {ttype1, ttype2, ttype3};
+        char* tform[] = {const_cast<char*>(fu.c_str()), const_cast<char*>(fu.c_str()),
+            const_cast<char*>(fd.c_str())};
+        fits_create_tbl(ofptr, BINARY_TBL, 0, 3, ttype, tform, nullptr, nullptr, &status);
+        fits::vif_check_cfitsio(status, "cannot create table in '"+outfile+"'");
+
+        uint_t nrow = 0;
+        vec1u id1;
+        uint_t nmatch = qxmatch_radius_stream(nra, [&](uint_t i0, uint_t i1, vec1d& ra, vec1d& dec) {
+            // Elements are contiguous, also across rows
+            ra.resize(i1 - i0);
+            dec.resize(i1 - i0);
+            double def = dnan;
+            int null;
+            fits_read_col(ifptr, TDOUBLE, cra, i0/repeat + 1, i0%repeat + 1, i1 - i0, &def,
+                ra.raw_data(), &null, &status);
+            fits_read_col(ifptr, TDOUBLE, cdec, i0/repeat + 1, i0%repeat + 1, i1 - i0, &def,
+                dec.raw_data(), &null, &status);
+            fits::vif_check_cfitsio(status, "cannot read positions from '"+infile+"'");
+        }, index2, radius, [&](uint_t i0, const qxmatch_radius_res& res) {
+            if (res.id.empty()) return;
+
+            id1.resize(res.id.size());
+            for (uint_t i : range(res.start.size()-1)) {
+                for (uint_t j = res.start.safe[i]; j < res.start.safe[i+1]; ++j) {
+                    id1.safe[j] = i0 + i;
+                }
+            }
+
+            using traits = impl::fits_impl::traits<uint_t>;
+            fits_write_col(ofptr, traits::ttype, 1, nrow+1, 1, id1.size(),
+                const_cast<uint_t*>(id1.raw_data()), &status);
+            fits_write_col(ofptr, traits::ttype, 2, nrow+1, 1, res.id.size(),
+                const_cast<uint_t*>(res.id.raw_data()), &status);
+            fits_write_col(ofptr, TDOUBLE, 3, nrow+1, 1, res.d.size(),
+                const_cast<double*>(res.d.raw_data()), &status);
+            fits::vif_check_cfitsio(status, "cannot write counterparts to '"+outfile+"'");
+
+            nrow += res.id.size();
+        }, params, chunk_size);
+
+        // Close the output explicitly, to catch errors when flushing the data to the disk
+        fits_close_file(oguard.release(), &status);
+        fits::vif_check_cfitsio(status, "cannot close file '"+outfile+"'");
+
+        return nmatch;
+    }
+    #endif
+
     struct id_pair {
         vec1u id1, id2;
         vec1u lost;
@@ -0,0 +1,615 @@
+#ifndef VIF_ASTRO_SKY_INDEX_HPP
+#define VIF_ASTRO_SKY_INDEX_HPP
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+#include <fstream>
+#include "vif/core/vec.hpp"
+#include "vif/core/error.hpp"
+#include "vif/math/base.hpp"
+#include "vif/utility/thread.hpp"
+#include "vif/io/filesystem.hpp"
+
+namespace vif {
+namespace impl {
+    namespace sky_index_impl {
+        // The sky is divided into a hierarchy of spherical triangles (or "trixels", as in
+        // the Hierarchical Triangular Mesh, Kunszt et al. 2001). At the top level, there
+        // are eight triangles, one per octant of the unit sphere. Each triangle is then
+        // recursively divided into four triangles by connecting the middle of its edges.
+        // A position is identified by the path to its triangle at the deepest level,
+        // which gives an integer identifier ("cell") such that all the positions inside a
+        // given triangle, at any level, have a contiguous range of identifiers.
+        //
+        // There are no special cases close to the poles or the RA=0/360 boundary, and
+        // triangles have roughly equal areas (within a factor of two).
+
+        // Deepest level of the hierarchy; triangles at this level are ~0.3" wide
+        static const uint_t max_level = 20;
+
+        struct point {
+            double x, y, z;
+        };
+
+        inline point operator + (const point& a, const point& b) {
+            return point{a.x + b.x, a.y + b.y, a.z + b.z};
+        }
+
+        inline double dot(const point& a, const point& b) {
+            return a.x*b.x + a.y*b.y + a.z*b.z;
+        }
+
+        inline point cross(const point& a, const point& b) {
+            return point{a.y*b.z - a.z*b.y, a.z*b.x - a.x*b.z, a.x*b.y - a.y*b.x};
+        }
+
+        inline point normalize(const point& a) {
+            double n = std::sqrt(dot(a, a));
+            return point{a.x/n, a.y/n, a.z/n};
+        }
+
+        inline point midpoint(const point& a, const point& b) {
+            return normalize(a + b);
+        }
+
+        inline double chord2(const point& a, const point& b) {
+            double dx = a.x - b.x, dy = a.y - b.y, dz = a.z - b.z;
+            return dx*dx + dy*dy + dz*dz;
+        }
+
+        // Convert RA/Dec (in degrees) to a point on the unit sphere
+        inline point radec_to_point(double ra, double dec) {
+            const double d2r = dpi/180.0;
+            double cd = std::cos(dec*d2r);
+            return point{cd*std::cos(ra*d2r), cd*std::sin(ra*d2r), std::sin(dec*d2r)};
+        }
+
+        // Conversion between the squared chord length between two points on the unit
+        // sphere (used internally, since it is cheap to compute) and the angular distance
+        // in arcseconds
+        inline double chord2_to_arcsec(double c2) {
+            return 3600.0*(180.0/dpi)*2.0*std::asin(std::min(1.0, 0.5*std::sqrt(c2)));
+        }
+
+        inline double arcsec_to_chord2(double d) {
+            if (d >= 180.0*3600.0) return 4.0;
+            return sqr(2.0*std::sin(0.5*d*dpi/(180.0*3600.0)));
+        }
+
+        struct triangle {
+            point v0, v1, v2;
+        };
+
+        // Top level triangle of each octant, with vertices in counter-clockwise order
+        inline triangle base_triangle(uint_t o) {
+            double sx = (o & 1) ? -1.0 : 1.0;
+            double sy = (o & 2) ? -1.0 : 1.0;
+            double sz = (o & 4) ? -1.0 : 1.0;
+            point ex{sx, 0, 0}, ey{0, sy, 0}, ez{0, 0, sz};
+            if (sx*sy*sz > 0) {
+                return triangle{ex, ey, ez};
+            } else {
+                return triangle{ey, ex, ez};
+            }
+        }
+
+        inline uint_t base_octant(const point& p) {
+            return (p.x < 0 ? 1 : 0) + (p.y < 0 ? 2 : 0) + (p.z < 0 ? 4 : 0);
+        }
+
+        // Sub-triangle 'c' (0 to 3) of a triangle
+        inline triangle child(const triangle& t, uint_t c) {
+            point w0 = midpoint(t.v1, t.v2);
+            point w1 = midpoint(t.v0, t.v2);
+            point w2 = midpoint(t.v0, t.v1);
+            switch (c) {
+                case 0 : return triangle{t.v0, w2, w1};
+                case 1 : return triangle{t.v1, w0, w2};
+                case 2 : return triangle{t.v2, w1, w0};
+                default: return triangle{w0, w1, w2};
+            }
+        }
+
+        // Identifier of the deepest triangle containing 'p'
+        inline std::uint64_t cell_of(const point& p) {
+            uint_t o = base_octant(p);
+            triangle t = base_triangle(o);
+            std::uint64_t c = o;
+            for (uint_t l = 0; l < max_level; ++l) {
+                point w0 = midpoint(t.v1, t.v2);
+                point w1 = midpoint(t.v0, t.v2);
+                point w2 = midpoint(t.v0, t.v1);
+
+                // The corner triangles are on the outer side of the inner edges
+                if (dot(cross(w2, w1), p) >= 0) {
+                    c = 4*c + 0; t = triangle{t.v0, w2, w1};
+                } else if (dot(cross(w0, w2), p) >= 0) {
+                    c = 4*c + 1; t = triangle{t.v1, w0, w2};
+                } else if (dot(cross(w1, w0), p) >= 0) {
+                    c = 4*c + 2; t = triangle{t.v2, w1, w0};
+                } else {
+                    c = 4*c + 3; t = triangle{w0, w1, w2};
+                }
+            }
+
+            return c;
+        }
+
+        // Node of the tree during a search
+        struct node {
+            double lb;        // lower bound on the chord^2 between the query and any point inside
+            uint_t level;     // level of the triangle
+            std::uint64_t c;  // identifier of the triangle at this level
+            uint_t i0, i1;    // range of sorted points inside this triangle
+            triangle t;
+
+            bool operator < (const node& n) const {
+                // For std::push_heap: smallest lower bound on top
+                return lb > n.lb;
+            }
+        };
+
+        // Lower bound on the chord^2 between 'q' and any point inside the triangle 't'
+        inline double lower_bound_chord2(const point& q, const triangle& t) {
+            // Bounding cap of the triangle
+            point c = normalize(t.v0 + t.v1 + t.v2);
+            double cr = std::min(std::min(dot(c, t.v0), dot(c, t.v1)), dot(c, t.v2));
+            double a = std::acos(clamp(dot(q, c), -1.0, 1.0)) - std::acos(clamp(cr, -1.0, 1.0));
+            // Margin for round-off errors (0.2 mas)
+            a -= 1e-9;
+            if (a <= 0) return 0.0;
+            return sqr(2.0*std::sin(0.5*std::min(a, dpi)));
+        }
+
+        // Bounded max-heap of the k nearest candidates found so far
+        struct candidate {
+            double d;
+            uint_t id;
+
+            bool operator < (const candidate& c) const {
+                return d < c.d || (d == c.d && id < c.id);
+            }
+        };
+
+        // Buffers reused from one query to the next
+        struct workspace {
+            std::vector<node> nodes;
+            std::vector<candidate> best;
+        };
+
+        // Index files start with this header, followed by the cell, id and xyz arrays.
+        // Everything is written in native byte order with 8 byte alignment, so that the
+        // arrays can be used directly from a memory mapping of the file.
+        struct file_header {
+            std::uint64_t magic;   // to identify the file (and its byte order)
+            std::uint64_t version;
+            std::uint64_t level;   // value of max_level used to compute the cells
+            std::uint64_t n;       // number of positions
+        };
+
+        static const std::uint64_t file_magic = 0x31584449594b5356ull; // "VSKYIDX1"
+        static const std::uint64_t file_version = 1;
+    }
+}
+
+namespace astro {
+    // Spatial index of positions on the sky, for fast nearest neighbor searches.
+    // Positions are sorted along a hierarchical triangular mesh (see sky_index_impl above),
+    // and stored in contiguous arrays: the memory usage is 40 bytes per position,
+    // regardless of the area covered on the sky. The index is immutable once built, and
+    // all the queries can be called concurrently from multiple threads.
+    // The index can be saved to a file with 'save()', and opened again later by giving
+    // the file name to the constructor. The file is then mapped in memory and used in
+    // place: opening is instantaneous, and only the pages touched by the queries are read
+    // from the disk.
+    class sky_index {
+    protected :
+        using point = impl::sky_index_impl::point;
+        using node = impl::sky_index_impl::node;
+        using triangle = impl::sky_index_impl::triangle;
+        using candidate = impl::sky_index_impl::candidate;
+
+    public :
+        using workspace = impl::sky_index_impl::workspace;
+
+        // Maximum number of positions in a triangle before it is subdivided during a search
+        uint_t leaf_size = 16;
+
+    protected :
+        // Storage, sorted by cell
+        std::vector<std::uint64_t> cell_store_;
+        std::vector<std::uint64_t> id_store_;
+        std::vector<double> xyz_store_;
+
+        // Pointers to the storage (which may be owned by another object)
+        const std::uint64_t* cell_ = nullptr;
+        const std::uint64_t* id_ = nullptr;
+        const double* xyz_ = nullptr;
+        uint_t n_ = 0;
+
+        // Memory mapped file, if the index was loaded from the disk
+        file::mapped_file map_;
+
+        void point_to_storage_() {
+            cell_ = cell_store_.data();
+            id_ = id_store_.data();
+            xyz_ = xyz_store_.data();
+            n_ = cell_store_.size();
+        }
+
+        void reset_() {
+            cell_ = id_ = nullptr;
+            xyz_ = nullptr;
+            n_ = 0;
+        }
+
+        point point_(uint_t i) const {
+            return point{xyz_[3*i+0], xyz_[3*i+1], xyz_[3*i+2]};
+        }
+
+        // First sorted point with a cell >= 'c', within [i0,i1)
+        uint_t find_(std::uint64_t c, uint_t i0, uint_t i1) const {
+            return std::lower_bound(cell_ + i0, cell_ + i1, c) - cell_;
+        }
+
+        // Split a node into its four children, skipping empty children
+        template<typename F>
+        void split_(const node& n, F&& func) const {
+            const uint_t shift = 2*(impl::sky_index_impl::max_level - n.level - 1);
+            uint_t b[5];
+            b[0] = n.i0;
+            b[4] = n.i1;
+            for (uint_t k : range(1, 4)) {
+                b[k] = find_((4*n.c + k) << shift, b[k-1], n.i1);
+            }
+
+            for (uint_t k : range(4)) {
+                if (b[k+1] == b[k]) continue;
+                node s;
+                s.level = n.level + 1;
+                s.c = 4*n.c + k;
+                s.i0 = b[k];
+                s.i1 = b[k+1];
+                s.t = impl::sky_index_impl::child(n.t, k);
+                func(s);
+            }
+        }
+
+        template<typename F>
+        void top_nodes_(F&& func) const {
+            const uint_t shift = 2*impl::sky_index_impl::max_level;
+            uint_t i0 = 0;
+            for (uint_t o : range(8)) {
+                uint_t i1 = find_(std::uint64_t(o+1) << shift, i0, n_);
+                if (i1 != i0) {
+                    node s;
+                    s.level = 0;
+                    s.c = o;
+                    s.i0 = i0;
+                    s.i1 = i1;
+                    s.t = impl::sky_index_impl::base_triangle(o);
+                    func(s);
+                }
+
+                i0 = i1;
+            }
+        }
+
+        bool is_leaf_(const node& n) const {
+            return n.i1 - n.i0 <= leaf_size || n.level == impl::sky_index_impl::max_level;
+        }
+
+    public :
+
+        sky_index() = default;
+        sky_index(const sky_index&) = delete;
+        sky_index& operator = (const sky_index&) = delete;
+
+        // The storage vectors and the file mapping are moved, so the pointers remain valid.
+        // The moved-from index is left empty.
+        sky_index(sky_index&& s) noexcept : leaf_size(s.leaf_size),
+            cell_store_(std::move(s.cell_store_)), id_store_(std::move(s.id_store_)),
+            xyz_store_(std::move(s.xyz_store_)), cell_(s.cell_), id_(s.id_), xyz_(s.xyz_),
+            n_(s.n_), map_(std::move(s.map_)) {
+            s.reset_();
+        }
+
+        sky_index& operator = (sky_index&& s) noexcept {
+            if (this != &s) {
+                leaf_size = s.leaf_size;
+                cell_store_ = std::move(s.cell_store_);
+                id_store_ = std::move(s.id_store_);
+                xyz_store_ = std::move(s.xyz_store_);
+                cell_ = s.cell_;
+                id_ = s.id_;
+                xyz_ = s.xyz_;
+                n_ = s.n_;
+                map_ = std::move(s.map_);
+                s.reset_();
+            }
+
+            return *this;
+        }
+
+        // Open an index previously saved with 'save()'
+        explicit sky_index(const std::string& filename) {
+            using impl::sky_index_impl::file_header;
+
+            vif_check(map_.open(filename) && map_.size() >= sizeof(file_header),
+                "could not read sky index file '", filename, "'");
+
+            const file_header& h = *reinterpret_cast<const file_header*>(map_.data());
+            vif_check(h.magic == impl::sky_index_impl::file_magic, "'", filename, "' is not "
+                "a sky index file, or was created on a machine with a different byte order");
+            vif_check(h.version == impl::sky_index_impl::file_version, "unsupported sky index "
+                "file version in '", filename, "' (", h.version, ", expected ",
+                impl::sky_index_impl::file_version, ")");
+            vif_check(h.level == impl::sky_index_impl::max_level, "incompatible sky index "
+                "file '", filename, "' (mesh level is ", h.level, ", expected ",
+                impl::sky_index_impl::max_level, ")");
+            // Bound 'n' first: a corrupted header could make the size computation overflow
+            const std::size_t bytes_per_pos = 5*sizeof(std::uint64_t);
+            vif_check(h.n <= (map_.size() - sizeof(file_header))/bytes_per_pos &&
+                map_.size() == sizeof(file_header) + bytes_per_pos*h.n,
+                "sky index file '", filename, "' is truncated or corrupted");
+
+            n_ = h.n;
+            cell_ = reinterpret_cast<const std::uint64_t*>(map_.data() + sizeof(file_header));
+            id_ = cell_ + n_;
+            xyz_ = reinterpret_cast<const double*>(id_ + n_);
+        }
+
+        // Build the index from RA and Dec coordinates (in degrees). The work is split
+        // among 'nthread' threads.
+        template<typename TypeR, typename TypeD>
+        sky_index(const vec<1,TypeR>& ra, const vec<1,TypeD>& dec, uint_t nthread = 1) {
+            vif_check(ra.dims == dec.dims, "RA and Dec dimensions do not match (",
+                ra.dims, " vs ", dec.dims, ")");
+
+            const uint_t n = ra.size();
+            std::vector<std::uint64_t> cells(n);
+            std::vector<point> points(n);
+            auto compute = [&](uint_t i0, uint_t i1) {
+                for (uint_t i = i0; i < i1; ++i) {
+                    points[i] = impl::sky_index_impl::radec_to_point(ra.safe[i], dec.safe[i]);
+                    cells[i] = impl::sky_index_impl::cell_of(points[i]);
+                }
+            };
+
+            if (nthread > 1 && n > 10000) {
+                thread::task_pool pool(nthread);
+                pool.execute_chunks(compute, 0, n);
+            } else {
+                compute(0, n);
+            }
+
+            std::vector<std::uint64_t> order(n);
+            for (uint_t i : range(n)) {
+                order[i] = i;
+            }
+
+            std::sort(order.begin(), order.end(), [&](std::uint64_t i, std::uint64_t j) {
+                return cells[i] < cells[j] || (cells[i] == cells[j] && i < j);
+            });
+
+            cell_store_.resize(n);
+            id_store_.resize(n);
+            xyz_store_.resize(3*n);
+            for (uint_t i : range(n)) {
+                uint_t j = order[i];
+                cell_store_[i] = cells[j];
+                id_store_[i] = j;
+                xyz_store_[3*i+0] = points[j].x;
+                xyz_store_[3*i+1] = points[j].y;
+                xyz_store_[3*i+2] = points[j].z;
+            }
+
+            point_to_storage_();
+        }
+
+        uint_t size() const {
+            return n_;
+        }
+
+        bool empty() const {
+            return n_ == 0;
+        }
+
+        // True if the index is used directly from a file mapped in memory
+        bool mapped() const {
+            return map_.is_open();
+        }
+
+        // Write the index to a file, to be opened again later with 'sky_index(filename)'
+        void save(const std::string& filename) const {
+            impl::sky_index_impl::file_header h;
+            h.magic = impl::sky_index_impl::file_magic;
+            h.version = impl::sky_index_impl::file_version;
+            h.level = impl::sky_index_impl::max_level;
+            h.n = n_;
+
+            std::ofstream f(filename, std::ios::binary);
+            vif_check(f.is_open(), "could not open '", filename, "' for writing");
+
+            f.write(reinterpret_cast<const char*>(&h), sizeof(h));
+            f.write(reinterpret_cast<const char*>(cell_), n_*sizeof(std::uint64_t));
+            f.write(reinterpret_cast<const char*>(id_), n_*sizeof(std::uint64_t));
+            f.write(reinterpret_cast<const char*>(xyz_), 3*n_*sizeof(double));
+            f.close();
+
+            vif_check(!f.fail(), "could not write sky index file '", filename, "'");
+        }
+
+        // Access the indexed positions, in the internal order of the index ('i' ranges
+        // from 0 to size()-1): 'id(i)' is the index of the position in the original
+        // vectors, and 'position(i)' is the corresponding point on the unit sphere
+        uint_t id(uint_t i) const {
+            return id_[i];
+        }
+
+        impl::sky_index_impl::point position(uint_t i) const {
+            return point_(i);
+        }
+
+        // Find the nearest neighbor of the position (ra,dec) (in degrees), and return its
+        // index, or 'npos' if the index is empty. The distance (in arcsec) is stored in 'dist'.
+        uint_t nearest(double ra, double dec, double& dist, uint_t exclude = npos) const {
+            workspace w;
+            uint_t id;
+            nearest(ra, dec, 1, &id, &dist, w, exclude);
+            return id;
+        }
+
+        // Find the 'k' nearest neighbors of the position (ra,dec) (in degrees). The indices
+        // of the neighbors (in the original vectors used to build the index) are stored in
+        // 'ids', and their distance (in arcseconds) in 'dists', sorted by increasing
+        // distance; if there are less than 'k' positions in the index, the remaining
+        // elements are set to 'npos' and infinity. The position with index 'exclude' is
+        // ignored, which is useful when searching for neighbors inside the same catalog.
+        // The 'workspace' can be reused between queries to avoid memory allocations.
+        void nearest(double ra, double dec, uint_t k, uint_t* ids, double* dists,
+            workspace& w, uint_t exclude = npos) const {
+
+            nearest_chord2(impl::sky_index_impl::radec_to_point(ra, dec), k, ids, dists, w, exclude);
+            for (uint_t i : range(k)) {
+                if (ids[i] != npos) dists[i] = impl::sky_index_impl::chord2_to_arcsec(dists[i]);
+            }
+        }
+
+        void nearest(double ra, double dec, uint_t k, vec1u& ids, vec1d& dists,
+            uint_t exclude = npos) const {
+            workspace w;
+            ids.resize(k);
+            dists.resize(k);
+            nearest(ra, dec, k, ids.data.data(), dists.data.data(), w, exclude);
+        }
+
+        // Same as above, but 'dists' contains squared chord lengths between points on the
+        // unit sphere (faster, and can be converted to arcsec with 'chord2_to_arcsec()')
+        void nearest_chord2(const point& q, uint_t k, uint_t* ids, double* dists,
+            workspace& w, uint_t exclude = npos) const {
+
+            auto& best = w.best;
+            auto& nodes = w.nodes;
+            best.clear();
+            nodes.clear();
+
+            auto worst = [&]() {
+                return best.size() < k ? dinf : best.front().d;
+            };
+
+            auto push_node = [&](node& s) {
+                s.lb = impl::sky_index_impl::lower_bound_chord2(q, s.t);
+                if (s.lb <= worst()) {
+                    nodes.push_back(s);
+                    std::push_heap(nodes.begin(), nodes.end());
+                }
+            };
+
+            if (k > 0) {
+                top_nodes_(push_node);
+            }
+
+            // Best-first search: always open the node that is closest to the query
+            while (!nodes.empty()) {
+                std::pop_heap(nodes.begin(), nodes.end());
+                node n = nodes.back();
+                nodes.pop_back();
+
+                if (n.lb > worst()) break;
+
+                if (is_leaf_(n)) {
+                    for (uint_t i = n.i0; i < n.i1; ++i) {
+                        if (id_[i] == exclude) continue;
+
+                        double d = impl::sky_index_impl::chord2(q, point_(i));
+                        candidate c{d, uint_t(id_[i])};
+                        if (best.size() < k) {
+                            best.push_back(c);
+                            std::push_heap(best.begin(), best.end());
+                        } else if (c < best.front()) {
+                            std::pop_heap(best.begin(), best.end());
+                            best.back() = c;
+                            std::push_heap(best.begin(), best.end());
+                        }
+                    }
+                } else {
+                    split_(n, push_node);
+                }
+            }
+
+            std::sort_heap(best.begin(), best.end());
+            for (uint_t i : range(k)) {
+                if (i < best.size()) {
+                    ids[i] = best[i].id;
+                    dists[i] = best[i].d;
+                } else {
+                    ids[i] = npos;
+                    dists[i] = dinf;
+                }
+            }
+        }
+
+        // Find all the positions within 'radius' (in arcsec) of the position (ra,dec) (in
+        // degrees). The indices of the positions are stored in 'ids', and their distances
+        // (in arcseconds) in 'dists', sorted by increasing distance.
+        void within(double ra, double dec, double radius, vec1u& ids, vec1d& dists,
+            uint_t exclude = npos) const {
+
+            workspace w;
+            within_chord2(impl::sky_index_impl::radec_to_point(ra, dec),
+                impl::sky_index_impl::arcsec_to_chord2(radius), w, exclude);
+
+            ids.resize(w.best.size());
+            dists.resize(w.best.size());
+            for (uint_t i : range(w.best)) {
+                ids.safe[i] = w.best[i].id;
+                dists.safe[i] = impl::sky_index_impl::chord2_to_arcsec(w.best[i].d);
+            }
+        }
+
+        // Same as above, but the radius is given as a squared chord length on the unit
+        // sphere, and the result is stored in 'w.best' (sorted by increasing distance)
+        void within_chord2(const point& q, double r2, workspace& w, uint_t exclude = npos) const {
+            auto& best = w.best;
+            auto& nodes = w.nodes;
+            best.clear();
+            nodes.clear();
+
+            // No need to sort the nodes here: the order of traversal does not matter
+            auto push_node = [&](node& s) {
+                s.lb = impl::sky_index_impl::lower_bound_chord2(q, s.t);
+                if (s.lb <= r2) {
+                    nodes.push_back(s);
+                }
+            };
+
+            top_nodes_(push_node);
+
+            while (!nodes.empty()) {
+                node n = nodes.back();
+                nodes.pop_back();
+
+                if (is_leaf_(n)) {
+                    for (uint_t i = n.i0; i < n.i1; ++i) {
+                        if (id_[i] == exclude) continue;
+
+                        double d = impl::sky_index_impl::chord2(q, point_(i));
+                        if (d <= r2) {
+                            best.push_back(candidate{d, uint_t(id_[i])});
+                        }
+                    }
+                } else {
+                    split_(n, push_node);
+                }
+            }
+
+            std::sort(best.begin(), best.end());
+        }
+    };
+}
+}
+
+#endif
@@ -1,8 +1,14 @@
 #ifndef VIF_ASTRO_TEMPLATE_FIT_HPP
 #define VIF_ASTRO_TEMPLATE_FIT_HPP
 
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <random>
 #include "vif/astro/astro.hpp"
 #include "vif/math/mpfit.hpp"
+#include "vif/utility/thread.hpp"
+#include "vif/io/filesystem.hpp"
 
 namespace vif {
 namespace astro {
@@ -12,6 +18,22 @@ namespace astro {
         const uint_t nsed = lib.sed.dims[0];
         const uint_t nfilter = filters.size();
 
+        // When all SEDs share the same wavelength grid, which is the common case, build the filter
+        // response operator once and apply it to the whole library
+        bool common_grid = nsed > 0;
+        for (uint_t s = 1; s < nsed && common_grid; ++s)
+        for (uint_t l : range(lib.lam.dims[1])) {
+            if (lib.lam.safe(s,l) != lib.lam.safe(0,l)) {
+                common_grid = false;
+                break;
+            }
+        }
+
+        if (common_grid) {
+            filter_response resp(filters, lib.lam.safe(0,_).concretise());
+            return resp.apply(lib.sed);
+        }
+
         vec2d flux(nsed, nfilter);
         for (uint_t f = 0; f < nfilter; ++f) {
             flux.safe(_,f) = sed2flux(filters[f], lib.lam, lib.sed);
@@ -543,6 +565,573 @@ namespace astro {
         return res;
     }
 }
+
+namespace impl {
+    namespace template_fit_impl {
+        // Template flux cube files start with this header, followed by the redshift grid
+        // (double) and the fluxes (float). Everything is written in native byte order with
+        // 8 byte alignment, so that the arrays can be used directly from a memory mapping
+        // of the file.
+        struct file_header {
+            std::uint64_t magic;   // to identify the file (and its byte order)
+            std::uint64_t version;
+            std::uint64_t nz;      // number of redshifts
+            std::uint64_t nsed;    // number of templates
+            std::uint64_t nfilter; // number of filters
+        };
+
+        static const std::uint64_t file_magic = 0x3142554349505456ull; // "VTPICUB1"
+        static const std::uint64_t file_version = 1;
+
+        // Number of fluxes 'n' in a cube of the given dimensions. Returns false if it is
+        // larger than 'nmax'; each product is checked before it is computed, so corrupted
+        // dimensions cannot make it overflow.
+        inline bool flux_count(std::uint64_t nz, std::uint64_t nsed, std::uint64_t nfilter,
+            std::uint64_t nmax, std::uint64_t& n) {
+            n = 0;
+            if (nz == 0 || nsed == 0 || nfilter == 0) return true;
+            if (nsed > nmax/nz) return false;
+            n = nz*nsed;
+            if (nfilter > nmax/n) return false;
+            n *= nfilter;
+            return true;
+        }
+
+        // First and second derivatives of limweight()
+        inline void limweight_deriv(double d, double& d1, double& d2) {
+            if (d < -3.0) {
+                d1 = 2.0*d + 2.0/d;
+                d2 = 2.0 - 2.0/(d*d);
+            } else {
+                double r = sqrt(2.0/dpi)*exp(-0.5*d*d)/(1.0 + erf(d/sqrt(2.0)));
+                d1 = -2.0*r;
+                d2 = 2.0*r*(d + r);
+            }
+        }
+
+        // Find the amplitude 'a' that minimizes the chi2 of 'a*model' against 'flux', where
+        // some measurements are upper limits ('ulim' is true). Fluxes and models are already
+        // divided by the errors. The chi2 is a convex function of 'a', so a Newton solver
+        // with step halving always converges. Returns the chi2.
+        inline double fit_ulim_amp(const double* flux, const double* model, const bool* ulim,
+            uint_t n, double& a) {
+
+            auto chi2_of = [&](double ta) {
+                double c = 0.0;
+                for (uint_t f = 0; f < n; ++f) {
+                    double d = flux[f] - ta*model[f];
+                    c += (ulim[f] ? astro::limweight(d) : d*d);
+                }
+
+                return c;
+            };
+
+            double chi2 = chi2_of(a);
+            for (uint_t iter = 0; iter < 50; ++iter) {
+                double g = 0.0, h = 0.0;
+                for (uint_t f = 0; f < n; ++f) {
+                    double d = flux[f] - a*model[f];
+                    if (ulim[f]) {
+                        double d1, d2;
+                        limweight_deriv(d, d1, d2);
+                        g -= d1*model[f];
+                        h += d2*model[f]*model[f];
+                    } else {
+                        g -= 2.0*d*model[f];
+                        h += 2.0*model[f]*model[f];
+                    }
+                }
+
+                if (!(h > 0.0)) break;
+
+                double step = g/h;
+                double na = a - step, nchi2 = chi2_of(na);
+                for (uint_t k = 0; k < 30 && !(nchi2 <= chi2); ++k) {
+                    step *= 0.5;
+                    na = a - step;
+                    nchi2 = chi2_of(na);
+                }
+
+                if (!(nchi2 <= chi2)) break;
+
+                bool converged = abs(step) <= 1e-10*std::max(abs(a), 1e-30);
+                a = na;
+                chi2 = nchi2;
+                if (converged) break;
+            }
+
+            return chi2;
+        }
+    }
+}
+
+namespace astro {
+    // Observed fluxes of a template library through a set of filters, for a grid of
+    // redshifts. This can be computed once for a whole catalog and reused for all the fits
+    // (see 'template_fit_batch()'). Fluxes are stored in single precision, with the
+    // templates varying fastest, so that all the templates of a given redshift and filter are
+    // contiguous in memory.
+    // The cube can be saved to a file with 'save()', and opened again later by giving the
+    // file name to the constructor. The file is then mapped in memory and used in place,
+    // so that it can be larger than the available memory.
+    class template_flux_cube {
+    protected :
+        // Storage
+        std::vector<double> z_store_;
+        std::vector<float> flux_store_;
+
+        // Pointers to the storage (which may be a memory mapped file)
+        const double* z_ = nullptr;
+        const float* flux_ = nullptr;
+        uint_t nz_ = 0, nsed_ = 0, nfilter_ = 0;
+
+        // Memory mapped file, if the cube was loaded from the disk
+        file::mapped_file map_;
+
+        void point_to_storage_() {
+            z_ = z_store_.data();
+            flux_ = flux_store_.data();
+        }
+
+        void reset_() {
+            z_ = nullptr;
+            flux_ = nullptr;
+            nz_ = nsed_ = nfilter_ = 0;
+        }
+
+        template<typename F>
+        void build_(uint_t nz, uint_t nsed, uint_t nfilter, uint_t nthread, F&& compute) {
+            nz_ = nz;
+            nsed_ = nsed;
+            nfilter_ = nfilter;
+
+            std::uint64_t nflux = 0;
+            vif_check(impl::template_fit_impl::flux_count(nz, nsed, nfilter,
+                flux_store_.max_size(), nflux), "template flux cube is too large (", nz,
+                " redshifts, ", nsed, " templates, ", nfilter, " filters)");
+            flux_store_.resize(nflux);
+
+            auto process = [&](uint_t i0, uint_t i1) {
+                for (uint_t iz = i0; iz < i1; ++iz) {
+                    vec2d tflux = compute(iz);
+                    float* p = flux_store_.data() + iz*nfilter*nsed;
+                    for (uint_t f : range(nfilter))
+                    for (uint_t t : range(nsed)) {
+                        p[f*nsed + t] = tflux.safe(t,f);
+                    }
+                }
+            };
+
+            if (nthread > 1 && nz > 1) {
+                thread::task_pool pool(nthread);
+                pool.execute_chunks(process, 0, nz, 1);
+            } else {
+                process(0, nz);
+            }
+
+            point_to_storage_();
+        }
+
+    public :
+
+        template_flux_cube() = default;
+        template_flux_cube(const template_flux_cube&) = delete;
+        template_flux_cube& operator = (const template_flux_cube&) = delete;
+
+        // The storage vectors and the file mapping are moved, so the pointers remain valid.
+        // The moved-from cube is left empty.
+        template_flux_cube(template_flux_cube&& c) noexcept :
+            z_store_(std::move(c.z_store_)), flux_store_(std::move(c.flux_store_)),
+            z_(c.z_), flux_(c.flux_), nz_(c.nz_), nsed_(c.nsed_), nfilter_(c.nfilter_),
+            map_(std::move(c.map_)) {
+            c.reset_();
+        }
+
+        template_flux_cube& operator = (template_flux_cube&& c) noexcept {
+            if (this != &c) {
+                z_store_ = std::move(c.z_store_);
+                flux_store_ = std::move(c.flux_store_);
+                z_ = c.z_;
+                flux_ = c.flux_;
+                nz_ = c.nz_;
+                nsed_ = c.nsed_;
+                nfilter_ = c.nfilter_;
+                map_ = std::move(c.map_);
+                c.reset_();
+            }
+
+            return *this;
+        }
+
+        // Open a cube previously saved with 'save()'
+        explicit template_flux_cube(const std::string& filename) {
+            using impl::template_fit_impl::file_header;
+
+            vif_check(map_.open(filename) && map_.size() >= sizeof(file_header),
+                "could not read template flux cube file '", filename, "'");
+
+            const file_header& h = *reinterpret_cast<const file_header*>(map_.data());
+            vif_check(h.magic == impl::template_fit_impl::file_magic, "'", filename, "' is not "
+                "a template flux cube file, or was created on a machine with a different byte "
+                "order");
+            vif_check(h.version == impl::template_fit_impl::file_version, "unsupported "
+                "template flux cube file version in '", filename, "' (", h.version,
+                ", expected ", impl::template_fit_impl::file_version, ")");
+
+            // Bound each dimension first: a corrupted header could make the size overflow
+            const std::uint64_t avail = map_.size() - sizeof(file_header);
+            std::uint64_t nflux = 0;
+            vif_check(h.nz <= avail/sizeof(double) && impl::template_fit_impl::flux_count(
+                h.nz, h.nsed, h.nfilter, (avail - sizeof(double)*h.nz)/sizeof(float), nflux) &&
+                avail == sizeof(double)*h.nz + sizeof(float)*nflux, "template flux cube file '",
+                filename, "' is truncated or corrupted");
+
+            nz_ = h.nz;
+            nsed_ = h.nsed;
+            nfilter_ = h.nfilter;
+            z_ = reinterpret_cast<const double*>(map_.data() + sizeof(h));
+            flux_ = reinterpret_cast<const float*>(z_ + nz_);
+        }
+
+        // Build the cube from a library in the observer frame, without redshift.
+        template<typename TLib, typename TFi>
+        template_flux_cube(const TLib& lib, const vec<1,TFi>& filters) {
+            z_store_.push_back(dnan);
+            build_(1, lib.sed.dims[0], filters.size(), 1, [&](uint_t) {
+                return template_observed(lib, filters);
+            });
+        }
+
+        // Build the cube from a library in the rest frame, for each redshift 'z' (with
+        // luminosity distance 'd', in Mpc). The work is split among 'nthread' threads.
+        template<typename TLib, typename TFi, typename TZ, typename TD>
+        template_flux_cube(const TLib& lib, const vec<1,TZ>& z, const vec<1,TD>& d,
+            const vec<1,TFi>& filters, uint_t nthread = 1) {
+
+            vif_check(z.size() == d.size(),
+                "incompatible redshift and distance variables (", z.dims, " vs ", d.dims, ")");
+
+            z_store_.assign(z.begin(), z.end());
+            build_(z.size(), lib.sed.dims[0], filters.size(), nthread, [&](uint_t iz) {
+                return template_observed(lib, double(z.safe[iz]), double(d.safe[iz]), filters);
+            });
+        }
+
+        // Write the cube to a file, to be opened again later with 'template_flux_cube(filename)'
+        void save(const std::string& filename) const {
+            impl::template_fit_impl::file_header h;
+            h.magic = impl::template_fit_impl::file_magic;
+            h.version = impl::template_fit_impl::file_version;
+            h.nz = nz_;
+            h.nsed = nsed_;
+            h.nfilter = nfilter_;
+
+            std::ofstream f(filename, std::ios::binary);
+            vif_check(f.is_open(), "could not open '", filename, "' for writing");
+
+            f.write(reinterpret_cast<const char*>(&h), sizeof(h));
+            f.write(reinterpret_cast<const char*>(z_), nz_*sizeof(double));
+            f.write(reinterpret_cast<const char*>(flux_), nz_*nsed_*nfilter_*sizeof(float));
+            f.close();
+
+            vif_check(!f.fail(), "could not write template flux cube file '", filename, "'");
+        }
+
+        // True if the cube is used directly from a file mapped in memory
+        bool mapped() const {
+            return map_.is_open();
+        }
+
+        uint_t nz() const {
+            return nz_;
+        }
+
+        uint_t nsed() const {
+            return nsed_;
+        }
+
+        uint_t nfilter() const {
+            return nfilter_;
+        }
+
+        // Redshift of the slice 'iz' (NaN for a cube in the observer frame)
+        double z(uint_t iz) const {
+            return z_[iz];
+        }
+
+        // Fluxes of all the templates at redshift 'iz' and in filter 'f'
+        const float* templates(uint_t iz, uint_t f) const {
+            return flux_ + (iz*nfilter_ + f)*nsed_;
+        }
+
+        // Fluxes of the template 't' at redshift 'iz' in all filters
+        vec1d model(uint_t iz, uint_t t) const {
+            vec1d m(nfilter_);
+            for (uint_t f : range(nfilter_)) {
+                m.safe[f] = templates(iz, f)[t];
+            }
+
+            return m;
+        }
+    };
+
+    struct template_fit_batch_res_t {
+        vec1u bfit_z;   // index of the best fit redshift in the cube, for each object
+        vec1u bfit;     // index of the best fit template in the library, for each object
+        vec1d chi2;     // chi^2 of the best fit
+        vec1d amp;      // renormalization amplitude of the best fit
+        vec2d chi2_z;   // best chi^2 at each redshift of the cube (if 'chi2_grid' is set)
+
+        vec2u z_sim;    // index of each error realization's best fit redshift
+        vec2u sed_sim;  // index of each error realization's best fit template
+        vec2d amp_sim;  // renormalization amplitude for each error realization's best fit
+    };
+
+    struct template_fit_batch_params {
+        uint_t nsim = 0;        // number of random realizations to perform to estimate errors
+        bool renorm = false;    // if true, allow templates to be renormalized when fitted
+        bool ulim = false;      // if true, use upper limits to constrain the fit (negative errors)
+        bool chi2_grid = false; // if true, save the best chi^2 at each redshift
+        uint_t thread = 1;      // number of threads, objects being split among them
+    };
+
+    // Fit the photometry of a whole catalog of objects with all the templates of the cube, at
+    // all the redshifts of the cube. Fluxes and errors are given as (nobj, nfilter) arrays.
+    // Measurements with non finite values (flux or error) are ignored.
+    //
+    // This gives the same result as 'template_fit()' (with the same meaning for the options),
+    // but the template fluxes are only computed once, and the amplitudes are computed
+    // analytically. With upper limits, the chi2 is a convex function of the amplitude, and
+    // the best amplitude is found with Newton iterations instead of a generic solver.
+    // Random realizations are drawn from a random sequence specific to each object, so the
+    // result does not depend on the number of threads.
+    template<typename TypeSeed, typename TF, typename TE>
+    template_fit_batch_res_t template_fit_batch(const template_flux_cube& cube, TypeSeed& seed,
+        const vec<2,TF>& flux, const vec<2,TE>& err,
+        const template_fit_batch_params& params = template_fit_batch_params()) {
+
+        vif_check(flux.dims == err.dims, "incompatible flux and error dimensions (",
+            flux.dims, " vs ", err.dims, ")");
+        vif_check(flux.dims[1] == cube.nfilter(), "incompatible number of filters between "
+            "the photometry and the template cube (", flux.dims[1], " vs ", cube.nfilter(), ")");
+
+        const uint_t nobj = flux.dims[0];
+        const uint_t nfilter = cube.nfilter();
+        const uint_t nsed = cube.nsed();
+        const uint_t nz = cube.nz();
+        const uint_t nsim = params.nsim;
+
+        template_fit_batch_res_t res;
+        res.bfit_z = replicate(npos, nobj);
+        res.bfit = replicate(npos, nobj);
+        res.chi2 = replicate(dnan, nobj);
+        res.amp = replicate(dnan, nobj);
+        if (params.chi2_grid) {
+            res.chi2_z = replicate(dnan, nobj, nz);
+        }
+        if (nsim > 0) {
+            res.z_sim = replicate(npos, nobj, nsim);
+            res.sed_sim = replicate(npos, nobj, nsim);
+            res.amp_sim = replicate(dnan, nobj, nsim);
+        }
+
+        const std::uint32_t base_seed = seed();
+
+        auto process = [&](uint_t i0, uint_t i1) {
+            // Work space
+            vec1d num(nsed), den(nz*nsed), tchi2(nsed);
+            vec1d tflux(nfilter), terr(nfilter), fsim(nfilter), model(nfilter);
+            std::unique_ptr<bool[]> ulim(new bool[nfilter]);
+            vec1u idm, idu;
+
+            for (uint_t i = i0; i < i1; ++i) {
+                // Select measurements
+                idm.clear();
+                idu.clear();
+                for (uint_t f : range(nfilter)) {
+                    double fl = flux.safe(i,f), e = err.safe(i,f);
+                    if (!is_finite(fl) || !is_finite(e) || e == 0.0) continue;
+
+                    if (params.ulim && e < 0) {
+                        idu.push_back(f);
+                    } else {
+                        idm.push_back(f);
+                    }
+                }
+
+                // Divide fluxes by errors; templates are divided on the fly
+                const uint_t nm = idm.size(), nu = idu.size();
+                const uint_t nuse = nm + nu;
+                if (nuse == 0) continue;
+
+                for (uint_t k : range(nuse)) {
+                    uint_t f = (k < nm ? idm.safe[k] : idu.safe[k-nm]);
+                    terr.safe[k] = abs(err.safe(i,f));
+                    tflux.safe[k] = flux.safe(i,f)/terr.safe[k];
+                    ulim[k] = k >= nm;
+                }
+
+                // Normalization of the templates against the measured values, which does
+                // not change between realizations
+                for (uint_t iz : range(nz)) {
+                    double* tden = den.data.data() + iz*nsed;
+                    std::fill(tden, tden + nsed, 0.0);
+                    for (uint_t k : range(nm)) {
+                        impl::simd_impl::axpy_sq(1.0/sqr(terr.safe[k]),
+                            cube.templates(iz, idm.safe[k]), tden, nsed);
+                    }
+                }
+
+                // Fit one realization of the photometry (stored in 'fsim', divided by errors)
+                // and return the best fit
+                auto fit = [&](double* chi2_z, uint_t& bz, uint_t& bt, double& bamp) {
+                    double best = dinf;
+                    bz = bt = npos;
+                    bamp = dnan;
+
+                    double s2 = 0.0;
+                    for (uint_t k : range(nm)) {
+                        s2 += sqr(fsim.safe[k]);
+                    }
+
+                    for (uint_t iz : range(nz)) {
+                        const double* tden = den.data.data() + iz*nsed;
+                        std::fill(num.data.begin(), num.data.end(), 0.0);
+                        for (uint_t k : range(nm)) {
+                            impl::simd_impl::axpy(fsim.safe[k]/terr.safe[k],
+                                cube.templates(iz, idm.safe[k]), num.data.data(), nsed);
+                        }
+
+                        // Chi2 of the measured values, from the sums computed above. This
+                        // loses precision when the chi2 is much smaller than 's2' (very good
+                        // fits of bright sources), so the chi2 of the best template is
+                        // computed again from the residuals below. The ranking of templates
+                        // whose chi2 differ by less than ~1e-15*s2 is not reliable.
+                        if (params.renorm) {
+                            for (uint_t t = 0; t < nsed; ++t) {
+                                tchi2.safe[t] = s2 - sqr(num.safe[t])/tden[t];
+                            }
+                        } else {
+                            for (uint_t t = 0; t < nsed; ++t) {
+                                tchi2.safe[t] = s2 - 2.0*num.safe[t] + tden[t];
+                            }
+                        }
+
+                        if (nu > 0) {
+                            // Upper limits
+                            for (uint_t t : range(nsed)) {
+                                for (uint_t k : range(nuse)) {
+                                    model.safe[k] = cube.templates(iz,
+                                        k < nm ? idm.safe[k] : idu.safe[k-nm])[t]/terr.safe[k];
+                                }
+
+                                if (params.renorm) {
+                                    double a = (tden[t] > 0.0 ? num.safe[t]/tden[t] : 0.0);
+                                    tchi2.safe[t] = impl::template_fit_impl::fit_ulim_amp(
+                                        fsim.data.data(), model.data.data(), ulim.get(), nuse, a);
+                                } else {
+                                    for (uint_t k : range(nm, nuse)) {
+                                        tchi2.safe[t] += limweight(fsim.safe[k] - model.safe[k]);
+                                    }
+                                }
+                            }
+                        }
+
+                        uint_t tb = npos;
+                        double tbest = dinf;
+                        for (uint_t t = 0; t < nsed; ++t) {
+                            if (tchi2.safe[t] < tbest) {
+                                tbest = tchi2.safe[t];
+                                tb = t;
+                            }
+                        }
+
+                        if (tb != npos && !(nu > 0 && params.renorm)) {
+                            // Chi2 of the best template from its residuals (the chi2
+                            // returned by 'fit_ulim_amp()' already is)
+                            const double a = (params.renorm ? num.safe[tb]/tden[tb] : 1.0);
+                            tbest = 0.0;
+                            for (uint_t k : range(nuse)) {
+                                double d = fsim.safe[k] - a*cube.templates(iz,
+                                    k < nm ? idm.safe[k] : idu.safe[k-nm])[tb]/terr.safe[k];
+                                tbest += (k < nm ? d*d : limweight(d));
+                            }
+                        }
+
+                        if (chi2_z) chi2_z[iz] = tbest;
+                        if (tbest < best) {
+                            best = tbest;
+                            bz = iz;
+                            bt = tb;
+                        }
+                    }
+
+                    if (bt == npos) return dnan;
+
+                    // Amplitude of the best fit
+                    const double* tden = den.data.data() + bz*nsed;
+                    double tnum = 0.0;
+                    for (uint_t k : range(nm)) {
+                        tnum += fsim.safe[k]*cube.templates(bz, idm.safe[k])[bt]/terr.safe[k];
+                    }
+
+                    bamp = (tden[bt] > 0.0 ? tnum/tden[bt] : dnan);
+                    if (nu > 0) {
+                        for (uint_t k : range(nuse)) {
+                            model.safe[k] = cube.templates(bz,
+                                k < nm ? idm.safe[k] : idu.safe[k-nm])[bt]/terr.safe[k];
+                        }
+
+                        double a = (is_finite(bamp) ? bamp : 0.0);
+                        impl::template_fit_impl::fit_ulim_amp(
+                            fsim.data.data(), model.data.data(), ulim.get(), nuse, a);
+                        bamp = a;
+                    }
+
+                    return best;
+                };
+
+                // Best fit
+                for (uint_t k : range(nuse)) {
+                    fsim.safe[k] = tflux.safe[k];
+                }
+
+                uint_t bz, bt;
+                double bamp;
+                res.chi2.safe[i] = fit(params.chi2_grid ? &res.chi2_z.safe(i,0) : nullptr,
+                    bz, bt, bamp);
+                res.bfit_z.safe[i] = bz;
+                res.bfit.safe[i] = bt;
+                res.amp.safe[i] = bamp;
+
+                // Random realizations of the measured values
+                if (nsim > 0) {
+                    std::seed_seq sseq{base_seed, std::uint32_t(i), std::uint32_t(i >> 32)};
+                    seed_t tseed(sseq);
+                    for (uint_t s : range(nsim)) {
+                        for (uint_t k : range(nm)) {
+                            fsim.safe[k] = tflux.safe[k] + randomn(tseed);
+                        }
+
+                        fit(nullptr, bz, bt, bamp);
+                        res.z_sim.safe(i,s) = bz;
+                        res.sed_sim.safe(i,s) = bt;
+                        res.amp_sim.safe(i,s) = bamp;
+                    }
+                }
+            }
+        };
+
+        if (params.thread > 1 && nobj > 1) {
+            thread::task_pool pool(params.thread);
+            pool.execute_chunks(process, 0, nobj, 1);
+        } else {
+            process(0, nobj);
+        }
+
+        return res;
+    }
+}
 }
 
 #endif
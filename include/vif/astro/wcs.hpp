@@ -233,11 +233,164 @@ namespace astro {
 
 namespace impl {
 namespace wcs_impl {
-    inline void cure_header(fits::header& hdr) {
+    // SIP distortion polynomials (Shupe et al. 2005), applied to the pixel offsets from
+    // CRPIX before the linear transformation. Coefficients are stored as c[p][q] for the
+    // term u^p*v^q.
+    struct sip_distortion {
+        static const uint_t max_order = 9;
+
+        uint_t a_order = 0, b_order = 0, ap_order = 0, bp_order = 0;
+        double a[max_order+1][max_order+1] = {};
+        double b[max_order+1][max_order+1] = {};
+        double ap[max_order+1][max_order+1] = {};
+        double bp[max_order+1][max_order+1] = {};
+
+        bool empty() const {
+            return a_order == 0 && b_order == 0;
+        }
+
+        static double eval(const double (&c)[max_order+1][max_order+1], uint_t order,
+            double u, double v) {
+
+            double f = 0.0;
+            for (uint_t p = order+1; p-- > 0;) {
+                double fv = 0.0;
+                for (uint_t q = order-p+1; q-- > 0;) {
+                    fv = fv*v + c[p][q];
+                }
+
+                f = f*u + fv;
+            }
+
+            return f;
+        }
+
+        static double eval(const double (&c)[max_order+1][max_order+1], uint_t order,
+            double u, double v, double& dfdu, double& dfdv) {
+
+            double f = 0.0;
+            dfdu = dfdv = 0.0;
+            for (uint_t p = order+1; p-- > 0;) {
+                double fv = 0.0, dfv = 0.0;
+                for (uint_t q = order-p+1; q-- > 0;) {
+                    dfv = dfv*v + fv;
+                    fv = fv*v + c[p][q];
+                }
+
+                dfdu = dfdu*u + f;
+                dfdv = dfdv*u + dfv;
+                f = f*u + fv;
+            }
+
+            return f;
+        }
+
+        // Distorted pixel offsets from undistorted ones
+        void forward(double& u, double& v) const {
+            double du = eval(a, a_order, u, v);
+            double dv = eval(b, b_order, u, v);
+            u += du;
+            v += dv;
+        }
+
+        // Undistorted pixel offsets from distorted ones. The AP and BP polynomials are only
+        // approximate (and may be missing), so they are just used as a starting point for
+        // Newton iterations on the forward polynomials.
+        void inverse(double& u, double& v) const {
+            double tu = u, tv = v;
+            if (ap_order != 0 || bp_order != 0) {
+                tu += eval(ap, ap_order, u, v);
+                tv += eval(bp, bp_order, u, v);
+            }
+
+            for (uint_t iter = 0; iter < 20; ++iter) {
+                double dadu, dadv, dbdu, dbdv;
+                double fu = tu + eval(a, a_order, tu, tv, dadu, dadv) - u;
+                double fv = tv + eval(b, b_order, tu, tv, dbdu, dbdv) - v;
+
+                double j11 = 1.0 + dadu, j12 = dadv;
+                double j21 = dbdu,       j22 = 1.0 + dbdv;
+                double det = j11*j22 - j12*j21;
+                if (det == 0.0 || !std::isfinite(det)) break;
+
+                double du = (j22*fu - j12*fv)/det;
+                double dv = (j11*fv - j21*fu)/det;
+                tu -= du;
+                tv -= dv;
+
+                if (std::abs(du) < 1e-12 && std::abs(dv) < 1e-12) break;
+            }
+
+            u = tu;
+            v = tv;
+        }
+    };
+
+    // Read SIP distortion coefficients from parsed header keywords.
+    // Returns false if the header does not follow the SIP convention or uses an
+    // unsupported polynomial order.
+    inline bool read_sip(const fits::parsed_header& keys, sip_distortion& sip) {
+        sip = sip_distortion{};
+
+        uint_t nsip = 0;
+        for (auto& k : keys) {
+            std::string v = trim(k.value, "' ");
+            if (k.key == "CTYPE1" || k.key == "CTYPE2") {
+                if (!ends_with(v, "-SIP")) return false;
+                ++nsip;
+                continue;
+            }
+
+            uint_t p = 0, q = 0;
+            vec1s parts = split(k.key, "_");
+            if (parts.size() == 2 && parts[1] == "ORDER") {
+                uint_t order = 0;
+                if (!from_string(v, order) || order > sip_distortion::max_order) return false;
+                if      (parts[0] == "A")  sip.a_order = order;
+                else if (parts[0] == "B")  sip.b_order = order;
+                else if (parts[0] == "AP") sip.ap_order = order;
+                else if (parts[0] == "BP") sip.bp_order = order;
+            } else if (parts.size() == 3 && (parts[0] == "A" || parts[0] == "B" ||
+                parts[0] == "AP" || parts[0] == "BP")) {
+                double c = 0.0;
+                if (!from_string(parts[1], p) || !from_string(parts[2], q) ||
+                    p > sip_distortion::max_order || q > sip_distortion::max_order ||
+                    !from_string(v, c)) {
+                    return false;
+                }
+
+                if      (parts[0] == "A")  sip.a[p][q] = c;
+                else if (parts[0] == "B")  sip.b[p][q] = c;
+                else if (parts[0] == "AP") sip.ap[p][q] = c;
+                else if (parts[0] == "BP") sip.bp[p][q] = c;
+            }
+        }
+
+        // Terms beyond the declared order are ignored, as in other SIP implementations
+        auto truncate = [](double (&c)[sip_distortion::max_order+1][sip_distortion::max_order+1],
+            uint_t order) {
+            for (uint_t p = 0; p <= sip_distortion::max_order; ++p)
+            for (uint_t q = 0; q <= sip_distortion::max_order; ++q) {
+                if (p+q > order) c[p][q] = 0.0;
+            }
+        };
+
+        truncate(sip.a, sip.a_order);
+        truncate(sip.b, sip.b_order);
+        truncate(sip.ap, sip.ap_order);
+        truncate(sip.bp, sip.bp_order);
+
+        return nsip == 2 && !sip.empty();
+    }
+
+    // Prepare a header for ingestion by WCSlib. If 'sip' is provided, SIP distortion
+    // keywords are read there (to be handled by native_projection) instead of being
+    // ignored with a warning.
+    inline void cure_header(fits::header& hdr, sip_distortion* sip = nullptr) {
         auto keys = fits::parse_header(hdr);
 
         bool cpdis_err = false;
-        bool sipdis_err = false;
+        bool has_sip = false;
 
         vec1b keep = replicate(true, keys.size());
         for (uint_t i : range(keys)) {
@@ -260,13 +413,18 @@ namespace wcs_impl {
                     cpdis_err = true;
                 }
             } else if (regex_match(k.key, "^[AB]P?_([0-9]+_[0-9]+|ORDER)$")) {
-                // Identify use of SIP distortion with A and B matrices which gives incorrect results
-                if (!sipdis_err) {
-                    warning("this header contains one or more SIP distortion keyword "
-                        "which are not properly handled (A_*_* and B_*_* matrices)");
-                    warning("the keywords will be removed and distortion will be ignored");
-                    sipdis_err = true;
-                }
+                // Identify use of SIP distortion with A and B matrices which gives incorrect
+                // results with WCSlib
+                has_sip = true;
+            }
+        }
+
+        if (has_sip) {
+            // These can be handled by native_projection, if the caller supports it
+            if (!sip || !read_sip(keys, *sip)) {
+                warning("this header contains one or more SIP distortion keyword "
+                    "which are not properly handled (A_*_* and B_*_* matrices)");
+                warning("the keywords will be removed and distortion will be ignored");
             }
         }
 
@@ -280,7 +438,7 @@ namespace wcs_impl {
             }
         }
 
-        if (sipdis_err) {
+        if (has_sip) {
             for (uint_t i : range(keys)) {
                 auto& k = keys[i];
 
@@ -341,6 +499,328 @@ namespace wcs_impl {
         static std::mutex m;
         return m;
     }
+
+#ifndef NO_WCSLIB
+    // Native implementation of the most common celestial projections (TAN, SIN, CAR),
+    // with optional SIP distortions. The parameters are taken from the WCSlib structure
+    // after it has been set, so the conventions and defaults are the same, but the
+    // conversions do not need any memory allocation and are much cheaper.
+    struct native_projection {
+        enum class kind {
+            none, tan, sin, car
+        };
+
+        kind proj = kind::none;
+
+        // Linear transformation, from pixel offsets to intermediate world coordinates
+        double crpix[2] = {0.0, 0.0};
+        double piximg[4] = {1.0, 0.0, 0.0, 1.0};
+        double imgpix[4] = {1.0, 0.0, 0.0, 1.0};
+
+        // Projection
+        double r0 = 0.0;
+
+        // Spherical rotation, in the same format as WCSlib's celprm::euler, and the cosine
+        // and sine of the native longitude of the celestial pole
+        double euler[5] = {0.0, 0.0, 0.0, 1.0, 0.0};
+        double cphip = 1.0, sphip = 0.0;
+
+        sip_distortion sip;
+
+        bool valid() const {
+            return proj != kind::none;
+        }
+
+        // SIP distortions are only applied by this implementation: WCSlib does not know about
+        // them, so they would be ignored if the WCSlib path was used instead
+        bool needs_native() const {
+            return !sip.empty();
+        }
+
+        // Setup from a WCSlib structure, which must have been set with wcsset().
+        // Returns false if this WCS is not supported (the projection is then disabled).
+        bool setup(const wcsprm& w, const sip_distortion& tsip) {
+            proj = kind::none;
+
+            if (w.naxis != 2 || w.lng != 0 || w.lat != 1 || w.ntab != 0) return false;
+            if (w.cel.offset || w.cel.prj.x0 != 0.0 || w.cel.prj.y0 != 0.0) return false;
+            if (!w.lin.unity && (!w.lin.piximg || !w.lin.imgpix)) return false;
+#ifndef WCSLIB_NO_DIS
+            if (w.lin.dispre || w.lin.disseq) return false;
+#endif
+
+            std::string code = w.cel.prj.code;
+            kind tproj = kind::none;
+            if (code == "TAN") {
+                tproj = kind::tan;
+            } else if (code == "SIN") {
+                // Only orthographic, not slant orthographic
+                if (w.cel.prj.pv[1] != 0.0 || w.cel.prj.pv[2] != 0.0) return false;
+                tproj = kind::sin;
+            } else if (code == "CAR") {
+                tproj = kind::car;
+            } else {
+                return false;
+            }
+
+            // SIP is only defined for TAN
+            if (!tsip.empty() && tproj != kind::tan) return false;
+
+            for (uint_t i : range(2)) {
+                crpix[i] = w.crpix[i];
+            }
+            if (w.lin.unity) {
+                // WCSlib does not compute the matrices in this case
+                piximg[0] = w.cdelt[0]; piximg[1] = 0.0;
+                piximg[2] = 0.0;        piximg[3] = w.cdelt[1];
+                imgpix[0] = 1.0/w.cdelt[0]; imgpix[1] = 0.0;
+                imgpix[2] = 0.0;            imgpix[3] = 1.0/w.cdelt[1];
+            } else {
+                for (uint_t i : range(4)) {
+                    piximg[i] = w.lin.piximg[i];
+                    imgpix[i] = w.lin.imgpix[i];
+                }
+            }
+
+            for (uint_t i : range(5)) {
+                euler[i] = w.cel.euler[i];
+            }
+
+            cphip = cos(euler[2]*dpi/180.0);
+            sphip = sin(euler[2]*dpi/180.0);
+
+            r0 = w.cel.prj.r0;
+            sip = tsip;
+            proj = tproj;
+
+            return true;
+        }
+
+        // Convert 1-based pixel coordinates (FITS convention) into celestial coordinates
+        // (in degrees). Points outside of the projection are set to NaN.
+        void pix2world(double x, double y, double& lng, double& lat) const {
+            const double d2r = dpi/180.0;
+
+            // Linear transformation
+            double u = x - crpix[0];
+            double v = y - crpix[1];
+            if (!sip.empty()) {
+                sip.forward(u, v);
+            }
+
+            double ix = piximg[0]*u + piximg[1]*v;
+            double iy = piximg[2]*u + piximg[3]*v;
+
+            if (proj == kind::car && euler[4] == 0.0) {
+                // Native and celestial poles are aligned, no rotation needed
+                double phi = ix/(r0*d2r), theta = iy/(r0*d2r);
+                if (euler[1] == 0.0) {
+                    lng = phi + fmod(euler[0] - 180.0 - euler[2], 360.0);
+                    lat = theta;
+                } else {
+                    lng = fmod(euler[0] + euler[2], 360.0) - phi;
+                    lat = -theta;
+                }
+
+                normalize_lng_(lng);
+                return;
+            }
+
+            // Projection plane to native spherical coordinates, as a unit vector:
+            // cos(theta)*cos(phi), cos(theta)*sin(phi), and sin(theta)
+            double cx, cy, sthe;
+            switch (proj) {
+            case kind::tan : {
+                double d = 1.0/sqrt(r0*r0 + ix*ix + iy*iy);
+                cx = -iy*d;
+                cy = ix*d;
+                sthe = r0*d;
+                break;
+            }
+            case kind::sin : {
+                double r2 = (ix*ix + iy*iy)/(r0*r0);
+                if (r2 > 1.0) {
+                    if (r2 > 1.0 + 1e-13) {
+                        lng = lat = dnan;
+                        return;
+                    }
+
+                    r2 = 1.0;
+                }
+
+                cx = -iy/r0;
+                cy = ix/r0;
+                sthe = sqrt(1.0 - r2);
+                break;
+            }
+            case kind::car : {
+                double phi = ix/r0, theta = iy/r0;
+                double cthe = cos(theta);
+                cx = cthe*cos(phi);
+                cy = cthe*sin(phi);
+                sthe = sin(theta);
+                break;
+            }
+            default : {
+                lng = lat = dnan;
+                return;
+            }
+            }
+
+            // Native to celestial spherical coordinates
+            double ccos = cx*cphip + cy*sphip; // cos(theta)*cos(phi - phi_p)
+            double csin = cy*cphip - cx*sphip; // cos(theta)*sin(phi - phi_p)
+
+            double tx = sthe*euler[4] - ccos*euler[3];
+            double ty = -csin;
+            double tz = sthe*euler[3] + ccos*euler[4];
+
+            double dlng;
+            if (tx != 0.0 || ty != 0.0) {
+                dlng = atan2(ty, tx)/d2r;
+            } else {
+                // Celestial pole, change of origin of longitude
+                double dphi = (ccos != 0.0 || csin != 0.0 ? atan2(csin, ccos)/d2r : 0.0);
+                dlng = (euler[1] < 90.0 ? dphi + 180.0 : -dphi);
+            }
+
+            lng = euler[0] + dlng;
+            normalize_lng_(lng);
+
+            if (std::abs(tz) > 0.99) {
+                // More accurate close to the poles
+                lat = std::copysign(acos(sqrt(tx*tx + ty*ty)), tz)/d2r;
+            } else {
+                lat = asin(tz)/d2r;
+            }
+        }
+
+        // Convert celestial coordinates (in degrees) into 1-based pixel coordinates (FITS
+        // convention). Points outside of the projection are set to NaN.
+        void world2pix(double lng, double lat, double& x, double& y) const {
+            const double d2r = dpi/180.0;
+
+            if (proj == kind::car && euler[4] == 0.0) {
+                // Native and celestial poles are aligned, no rotation needed
+                double phi, theta;
+                if (euler[1] == 0.0) {
+                    phi = fmod(lng + fmod(euler[2] - 180.0 - euler[0], 360.0), 360.0);
+                    theta = lat;
+                } else {
+                    phi = fmod(fmod(euler[2] + euler[0], 360.0) - lng, 360.0);
+                    theta = -lat;
+                }
+
+                normalize_phi_(phi);
+                linear_inverse_(r0*phi*d2r, r0*theta*d2r, x, y);
+                return;
+            }
+
+            // Celestial to native spherical coordinates, as a unit vector:
+            // cos(theta)*cos(phi - phi_p), cos(theta)*sin(phi - phi_p), and sin(theta)
+            double dlng = (lng - euler[0])*d2r;
+            double slat = sin(lat*d2r), clat = cos(lat*d2r);
+            double clng = cos(dlng);
+
+            double tx = slat*euler[4] - clat*euler[3]*clng;
+            double ty = -clat*sin(dlng);
+            double tz = slat*euler[3] + clat*euler[4]*clng;
+
+            // Native spherical coordinates to projection plane
+            double ix, iy;
+            switch (proj) {
+            case kind::tan : {
+                if (tz <= 0.0) {
+                    x = y = dnan;
+                    return;
+                }
+
+                ix =  r0*(ty*cphip + tx*sphip)/tz;
+                iy = -r0*(tx*cphip - ty*sphip)/tz;
+                break;
+            }
+            case kind::sin : {
+                if (tz < 0.0) {
+                    x = y = dnan;
+                    return;
+                }
+
+                ix =  r0*(ty*cphip + tx*sphip);
+                iy = -r0*(tx*cphip - ty*sphip);
+                break;
+            }
+            case kind::car : {
+                double dphi;
+                if (tx != 0.0 || ty != 0.0) {
+                    dphi = atan2(ty, tx)/d2r;
+                } else {
+                    // Native pole, change of origin of longitude
+                    dphi = (euler[1] < 90.0 ? dlng/d2r - 180.0 : -dlng/d2r);
+                }
+
+                double phi = euler[2] + dphi;
+                normalize_phi_(phi);
+
+                double theta;
+                if (std::abs(tz) > 0.99) {
+                    // More accurate close to the poles
+                    theta = std::copysign(acos(sqrt(tx*tx + ty*ty)), tz);
+                } else {
+                    theta = asin(tz);
+                }
+
+                ix = r0*phi*d2r;
+                iy = r0*theta;
+                break;
+            }
+            default : {
+                x = y = dnan;
+                return;
+            }
+            }
+
+            linear_inverse_(ix, iy, x, y);
+        }
+
+    private :
+
+        // Normalize celestial longitude as in WCSlib
+        void normalize_lng_(double& lng) const {
+            if (euler[0] >= 0.0) {
+                if (lng < 0.0) lng += 360.0;
+            } else {
+                if (lng > 0.0) lng -= 360.0;
+            }
+
+            if (lng > 360.0) {
+                lng -= 360.0;
+            } else if (lng < -360.0) {
+                lng += 360.0;
+            }
+        }
+
+        // Normalize native longitude as in WCSlib
+        static void normalize_phi_(double& phi) {
+            if (phi > 180.0) {
+                phi -= 360.0;
+            } else if (phi < -180.0) {
+                phi += 360.0;
+            }
+        }
+
+        // Intermediate world coordinates to pixel coordinates
+        void linear_inverse_(double ix, double iy, double& x, double& y) const {
+            double u = imgpix[0]*ix + imgpix[1]*iy;
+            double v = imgpix[2]*ix + imgpix[3]*iy;
+            if (!sip.empty()) {
+                sip.inverse(u, v);
+            }
+
+            x = u + crpix[0];
+            y = v + crpix[1];
+        }
+    };
+#endif
 }
 }
 
@@ -360,6 +840,9 @@ namespace astro {
         uint_t ra_axis = 1, dec_axis = 0;
         uint_t x_axis = 1, y_axis = 0;
 
+        // Fast path for simple 2D projections, used instead of WCSlib when valid
+        impl::wcs_impl::native_projection native;
+
         explicit wcs(uint_t naxis = 2) : w(new wcsprm), nwcs(1) {
             w->flag = -1;
             wcsini(true, naxis, w);
@@ -371,7 +854,8 @@ namespace astro {
 
         explicit wcs(fits::header hdr) {
             // Cure header for ingestion by WCSlib
-            impl::wcs_impl::cure_header(hdr);
+            impl::wcs_impl::sip_distortion sip;
+            impl::wcs_impl::cure_header(hdr, &sip);
 
             // Feed the header to WCSLib to extract the astrometric parameters
             int nreject = 0, status = 0;
@@ -471,6 +955,14 @@ namespace astro {
                 report_errors();
                 wcsvfree(&nwcs, &w);
                 w = nullptr;
+                return;
+            }
+
+            // Use native implementation if possible
+            if (!native.setup(*w, sip) && !sip.empty()) {
+                warning("this header contains SIP distortion keywords, which are only "
+                    "supported for 2D TAN projections");
+                warning("the keywords will be removed and distortion will be ignored");
             }
         }
 
@@ -552,6 +1044,7 @@ namespace astro {
             std::swap(dec_axis, tw.dec_axis);
             std::swap(x_axis, tw.x_axis);
             std::swap(y_axis, tw.y_axis);
+            std::swap(native, tw.native);
         }
 
         wcs& operator = (wcs&& tw) noexcept {
@@ -568,6 +1061,7 @@ namespace astro {
             dec_axis = tw.dec_axis;
             x_axis = tw.x_axis;
             y_axis = tw.y_axis;
+            native = tw.native; tw.native = impl::wcs_impl::native_projection{};
 
             return *this;
         }
@@ -582,11 +1076,18 @@ namespace astro {
                 int status = wcsset(w);
                 vif_check(status == 0, "error updating WCS structure");
                 isset = true;
+
+                vif_check(native.setup(*w, native.sip) || !native.needs_native(),
+                    "this WCS has SIP distortion keywords, which are only supported for 2D "
+                    "TAN projections");
             }
         }
 
+        // Call after modifying the WCSlib structure, then call 'update()' before using it
+        // again. The SIP distortions, if any, are kept.
         void flag_dirty() {
             isset = false;
+            native.proj = impl::wcs_impl::native_projection::kind::none;
         }
 
         void report_errors() const {
@@ -727,6 +1228,23 @@ namespace astro {
             return;
         }
 
+        vif_check(w.native.valid() || !w.native.needs_native(), "this WCS has SIP distortions "
+            "and was modified, call update() before using it");
+
+        if (w.native.valid()) {
+            x.resize(ra.dims);
+            y.resize(ra.dims);
+
+            for (uint_t i : range(npt)) {
+                double tx, ty;
+                w.native.world2pix(ra.safe[i], dec.safe[i], tx, ty);
+                x.safe[i] = tx;
+                y.safe[i] = ty;
+            }
+
+            return;
+        }
+
         uint_t naxis = w.axis_count();
         vec2d world(npt, naxis);
         for (uint_t i : range(npt)) {
@@ -764,6 +1282,23 @@ namespace astro {
             return;
         }
 
+        vif_check(w.native.valid() || !w.native.needs_native(), "this WCS has SIP distortions "
+            "and was modified, call update() before using it");
+
+        if (w.native.valid()) {
+            ra.resize(x.dims);
+            dec.resize(x.dims);
+
+            for (uint_t i : range(npt)) {
+                double tra, tdec;
+                w.native.pix2world(x.safe[i], y.safe[i], tra, tdec);
+                ra.safe[i] = tra;
+                dec.safe[i] = tdec;
+            }
+
+            return;
+        }
+
         uint_t naxis = w.axis_count();
         vec2d pix(npt, naxis);
         for (uint_t i : range(npt)) {
@@ -791,6 +1326,17 @@ namespace astro {
         static_assert(!std::is_same<T,T>::value, "WCS support is disabled, "
             "please enable the WCSLib library to use this function");
 #else
+        vif_check(w.native.valid() || !w.native.needs_native(), "this WCS has SIP distortions "
+            "and was modified, call update() before using it");
+
+        if (w.native.valid()) {
+            double tx, ty;
+            w.native.world2pix(ra, dec, tx, ty);
+            x = tx;
+            y = ty;
+            return;
+        }
+
         vec<1,T> tra  = replicate(ra,  1);
         vec<1,T> tdec = replicate(dec, 1);
         vec<1,V> tx;
@@ -811,6 +1357,17 @@ namespace astro {
         static_assert(!std::is_same<T,T>::value, "WCS support is disabled, "
             "please enable the WCSLib library to use this function");
 #else
+        vif_check(w.native.valid() || !w.native.needs_native(), "this WCS has SIP distortions "
+            "and was modified, call update() before using it");
+
+        if (w.native.valid()) {
+            double tra, tdec;
+            w.native.pix2world(x, y, tra, tdec);
+            ra = tra;
+            dec = tdec;
+            return;
+        }
+
         vec<1,T> tx = replicate(x, 1);
         vec<1,T> ty = replicate(y, 1);
         vec<1,V> tra;
@@ -35,6 +35,16 @@ namespace meta {
 }
 
 namespace impl {
+    // Base class of all lazy expressions, see bits/lazy.hpp
+    struct lazy_expr_base {};
+
+    // Evaluate a lazy expression into a vector or a view (defined in bits/lazy.hpp)
+    template<std::size_t Dim, typename Type, typename E>
+    void lazy_assign(vec<Dim,Type>& v, const E& e);
+
+    template<std::size_t Dim, typename Type, typename E>
+    void lazy_assign(vec<Dim,Type*>& v, const E& e);
+
     namespace meta_impl {
         template<typename T>
         struct is_vec_ : std::false_type {};
@@ -87,6 +97,10 @@ namespace meta {
     template<typename T>
     using is_scalar = impl::meta_impl::is_scalar_<typename std::decay<T>::type>;
 
+    // Helper to check if a given type is a lazy expression (see lazy()).
+    template<typename T>
+    using is_lazy = std::is_base_of<impl::lazy_expr_base, typename std::decay<T>::type>;
+
     // Return the data type of the provided type
     template<typename T>
     struct data_type {
@@ -0,0 +1,371 @@
+#ifndef VIF_INCLUDING_CORE_VEC_BITS
+#error this file is not meant to be included separately, include "vif/core/vec.hpp" instead
+#endif
+
+namespace vif {
+    ////////////////////////////////////////////
+    //           Lazy expressions             //
+    ////////////////////////////////////////////
+
+    // Operators and vectorized functions (see VIF_VECTORIZE) applied to a lazy expression do
+    // not compute anything: they build a tree describing the computation, which is evaluated
+    // in a single loop when the expression is assigned to a vector or a view, or when calling
+    // concretise(). This avoids allocating and filling one temporary vector for each
+    // intermediate result. A lazy expression is started by calling lazy() on a vector:
+    //
+    //     vec1d d = sqrt(sqr(lazy(x1) - x2) + sqr(lazy(y1) - y2))*w;
+    //
+    // Vectors used in a lazy expression are referenced, not copied (unless they are
+    // temporaries), so they must outlive the expression. Only element-wise operations can be
+    // made lazy; all the vectors in the expression must have the same dimensions.
+
+    namespace impl {
+    namespace lazy_impl {
+        // Base class of all expression nodes. Each node 'N' must provide:
+        //  - 'N::dim', the number of dimensions (0 for scalars),
+        //  - 'N::value_type', the type of the elements,
+        //  - 'dims', the dimensions of the expression,
+        //  - 'eval(i)', which returns the value of the element 'i',
+        //  - 'refers_to(p, direct)', which is true if the node reads data from the vector at
+        //    address 'p' through a view (or directly, if 'direct' is true).
+        template<typename N>
+        struct expr : lazy_expr_base {
+            // Evaluate the expression into a new vector
+            template<typename T = N>
+            vec<T::dim, typename T::value_type> concretise() const {
+                return vec<T::dim, typename T::value_type>(static_cast<const N&>(*this));
+            }
+        };
+
+        template<std::size_t D, typename N>
+        void merge_dims(std::array<std::size_t,D>& d, bool& set, const N& n, std::true_type) {
+            if (!set) {
+                d = n.dims;
+                set = true;
+            } else {
+                vif_check(d == n.dims, "incompatible dimensions in lazy expression (",
+                    d, " vs ", n.dims, ")");
+            }
+        }
+
+        template<std::size_t D, typename N>
+        void merge_dims(std::array<std::size_t,D>&, bool&, const N&, std::false_type) {}
+
+        template<std::size_t D>
+        uint_t size_of(const std::array<std::size_t,D>& d) {
+            uint_t n = 1;
+            for (auto s : d) {
+                n *= s;
+            }
+
+            return n;
+        }
+
+        template<std::size_t D, typename T>
+        bool refers_to_(const vec<D,T>& v, const void* p, bool direct) {
+            return direct && static_cast<const void*>(&v) == p;
+        }
+
+        template<std::size_t D, typename T>
+        bool refers_to_(const vec<D,T*>& v, const void* p, bool) {
+            return v.parent == p;
+        }
+
+        // Vector (or view) used by reference
+        template<std::size_t D, typename T>
+        struct vec_ref : expr<vec_ref<D,T>> {
+            static const std::size_t dim = D;
+            using value_type = meta::rtype_t<T>;
+
+            const vec<D,T>& v;
+            std::array<std::size_t,D> dims;
+
+            explicit vec_ref(const vec<D,T>& tv) : v(tv), dims(tv.dims) {}
+
+            const value_type& eval(uint_t i) const {
+                return impl::dref<T>(v.data[i]);
+            }
+
+            bool refers_to(const void* p, bool direct) const {
+                return refers_to_(v, p, direct);
+            }
+        };
+
+        // Temporary vector (or view), stored inside the expression
+        template<std::size_t D, typename T>
+        struct vec_value : expr<vec_value<D,T>> {
+            static const std::size_t dim = D;
+            using value_type = meta::rtype_t<T>;
+
+            vec<D,T> v;
+            std::array<std::size_t,D> dims;
+
+            explicit vec_value(vec<D,T>&& tv) : v(std::move(tv)), dims(v.dims) {}
+
+            const value_type& eval(uint_t i) const {
+                return impl::dref<T>(v.data[i]);
+            }
+
+            bool refers_to(const void* p, bool) const {
+                // Only views can refer to another vector
+                return refers_to_(v, p, false);
+            }
+        };
+
+        // Scalar value, used for all the elements
+        template<typename T>
+        struct scalar : expr<scalar<T>> {
+            static const std::size_t dim = 0;
+            using value_type = T;
+
+            T value;
+            std::array<std::size_t,0> dims;
+
+            explicit scalar(T t) : value(std::move(t)) {}
+
+            const value_type& eval(uint_t) const {
+                return value;
+            }
+
+            bool refers_to(const void*, bool) const {
+                return false;
+            }
+        };
+
+        // Function 'F' applied element-wise to the arguments
+        template<typename F, typename ... Args>
+        struct function : expr<function<F,Args...>> {
+            static const std::size_t dim = meta::max<std::size_t, Args::dim...>::value;
+            static_assert(meta::are_all_true<meta::bool_list<(Args::dim == 0 || Args::dim == dim)...>>::value,
+                "incompatible number of dimensions in lazy expression");
+
+            using value_type = typename std::decay<decltype(std::declval<const F&>()(
+                std::declval<const Args&>().eval(0)...))>::type;
+
+            F f;
+            std::tuple<Args...> args;
+            std::array<std::size_t,dim> dims;
+
+            template<std::size_t ... S>
+            void merge_dims_(meta::seq_t<S...>) {
+                bool set = false;
+                bool dummy[] = {(merge_dims(dims, set, std::get<S>(args),
+                    meta::bool_constant<Args::dim != 0>{}), true)...};
+                (void)dummy;
+            }
+
+            template<std::size_t ... S>
+            value_type eval_(uint_t i, meta::seq_t<S...>) const {
+                return f(std::get<S>(args).eval(i)...);
+            }
+
+            template<std::size_t ... S>
+            bool refers_to_(const void* p, bool direct, meta::seq_t<S...>) const {
+                bool res = false;
+                bool dummy[] = {(res = res || std::get<S>(args).refers_to(p, direct))...};
+                (void)dummy;
+                return res;
+            }
+
+            explicit function(F tf, Args ... ta) : f(std::move(tf)), args(std::move(ta)...) {
+                merge_dims_(meta::gen_seq_t<sizeof...(Args)>{});
+            }
+
+            value_type eval(uint_t i) const {
+                return eval_(i, meta::gen_seq_t<sizeof...(Args)>{});
+            }
+
+            bool refers_to(const void* p, bool direct) const {
+                return refers_to_(p, direct, meta::gen_seq_t<sizeof...(Args)>{});
+            }
+        };
+
+        // Build expression nodes out of vectors, scalars and other expressions
+        template<std::size_t D, typename T>
+        vec_ref<D,T> make_node(const vec<D,T>& v) {
+            return vec_ref<D,T>(v);
+        }
+
+        template<std::size_t D, typename T>
+        vec_value<D,T> make_node(vec<D,T>&& v) {
+            return vec_value<D,T>(std::move(v));
+        }
+
+        template<typename T>
+        typename std::enable_if<meta::is_lazy<T>::value, meta::decay_t<T>>::type
+        make_node(T&& t) {
+            return std::forward<T>(t);
+        }
+
+        template<typename T>
+        typename std::enable_if<!meta::is_lazy<T>::value && !meta::is_vec<T>::value,
+            scalar<meta::decay_t<T>>>::type
+        make_node(T&& t) {
+            return scalar<meta::decay_t<T>>(std::forward<T>(t));
+        }
+
+        template<typename T>
+        using node_t = decltype(make_node(std::declval<T>()));
+
+        template<typename F, typename ... Args>
+        function<F, node_t<Args>...> make_function(F f, Args&& ... args) {
+            return function<F, node_t<Args>...>(std::move(f), make_node(std::forward<Args>(args))...);
+        }
+
+        #define OPERATOR(op, name) \
+            struct op_##name { \
+                template<typename T, typename U> \
+                auto operator() (const T& t, const U& u) const -> decltype(t op u) { \
+                    return t op u; \
+                } \
+            };
+
+        OPERATOR(*, mul)
+        OPERATOR(/, div)
+        OPERATOR(%, mod)
+        OPERATOR(+, add)
+        OPERATOR(-, sub)
+        OPERATOR(==, eq)
+        OPERATOR(!=, neq)
+        OPERATOR(<, lt)
+        OPERATOR(<=, le)
+        OPERATOR(>, gt)
+        OPERATOR(>=, ge)
+
+        #undef OPERATOR
+
+        struct op_neg {
+            template<typename T>
+            auto operator() (const T& t) const -> decltype(-t) {
+                return -t;
+            }
+        };
+
+        // Operators
+        #define OPERATOR(op, name) \
+            template<typename T, typename U, typename enable = typename std::enable_if< \
+                meta::is_lazy<T>::value || meta::is_lazy<U>::value>::type> \
+            auto operator op (T&& t, U&& u) -> \
+                decltype(make_function(op_##name{}, \
+                    std::forward<T>(t), std::forward<U>(u))) { \
+                return make_function(op_##name{}, \
+                    std::forward<T>(t), std::forward<U>(u)); \
+            }
+
+        OPERATOR(*, mul)
+        OPERATOR(/, div)
+        OPERATOR(%, mod)
+        OPERATOR(+, add)
+        OPERATOR(-, sub)
+        OPERATOR(==, eq)
+        OPERATOR(!=, neq)
+        OPERATOR(<, lt)
+        OPERATOR(<=, le)
+        OPERATOR(>, gt)
+        OPERATOR(>=, ge)
+
+        #undef OPERATOR
+
+        template<typename E, typename enable = typename std::enable_if<meta::is_lazy<E>::value>::type>
+        auto operator - (E&& e) -> decltype(make_function(op_neg{},
+            std::forward<E>(e))) {
+            return make_function(op_neg{}, std::forward<E>(e));
+        }
+
+        // Compound assignment operators
+        #define OPERATOR(op, bop) \
+            template<std::size_t Dim, typename Type, typename E, typename enable = \
+                typename std::enable_if<meta::is_lazy<E>::value>::type> \
+            vec<Dim,Type>& operator op (vec<Dim,Type>& v, E&& e) { \
+                impl::lazy_assign(v, make_node(v) bop std::forward<E>(e)); \
+                return v; \
+            } \
+            template<std::size_t Dim, typename Type, typename E, typename enable = \
+                typename std::enable_if<meta::is_lazy<E>::value>::type> \
+            vec<Dim,Type*>& operator op (vec<Dim,Type*>&& v, E&& e) { \
+                impl::lazy_assign(v, make_node(v) bop std::forward<E>(e)); \
+                return v; \
+            }
+
+        OPERATOR(*=, *)
+        OPERATOR(/=, /)
+        OPERATOR(+=, +)
+        OPERATOR(-=, -)
+
+        #undef OPERATOR
+    }
+
+    // Evaluate a lazy expression into a vector
+    template<std::size_t Dim, typename Type, typename E>
+    void lazy_assign(vec<Dim,Type>& v, const E& e) {
+        static_assert(E::dim == Dim, "incompatible number of dimensions in assignment of "
+            "lazy expression");
+        static_assert(meta::vec_implicit_convertible<typename E::value_type,Type>::value,
+            "could not assign lazy expression of non-implicitly-convertible type");
+
+        if (v.dims == e.dims && !e.refers_to(&v, false)) {
+            // Operations are element-wise, so 'v' can be used in the expression as long as it
+            // is not accessed through a view
+            for (uint_t i : range(v)) {
+                v.safe[i] = e.eval(i);
+            }
+        } else if (e.refers_to(&v, true)) {
+            // Make a copy to prevent aliasing
+            vec<Dim,Type> t;
+            t.dims = e.dims;
+            t.resize();
+            for (uint_t i : range(t)) {
+                t.safe[i] = e.eval(i);
+            }
+
+            v = std::move(t);
+        } else {
+            v.dims = e.dims;
+            v.resize();
+            for (uint_t i : range(v)) {
+                v.safe[i] = e.eval(i);
+            }
+        }
+    }
+
+    // Evaluate a lazy expression into a view
+    template<std::size_t Dim, typename Type, typename E>
+    void lazy_assign(vec<Dim,Type*>& v, const E& e) {
+        static_assert(E::dim == Dim, "incompatible number of dimensions in assignment of "
+            "lazy expression");
+        static_assert(meta::vec_implicit_convertible<typename E::value_type,Type>::value,
+            "could not assign lazy expression of non-implicitly-convertible type");
+        vif_check(v.data.size() == lazy_impl::size_of(e.dims), "incompatible size in assignment "
+            "(assigning ", e.dims, " to ", v.dims, ")");
+
+        if (e.refers_to(v.parent, true)) {
+            // Make a copy to prevent aliasing
+            vec<Dim,typename E::value_type> t(e);
+            for (uint_t i : range(v)) {
+                *v.data[i] = t.safe[i];
+            }
+        } else {
+            for (uint_t i : range(v)) {
+                *v.data[i] = e.eval(i);
+            }
+        }
+    }
+    }
+
+    // Start a lazy expression from a vector or a view
+    template<std::size_t Dim, typename Type>
+    impl::lazy_impl::vec_ref<Dim,Type> lazy(const vec<Dim,Type>& v) {
+        return impl::lazy_impl::vec_ref<Dim,Type>(v);
+    }
+
+    template<std::size_t Dim, typename Type>
+    impl::lazy_impl::vec_value<Dim,Type> lazy(vec<Dim,Type>&& v) {
+        return impl::lazy_impl::vec_value<Dim,Type>(std::move(v));
+    }
+
+    template<typename E, typename enable = typename std::enable_if<meta::is_lazy<E>::value>::type>
+    meta::decay_t<E> lazy(E&& e) {
+        return std::forward<E>(e);
+    }
+
+}
@@ -71,6 +71,85 @@ namespace vif {
         auto get_element_(const vec<Dim,T>& t, uint_t i) -> decltype(t.safe[i]) {
             return t.safe[i];
         }
+
+        // Vectorized kernels for contiguous float and double vectors (see vif/core/simd.hpp).
+        // These functions return false if the operation cannot be vectorized, in which case
+        // the caller falls back to a regular loop.
+        template<typename OP>
+        struct simd_op_ {
+            using type = void;
+        };
+
+        template<> struct simd_op_<op_mul_t> { using type = simd_impl::op_mul; };
+        template<> struct simd_op_<op_div_t> { using type = simd_impl::op_div; };
+        template<> struct simd_op_<op_add_t> { using type = simd_impl::op_add; };
+        template<> struct simd_op_<op_sub_t> { using type = simd_impl::op_sub; };
+
+        template<typename OP, typename T>
+        using has_simd_op_ = meta::bool_constant<simd_impl::is_supported<T>::value &&
+            !std::is_void<typename simd_op_<OP>::type>::value>;
+
+        template<typename T, typename U>
+        using is_simd_scalar_ = meta::bool_constant<std::is_arithmetic<U>::value &&
+            std::is_same<typename std::common_type<T,U>::type, T>::value>;
+
+        template<typename OP, std::size_t Dim, typename T, typename U, typename V>
+        bool simd_apply_(vec<Dim,T>&, const U&, const V&) {
+            return false;
+        }
+
+        template<typename OP, std::size_t Dim, typename T, typename enable = typename std::enable_if<
+            has_simd_op_<OP,T>::value>::type>
+        bool simd_apply_(vec<Dim,T>& r, const vec<Dim,T>& a, const vec<Dim,T>& b) {
+            r.data.resize(a.data.size());
+            simd_impl::binary(typename simd_op_<OP>::type{}, a.data.data(), b.data.data(),
+                r.data.data(), a.data.size());
+            return true;
+        }
+
+        template<typename OP, std::size_t Dim, typename T, typename U, typename enable = typename std::enable_if<
+            has_simd_op_<OP,T>::value && is_simd_scalar_<T,U>::value>::type>
+        bool simd_apply_(vec<Dim,T>& r, const vec<Dim,T>& a, const U& b) {
+            r.data.resize(a.data.size());
+            simd_impl::binary(typename simd_op_<OP>::type{}, a.data.data(), T(b),
+                r.data.data(), a.data.size());
+            return true;
+        }
+
+        template<typename OP, std::size_t Dim, typename T, typename U, typename enable = typename std::enable_if<
+            has_simd_op_<OP,T>::value && is_simd_scalar_<T,U>::value>::type>
+        bool simd_apply_(vec<Dim,T>& r, const U& a, const vec<Dim,T>& b) {
+            r.data.resize(b.data.size());
+            simd_impl::binary(typename simd_op_<OP>::type{}, T(a), b.data.data(),
+                r.data.data(), b.data.size());
+            return true;
+        }
+
+        template<typename OP, std::size_t Dim, typename U, typename V>
+        bool simd_compare_(vec<Dim,bool>&, const U&, const V&) {
+            return false;
+        }
+
+        template<typename OP, std::size_t Dim, typename T, typename enable = typename std::enable_if<
+            simd_impl::is_supported<T>::value>::type>
+        bool simd_compare_(vec<Dim,bool>& r, const vec<Dim,T>& a, const vec<Dim,T>& b) {
+            simd_impl::compare(OP{}, a.data.data(), b.data.data(), r.data.data(), a.data.size());
+            return true;
+        }
+
+        template<typename OP, std::size_t Dim, typename T, typename U, typename enable = typename std::enable_if<
+            simd_impl::is_supported<T>::value && is_simd_scalar_<T,U>::value>::type>
+        bool simd_compare_(vec<Dim,bool>& r, const vec<Dim,T>& a, const U& b) {
+            simd_impl::compare(OP{}, a.data.data(), T(b), r.data.data(), a.data.size());
+            return true;
+        }
+
+        template<typename OP, std::size_t Dim, typename T, typename U, typename enable = typename std::enable_if<
+            simd_impl::is_supported<T>::value && is_simd_scalar_<T,U>::value>::type>
+        bool simd_compare_(vec<Dim,bool>& r, const U& a, const vec<Dim,T>& b) {
+            simd_impl::compare(OP{}, T(a), b.data.data(), r.data.data(), b.data.size());
+            return true;
+        }
     }
 
     #define VECTORIZE(op, sop) \
@@ -78,18 +157,24 @@ namespace vif {
         vec<Dim,typename impl::op_res_t<OP_TYPE(op),T,U>::type> operator op (const vec<Dim,T>& v, const vec<Dim,U>& u) { \
             vif_check(v.dims == u.dims, "incompatible dimensions in operator '" #op \
                 "' (", v.dims, " vs ", u.dims, ")"); \
-            vec<Dim,typename impl::op_res_t<OP_TYPE(op),T,U>::type> tv; tv.dims = v.dims; tv.reserve(v.size()); \
-            for (uint_t i : range(v)) { \
-                tv.data.push_back(impl::get_element_(v, i) op impl::get_element_(u, i)); \
+            vec<Dim,typename impl::op_res_t<OP_TYPE(op),T,U>::type> tv; tv.dims = v.dims; \
+            if (!impl::simd_apply_<OP_TYPE(op)>(tv, v, u)) { \
+                tv.reserve(v.size()); \
+                for (uint_t i : range(v)) { \
+                    tv.data.push_back(impl::get_element_(v, i) op impl::get_element_(u, i)); \
+                } \
             } \
             return tv; \
         } \
         template<std::size_t Dim, typename T, typename U, typename enable = typename std::enable_if< \
             meta::is_scalar<U>::value>::type> \
         vec<Dim,typename impl::op_res_t<OP_TYPE(op),T,U>::type> operator op (const vec<Dim,T>& v, const U& u) { \
-            vec<Dim,typename impl::op_res_t<OP_TYPE(op),T,U>::type> tv; tv.dims = v.dims; tv.reserve(v.size()); \
-            for (uint_t i : range(v)) { \
-                tv.data.push_back(impl::get_element_(v, i) op u); \
+            vec<Dim,typename impl::op_res_t<OP_TYPE(op),T,U>::type> tv; tv.dims = v.dims; \
+            if (!impl::simd_apply_<OP_TYPE(op)>(tv, v, u)) { \
+                tv.reserve(v.size()); \
+                for (uint_t i : range(v)) { \
+                    tv.data.push_back(impl::get_element_(v, i) op u); \
+                } \
             } \
             return tv; \
         } \
@@ -98,8 +183,10 @@ namespace vif {
         vec<Dim,T> operator op (vec<Dim,T>&& v, const vec<Dim,U>& u) { \
             vif_check(v.dims == u.dims, "incompatible dimensions in operator '" #op \
                 "' (", v.dims, " vs ", u.dims, ")"); \
-            for (uint_t i : range(v)) { \
-                v.data[i] sop impl::get_element_(u, i); \
+            if (!impl::simd_apply_<OP_TYPE(op)>(v, v, u)) { \
+                for (uint_t i : range(v)) { \
+                    v.data[i] sop impl::get_element_(u, i); \
+                } \
             } \
             return std::move(v); \
         } \
@@ -107,17 +194,22 @@ namespace vif {
             std::is_same<typename impl::op_res_t<OP_TYPE(op),T,U>::type, T>::value && \
             meta::is_scalar<U>::value>::type> \
         vec<Dim,T> operator op (vec<Dim,T>&& v, const U& u) { \
-            for (auto& t : v) { \
-                t sop u; \
+            if (!impl::simd_apply_<OP_TYPE(op)>(v, v, u)) { \
+                for (auto& t : v) { \
+                    t sop u; \
+                } \
             } \
             return std::move(v); \
         } \
         template<std::size_t Dim, typename T, typename U, typename enable = typename std::enable_if< \
             meta::is_scalar<U>::value>::type> \
         vec<Dim,typename impl::op_res_t<OP_TYPE(op),U,T>::type> operator op (const U& u, const vec<Dim,T>& v) { \
-            vec<Dim,typename impl::op_res_t<OP_TYPE(op),T,U>::type> tv; tv.dims = v.dims; tv.reserve(v.size()); \
-            for (uint_t i : range(v)) { \
-                tv.data.push_back(u op impl::get_element_(v, i)); \
+            vec<Dim,typename impl::op_res_t<OP_TYPE(op),T,U>::type> tv; tv.dims = v.dims; \
+            if (!impl::simd_apply_<OP_TYPE(op)>(tv, u, v)) { \
+                tv.reserve(v.size()); \
+                for (uint_t i : range(v)) { \
+                    tv.data.push_back(u op impl::get_element_(v, i)); \
+                } \
             } \
             return tv; \
         } \
@@ -126,8 +218,10 @@ namespace vif {
         vec<Dim,T> operator op (const vec<Dim,U>& u, vec<Dim,T>&& v) { \
             vif_check(v.dims == u.dims, "incompatible dimensions in operator '" #op \
                 "' (", v.dims, " vs ", u.dims, ")"); \
-            for (uint_t i : range(v)) { \
-                v.data[i] = impl::get_element_(u, i) op v.data[i]; \
+            if (!impl::simd_apply_<OP_TYPE(op)>(v, u, v)) { \
+                for (uint_t i : range(v)) { \
+                    v.data[i] = impl::get_element_(u, i) op v.data[i]; \
+                } \
             } \
             return std::move(v); \
         } \
@@ -135,8 +229,10 @@ namespace vif {
             std::is_same<typename impl::op_res_t<OP_TYPE(op),U,T>::type, T>::value && \
             meta::is_scalar<U>::value>::type> \
         vec<Dim,T> operator op (const U& u, vec<Dim,T>&& v) { \
-            for (auto& t : v) { \
-                t = u op t; \
+            if (!impl::simd_apply_<OP_TYPE(op)>(v, u, v)) { \
+                for (auto& t : v) { \
+                    t = u op t; \
+                } \
             } \
             return std::move(v); \
         } \
@@ -146,8 +242,10 @@ namespace vif {
         vec<Dim,T> operator op (vec<Dim,T>&& v, vec<Dim,U>&& u) { \
             vif_check(v.dims == u.dims, "incompatible dimensions in operator '" #op \
                 "' (", v.dims, " vs ", u.dims, ")"); \
-            for (uint_t i : range(v)) { \
-                v.data[i] sop u.data[i]; \
+            if (!impl::simd_apply_<OP_TYPE(op)>(v, v, u)) { \
+                for (uint_t i : range(v)) { \
+                    v.data[i] sop u.data[i]; \
+                } \
             } \
             return std::move(v); \
         }
@@ -161,21 +259,27 @@ namespace vif {
     #undef VECTORIZE
 
     // Logical operators
-    #define VECTORIZE(op) \
-        template<std::size_t Dim, typename T, typename U, typename enable = typename std::enable_if<!meta::is_vec<U>::value>::type> \
+    #define VECTORIZE(op, name) \
+        template<std::size_t Dim, typename T, typename U, typename enable = typename std::enable_if<!meta::is_vec<U>::value && \
+            !meta::is_lazy<U>::value>::type> \
         vec<Dim,bool> operator op (const vec<Dim,T>& v, const U& u) { \
             vec<Dim,bool> tv(v.dims); \
-            for (uint_t i : range(v)) { \
-                tv.safe[i] = (v.safe[i] op u); \
+            if (!impl::simd_compare_<impl::simd_impl::op_##name>(tv, v, u)) { \
+                for (uint_t i : range(v)) { \
+                    tv.safe[i] = (v.safe[i] op u); \
+                } \
             } \
             return tv; \
         } \
         \
-        template<std::size_t Dim, typename T, typename U, typename enable = typename std::enable_if<!meta::is_vec<U>::value>::type> \
+        template<std::size_t Dim, typename T, typename U, typename enable = typename std::enable_if<!meta::is_vec<U>::value && \
+            !meta::is_lazy<U>::value>::type> \
         vec<Dim,bool> operator op (const U& u, const vec<Dim,T>& v) { \
             vec<Dim,bool> tv(v.dims); \
-            for (uint_t i : range(v)) { \
-                tv.safe[i] = (u op v.safe[i]); \
+            if (!impl::simd_compare_<impl::simd_impl::op_##name>(tv, u, v)) { \
+                for (uint_t i : range(v)) { \
+                    tv.safe[i] = (u op v.safe[i]); \
+                } \
             } \
             return tv; \
         } \
@@ -185,18 +289,20 @@ namespace vif {
             vif_check(v.dims == u.dims, "incompatible dimensions in operator '" #op \
                 "' (", v.dims, " vs ", u.dims, ")"); \
             vec<Dim,bool> tv(v.dims); \
-            for (uint_t i : range(v)) { \
-                tv.safe[i] = (v.safe[i] op u.safe[i]); \
+            if (!impl::simd_compare_<impl::simd_impl::op_##name>(tv, v, u)) { \
+                for (uint_t i : range(v)) { \
+                    tv.safe[i] = (v.safe[i] op u.safe[i]); \
+                } \
             } \
             return tv; \
         }
 
-    VECTORIZE(==)
-    VECTORIZE(!=)
-    VECTORIZE(<)
-    VECTORIZE(<=)
-    VECTORIZE(>)
-    VECTORIZE(>=)
+    VECTORIZE(==, eq)
+    VECTORIZE(!=, neq)
+    VECTORIZE(<,  lt)
+    VECTORIZE(<=, le)
+    VECTORIZE(>,  gt)
+    VECTORIZE(>=, ge)
 
     #undef VECTORIZE
 
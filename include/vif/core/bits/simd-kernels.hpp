@@ -0,0 +1,316 @@
+#ifndef VIF_INCLUDING_SIMD_KERNELS
+#error this file is not meant to be included separately, include "vif/core/simd.hpp" instead
+#endif
+
+// This file is included once for each instruction set, inside a namespace providing the
+// 'traits<T>' and 'bytes' structs for this instruction set (see vif/core/simd.hpp). Each
+// kernel processes full registers, then finishes the remaining elements with scalar code.
+
+template<typename Op, typename T>
+void binary(Op op, const T* a, const T* b, T* r, uint_t n) {
+    using tr = traits<T>;
+    uint_t i = 0;
+    for (; i + tr::width <= n; i += tr::width) {
+        tr::store(r + i, tr::apply(op, tr::load(a + i), tr::load(b + i)));
+    }
+    for (; i < n; ++i) {
+        r[i] = apply_scalar(op, a[i], b[i]);
+    }
+}
+
+template<typename Op, typename T>
+void binary(Op op, const T* a, T b, T* r, uint_t n) {
+    using tr = traits<T>;
+    const typename tr::reg vb = tr::set1(b);
+    uint_t i = 0;
+    for (; i + tr::width <= n; i += tr::width) {
+        tr::store(r + i, tr::apply(op, tr::load(a + i), vb));
+    }
+    for (; i < n; ++i) {
+        r[i] = apply_scalar(op, a[i], b);
+    }
+}
+
+template<typename Op, typename T>
+void binary(Op op, T a, const T* b, T* r, uint_t n) {
+    using tr = traits<T>;
+    const typename tr::reg va = tr::set1(a);
+    uint_t i = 0;
+    for (; i + tr::width <= n; i += tr::width) {
+        tr::store(r + i, tr::apply(op, va, tr::load(b + i)));
+    }
+    for (; i < n; ++i) {
+        r[i] = apply_scalar(op, a, b[i]);
+    }
+}
+
+template<typename Op, typename T>
+void compare(Op op, const T* a, const T* b, char* r, uint_t n) {
+    using tr = traits<T>;
+    uint_t i = 0;
+    for (; i + tr::width <= n; i += tr::width) {
+        store_mask(r + i, tr::apply(op, tr::load(a + i), tr::load(b + i)), tr::width);
+    }
+    for (; i < n; ++i) {
+        r[i] = apply_scalar(op, a[i], b[i]);
+    }
+}
+
+template<typename Op, typename T>
+void compare(Op op, const T* a, T b, char* r, uint_t n) {
+    using tr = traits<T>;
+    const typename tr::reg vb = tr::set1(b);
+    uint_t i = 0;
+    for (; i + tr::width <= n; i += tr::width) {
+        store_mask(r + i, tr::apply(op, tr::load(a + i), vb), tr::width);
+    }
+    for (; i < n; ++i) {
+        r[i] = apply_scalar(op, a[i], b);
+    }
+}
+
+template<typename Op, typename T>
+void compare(Op op, T a, const T* b, char* r, uint_t n) {
+    using tr = traits<T>;
+    const typename tr::reg va = tr::set1(a);
+    uint_t i = 0;
+    for (; i + tr::width <= n; i += tr::width) {
+        store_mask(r + i, tr::apply(op, va, tr::load(b + i)), tr::width);
+    }
+    for (; i < n; ++i) {
+        r[i] = apply_scalar(op, a, b[i]);
+    }
+}
+
+template<typename T>
+void is_nan(const T* a, char* r, uint_t n) {
+    using tr = traits<T>;
+    uint_t i = 0;
+    for (; i + tr::width <= n; i += tr::width) {
+        store_mask(r + i, tr::is_nan(tr::load(a + i)), tr::width);
+    }
+    for (; i < n; ++i) {
+        r[i] = std::isnan(a[i]);
+    }
+}
+
+template<typename T>
+void is_finite(const T* a, char* r, uint_t n) {
+    using tr = traits<T>;
+    uint_t i = 0;
+    for (; i + tr::width <= n; i += tr::width) {
+        store_mask(r + i, tr::is_finite(tr::load(a + i)), tr::width);
+    }
+    for (; i < n; ++i) {
+        r[i] = std::isfinite(a[i]);
+    }
+}
+
+inline void fast_exp(const float* a, float* r, uint_t n) {
+    using tr = traits<float>;
+    uint_t i = 0;
+    for (; i + tr::width <= n; i += tr::width) {
+        tr::store(r + i, tr::fast_exp(tr::load(a + i)));
+    }
+    for (; i < n; ++i) {
+        r[i] = fast_exp_scalar(a[i]);
+    }
+}
+
+template<typename T>
+double sum(const T* a, uint_t n) {
+    using tr = traits<T>;
+    // Two sets of accumulators to hide the latency of the additions
+    typename tr::acc s0 = tr::acc_zero(), s1 = tr::acc_zero();
+    typename tr::acc s2 = tr::acc_zero(), s3 = tr::acc_zero();
+    uint_t i = 0;
+    for (; i + 2*tr::width <= n; i += 2*tr::width) {
+        tr::accumulate(s0, s1, tr::load(a + i));
+        tr::accumulate(s2, s3, tr::load(a + i + tr::width));
+    }
+    for (; i + tr::width <= n; i += tr::width) {
+        tr::accumulate(s0, s1, tr::load(a + i));
+    }
+
+    double s = (tr::hsum(s0) + tr::hsum(s2)) + (tr::hsum(s1) + tr::hsum(s3));
+    for (; i < n; ++i) {
+        s += a[i];
+    }
+
+    return s;
+}
+
+template<typename T>
+double sum_sq(const T* a, uint_t n) {
+    using tr = traits<T>;
+    typename tr::acc s0 = tr::acc_zero(), s1 = tr::acc_zero();
+    typename tr::acc s2 = tr::acc_zero(), s3 = tr::acc_zero();
+    uint_t i = 0;
+    for (; i + 2*tr::width <= n; i += 2*tr::width) {
+        tr::accumulate_sq(s0, s1, tr::load(a + i));
+        tr::accumulate_sq(s2, s3, tr::load(a + i + tr::width));
+    }
+    for (; i + tr::width <= n; i += tr::width) {
+        tr::accumulate_sq(s0, s1, tr::load(a + i));
+    }
+
+    double s = (tr::hsum(s0) + tr::hsum(s2)) + (tr::hsum(s1) + tr::hsum(s3));
+    for (; i < n; ++i) {
+        s += double(a[i])*a[i];
+    }
+
+    return s;
+}
+
+template<typename T>
+double dot(const T* a, const T* b, uint_t n) {
+    using tr = traits<T>;
+    typename tr::acc s0 = tr::acc_zero(), s1 = tr::acc_zero();
+    typename tr::acc s2 = tr::acc_zero(), s3 = tr::acc_zero();
+    uint_t i = 0;
+    for (; i + 2*tr::width <= n; i += 2*tr::width) {
+        tr::accumulate_prod(s0, s1, tr::load(a + i), tr::load(b + i));
+        tr::accumulate_prod(s2, s3, tr::load(a + i + tr::width), tr::load(b + i + tr::width));
+    }
+    for (; i + tr::width <= n; i += tr::width) {
+        tr::accumulate_prod(s0, s1, tr::load(a + i), tr::load(b + i));
+    }
+
+    double s = (tr::hsum(s0) + tr::hsum(s2)) + (tr::hsum(s1) + tr::hsum(s3));
+    for (; i < n; ++i) {
+        s += double(a[i])*b[i];
+    }
+
+    return s;
+}
+
+template<typename T>
+void axpy(double a, const T* x, double* r, uint_t n) {
+    using tr = traits<T>;
+    const typename tr::acc va = tr::acc_set1(a);
+    uint_t i = 0;
+    for (; i + tr::width <= n; i += tr::width) {
+        tr::axpy(va, tr::load(x + i), r + i);
+    }
+    for (; i < n; ++i) {
+        r[i] += a*x[i];
+    }
+}
+
+template<typename T>
+void axpy_sq(double a, const T* x, double* r, uint_t n) {
+    using tr = traits<T>;
+    const typename tr::acc va = tr::acc_set1(a);
+    uint_t i = 0;
+    for (; i + tr::width <= n; i += tr::width) {
+        tr::axpy_sq(va, tr::load(x + i), r + i);
+    }
+    for (; i < n; ++i) {
+        r[i] += a*x[i]*x[i];
+    }
+}
+
+template<typename T>
+uint_t count_nan(const T* a, uint_t n) {
+    using tr = traits<T>;
+    uint_t c = 0;
+    uint_t i = 0;
+    for (; i + tr::width <= n; i += tr::width) {
+        c += popcount(tr::is_nan(tr::load(a + i)));
+    }
+    for (; i < n; ++i) {
+        c += std::isnan(a[i]);
+    }
+
+    return c;
+}
+
+inline uint_t count_nonzero(const char* a, uint_t n) {
+    uint_t c = 0;
+    uint_t i = 0;
+    for (; i + bytes::width <= n; i += bytes::width) {
+        c += bytes::count_zero(a + i);
+    }
+    for (; i < n; ++i) {
+        c += (a[i] == 0);
+    }
+
+    return n - c;
+}
+
+template<typename T>
+T min_skip_nan(const T* a, uint_t n) {
+    using tr = traits<T>;
+    const T inf = std::numeric_limits<T>::infinity();
+    typename tr::reg m0 = tr::set1(inf), m1 = tr::set1(inf);
+    uint_t i = 0;
+    for (; i + 2*tr::width <= n; i += 2*tr::width) {
+        m0 = tr::min_skip_nan(tr::load(a + i), m0);
+        m1 = tr::min_skip_nan(tr::load(a + i + tr::width), m1);
+    }
+    for (; i + tr::width <= n; i += tr::width) {
+        m0 = tr::min_skip_nan(tr::load(a + i), m0);
+    }
+
+    T m = tr::hmin(tr::min_skip_nan(m1, m0));
+    for (; i < n; ++i) {
+        if (a[i] < m) m = a[i];
+    }
+
+    return m;
+}
+
+template<typename T>
+T max_skip_nan(const T* a, uint_t n) {
+    using tr = traits<T>;
+    const T inf = std::numeric_limits<T>::infinity();
+    typename tr::reg m0 = tr::set1(-inf), m1 = tr::set1(-inf);
+    uint_t i = 0;
+    for (; i + 2*tr::width <= n; i += 2*tr::width) {
+        m0 = tr::max_skip_nan(tr::load(a + i), m0);
+        m1 = tr::max_skip_nan(tr::load(a + i + tr::width), m1);
+    }
+    for (; i + tr::width <= n; i += tr::width) {
+        m0 = tr::max_skip_nan(tr::load(a + i), m0);
+    }
+
+    T m = tr::hmax(tr::max_skip_nan(m1, m0));
+    for (; i < n; ++i) {
+        if (a[i] > m) m = a[i];
+    }
+
+    return m;
+}
+
+template<typename T>
+uint_t find_first(const T* a, uint_t n, T v) {
+    using tr = traits<T>;
+    const typename tr::reg vv = tr::set1(v);
+    uint_t i = 0;
+    for (; i + tr::width <= n; i += tr::width) {
+        std::uint32_t m = tr::apply(op_eq{}, tr::load(a + i), vv);
+        if (m != 0) return i + first_bit(m);
+    }
+    for (; i < n; ++i) {
+        if (a[i] == v) return i;
+    }
+
+    return npos;
+}
+
+template<typename T>
+uint_t find_last(const T* a, uint_t n, T v) {
+    using tr = traits<T>;
+    uint_t nfull = n - n % tr::width;
+    for (uint_t i = n; i > nfull; --i) {
+        if (a[i-1] == v) return i-1;
+    }
+
+    const typename tr::reg vv = tr::set1(v);
+    for (uint_t i = nfull; i > 0; i -= tr::width) {
+        std::uint32_t m = tr::apply(op_eq{}, tr::load(a + i - tr::width), vv);
+        if (m != 0) return i - tr::width + last_bit(m);
+    }
+
+    return npos;
+}
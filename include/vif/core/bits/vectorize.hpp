@@ -7,6 +7,39 @@ namespace vif {
     //         Vectorization helpers          //
     ////////////////////////////////////////////
 
+    // Lazy overloads (see lazy()): the function is stored in the expression tree, and called
+    // on each element when the expression is evaluated
+    #define VIF_VECTORIZE_LAZY_FUNCTOR_(name, orig) \
+        namespace lazy_functions { \
+            struct name##_t { \
+                template<typename ... Args> \
+                auto operator() (const Args& ... args) const -> decltype(orig(args...)) { \
+                    return orig(args...); \
+                } \
+            }; \
+        }
+
+    #define VIF_VECTORIZE_LAZY_(name, orig) \
+        VIF_VECTORIZE_LAZY_FUNCTOR_(name, orig) \
+        template<typename E, typename ... Args> \
+        auto name(E&& e, const Args& ... args) -> typename std::enable_if<meta::is_lazy<E>::value, \
+            decltype(impl::lazy_impl::make_function(lazy_functions::name##_t{}, \
+                std::forward<E>(e), args...))>::type { \
+            return impl::lazy_impl::make_function(lazy_functions::name##_t{}, \
+                std::forward<E>(e), args...); \
+        }
+
+    #define VIF_VECTORIZE2_LAZY_(name) \
+        VIF_VECTORIZE_LAZY_FUNCTOR_(name, name) \
+        template<typename T1, typename T2, typename ... Args> \
+        auto name(T1&& v1, T2&& v2, const Args& ... args) -> typename std::enable_if< \
+            meta::is_lazy<T1>::value || meta::is_lazy<T2>::value, \
+            decltype(impl::lazy_impl::make_function(lazy_functions::name##_t{}, \
+                std::forward<T1>(v1), std::forward<T2>(v2), args...))>::type { \
+            return impl::lazy_impl::make_function(lazy_functions::name##_t{}, \
+                std::forward<T1>(v1), std::forward<T2>(v2), args...); \
+        }
+
     #define VIF_VECTORIZE(name) \
         template<std::size_t Dim, typename Type, typename ... Args> \
         auto name(const vec<Dim,Type>& v, const Args& ... args) -> \
@@ -26,7 +59,8 @@ namespace vif {
                 t = name(t, args...); \
             } \
             return std::move(v); \
-        }
+        } \
+        VIF_VECTORIZE_LAZY_(name, name)
 
     #define VIF_VECTORIZE2(name) \
         template<std::size_t D, typename T1, typename T2, typename ... Args> \
@@ -75,7 +109,7 @@ namespace vif {
             return v1; \
         } \
         template<std::size_t D, typename T1, typename T2, typename ... Args> \
-        auto name(T1 v1, const vec<D,T2>& v2, const Args& ... args) -> typename std::enable_if<!meta::is_vec<T1>::value, \
+        auto name(T1 v1, const vec<D,T2>& v2, const Args& ... args) -> typename std::enable_if<!meta::is_vec<T1>::value && !meta::is_lazy<T1>::value, \
             vec<D,decltype(name(v1, v2[0], args...))>>::type { \
             using ntype = decltype(name(v1, v2[0], args...)); \
             vec<D,ntype> r; r.dims = v2.dims; r.data.reserve(v2.size()); \
@@ -85,7 +119,7 @@ namespace vif {
             return r; \
         } \
         template<std::size_t D, typename T1, typename T2, typename ... Args> \
-        auto name(const vec<D,T1>& v1, T2 v2, const Args& ... args) -> typename std::enable_if<!meta::is_vec<T2>::value, \
+        auto name(const vec<D,T1>& v1, T2 v2, const Args& ... args) -> typename std::enable_if<!meta::is_vec<T2>::value && !meta::is_lazy<T2>::value, \
             vec<D,decltype(name(v1[0], v2, args...))>>::type { \
             using ntype = decltype(name(v1[0], v2, args...)); \
             vec<D,ntype> r; r.dims = v1.dims; r.data.reserve(v1.size()); \
@@ -95,7 +129,7 @@ namespace vif {
             return r; \
         } \
         template<std::size_t D, typename T1, typename T2, typename ... Args> \
-        auto name(T1 v1, vec<D,T2>&& v2, const Args& ... args) -> typename std::enable_if<!meta::is_vec<T1>::value && \
+        auto name(T1 v1, vec<D,T2>&& v2, const Args& ... args) -> typename std::enable_if<!meta::is_vec<T1>::value && !meta::is_lazy<T1>::value && \
             !std::is_pointer<T2>::value && std::is_same<decltype(name(v1, v2[0], args...)), T2>::value, \
             vec<D,decltype(name(v1, v2[0], args...))>>::type { \
             for (uint_t i : range(v2)) { \
@@ -104,7 +138,7 @@ namespace vif {
             return v2; \
         } \
         template<std::size_t D, typename T1, typename T2, typename ... Args> \
-        auto name(vec<D,T1>&& v1, T2 v2, const Args& ... args) -> typename std::enable_if<!meta::is_vec<T2>::value && \
+        auto name(vec<D,T1>&& v1, T2 v2, const Args& ... args) -> typename std::enable_if<!meta::is_vec<T2>::value && !meta::is_lazy<T2>::value && \
             !std::is_pointer<T1>::value && std::is_same<decltype(name(v1[0], v2, args...)), T1>::value, \
             vec<D,decltype(name(v1[0], v2, args...))>>::type { \
             for (uint_t i : range(v1)) { \
@@ -112,6 +146,7 @@ namespace vif {
             } \
             return v1; \
         } \
+        VIF_VECTORIZE2_LAZY_(name)
 
     #define VIF_VECTORIZE_REN(name, orig) \
         template<std::size_t Dim, typename Type, typename ... Args> \
@@ -133,6 +168,7 @@ namespace vif {
             } \
             return std::move(v); \
         } \
+        VIF_VECTORIZE_LAZY_(name, orig) \
         template<typename ... Args> \
         auto name(Args&& ... args) -> decltype(orig(std::forward<Args>(args)...)) { \
             return orig(std::forward<Args>(args)...); \
@@ -0,0 +1,888 @@
+#ifndef VIF_CORE_SIMD_HPP
+#define VIF_CORE_SIMD_HPP
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include "vif/core/typedefs.hpp"
+#include "vif/core/error.hpp"
+
+#ifndef NO_SIMD
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define VIF_SIMD_X86
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define VIF_SIMD_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+namespace vif {
+    ////////////////////////////////////////////
+    //         Vectorized kernels             //
+    ////////////////////////////////////////////
+
+    // Element-wise operations and reductions on contiguous float and double vectors are
+    // processed by explicitly vectorized kernels. Several versions of these kernels are
+    // compiled (AVX-512, AVX2, NEON, and a portable scalar version), and the best one
+    // supported by the CPU is picked at runtime. The choice can be overriden with the
+    // VIF_SIMD environment variable ("none", "avx2", "avx512" or "neon"), or with
+    // simd_set_level(). Defining NO_SIMD only compiles the portable version.
+
+    enum class simd_level {
+        none, avx2, avx512, neon
+    };
+
+    namespace impl {
+    namespace simd_impl {
+        template<typename T>
+        using is_supported = std::integral_constant<bool,
+            std::is_same<T,float>::value || std::is_same<T,double>::value>;
+
+        // Operation tags
+        struct op_add {};
+        struct op_sub {};
+        struct op_mul {};
+        struct op_div {};
+        struct op_eq {};
+        struct op_neq {};
+        struct op_lt {};
+        struct op_le {};
+        struct op_gt {};
+        struct op_ge {};
+
+        template<typename T> T apply_scalar(op_add, T a, T b) { return a + b; }
+        template<typename T> T apply_scalar(op_sub, T a, T b) { return a - b; }
+        template<typename T> T apply_scalar(op_mul, T a, T b) { return a * b; }
+        template<typename T> T apply_scalar(op_div, T a, T b) { return a / b; }
+        template<typename T> bool apply_scalar(op_eq,  T a, T b) { return a == b; }
+        template<typename T> bool apply_scalar(op_neq, T a, T b) { return a != b; }
+        template<typename T> bool apply_scalar(op_lt,  T a, T b) { return a < b; }
+        template<typename T> bool apply_scalar(op_le,  T a, T b) { return a <= b; }
+        template<typename T> bool apply_scalar(op_gt,  T a, T b) { return a > b; }
+        template<typename T> bool apply_scalar(op_ge,  T a, T b) { return a >= b; }
+
+        inline float fast_exp_scalar(float x) {
+            // Implementation based on:
+            // https://stackoverflow.com/a/10792321/1565581
+
+            static_assert(sizeof(float) == sizeof(std::int32_t), "size of float and int32_t don't match");
+
+            if (x < -87.0f || x > 88.0f) return 0.0f;
+
+            // exp(x) = 2^i * 2^f; i = floor (log2(e) * x), 0 <= f <= 1
+            float t = x * 1.442695041f;
+            float fi = std::floor(t);
+            float f = t - fi;
+            std::int32_t i = (std::int32_t)fi;
+
+            // compute 2^f
+            f = (0.3371894346f*f + 0.657636276f)*f + 1.00172476f;
+
+            // scale by 2^i
+            std::int32_t k;
+            std::memcpy(&k, &f, sizeof(float));
+            k += (i << 23);
+            std::memcpy(&f, &k, sizeof(float));
+
+            return f;
+        }
+
+        inline uint_t popcount(std::uint32_t m) {
+        #ifdef __GNUC__
+            return __builtin_popcount(m);
+        #else
+            uint_t n = 0;
+            for (; m != 0; m &= m - 1) ++n;
+            return n;
+        #endif
+        }
+
+        inline uint_t first_bit(std::uint32_t m) {
+        #ifdef __GNUC__
+            return __builtin_ctz(m);
+        #else
+            uint_t n = 0;
+            for (; (m & 1) == 0; m >>= 1) ++n;
+            return n;
+        #endif
+        }
+
+        inline uint_t last_bit(std::uint32_t m) {
+        #ifdef __GNUC__
+            return 31 - __builtin_clz(m);
+        #else
+            uint_t n = 0;
+            for (; m > 1; m >>= 1) ++n;
+            return n;
+        #endif
+        }
+
+        inline void store_mask(char* r, std::uint32_t m, uint_t width) {
+            for (uint_t j = 0; j < width; ++j) {
+                r[j] = (m >> j) & 1;
+            }
+        }
+
+        // Portable version
+        namespace generic {
+            template<typename T>
+            struct traits {
+                using reg = T;
+                using acc = double;
+                static constexpr uint_t width = 1;
+
+                static reg load(const T* p) { return *p; }
+                static void store(T* p, reg a) { *p = a; }
+                static reg set1(T v) { return v; }
+
+                template<typename Op>
+                static auto apply(Op op, reg a, reg b) -> decltype(apply_scalar(op, a, b)) {
+                    return apply_scalar(op, a, b);
+                }
+
+                static std::uint32_t is_nan(reg a) { return std::isnan(a); }
+                static std::uint32_t is_finite(reg a) { return std::isfinite(a); }
+
+                static reg min_skip_nan(reg a, reg m) { return a < m ? a : m; }
+                static reg max_skip_nan(reg a, reg m) { return a > m ? a : m; }
+                static T hmin(reg a) { return a; }
+                static T hmax(reg a) { return a; }
+
+                static acc acc_zero() { return 0.0; }
+                static acc acc_set1(double v) { return v; }
+                static void accumulate(acc& a0, acc&, reg a) { a0 += a; }
+                static void accumulate_sq(acc& a0, acc&, reg a) { a0 += double(a)*a; }
+                static void accumulate_prod(acc& a0, acc&, reg a, reg b) { a0 += double(a)*b; }
+                static double hsum(acc a) { return a; }
+
+                static void axpy(acc a, reg x, double* r) { *r += a*x; }
+                static void axpy_sq(acc a, reg x, double* r) { *r += a*x*x; }
+
+                static reg fast_exp(reg a) { return fast_exp_scalar(a); }
+            };
+
+            struct bytes {
+                static constexpr uint_t width = 1;
+                static uint_t count_zero(const char* p) { return *p == 0; }
+            };
+
+            #define VIF_INCLUDING_SIMD_KERNELS
+            #include "vif/core/bits/simd-kernels.hpp"
+            #undef VIF_INCLUDING_SIMD_KERNELS
+        }
+
+    #ifdef VIF_SIMD_X86
+        #if defined(__clang__)
+        #pragma clang attribute push (__attribute__((target("avx2"))), apply_to = function)
+        #else
+        #pragma GCC push_options
+        #pragma GCC target("avx2")
+        #endif
+
+        // AVX2 version (256 bit registers)
+        namespace avx2 {
+            template<typename T>
+            struct traits;
+
+            template<>
+            struct traits<double> {
+                using reg = __m256d;
+                using acc = __m256d;
+                static constexpr uint_t width = 4;
+
+                static reg load(const double* p) { return _mm256_loadu_pd(p); }
+                static void store(double* p, reg a) { _mm256_storeu_pd(p, a); }
+                static reg set1(double v) { return _mm256_set1_pd(v); }
+
+                static reg apply(op_add, reg a, reg b) { return _mm256_add_pd(a, b); }
+                static reg apply(op_sub, reg a, reg b) { return _mm256_sub_pd(a, b); }
+                static reg apply(op_mul, reg a, reg b) { return _mm256_mul_pd(a, b); }
+                static reg apply(op_div, reg a, reg b) { return _mm256_div_pd(a, b); }
+
+                static std::uint32_t mask(reg m) { return _mm256_movemask_pd(m); }
+                static std::uint32_t apply(op_eq,  reg a, reg b) { return mask(_mm256_cmp_pd(a, b, _CMP_EQ_OQ)); }
+                static std::uint32_t apply(op_neq, reg a, reg b) { return mask(_mm256_cmp_pd(a, b, _CMP_NEQ_UQ)); }
+                static std::uint32_t apply(op_lt,  reg a, reg b) { return mask(_mm256_cmp_pd(a, b, _CMP_LT_OQ)); }
+                static std::uint32_t apply(op_le,  reg a, reg b) { return mask(_mm256_cmp_pd(a, b, _CMP_LE_OQ)); }
+                static std::uint32_t apply(op_gt,  reg a, reg b) { return mask(_mm256_cmp_pd(a, b, _CMP_GT_OQ)); }
+                static std::uint32_t apply(op_ge,  reg a, reg b) { return mask(_mm256_cmp_pd(a, b, _CMP_GE_OQ)); }
+
+                static std::uint32_t is_nan(reg a) { return mask(_mm256_cmp_pd(a, a, _CMP_UNORD_Q)); }
+                static std::uint32_t is_finite(reg a) {
+                    // x - x is NaN for NaN and infinities, and 0 otherwise
+                    return mask(_mm256_cmp_pd(_mm256_sub_pd(a, a), _mm256_setzero_pd(), _CMP_EQ_OQ));
+                }
+
+                // The second operand is returned when the first one is NaN
+                static reg min_skip_nan(reg a, reg m) { return _mm256_min_pd(a, m); }
+                static reg max_skip_nan(reg a, reg m) { return _mm256_max_pd(a, m); }
+                static double hmin(reg a) {
+                    __m128d m = _mm_min_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+                    return _mm_cvtsd_f64(_mm_min_sd(m, _mm_unpackhi_pd(m, m)));
+                }
+                static double hmax(reg a) {
+                    __m128d m = _mm_max_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+                    return _mm_cvtsd_f64(_mm_max_sd(m, _mm_unpackhi_pd(m, m)));
+                }
+
+                static acc acc_zero() { return _mm256_setzero_pd(); }
+                static acc acc_set1(double v) { return _mm256_set1_pd(v); }
+                static void accumulate(acc& a0, acc&, reg a) { a0 = _mm256_add_pd(a0, a); }
+                static void accumulate_sq(acc& a0, acc&, reg a) { a0 = _mm256_add_pd(a0, _mm256_mul_pd(a, a)); }
+                static void accumulate_prod(acc& a0, acc&, reg a, reg b) { a0 = _mm256_add_pd(a0, _mm256_mul_pd(a, b)); }
+                static double hsum(acc a) {
+                    __m128d m = _mm_add_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+                    return _mm_cvtsd_f64(_mm_add_sd(m, _mm_unpackhi_pd(m, m)));
+                }
+
+                static void axpy(acc a, reg x, double* r) {
+                    _mm256_storeu_pd(r, _mm256_add_pd(_mm256_loadu_pd(r), _mm256_mul_pd(a, x)));
+                }
+                static void axpy_sq(acc a, reg x, double* r) {
+                    _mm256_storeu_pd(r, _mm256_add_pd(_mm256_loadu_pd(r),
+                        _mm256_mul_pd(_mm256_mul_pd(a, x), x)));
+                }
+            };
+
+            template<>
+            struct traits<float> {
+                using reg = __m256;
+                using acc = __m256d;
+                static constexpr uint_t width = 8;
+
+                static reg load(const float* p) { return _mm256_loadu_ps(p); }
+                static void store(float* p, reg a) { _mm256_storeu_ps(p, a); }
+                static reg set1(float v) { return _mm256_set1_ps(v); }
+
+                static reg apply(op_add, reg a, reg b) { return _mm256_add_ps(a, b); }
+                static reg apply(op_sub, reg a, reg b) { return _mm256_sub_ps(a, b); }
+                static reg apply(op_mul, reg a, reg b) { return _mm256_mul_ps(a, b); }
+                static reg apply(op_div, reg a, reg b) { return _mm256_div_ps(a, b); }
+
+                static std::uint32_t mask(reg m) { return _mm256_movemask_ps(m); }
+                static std::uint32_t apply(op_eq,  reg a, reg b) { return mask(_mm256_cmp_ps(a, b, _CMP_EQ_OQ)); }
+                static std::uint32_t apply(op_neq, reg a, reg b) { return mask(_mm256_cmp_ps(a, b, _CMP_NEQ_UQ)); }
+                static std::uint32_t apply(op_lt,  reg a, reg b) { return mask(_mm256_cmp_ps(a, b, _CMP_LT_OQ)); }
+                static std::uint32_t apply(op_le,  reg a, reg b) { return mask(_mm256_cmp_ps(a, b, _CMP_LE_OQ)); }
+                static std::uint32_t apply(op_gt,  reg a, reg b) { return mask(_mm256_cmp_ps(a, b, _CMP_GT_OQ)); }
+                static std::uint32_t apply(op_ge,  reg a, reg b) { return mask(_mm256_cmp_ps(a, b, _CMP_GE_OQ)); }
+
+                static std::uint32_t is_nan(reg a) { return mask(_mm256_cmp_ps(a, a, _CMP_UNORD_Q)); }
+                static std::uint32_t is_finite(reg a) {
+                    return mask(_mm256_cmp_ps(_mm256_sub_ps(a, a), _mm256_setzero_ps(), _CMP_EQ_OQ));
+                }
+
+                static reg min_skip_nan(reg a, reg m) { return _mm256_min_ps(a, m); }
+                static reg max_skip_nan(reg a, reg m) { return _mm256_max_ps(a, m); }
+                static float hmin(reg a) {
+                    __m128 m = _mm_min_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+                    m = _mm_min_ps(m, _mm_movehl_ps(m, m));
+                    return _mm_cvtss_f32(_mm_min_ss(m, _mm_shuffle_ps(m, m, 1)));
+                }
+                static float hmax(reg a) {
+                    __m128 m = _mm_max_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+                    m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+                    return _mm_cvtss_f32(_mm_max_ss(m, _mm_shuffle_ps(m, m, 1)));
+                }
+
+                // Sums are computed in double precision
+                static acc acc_zero() { return _mm256_setzero_pd(); }
+                static acc acc_set1(double v) { return _mm256_set1_pd(v); }
+                static __m256d lower(reg a) { return _mm256_cvtps_pd(_mm256_castps256_ps128(a)); }
+                static __m256d upper(reg a) { return _mm256_cvtps_pd(_mm256_extractf128_ps(a, 1)); }
+                static void accumulate(acc& a0, acc& a1, reg a) {
+                    a0 = _mm256_add_pd(a0, lower(a));
+                    a1 = _mm256_add_pd(a1, upper(a));
+                }
+                static void accumulate_sq(acc& a0, acc& a1, reg a) {
+                    __m256d lo = lower(a), hi = upper(a);
+                    a0 = _mm256_add_pd(a0, _mm256_mul_pd(lo, lo));
+                    a1 = _mm256_add_pd(a1, _mm256_mul_pd(hi, hi));
+                }
+                static void accumulate_prod(acc& a0, acc& a1, reg a, reg b) {
+                    a0 = _mm256_add_pd(a0, _mm256_mul_pd(lower(a), lower(b)));
+                    a1 = _mm256_add_pd(a1, _mm256_mul_pd(upper(a), upper(b)));
+                }
+                static double hsum(acc a) {
+                    return traits<double>::hsum(a);
+                }
+
+                static void axpy(acc a, reg x, double* r) {
+                    traits<double>::axpy(a, lower(x), r);
+                    traits<double>::axpy(a, upper(x), r + 4);
+                }
+                static void axpy_sq(acc a, reg x, double* r) {
+                    traits<double>::axpy_sq(a, lower(x), r);
+                    traits<double>::axpy_sq(a, upper(x), r + 4);
+                }
+
+                static reg fast_exp(reg x) {
+                    reg t = _mm256_mul_ps(x, _mm256_set1_ps(1.442695041f));
+                    reg fi = _mm256_floor_ps(t);
+                    reg f = _mm256_sub_ps(t, fi);
+                    __m256i i = _mm256_cvttps_epi32(fi);
+                    f = _mm256_add_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(
+                        _mm256_set1_ps(0.3371894346f), f), _mm256_set1_ps(0.657636276f)), f),
+                        _mm256_set1_ps(1.00172476f));
+                    reg r = _mm256_castsi256_ps(_mm256_add_epi32(_mm256_castps_si256(f),
+                        _mm256_slli_epi32(i, 23)));
+                    reg out = _mm256_or_ps(
+                        _mm256_cmp_ps(x, _mm256_set1_ps(-87.0f), _CMP_LT_OQ),
+                        _mm256_cmp_ps(x, _mm256_set1_ps(88.0f), _CMP_GT_OQ));
+                    return _mm256_andnot_ps(out, r);
+                }
+            };
+
+            struct bytes {
+                static constexpr uint_t width = 32;
+                static uint_t count_zero(const char* p) {
+                    __m256i z = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)),
+                        _mm256_setzero_si256());
+                    return popcount(std::uint32_t(_mm256_movemask_epi8(z)));
+                }
+            };
+
+            #define VIF_INCLUDING_SIMD_KERNELS
+            #include "vif/core/bits/simd-kernels.hpp"
+            #undef VIF_INCLUDING_SIMD_KERNELS
+        }
+
+        #if defined(__clang__)
+        #pragma clang attribute pop
+        #pragma clang attribute push (__attribute__((target("avx512f,avx512bw"))), apply_to = function)
+        #else
+        #pragma GCC pop_options
+        #pragma GCC push_options
+        #pragma GCC target("avx512f,avx512bw")
+        #endif
+
+        // AVX-512 version (512 bit registers)
+        namespace avx512 {
+            template<typename T>
+            struct traits;
+
+            template<>
+            struct traits<double> {
+                using reg = __m512d;
+                using acc = __m512d;
+                static constexpr uint_t width = 8;
+
+                static reg load(const double* p) { return _mm512_loadu_pd(p); }
+                static void store(double* p, reg a) { _mm512_storeu_pd(p, a); }
+                static reg set1(double v) { return _mm512_set1_pd(v); }
+
+                static reg apply(op_add, reg a, reg b) { return _mm512_add_pd(a, b); }
+                static reg apply(op_sub, reg a, reg b) { return _mm512_sub_pd(a, b); }
+                static reg apply(op_mul, reg a, reg b) { return _mm512_mul_pd(a, b); }
+                static reg apply(op_div, reg a, reg b) { return _mm512_div_pd(a, b); }
+
+                static std::uint32_t apply(op_eq,  reg a, reg b) { return _mm512_cmp_pd_mask(a, b, _CMP_EQ_OQ); }
+                static std::uint32_t apply(op_neq, reg a, reg b) { return _mm512_cmp_pd_mask(a, b, _CMP_NEQ_UQ); }
+                static std::uint32_t apply(op_lt,  reg a, reg b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+                static std::uint32_t apply(op_le,  reg a, reg b) { return _mm512_cmp_pd_mask(a, b, _CMP_LE_OQ); }
+                static std::uint32_t apply(op_gt,  reg a, reg b) { return _mm512_cmp_pd_mask(a, b, _CMP_GT_OQ); }
+                static std::uint32_t apply(op_ge,  reg a, reg b) { return _mm512_cmp_pd_mask(a, b, _CMP_GE_OQ); }
+
+                static std::uint32_t is_nan(reg a) { return _mm512_cmp_pd_mask(a, a, _CMP_UNORD_Q); }
+                static std::uint32_t is_finite(reg a) {
+                    return _mm512_cmp_pd_mask(_mm512_sub_pd(a, a), _mm512_setzero_pd(), _CMP_EQ_OQ);
+                }
+
+                static reg min_skip_nan(reg a, reg m) { return _mm512_maskz_min_pd(0xff, a, m); }
+                static reg max_skip_nan(reg a, reg m) { return _mm512_maskz_max_pd(0xff, a, m); }
+                // NB: the non-masked versions of some intrinsics are avoided, since they
+                // trigger spurious "uninitialized" warnings in GCC 12 (bug 105593)
+                static __m256d lower(reg a) { return _mm512_maskz_extractf64x4_pd(0xff, a, 0); }
+                static __m256d upper(reg a) { return _mm512_maskz_extractf64x4_pd(0xff, a, 1); }
+                static double hmin(reg a) { return avx2::traits<double>::hmin(_mm256_min_pd(lower(a), upper(a))); }
+                static double hmax(reg a) { return avx2::traits<double>::hmax(_mm256_max_pd(lower(a), upper(a))); }
+
+                static acc acc_zero() { return _mm512_setzero_pd(); }
+                static acc acc_set1(double v) { return _mm512_set1_pd(v); }
+                static void accumulate(acc& a0, acc&, reg a) { a0 = _mm512_add_pd(a0, a); }
+                static void accumulate_sq(acc& a0, acc&, reg a) { a0 = _mm512_add_pd(a0, _mm512_mul_pd(a, a)); }
+                static void accumulate_prod(acc& a0, acc&, reg a, reg b) { a0 = _mm512_add_pd(a0, _mm512_mul_pd(a, b)); }
+                static double hsum(acc a) { return avx2::traits<double>::hsum(_mm256_add_pd(lower(a), upper(a))); }
+
+                static void axpy(acc a, reg x, double* r) {
+                    _mm512_storeu_pd(r, _mm512_add_pd(_mm512_loadu_pd(r), _mm512_mul_pd(a, x)));
+                }
+                static void axpy_sq(acc a, reg x, double* r) {
+                    _mm512_storeu_pd(r, _mm512_add_pd(_mm512_loadu_pd(r),
+                        _mm512_mul_pd(_mm512_mul_pd(a, x), x)));
+                }
+            };
+
+            template<>
+            struct traits<float> {
+                using reg = __m512;
+                using acc = __m512d;
+                static constexpr uint_t width = 16;
+
+                static reg load(const float* p) { return _mm512_loadu_ps(p); }
+                static void store(float* p, reg a) { _mm512_storeu_ps(p, a); }
+                static reg set1(float v) { return _mm512_set1_ps(v); }
+
+                static reg apply(op_add, reg a, reg b) { return _mm512_add_ps(a, b); }
+                static reg apply(op_sub, reg a, reg b) { return _mm512_sub_ps(a, b); }
+                static reg apply(op_mul, reg a, reg b) { return _mm512_mul_ps(a, b); }
+                static reg apply(op_div, reg a, reg b) { return _mm512_div_ps(a, b); }
+
+                static std::uint32_t apply(op_eq,  reg a, reg b) { return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ); }
+                static std::uint32_t apply(op_neq, reg a, reg b) { return _mm512_cmp_ps_mask(a, b, _CMP_NEQ_UQ); }
+                static std::uint32_t apply(op_lt,  reg a, reg b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+                static std::uint32_t apply(op_le,  reg a, reg b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+                static std::uint32_t apply(op_gt,  reg a, reg b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+                static std::uint32_t apply(op_ge,  reg a, reg b) { return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ); }
+
+                static std::uint32_t is_nan(reg a) { return _mm512_cmp_ps_mask(a, a, _CMP_UNORD_Q); }
+                static std::uint32_t is_finite(reg a) {
+                    return _mm512_cmp_ps_mask(_mm512_sub_ps(a, a), _mm512_setzero_ps(), _CMP_EQ_OQ);
+                }
+
+                static reg min_skip_nan(reg a, reg m) { return _mm512_maskz_min_ps(0xffff, a, m); }
+                static reg max_skip_nan(reg a, reg m) { return _mm512_maskz_max_ps(0xffff, a, m); }
+                static __m256 lower_half(reg a) {
+                    return _mm256_castpd_ps(traits<double>::lower(_mm512_castps_pd(a)));
+                }
+                static __m256 upper_half(reg a) {
+                    return _mm256_castpd_ps(traits<double>::upper(_mm512_castps_pd(a)));
+                }
+                static float hmin(reg a) { return avx2::traits<float>::hmin(_mm256_min_ps(lower_half(a), upper_half(a))); }
+                static float hmax(reg a) { return avx2::traits<float>::hmax(_mm256_max_ps(lower_half(a), upper_half(a))); }
+
+                // Sums are computed in double precision
+                static acc acc_zero() { return _mm512_setzero_pd(); }
+                static __m512d lower(reg a) { return _mm512_maskz_cvtps_pd(0xff, lower_half(a)); }
+                static __m512d upper(reg a) { return _mm512_maskz_cvtps_pd(0xff, upper_half(a)); }
+                static void accumulate(acc& a0, acc& a1, reg a) {
+                    a0 = _mm512_add_pd(a0, lower(a));
+                    a1 = _mm512_add_pd(a1, upper(a));
+                }
+                static void accumulate_sq(acc& a0, acc& a1, reg a) {
+                    __m512d lo = lower(a), hi = upper(a);
+                    a0 = _mm512_add_pd(a0, _mm512_mul_pd(lo, lo));
+                    a1 = _mm512_add_pd(a1, _mm512_mul_pd(hi, hi));
+                }
+                static void accumulate_prod(acc& a0, acc& a1, reg a, reg b) {
+                    a0 = _mm512_add_pd(a0, _mm512_mul_pd(lower(a), lower(b)));
+                    a1 = _mm512_add_pd(a1, _mm512_mul_pd(upper(a), upper(b)));
+                }
+                static double hsum(acc a) { return traits<double>::hsum(a); }
+
+                static acc acc_set1(double v) { return _mm512_set1_pd(v); }
+                static void axpy(acc a, reg x, double* r) {
+                    traits<double>::axpy(a, lower(x), r);
+                    traits<double>::axpy(a, upper(x), r + 8);
+                }
+                static void axpy_sq(acc a, reg x, double* r) {
+                    traits<double>::axpy_sq(a, lower(x), r);
+                    traits<double>::axpy_sq(a, upper(x), r + 8);
+                }
+
+                static reg fast_exp(reg x) {
+                    reg t = _mm512_mul_ps(x, _mm512_set1_ps(1.442695041f));
+                    reg fi = _mm512_maskz_roundscale_ps(0xffff, t, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+                    reg f = _mm512_sub_ps(t, fi);
+                    __m512i i = _mm512_maskz_cvttps_epi32(0xffff, fi);
+                    f = _mm512_add_ps(_mm512_mul_ps(_mm512_add_ps(_mm512_mul_ps(
+                        _mm512_set1_ps(0.3371894346f), f), _mm512_set1_ps(0.657636276f)), f),
+                        _mm512_set1_ps(1.00172476f));
+                    reg r = _mm512_castsi512_ps(_mm512_add_epi32(_mm512_castps_si512(f),
+                        _mm512_maskz_slli_epi32(0xffff, i, 23)));
+                    __mmask16 out =
+                        _mm512_cmp_ps_mask(x, _mm512_set1_ps(-87.0f), _CMP_LT_OQ) |
+                        _mm512_cmp_ps_mask(x, _mm512_set1_ps(88.0f), _CMP_GT_OQ);
+                    return _mm512_maskz_mov_ps(~out, r);
+                }
+            };
+
+            struct bytes {
+                static constexpr uint_t width = 64;
+                static uint_t count_zero(const char* p) {
+                    std::uint64_t m = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(p), _mm512_setzero_si512());
+                    return popcount(std::uint32_t(m)) + popcount(std::uint32_t(m >> 32));
+                }
+            };
+
+            #define VIF_INCLUDING_SIMD_KERNELS
+            #include "vif/core/bits/simd-kernels.hpp"
+            #undef VIF_INCLUDING_SIMD_KERNELS
+        }
+
+        #if defined(__clang__)
+        #pragma clang attribute pop
+        #else
+        #pragma GCC pop_options
+        #endif
+    #endif
+
+    #ifdef VIF_SIMD_NEON
+        // NEON version (128 bit registers, always available on AArch64)
+        namespace neon {
+            template<typename T>
+            struct traits;
+
+            template<>
+            struct traits<double> {
+                using reg = float64x2_t;
+                using acc = float64x2_t;
+                static constexpr uint_t width = 2;
+
+                static reg load(const double* p) { return vld1q_f64(p); }
+                static void store(double* p, reg a) { vst1q_f64(p, a); }
+                static reg set1(double v) { return vdupq_n_f64(v); }
+
+                static reg apply(op_add, reg a, reg b) { return vaddq_f64(a, b); }
+                static reg apply(op_sub, reg a, reg b) { return vsubq_f64(a, b); }
+                static reg apply(op_mul, reg a, reg b) { return vmulq_f64(a, b); }
+                static reg apply(op_div, reg a, reg b) { return vdivq_f64(a, b); }
+
+                static std::uint32_t mask(uint64x2_t m) {
+                    const uint64x2_t bits = {1, 2};
+                    return vaddvq_u64(vandq_u64(m, bits));
+                }
+                static uint64x2_t inv(uint64x2_t m) {
+                    return vreinterpretq_u64_u32(vmvnq_u32(vreinterpretq_u32_u64(m)));
+                }
+                static std::uint32_t apply(op_eq,  reg a, reg b) { return mask(vceqq_f64(a, b)); }
+                static std::uint32_t apply(op_neq, reg a, reg b) { return mask(inv(vceqq_f64(a, b))); }
+                static std::uint32_t apply(op_lt,  reg a, reg b) { return mask(vcltq_f64(a, b)); }
+                static std::uint32_t apply(op_le,  reg a, reg b) { return mask(vcleq_f64(a, b)); }
+                static std::uint32_t apply(op_gt,  reg a, reg b) { return mask(vcgtq_f64(a, b)); }
+                static std::uint32_t apply(op_ge,  reg a, reg b) { return mask(vcgeq_f64(a, b)); }
+
+                static std::uint32_t is_nan(reg a) { return mask(inv(vceqq_f64(a, a))); }
+                static std::uint32_t is_finite(reg a) {
+                    return mask(vceqq_f64(vsubq_f64(a, a), vdupq_n_f64(0.0)));
+                }
+
+                // The "minnm" and "maxnm" instructions return the number when one operand is NaN
+                static reg min_skip_nan(reg a, reg m) { return vminnmq_f64(a, m); }
+                static reg max_skip_nan(reg a, reg m) { return vmaxnmq_f64(a, m); }
+                static double hmin(reg a) { return vminvq_f64(a); }
+                static double hmax(reg a) { return vmaxvq_f64(a); }
+
+                static acc acc_zero() { return vdupq_n_f64(0.0); }
+                static acc acc_set1(double v) { return vdupq_n_f64(v); }
+                static void accumulate(acc& a0, acc&, reg a) { a0 = vaddq_f64(a0, a); }
+                static void accumulate_sq(acc& a0, acc&, reg a) { a0 = vfmaq_f64(a0, a, a); }
+                static void accumulate_prod(acc& a0, acc&, reg a, reg b) { a0 = vfmaq_f64(a0, a, b); }
+                static double hsum(acc a) { return vaddvq_f64(a); }
+
+                static void axpy(acc a, reg x, double* r) { vst1q_f64(r, vfmaq_f64(vld1q_f64(r), a, x)); }
+                static void axpy_sq(acc a, reg x, double* r) {
+                    vst1q_f64(r, vfmaq_f64(vld1q_f64(r), vmulq_f64(a, x), x));
+                }
+            };
+
+            template<>
+            struct traits<float> {
+                using reg = float32x4_t;
+                using acc = float64x2_t;
+                static constexpr uint_t width = 4;
+
+                static reg load(const float* p) { return vld1q_f32(p); }
+                static void store(float* p, reg a) { vst1q_f32(p, a); }
+                static reg set1(float v) { return vdupq_n_f32(v); }
+
+                static reg apply(op_add, reg a, reg b) { return vaddq_f32(a, b); }
+                static reg apply(op_sub, reg a, reg b) { return vsubq_f32(a, b); }
+                static reg apply(op_mul, reg a, reg b) { return vmulq_f32(a, b); }
+                static reg apply(op_div, reg a, reg b) { return vdivq_f32(a, b); }
+
+                static std::uint32_t mask(uint32x4_t m) {
+                    const uint32x4_t bits = {1, 2, 4, 8};
+                    return vaddvq_u32(vandq_u32(m, bits));
+                }
+                static std::uint32_t apply(op_eq,  reg a, reg b) { return mask(vceqq_f32(a, b)); }
+                static std::uint32_t apply(op_neq, reg a, reg b) { return mask(vmvnq_u32(vceqq_f32(a, b))); }
+                static std::uint32_t apply(op_lt,  reg a, reg b) { return mask(vcltq_f32(a, b)); }
+                static std::uint32_t apply(op_le,  reg a, reg b) { return mask(vcleq_f32(a, b)); }
+                static std::uint32_t apply(op_gt,  reg a, reg b) { return mask(vcgtq_f32(a, b)); }
+                static std::uint32_t apply(op_ge,  reg a, reg b) { return mask(vcgeq_f32(a, b)); }
+
+                static std::uint32_t is_nan(reg a) { return mask(vmvnq_u32(vceqq_f32(a, a))); }
+                static std::uint32_t is_finite(reg a) {
+                    return mask(vceqq_f32(vsubq_f32(a, a), vdupq_n_f32(0.0f)));
+                }
+
+                static reg min_skip_nan(reg a, reg m) { return vminnmq_f32(a, m); }
+                static reg max_skip_nan(reg a, reg m) { return vmaxnmq_f32(a, m); }
+                static float hmin(reg a) { return vminvq_f32(a); }
+                static float hmax(reg a) { return vmaxvq_f32(a); }
+
+                // Sums are computed in double precision
+                static acc acc_zero() { return vdupq_n_f64(0.0); }
+                static void accumulate(acc& a0, acc& a1, reg a) {
+                    a0 = vaddq_f64(a0, vcvt_f64_f32(vget_low_f32(a)));
+                    a1 = vaddq_f64(a1, vcvt_high_f64_f32(a));
+                }
+                static void accumulate_sq(acc& a0, acc& a1, reg a) {
+                    float64x2_t lo = vcvt_f64_f32(vget_low_f32(a));
+                    float64x2_t hi = vcvt_high_f64_f32(a);
+                    a0 = vfmaq_f64(a0, lo, lo);
+                    a1 = vfmaq_f64(a1, hi, hi);
+                }
+                static void accumulate_prod(acc& a0, acc& a1, reg a, reg b) {
+                    a0 = vfmaq_f64(a0, vcvt_f64_f32(vget_low_f32(a)), vcvt_f64_f32(vget_low_f32(b)));
+                    a1 = vfmaq_f64(a1, vcvt_high_f64_f32(a), vcvt_high_f64_f32(b));
+                }
+                static double hsum(acc a) { return vaddvq_f64(a); }
+
+                static acc acc_set1(double v) { return vdupq_n_f64(v); }
+                static void axpy(acc a, reg x, double* r) {
+                    traits<double>::axpy(a, vcvt_f64_f32(vget_low_f32(x)), r);
+                    traits<double>::axpy(a, vcvt_high_f64_f32(x), r + 2);
+                }
+                static void axpy_sq(acc a, reg x, double* r) {
+                    traits<double>::axpy_sq(a, vcvt_f64_f32(vget_low_f32(x)), r);
+                    traits<double>::axpy_sq(a, vcvt_high_f64_f32(x), r + 2);
+                }
+
+                static reg fast_exp(reg x) {
+                    reg t = vmulq_f32(x, vdupq_n_f32(1.442695041f));
+                    reg fi = vrndmq_f32(t);
+                    reg f = vsubq_f32(t, fi);
+                    int32x4_t i = vcvtq_s32_f32(fi);
+                    f = vaddq_f32(vmulq_f32(vaddq_f32(vmulq_f32(
+                        vdupq_n_f32(0.3371894346f), f), vdupq_n_f32(0.657636276f)), f),
+                        vdupq_n_f32(1.00172476f));
+                    reg r = vreinterpretq_f32_s32(vaddq_s32(vreinterpretq_s32_f32(f),
+                        vshlq_n_s32(i, 23)));
+                    uint32x4_t out = vorrq_u32(
+                        vcltq_f32(x, vdupq_n_f32(-87.0f)), vcgtq_f32(x, vdupq_n_f32(88.0f)));
+                    return vbslq_f32(out, vdupq_n_f32(0.0f), r);
+                }
+            };
+
+            struct bytes {
+                static constexpr uint_t width = 16;
+                static uint_t count_zero(const char* p) {
+                    uint8x16_t z = vceqq_u8(vld1q_u8(reinterpret_cast<const std::uint8_t*>(p)),
+                        vdupq_n_u8(0));
+                    return vaddvq_u8(vshrq_n_u8(z, 7));
+                }
+            };
+
+            #define VIF_INCLUDING_SIMD_KERNELS
+            #include "vif/core/bits/simd-kernels.hpp"
+            #undef VIF_INCLUDING_SIMD_KERNELS
+        }
+    #endif
+
+        // Runtime selection
+        inline simd_level detect_level() {
+        #if defined(VIF_SIMD_X86)
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+                return simd_level::avx512;
+            } else if (__builtin_cpu_supports("avx2")) {
+                return simd_level::avx2;
+            } else {
+                return simd_level::none;
+            }
+        #elif defined(VIF_SIMD_NEON)
+            return simd_level::neon;
+        #else
+            return simd_level::none;
+        #endif
+        }
+
+        inline bool is_level_supported(simd_level l) {
+            static const simd_level best = detect_level();
+            switch (l) {
+            case simd_level::none :   return true;
+            case simd_level::avx2 :   return best == simd_level::avx2 || best == simd_level::avx512;
+            case simd_level::avx512 : return best == simd_level::avx512;
+            case simd_level::neon :   return best == simd_level::neon;
+            }
+
+            return false;
+        }
+
+        inline simd_level default_level() {
+            simd_level l = detect_level();
+
+            const char* env = std::getenv("VIF_SIMD");
+            if (env != nullptr) {
+                std::string s = env;
+                simd_level u = l;
+                if (s == "none") {
+                    u = simd_level::none;
+                } else if (s == "avx2") {
+                    u = simd_level::avx2;
+                } else if (s == "avx512") {
+                    u = simd_level::avx512;
+                } else if (s == "neon") {
+                    u = simd_level::neon;
+                }
+
+                if (is_level_supported(u)) l = u;
+            }
+
+            return l;
+        }
+
+        inline std::atomic<simd_level>& current_level() {
+            static std::atomic<simd_level> l(default_level());
+            return l;
+        }
+
+        #if defined(VIF_SIMD_X86)
+        #define VIF_SIMD_DISPATCH(call) \
+            switch (current_level().load(std::memory_order_relaxed)) { \
+            case simd_level::avx512 : return avx512::call; \
+            case simd_level::avx2 :   return avx2::call; \
+            default :                 return generic::call; \
+            }
+        #elif defined(VIF_SIMD_NEON)
+        #define VIF_SIMD_DISPATCH(call) \
+            switch (current_level().load(std::memory_order_relaxed)) { \
+            case simd_level::neon : return neon::call; \
+            default :               return generic::call; \
+            }
+        #else
+        #define VIF_SIMD_DISPATCH(call) \
+            return generic::call;
+        #endif
+
+        // Element-wise operations, 'r' may be equal to one of the inputs
+        template<typename Op, typename T>
+        void binary(Op op, const T* a, const T* b, T* r, uint_t n) {
+            VIF_SIMD_DISPATCH(binary(op, a, b, r, n))
+        }
+
+        template<typename Op, typename T>
+        void binary(Op op, const T* a, T b, T* r, uint_t n) {
+            VIF_SIMD_DISPATCH(binary(op, a, b, r, n))
+        }
+
+        template<typename Op, typename T>
+        void binary(Op op, T a, const T* b, T* r, uint_t n) {
+            VIF_SIMD_DISPATCH(binary(op, a, b, r, n))
+        }
+
+        template<typename Op, typename T>
+        void compare(Op op, const T* a, const T* b, char* r, uint_t n) {
+            VIF_SIMD_DISPATCH(compare(op, a, b, r, n))
+        }
+
+        template<typename Op, typename T>
+        void compare(Op op, const T* a, T b, char* r, uint_t n) {
+            VIF_SIMD_DISPATCH(compare(op, a, b, r, n))
+        }
+
+        template<typename Op, typename T>
+        void compare(Op op, T a, const T* b, char* r, uint_t n) {
+            VIF_SIMD_DISPATCH(compare(op, a, b, r, n))
+        }
+
+        template<typename T>
+        void is_nan(const T* a, char* r, uint_t n) {
+            VIF_SIMD_DISPATCH(is_nan(a, r, n))
+        }
+
+        template<typename T>
+        void is_finite(const T* a, char* r, uint_t n) {
+            VIF_SIMD_DISPATCH(is_finite(a, r, n))
+        }
+
+        inline void fast_exp(const float* a, float* r, uint_t n) {
+            VIF_SIMD_DISPATCH(fast_exp(a, r, n))
+        }
+
+        // In place accumulation into double precision: r[i] += a*x[i] and r[i] += a*x[i]*x[i]
+        template<typename T>
+        void axpy(double a, const T* x, double* r, uint_t n) {
+            VIF_SIMD_DISPATCH(axpy(a, x, r, n))
+        }
+
+        template<typename T>
+        void axpy_sq(double a, const T* x, double* r, uint_t n) {
+            VIF_SIMD_DISPATCH(axpy_sq(a, x, r, n))
+        }
+
+        // Reductions
+        template<typename T>
+        double sum(const T* a, uint_t n) {
+            VIF_SIMD_DISPATCH(sum(a, n))
+        }
+
+        template<typename T>
+        double sum_sq(const T* a, uint_t n) {
+            VIF_SIMD_DISPATCH(sum_sq(a, n))
+        }
+
+        template<typename T>
+        double dot(const T* a, const T* b, uint_t n) {
+            VIF_SIMD_DISPATCH(dot(a, b, n))
+        }
+
+        template<typename T>
+        uint_t count_nan(const T* a, uint_t n) {
+            VIF_SIMD_DISPATCH(count_nan(a, n))
+        }
+
+        inline uint_t count_nonzero(const char* a, uint_t n) {
+            VIF_SIMD_DISPATCH(count_nonzero(a, n))
+        }
+
+        // Minimum and maximum ignoring NaN values; return +inf/-inf if all values are NaN
+        template<typename T>
+        T min_skip_nan(const T* a, uint_t n) {
+            VIF_SIMD_DISPATCH(min_skip_nan(a, n))
+        }
+
+        template<typename T>
+        T max_skip_nan(const T* a, uint_t n) {
+            VIF_SIMD_DISPATCH(max_skip_nan(a, n))
+        }
+
+        // Position of the first/last element equal to 'v', or npos if none
+        template<typename T>
+        uint_t find_first(const T* a, uint_t n, T v) {
+            VIF_SIMD_DISPATCH(find_first(a, n, v))
+        }
+
+        template<typename T>
+        uint_t find_last(const T* a, uint_t n, T v) {
+            VIF_SIMD_DISPATCH(find_last(a, n, v))
+        }
+
+        #undef VIF_SIMD_DISPATCH
+
+        // Position of the first minimum and maximum ignoring NaN values (0 if all NaN)
+        template<typename T>
+        uint_t min_id(const T* a, uint_t n) {
+            uint_t id = find_first(a, n, min_skip_nan(a, n));
+            return id == npos ? 0 : id;
+        }
+
+        template<typename T>
+        uint_t max_id(const T* a, uint_t n) {
+            uint_t id = find_first(a, n, max_skip_nan(a, n));
+            return id == npos ? 0 : id;
+        }
+    }
+    }
+
+    // Select the instruction set used by the vectorized kernels
+    inline void simd_set_level(simd_level l) {
+        vif_check(impl::simd_impl::is_level_supported(l), "this instruction set is not "
+            "supported on this machine");
+        impl::simd_impl::current_level() = l;
+    }
+
+    inline simd_level simd_get_level() {
+        return impl::simd_impl::current_level();
+    }
+}
+
+#endif
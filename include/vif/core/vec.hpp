@@ -7,6 +7,7 @@
 #include <cstddef>
 #include <algorithm>
 #include <utility>
+#include <tuple>
 #include <initializer_list>
 #include <limits>
 #include "vif/core/typedefs.hpp"
@@ -14,6 +15,7 @@
 #include "vif/core/meta.hpp"
 #include "vif/core/error.hpp"
 #include "vif/core/iterator_base.hpp"
+#include "vif/core/simd.hpp"
 
 namespace vif {
     namespace impl {
@@ -132,11 +134,23 @@ namespace vif {
             }
         }
 
+        // Evaluation of a lazy expression (see lazy())
+        template<typename E, typename enable = typename std::enable_if<meta::is_lazy<E>::value>::type>
+        vec(const E& e) : safe(*this) {
+            impl::lazy_assign(*this, e);
+        }
+
         vec& operator = (meta::nested_initializer_list<Dim,meta::dtype_t<Type>> il) {
             impl::vec_ilist::helper<Dim, Type>::fill(*this, il);
             return *this;
         }
 
+        template<typename E, typename enable = typename std::enable_if<meta::is_lazy<E>::value>::type>
+        vec& operator = (const E& e) {
+            impl::lazy_assign(*this, e);
+            return *this;
+        }
+
         vec& operator = (const vec& v) {
             data = v.data;
             dims = v.dims;
@@ -738,6 +752,12 @@ namespace vif {
             return *this;
         }
 
+        template<typename E, typename enable = typename std::enable_if<meta::is_lazy<E>::value>::type>
+        vec& operator = (const E& e) {
+            impl::lazy_assign(*this, e);
+            return *this;
+        }
+
         template<typename T>
         void assign_(const vec<Dim,T>& v) {
             if (view_same(v)) {
@@ -1119,7 +1139,8 @@ namespace vif {
                 return *this; \
             } \
             \
-            template<typename U> \
+            template<typename U, typename enable = typename std::enable_if< \
+                !meta::is_lazy<U>::value>::type> \
             vec& operator op (U u) { \
                 for (auto& v : data) { \
                     *v op u; \
@@ -1234,6 +1255,7 @@ namespace vif {
 
 #define VIF_INCLUDING_CORE_VEC_BITS
 #include "vif/core/bits/operators.hpp"
+#include "vif/core/bits/lazy.hpp"
 #include "vif/core/bits/vectorize.hpp"
 #undef VIF_INCLUDING_CORE_VEC_BITS
 
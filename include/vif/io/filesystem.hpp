@@ -3,10 +3,12 @@
 
 #include <dirent.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <fnmatch.h>
 #include <cstring>
 #include <cstdio>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fstream>
 #include <sstream>
 #include <ctime>
@@ -280,6 +282,91 @@ namespace file {
         return true;
     }
 
+    // Read-only memory mapping of a file, or of a range of bytes within a file. The pages
+    // are only loaded from the disk when they are first accessed. The mapping is released
+    // when the object is closed or destroyed; it can be moved but not copied.
+    class mapped_file {
+        void* map_ = nullptr;
+        std::size_t size_ = 0;
+
+    public :
+        mapped_file() = default;
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator = (const mapped_file&) = delete;
+
+        mapped_file(mapped_file&& m) noexcept : map_(m.map_), size_(m.size_) {
+            m.map_ = nullptr;
+            m.size_ = 0;
+        }
+
+        mapped_file& operator = (mapped_file&& m) noexcept {
+            if (this != &m) {
+                close();
+                map_ = m.map_;
+                size_ = m.size_;
+                m.map_ = nullptr;
+                m.size_ = 0;
+            }
+
+            return *this;
+        }
+
+        ~mapped_file() {
+            close();
+        }
+
+        // Granularity of the mappings; 'offset' in 'open()' must be a multiple of this value
+        static std::size_t page_size() {
+            return ::sysconf(_SC_PAGESIZE);
+        }
+
+        // Map 'size' bytes starting at 'offset' (or until the end of the file, if 'size' is
+        // npos). Returns false if the file could not be opened or mapped, or if it is too
+        // short. An empty range cannot be mapped.
+        bool open(const std::string& filename, std::size_t offset = 0, std::size_t size = npos) {
+            close();
+
+            int fd = ::open(filename.c_str(), O_RDONLY);
+            if (fd < 0) return false;
+
+            struct stat st;
+            if (::fstat(fd, &st) == 0 && std::size_t(st.st_size) > offset) {
+                std::size_t avail = std::size_t(st.st_size) - offset;
+                if (size == npos) size = avail;
+                if (size != 0 && size <= avail) {
+                    void* m = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, offset);
+                    if (m != MAP_FAILED) {
+                        map_ = m;
+                        size_ = size;
+                    }
+                }
+            }
+
+            ::close(fd);
+            return map_ != nullptr;
+        }
+
+        void close() {
+            if (map_) {
+                ::munmap(map_, size_);
+                map_ = nullptr;
+                size_ = 0;
+            }
+        }
+
+        bool is_open() const {
+            return map_ != nullptr;
+        }
+
+        const char* data() const {
+            return static_cast<const char*>(map_);
+        }
+
+        std::size_t size() const {
+            return size_;
+        }
+    };
+
     VIF_VECTORIZE(directorize)
     VIF_VECTORIZE(is_absolute_path)
     VIF_VECTORIZE(get_basename)
@@ -33,26 +33,26 @@ namespace fits {
     // Load the content of a FITS file into an array.
     template<std::size_t Dim, typename Type>
     void read_hdu(const std::string& filename, vec<Dim,Type>& v, uint_t hdu, fits::header& hdr) {
-        fits::input_image img(filename, hdu);
+        fits::mapped_image img(filename, hdu);
         hdr = img.read_header();
         img.read(v);
     }
 
     template<std::size_t Dim, typename Type>
     void read_hdu(const std::string& filename, vec<Dim, Type>& v, uint_t hdu) {
-        fits::input_image(filename, hdu).read(v);
+        fits::mapped_image(filename, hdu).read(v);
     }
 
     template<std::size_t Dim, typename Type>
     void read(const std::string& filename, vec<Dim,Type>& v, fits::header& hdr) {
-        fits::input_image img(filename);
+        fits::mapped_image img(filename);
         hdr = img.read_header();
         img.read(v);
     }
 
     template<std::size_t Dim, typename Type>
     void read(const std::string& filename, vec<Dim, Type>& v) {
-        fits::input_image(filename).read(v);
+        fits::mapped_image(filename).read(v);
     }
 
     template<std::size_t Dim = 2, typename Type = double>
@@ -1,11 +1,164 @@
 #ifndef VIF_IO_FITS_IMAGE_HPP
 #define VIF_IO_FITS_IMAGE_HPP
 
+#include <cstring>
+#include <cstdint>
 #include "vif/io/fits/base.hpp"
 
 #ifndef NO_CFITSIO
 
 namespace vif {
+namespace impl {
+    namespace fits_impl {
+        // Pixels are stored in big-endian byte order in FITS files
+        inline std::uint8_t from_big_endian(std::uint8_t v) {
+            return v;
+        }
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        static const bool native_big_endian = true;
+
+        inline std::uint16_t from_big_endian(std::uint16_t v) {
+            return v;
+        }
+
+        inline std::uint32_t from_big_endian(std::uint32_t v) {
+            return v;
+        }
+
+        inline std::uint64_t from_big_endian(std::uint64_t v) {
+            return v;
+        }
+#else
+        static const bool native_big_endian = false;
+
+        inline std::uint16_t from_big_endian(std::uint16_t v) {
+            return __builtin_bswap16(v);
+        }
+
+        inline std::uint32_t from_big_endian(std::uint32_t v) {
+            return __builtin_bswap32(v);
+        }
+
+        inline std::uint64_t from_big_endian(std::uint64_t v) {
+            return __builtin_bswap64(v);
+        }
+#endif
+
+        template<std::size_t N>
+        struct unsigned_of_size;
+
+        template<>
+        struct unsigned_of_size<1> {
+            using type = std::uint8_t;
+        };
+
+        template<>
+        struct unsigned_of_size<2> {
+            using type = std::uint16_t;
+        };
+
+        template<>
+        struct unsigned_of_size<4> {
+            using type = std::uint32_t;
+        };
+
+        template<>
+        struct unsigned_of_size<8> {
+            using type = std::uint64_t;
+        };
+
+        template<typename R>
+        R load_big_endian(const unsigned char* p) {
+            using utype = typename unsigned_of_size<sizeof(R)>::type;
+            utype u;
+            std::memcpy(&u, p, sizeof(R));
+            u = from_big_endian(u);
+            R r;
+            std::memcpy(&r, &u, sizeof(R));
+            return r;
+        }
+
+        // Pixel value transformation (BSCALE, BZERO, BLANK), as applied by cfitsio
+        struct pixel_scaling {
+            double scale = 1.0;
+            double zero = 0.0;
+            bool has_blank = false;
+            long long blank = 0;
+
+            bool scaled() const {
+                return scale != 1.0 || zero != 0.0;
+            }
+        };
+
+        // Convert a scaled pixel value to the output type. Like cfitsio, integer types are
+        // rounded to the nearest integer rather than truncated.
+        template<typename O>
+        O scaled_pixel_(double v, std::true_type) {
+            return O(std::round(v));
+        }
+
+        template<typename O>
+        O scaled_pixel_(double v, std::false_type) {
+            return O(v);
+        }
+
+        // Convert 'n' consecutive pixels from the file into values of type 'Type', replacing
+        // the BLANK pixels by the default value of 'Type'. Each branch is a simple loop that
+        // the compiler can vectorize.
+        template<typename R, typename Type, typename O>
+        void convert_pixels_(const unsigned char* p, O* out, uint_t n, const pixel_scaling& s) {
+            const O def = traits<Type>::def();
+            const double scale = s.scale, zero = s.zero;
+            if (s.has_blank) {
+                const R blank = R(s.blank);
+                if (s.scaled()) {
+                    for (uint_t i = 0; i < n; ++i) {
+                        R r = load_big_endian<R>(p + i*sizeof(R));
+                        out[i] = (r == blank ? def :
+                            scaled_pixel_<O>(r*scale + zero, std::is_integral<O>{}));
+                    }
+                } else {
+                    for (uint_t i = 0; i < n; ++i) {
+                        R r = load_big_endian<R>(p + i*sizeof(R));
+                        out[i] = (r == blank ? def : O(r));
+                    }
+                }
+            } else if (s.scaled()) {
+                for (uint_t i = 0; i < n; ++i) {
+                    out[i] = scaled_pixel_<O>(load_big_endian<R>(p + i*sizeof(R))*scale + zero,
+                        std::is_integral<O>{});
+                }
+            } else {
+                for (uint_t i = 0; i < n; ++i) {
+                    out[i] = O(load_big_endian<R>(p + i*sizeof(R)));
+                }
+            }
+        }
+
+        template<typename Type, typename O>
+        void convert_pixels(int bitpix, const unsigned char* p, O* out, uint_t n,
+            const pixel_scaling& s) {
+
+            switch (bitpix) {
+                case BYTE_IMG     : convert_pixels_<std::uint8_t, Type>(p, out, n, s); break;
+                case SHORT_IMG    : convert_pixels_<std::int16_t, Type>(p, out, n, s); break;
+                case LONG_IMG     : convert_pixels_<std::int32_t, Type>(p, out, n, s); break;
+                case LONGLONG_IMG : convert_pixels_<std::int64_t, Type>(p, out, n, s); break;
+                case FLOAT_IMG    : convert_pixels_<float,        Type>(p, out, n, s); break;
+                case DOUBLE_IMG   : convert_pixels_<double,       Type>(p, out, n, s); break;
+                default : throw fits::exception("unknown image type '"+to_string(bitpix)+"'");
+            }
+        }
+
+        // BITPIX value of the pixels that can be used in place as 'Type'
+        template<typename Type>
+        int native_bitpix() {
+            return (std::is_floating_point<Type>::value ? -8 : 8)*int(sizeof(Type));
+        }
+    }
+}
+
 namespace fits {
     // FITS input table (read only)
     class input_image : public virtual impl::fits_impl::file_base {
@@ -25,7 +178,24 @@ namespace fits {
         input_image& operator = (input_image&&) noexcept = delete;
         input_image& operator = (const input_image&&) noexcept = delete;
 
+        // Allow reading pixels into a type with less precision than the image
+        // (e.g., double precision images into float vectors)
+        void allow_narrow(bool narrow = true) {
+            allow_narrow_ = narrow;
+        }
+
     protected:
+
+        bool allow_narrow_ = false;
+
+        template<typename Type>
+        bool is_convertible_(int type) const {
+            if (allow_narrow_) {
+                return impl::fits_impl::traits<Type>::is_convertible_narrow(type);
+            } else {
+                return impl::fits_impl::traits<Type>::is_convertible(type);
+            }
+        }
         template<typename Type>
         void read_prep_(uint_t rdims, int& naxis, std::vector<long>& naxes, int& type) const {
             fits_get_img_dim(fptr_, &naxis, &status_);
@@ -39,7 +209,7 @@ namespace fits {
             fits::vif_check_cfitsio(status_, "could not read image parameters of HDU");
 
             type = impl::fits_impl::bitpix_to_type(bitpix);
-            vif_check_fits(impl::fits_impl::traits<Type>::is_convertible(type), "wrong image type "
+            vif_check_fits(is_convertible_<Type>(type), "wrong image type "
                 "(expected "+pretty_type_t(Type)+", got "+impl::fits_impl::type_to_string_(type)+")");
 
             type = impl::fits_impl::traits<Type>::ttype;
@@ -200,6 +370,258 @@ namespace fits {
         }
     };
 
+    // FITS input image read through a memory map (read only).
+    // The pixels of an uncompressed image HDU are read straight from the pages of the file,
+    // which the operating system only loads when they are first accessed: opening a large
+    // mosaic is instantaneous, no intermediate buffer is allocated, and reading a small subset
+    // only touches the pages that contain it. The pixels are converted from the FITS byte order
+    // (and BSCALE, BZERO and BLANK are applied) in a single pass while they are copied into the
+    // output vector. Compressed HDUs, and files that cannot be mapped (e.g., gzipped files), are
+    // read through cfitsio like with 'input_image'. Reading pixels from a mapped HDU does not
+    // involve cfitsio, and is therefore thread-safe.
+    class mapped_image : public input_image {
+    public :
+        mapped_image() :
+            impl::fits_impl::file_base(impl::fits_impl::image_file, impl::fits_impl::read_only) {}
+
+        explicit mapped_image(const std::string& filename) :
+            impl::fits_impl::file_base(impl::fits_impl::image_file, filename, impl::fits_impl::read_only),
+            input_image(filename) {
+            map_hdu_();
+        }
+
+        explicit mapped_image(const std::string& filename, uint_t hdu) :
+            impl::fits_impl::file_base(impl::fits_impl::image_file, filename, impl::fits_impl::read_only),
+            input_image(filename) {
+            reach_hdu(hdu);
+        }
+
+        mapped_image(mapped_image&& m) noexcept :
+            impl::fits_impl::file_base(std::move(m)), input_image(std::move(m)),
+            bitpix_(m.bitpix_), naxes_(std::move(m.naxes_)), scaling_(m.scaling_),
+            map_(std::move(m.map_)), data_(m.data_) {
+            m.data_ = nullptr;
+        }
+
+        mapped_image(const mapped_image&) = delete;
+        mapped_image& operator = (mapped_image&&) noexcept = delete;
+        mapped_image& operator = (const mapped_image&&) = delete;
+
+        ~mapped_image() {
+            unmap_();
+        }
+
+        void open(const std::string& filename) {
+            unmap_();
+            input_image::open(filename);
+            map_hdu_();
+        }
+
+        void close() {
+            unmap_();
+            input_image::close();
+        }
+
+        void reach_hdu(uint_t hdu) {
+            unmap_();
+            input_image::reach_hdu(hdu);
+            map_hdu_();
+        }
+
+        // Check if the pixels of the current HDU are read from the memory map
+        bool is_mapped() const {
+            return data_ != nullptr;
+        }
+
+        // Pointer to the pixels of the current HDU in the memory map, in FITS order (first axis
+        // varies fastest). This is only possible if the pixels need no conversion to be read as
+        // 'Type': same type, native byte order (always true for 8 bit integers), and no BSCALE,
+        // BZERO or BLANK. Returns a null pointer otherwise.
+        template<typename Type>
+        const Type* mapped_data() const {
+            if (!is_mapped() || bitpix_ != impl::fits_impl::native_bitpix<Type>() ||
+                scaling_.scaled() || (bitpix_ > 0 && scaling_.has_blank)) {
+                return nullptr;
+            }
+
+            if (sizeof(Type) != 1 && !impl::fits_impl::native_big_endian) {
+                return nullptr;
+            }
+
+            return reinterpret_cast<const Type*>(data_);
+        }
+
+    protected :
+
+        void unmap_() {
+            map_.close();
+            data_ = nullptr;
+        }
+
+        void map_hdu_() {
+            if (!is_open()) return;
+
+            int naxis = 0;
+            fits_get_img_dim(fptr_, &naxis, &status_);
+            fits::vif_check_cfitsio(status_, "could not read dimensions of HDU");
+            if (naxis == 0) return;
+
+            naxes_.resize(naxis);
+            fits_get_img_param(fptr_, naxis, &bitpix_, &naxis, naxes_.data(), &status_);
+            fits::vif_check_cfitsio(status_, "could not read image parameters of HDU");
+
+            int compressed = fits_is_compressed_image(fptr_, &status_);
+            fits::vif_check_cfitsio(status_, "could not read image parameters of HDU");
+            if (compressed) return;
+
+            LONGLONG hstart, dstart, dend;
+            fits_get_hduaddrll(fptr_, &hstart, &dstart, &dend, &status_);
+            fits::vif_check_cfitsio(status_, "could not read data location of HDU");
+
+            std::size_t npix = 1;
+            for (long n : naxes_) {
+                npix *= n;
+            }
+
+            std::size_t nbyte = npix*(std::abs(bitpix_)/8);
+            if (nbyte == 0 || std::size_t(dend - dstart) < nbyte) return;
+
+            // Map from the start of the header, which must be aligned on a page
+            std::size_t page = file::mapped_file::page_size();
+            std::size_t first = (std::size_t(hstart)/page)*page;
+            std::size_t last = std::size_t(dstart) + nbyte;
+            if (!map_.open(filename(), first, last - first)) return;
+
+            // Make sure the file on disk is the one cfitsio has read (it is not if the
+            // file was decompressed in memory)
+            const char* hdr = map_.data() + (std::size_t(hstart) - first);
+            if (std::strncmp(hdr, "SIMPLE  ", 8) != 0 && std::strncmp(hdr, "XTENSION", 8) != 0) {
+                unmap_();
+                return;
+            }
+
+            scaling_ = impl::fits_impl::pixel_scaling{};
+            read_keyword("BSCALE", scaling_.scale);
+            read_keyword("BZERO", scaling_.zero);
+            if (bitpix_ > 0) {
+                scaling_.has_blank = read_keyword("BLANK", scaling_.blank);
+            }
+
+            data_ = reinterpret_cast<const unsigned char*>(map_.data()) +
+                (std::size_t(dstart) - first);
+        }
+
+        template<typename Type>
+        void check_mapped_type_(uint_t rdims) const {
+            vif_check_fits(naxes_.size() == rdims, "FITS file has wrong number of dimensions "
+                "(expected "+to_string(rdims)+", got "+to_string(naxes_.size())+")");
+
+            int type = impl::fits_impl::bitpix_to_type(bitpix_);
+            vif_check_fits(is_convertible_<Type>(type), "wrong image type "
+                "(expected "+pretty_type_t(Type)+", got "+impl::fits_impl::type_to_string_(type)+")");
+        }
+
+    public :
+
+        template<std::size_t Dim, typename Type>
+        void read(vec<Dim,Type>& v) const {
+            if (!is_mapped()) {
+                input_image::read(v);
+                return;
+            }
+
+            check_mapped_type_<Type>(Dim);
+
+            for (uint_t i : range(Dim)) {
+                v.dims[i] = naxes_[Dim-1-i];
+            }
+
+            v.resize();
+
+            impl::fits_impl::convert_pixels<Type>(bitpix_, data_, v.raw_data(), v.size(), scaling_);
+        }
+
+        template<std::size_t Dim, typename Type, typename ... Args>
+        void read_subset(vec<Dim,Type>& v, const Args& ... args) const {
+            static_assert(Dim == sizeof...(Args), "incompatible subset and vector dimensions");
+
+            if (!is_mapped()) {
+                input_image::read_subset(v, args...);
+                return;
+            }
+
+            check_mapped_type_<Type>(Dim);
+
+            std::vector<long> fpixel(Dim), lpixel(Dim);
+            make_indices_(0, naxes_, fpixel, lpixel, args...);
+
+            for (uint_t i : range(Dim)) {
+                v.dims[i] = (lpixel[Dim-1-i]-fpixel[Dim-1-i])+1;
+            }
+
+            v.resize();
+
+            // Convert the subset one row (along the first FITS axis) at a time
+            const uint_t bpp = std::abs(bitpix_)/8;
+            const uint_t nrow = lpixel[0]-fpixel[0]+1;
+            std::vector<long> p = fpixel;
+            auto* out = v.raw_data();
+            for (uint_t i = 0; i < v.size(); i += nrow) {
+                uint_t offset = 0, pitch = 1;
+                for (uint_t d : range(Dim)) {
+                    offset += (p[d]-1)*pitch;
+                    pitch *= naxes_[d];
+                }
+
+                impl::fits_impl::convert_pixels<Type>(bitpix_, data_ + offset*bpp, out + i, nrow,
+                    scaling_);
+
+                for (uint_t d = 1; d < Dim; ++d) {
+                    if (p[d] < lpixel[d]) {
+                        ++p[d];
+                        break;
+                    }
+
+                    p[d] = fpixel[d];
+                }
+            }
+        }
+
+        template<typename Type = double>
+        Type read_pixel(vec1u p) const {
+            if (!is_mapped()) {
+                return input_image::read_pixel<Type>(p);
+            }
+
+            check_mapped_type_<Type>(p.size());
+
+            uint_t naxis = naxes_.size();
+            uint_t ppos = 0;
+            uint_t pitch = 1;
+            for (uint_t i : range(p)) {
+                vif_check_fits(p.safe[naxis-1-i] < uint_t(naxes_[i]),
+                    "FITS file has too small dimensions (reading pixel "+to_string(p)+")");
+                ppos += p.safe[naxis-1-i]*pitch;
+                pitch *= naxes_[i];
+            }
+
+            Type val;
+            impl::fits_impl::convert_pixels<Type>(bitpix_, data_ + ppos*(std::abs(bitpix_)/8),
+                &val, 1, scaling_);
+
+            return val;
+        }
+
+    private :
+
+        int bitpix_ = 0;
+        std::vector<long> naxes_;
+        impl::fits_impl::pixel_scaling scaling_;
+
+        file::mapped_file map_;
+        const unsigned char* data_ = nullptr;
+    };
+
     // Output FITS table (write only, overwrites existing files)
     class output_image : public virtual impl::fits_impl::file_base {
     public :
@@ -223,15 +645,11 @@ namespace fits {
             fits::vif_check_cfitsio(status_, "could not write image to HDU");
         }
 
-    public :
-
-        template<std::size_t Dim, typename Type>
-        void write(const vec<Dim,Type>& v) {
-            check_is_open_();
-
+        template<typename Type, std::size_t Dim>
+        void create_image_(const std::array<uint_t,Dim>& dims) {
             std::array<long,Dim> naxes;
             for (uint_t i : range(Dim)) {
-                naxes[i] = v.dims[Dim-1-i];
+                naxes[i] = dims[Dim-1-i];
             }
 
             if (hdu_count() > 0) {
@@ -241,20 +659,62 @@ namespace fits {
                     "cannot write image, there is already data in this HDU");
 
                 // Then resize it
-                fits_resize_img(fptr_, impl::fits_impl::traits<meta::rtype_t<Type>>::image_type, Dim,
+                fits_resize_img(fptr_, impl::fits_impl::traits<Type>::image_type, Dim,
                     naxes.data(), &status_);
                 fits::vif_check_cfitsio(status_, "could not create image HDU");
             } else {
                 // No HDU yet, just create the image in the primary array
-                fits_insert_img(fptr_, impl::fits_impl::traits<meta::rtype_t<Type>>::image_type, Dim,
+                fits_insert_img(fptr_, impl::fits_impl::traits<Type>::image_type, Dim,
                     naxes.data(), &status_);
                 fits::vif_check_cfitsio(status_, "could not create image HDU");
             }
+        }
+
+    public :
+
+        template<std::size_t Dim, typename Type>
+        void write(const vec<Dim,Type>& v) {
+            check_is_open_();
+
+            create_image_<meta::rtype_t<Type>>(v.dims);
 
             // Finally write the data
             write_impl_(v.concretise());
         }
 
+        // Create an image of the provided dimensions and pixel type in the current HDU,
+        // without writing the pixels. The pixels can then be written piece by piece with
+        // 'write_subset()', in any order, so the whole image never needs to be in memory.
+        template<typename Type, std::size_t Dim>
+        void create(const std::array<uint_t,Dim>& dims) {
+            check_is_open_();
+
+            create_image_<Type>(dims);
+
+            // Update internal structures, because CFITSIO won't do that by itself
+            fits_set_hdustruc(fptr_, &status_);
+            fits::vif_check_cfitsio(status_, "could not create image HDU");
+        }
+
+        // Write a block of pixels of the image (created with 'write()' or 'create()'), with
+        // its first pixel at the position 'start' (0-based, in C order).
+        template<std::size_t Dim, typename Type>
+        void write_subset(const vec<Dim,Type>& v, const std::array<uint_t,Dim>& start) {
+            check_is_open_();
+
+            std::array<long,Dim> fpixel, lpixel;
+            for (uint_t i : range(Dim)) {
+                fpixel[i] = start[Dim-1-i] + 1;
+                lpixel[i] = start[Dim-1-i] + v.dims[Dim-1-i];
+            }
+
+            auto cv = v.concretise();
+            fits_write_subset(fptr_, impl::fits_impl::traits<meta::rtype_t<Type>>::ttype,
+                fpixel.data(), lpixel.data(),
+                const_cast<typename vec<Dim,Type>::dtype*>(cv.raw_data()), &status_);
+            fits::vif_check_cfitsio(status_, "could not write image subset to HDU");
+        }
+
         void write_empty() {
             check_is_open_();
 
@@ -54,13 +54,36 @@ namespace vif {
         return std::isfinite(t);
     }
 
+    namespace impl {
+        template<std::size_t Dim, typename Type>
+        void is_finite_(const vec<Dim,Type>& v, vec<Dim,bool>& r, std::false_type) {
+            for (uint_t i : range(v)) {
+                r.safe[i] = std::isfinite(v.safe[i]);
+            }
+        }
+
+        template<std::size_t Dim, typename Type>
+        void is_finite_(const vec<Dim,Type>& v, vec<Dim,bool>& r, std::true_type) {
+            simd_impl::is_finite(v.data.data(), r.data.data(), v.size());
+        }
+
+        template<std::size_t Dim, typename Type>
+        void is_nan_(const vec<Dim,Type>& v, vec<Dim,bool>& r, std::false_type) {
+            for (uint_t i : range(v)) {
+                r.safe[i] = std::isnan(v.safe[i]);
+            }
+        }
+
+        template<std::size_t Dim, typename Type>
+        void is_nan_(const vec<Dim,Type>& v, vec<Dim,bool>& r, std::true_type) {
+            simd_impl::is_nan(v.data.data(), r.data.data(), v.size());
+        }
+    }
+
     template<std::size_t Dim, typename Type>
     vec<Dim,bool> is_finite(const vec<Dim,Type>& v) {
         vec<Dim,bool> r(v.dims);
-        for (uint_t i : range(v)) {
-            r.safe[i] = std::isfinite(v.safe[i]);
-        }
-
+        impl::is_finite_(v, r, impl::simd_impl::is_supported<Type>{});
         return r;
     }
 
@@ -72,10 +95,7 @@ namespace vif {
     template<std::size_t Dim, typename Type>
     vec<Dim,bool> is_nan(const vec<Dim,Type>& v) {
         vec<Dim,bool> r(v.dims);
-        for (uint_t i : range(v)) {
-            r.safe[i] = std::isnan(v.safe[i]);
-        }
-
+        impl::is_nan_(v, r, impl::simd_impl::is_supported<Type>{});
         return r;
     }
 
@@ -126,29 +146,22 @@ namespace vif {
     }
 
     inline float fast_exp(float x) {
-        // Implementation based on:
-        // https://stackoverflow.com/a/10792321/1565581
-
-        static_assert(sizeof(float) == sizeof(std::int32_t), "size of float and int32_t don't match");
-
-        if (x < -87.0f || x > 88.0f) return 0.0f;
-
-        // exp(x) = 2^i * 2^f; i = floor (log2(e) * x), 0 <= f <= 1
-        float t = x * 1.442695041f;
-        float fi = floor(t);
-        float f = t - fi;
-        std::int32_t i = (std::int32_t)fi;
-
-        // compute 2^f
-        f = (0.3371894346f*f + 0.657636276f)*f + 1.00172476f;
+        // Implementation in vif/core/simd.hpp, shared with the vectorized version
+        return impl::simd_impl::fast_exp_scalar(x);
+    }
 
-        // scale by 2^i
-        std::int32_t k;
-        std::memcpy(&k, &f, sizeof(float));
-        k += (i << 23);
-        std::memcpy(&f, &k, sizeof(float));
+    // Vectorized version for float, the generic version is generated by VIF_VECTORIZE below
+    template<std::size_t Dim>
+    vec<Dim,float> fast_exp(const vec<Dim,float>& v) {
+        vec<Dim,float> r(v.dims);
+        impl::simd_impl::fast_exp(v.data.data(), r.data.data(), v.size());
+        return r;
+    }
 
-        return f;
+    template<std::size_t Dim>
+    vec<Dim,float> fast_exp(vec<Dim,float>&& v) {
+        impl::simd_impl::fast_exp(v.data.data(), v.data.data(), v.size());
+        return std::move(v);
     }
 
     VIF_VECTORIZE(sqrt);
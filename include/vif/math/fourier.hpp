@@ -4,7 +4,10 @@
 #ifndef NO_FFTW
 #include <fftw3.h>
 #endif
+#include <map>
+#include <tuple>
 #include "vif/core/vec.hpp"
+#include "vif/utility/os.hpp"
 #include "vif/utility/thread.hpp"
 #include "vif/math/complex.hpp"
 
@@ -16,23 +19,449 @@ namespace vif {
         }
     }
 
+    // Planning strategy used by FFTW when a new plan is needed. Plans are cached, so the
+    // planning cost is paid only once per array shape: 'measure' and 'patient' are slower
+    // to plan, but give faster transforms. The default is 'estimate', unless the
+    // VIF_FFTW_PLANNER environment variable is set to one of "measure", "patient" or
+    // "exhaustive".
+    enum class fft_planner {
+        estimate, measure, patient, exhaustive
+    };
+
     #ifndef NO_FFTW
-    // Compute the Fast Fourier Transform (FFT) of the provided 2d array
-    inline void fft(const vec2d& v, vec2cd& r) {
-        fftw_plan p;
-        {
-            std::lock_guard<std::mutex> lock(impl::fftw_planner_mutex());
-            p = fftw_plan_dft_r2c_2d(v.dims[0], v.dims[1],
-                const_cast<double*>(v.raw_data()),
-                reinterpret_cast<fftw_complex*>(r.raw_data()), FFTW_ESTIMATE);
+    namespace impl {
+    namespace fourier_impl {
+        enum class transform {
+            r2c, c2r, c2c_forward, c2c_backward
+        };
+
+        // Memory layout of a transform, following the "guru" interface of FFTW: each
+        // dimension is described by a triplet (n, input stride, output stride), with strides
+        // in units of elements. 'dims' are the dimensions to transform, and 'howmany' are the
+        // dimensions over which the transform is repeated.
+        struct plan_shape {
+            std::vector<int> dims;
+            std::vector<int> howmany;
+        };
+
+        struct plan_key {
+            transform type;
+            plan_shape shape;
+            bool inplace;
+            bool aligned;
+            unsigned flags;
+            uint_t nthread;
+
+            bool operator < (const plan_key& k) const {
+                return std::tie(type, inplace, aligned, flags, nthread, shape.dims, shape.howmany) <
+                    std::tie(k.type, k.inplace, k.aligned, k.flags, k.nthread, k.shape.dims,
+                        k.shape.howmany);
+            }
+        };
+
+        // Transform over all the dimensions of a contiguous array
+        template<std::size_t D>
+        plan_shape full_shape(const std::array<uint_t,D>& d, transform type) {
+            plan_shape s;
+            s.dims.resize(3*D);
+
+            int is = 1, os = 1;
+            for (uint_t i = D; i-- > 0;) {
+                int ni = d[i], no = d[i];
+                if (i == D-1) {
+                    // Only half of the complex plane is stored for real transforms
+                    if (type == transform::r2c) no = d[i]/2 + 1;
+                    if (type == transform::c2r) ni = d[i]/2 + 1;
+                }
+
+                s.dims[3*i+0] = d[i];
+                s.dims[3*i+1] = is;
+                s.dims[3*i+2] = os;
+
+                is *= ni;
+                os *= no;
+            }
+
+            return s;
+        }
+
+        // Transform along one dimension of a contiguous array, repeated over all the others
+        template<std::size_t D>
+        plan_shape axis_shape(const std::array<uint_t,D>& d, uint_t axis) {
+            vif_check(axis < D, "cannot transform along axis ", axis, " of a ", D,
+                "-dimensional array");
+
+            int outer = 1, inner = 1;
+            for (uint_t i : range(axis)) {
+                outer *= d[i];
+            }
+            for (uint_t i = axis+1; i < D; ++i) {
+                inner *= d[i];
+            }
+
+            const int n = d[axis];
+
+            plan_shape s;
+            s.dims = {n, inner, inner};
+            if (outer > 1) {
+                s.howmany.insert(s.howmany.end(), {outer, n*inner, n*inner});
+            }
+            if (inner > 1) {
+                s.howmany.insert(s.howmany.end(), {inner, 1, 1});
+            }
+
+            return s;
+        }
+
+        inline vec1i shape_of(const std::vector<int>& dims) {
+            vec1i r(dims.size()/3);
+            for (uint_t i : range(r)) {
+                r.safe[i] = dims[3*i];
+            }
+
+            return r;
         }
 
-        fftw_execute(p);
+        inline std::vector<fftw_iodim> make_iodims(const std::vector<int>& dims) {
+            std::vector<fftw_iodim> r(dims.size()/3);
+            for (uint_t i : range(r)) {
+                r[i].n = dims[3*i+0];
+                r[i].is = dims[3*i+1];
+                r[i].os = dims[3*i+2];
+            }
 
-        {
-            std::lock_guard<std::mutex> lock(impl::fftw_planner_mutex());
-            fftw_destroy_plan(p);
+            return r;
         }
+
+        inline unsigned planner_flags(fft_planner p) {
+            switch (p) {
+                case fft_planner::estimate :   return FFTW_ESTIMATE;
+                case fft_planner::measure :    return FFTW_MEASURE;
+                case fft_planner::patient :    return FFTW_PATIENT;
+                case fft_planner::exhaustive : return FFTW_EXHAUSTIVE;
+            }
+
+            return FFTW_ESTIMATE;
+        }
+
+        // Thread-safe registry of FFTW plans, indexed by transform type, shape and alignment.
+        // Plans are created on first use (on scratch buffers, so that the 'measure' planners
+        // do not overwrite user data), and are then executed with the new-array interface of
+        // FFTW, which is thread-safe. Plans live until the end of the program, or until
+        // 'fft_clear_plans()' is called.
+        class plan_cache {
+            std::map<plan_key, fftw_plan> plans_;
+            fft_planner planner_ = fft_planner::estimate;
+            uint_t nthread_ = 1;
+            std::string wisdom_file_;
+            bool wisdom_dirty_ = false;
+
+            plan_cache() {
+                // Make sure the mutex outlives the cache
+                fftw_planner_mutex();
+
+                std::string planner = system_var("VIF_FFTW_PLANNER", "estimate");
+                if (planner == "measure") {
+                    planner_ = fft_planner::measure;
+                } else if (planner == "patient") {
+                    planner_ = fft_planner::patient;
+                } else if (planner == "exhaustive") {
+                    planner_ = fft_planner::exhaustive;
+                }
+
+#ifndef NO_FFTW_THREADS
+                fftw_init_threads();
+                nthread_ = std::max(system_var<uint_t>("VIF_FFTW_THREADS", 1), uint_t(1));
+#endif
+
+                std::string wisdom = system_var("VIF_FFTW_WISDOM", "");
+                if (!wisdom.empty()) {
+                    set_wisdom_file_(wisdom);
+                }
+            }
+
+            void set_wisdom_file_(const std::string& filename) {
+                wisdom_file_ = filename;
+                if (!wisdom_file_.empty()) {
+                    // The file may not exist yet: it will be created on exit
+                    fftw_import_wisdom_from_filename(wisdom_file_.c_str());
+                }
+            }
+
+            fftw_plan make_plan_(const plan_key& key) {
+                // Find the number of elements spanned by the input and output arrays
+                const bool r2c = key.type == transform::r2c;
+                const bool c2r = key.type == transform::c2r;
+                uint_t nin = 1, nout = 1;
+                const uint_t rank = key.shape.dims.size()/3;
+                for (uint_t i : range(rank)) {
+                    int n = key.shape.dims[3*i+0];
+                    int ni = (c2r && i == rank-1 ? n/2 + 1 : n);
+                    int no = (r2c && i == rank-1 ? n/2 + 1 : n);
+                    nin += (ni - 1)*key.shape.dims[3*i+1];
+                    nout += (no - 1)*key.shape.dims[3*i+2];
+                }
+                for (uint_t i : range(key.shape.howmany.size()/3)) {
+                    int n = key.shape.howmany[3*i+0];
+                    nin += (n - 1)*key.shape.howmany[3*i+1];
+                    nout += (n - 1)*key.shape.howmany[3*i+2];
+                }
+
+                uint_t nbin = nin*(r2c ? sizeof(double) : sizeof(fftw_complex));
+                uint_t nbout = nout*(c2r ? sizeof(double) : sizeof(fftw_complex));
+
+                // Plan on scratch buffers: the planner may write into the arrays
+                void* in = fftw_malloc(key.inplace ? std::max(nbin, nbout) : nbin);
+                void* out = (key.inplace ? in : fftw_malloc(nbout));
+
+                unsigned flags = key.flags;
+                if (!key.aligned) {
+                    flags |= FFTW_UNALIGNED;
+                }
+
+#ifndef NO_FFTW_THREADS
+                fftw_plan_with_nthreads(key.nthread);
+#endif
+
+                std::vector<fftw_iodim> dims = make_iodims(key.shape.dims);
+                std::vector<fftw_iodim> howmany = make_iodims(key.shape.howmany);
+
+                fftw_plan p = nullptr;
+                switch (key.type) {
+                case transform::r2c :
+                    p = fftw_plan_guru_dft_r2c(dims.size(), dims.data(),
+                        howmany.size(), howmany.data(),
+                        static_cast<double*>(in), static_cast<fftw_complex*>(out), flags);
+                    break;
+                case transform::c2r :
+                    p = fftw_plan_guru_dft_c2r(dims.size(), dims.data(),
+                        howmany.size(), howmany.data(),
+                        static_cast<fftw_complex*>(in), static_cast<double*>(out), flags);
+                    break;
+                case transform::c2c_forward :
+                    p = fftw_plan_guru_dft(dims.size(), dims.data(),
+                        howmany.size(), howmany.data(),
+                        static_cast<fftw_complex*>(in), static_cast<fftw_complex*>(out),
+                        FFTW_FORWARD, flags);
+                    break;
+                case transform::c2c_backward :
+                    p = fftw_plan_guru_dft(dims.size(), dims.data(),
+                        howmany.size(), howmany.data(),
+                        static_cast<fftw_complex*>(in), static_cast<fftw_complex*>(out),
+                        FFTW_BACKWARD, flags);
+                    break;
+                }
+
+                if (out != in) fftw_free(out);
+                fftw_free(in);
+
+                vif_check(p != nullptr, "could not create FFTW plan for dimensions ",
+                    shape_of(key.shape.dims));
+
+                if (!(key.flags & FFTW_ESTIMATE)) {
+                    wisdom_dirty_ = true;
+                }
+
+                return p;
+            }
+
+        public :
+            plan_cache(const plan_cache&) = delete;
+            plan_cache(plan_cache&&) = delete;
+            plan_cache& operator = (const plan_cache&) = delete;
+            plan_cache& operator = (plan_cache&&) = delete;
+
+            ~plan_cache() {
+                std::lock_guard<std::mutex> lock(fftw_planner_mutex());
+                if (wisdom_dirty_ && !wisdom_file_.empty()) {
+                    fftw_export_wisdom_to_filename(wisdom_file_.c_str());
+                }
+
+                for (auto& p : plans_) {
+                    fftw_destroy_plan(p.second);
+                }
+            }
+
+            static plan_cache& get() {
+                static plan_cache cache;
+                return cache;
+            }
+
+            // Return a plan suitable for transforming the provided arrays
+            fftw_plan plan(transform type, plan_shape shape, const void* in, const void* out) {
+                plan_key key;
+                key.type = type;
+                key.shape = std::move(shape);
+                key.inplace = (in == out);
+                key.aligned =
+                    fftw_alignment_of(const_cast<double*>(static_cast<const double*>(in))) == 0 &&
+                    fftw_alignment_of(const_cast<double*>(static_cast<const double*>(out))) == 0;
+
+                std::lock_guard<std::mutex> lock(fftw_planner_mutex());
+                key.flags = planner_flags(planner_);
+                key.nthread = nthread_;
+
+                auto iter = plans_.find(key);
+                if (iter != plans_.end()) {
+                    return iter->second;
+                }
+
+                fftw_plan p = make_plan_(key);
+                plans_.insert(std::make_pair(std::move(key), p));
+                return p;
+            }
+
+            void set_planner(fft_planner p) {
+                std::lock_guard<std::mutex> lock(fftw_planner_mutex());
+                planner_ = p;
+            }
+
+            fft_planner planner() {
+                std::lock_guard<std::mutex> lock(fftw_planner_mutex());
+                return planner_;
+            }
+
+            void set_threads(uint_t n) {
+#ifndef NO_FFTW_THREADS
+                std::lock_guard<std::mutex> lock(fftw_planner_mutex());
+                nthread_ = std::max(n, uint_t(1));
+#endif
+            }
+
+            uint_t threads() {
+                std::lock_guard<std::mutex> lock(fftw_planner_mutex());
+                return nthread_;
+            }
+
+            void set_wisdom_file(const std::string& filename) {
+                std::lock_guard<std::mutex> lock(fftw_planner_mutex());
+                set_wisdom_file_(filename);
+            }
+
+            bool save_wisdom(const std::string& filename) {
+                std::lock_guard<std::mutex> lock(fftw_planner_mutex());
+                return fftw_export_wisdom_to_filename(filename.c_str()) != 0;
+            }
+
+            bool load_wisdom(const std::string& filename) {
+                std::lock_guard<std::mutex> lock(fftw_planner_mutex());
+                return fftw_import_wisdom_from_filename(filename.c_str()) != 0;
+            }
+
+            void clear() {
+                std::lock_guard<std::mutex> lock(fftw_planner_mutex());
+                for (auto& p : plans_) {
+                    fftw_destroy_plan(p.second);
+                }
+
+                plans_.clear();
+            }
+        };
+
+        // Real to complex forward transform, using a cached plan
+        template<std::size_t D>
+        void execute_r2c(const vec<D,double>& v, vec<D,complex<double>>& r, plan_shape shape) {
+            vif_check(r.dims == v.dims, "incompatible dimensions for input and output arrays (",
+                v.dims, " vs. ", r.dims, ")");
+
+            double* in = const_cast<double*>(v.raw_data());
+            fftw_complex* out = reinterpret_cast<fftw_complex*>(r.raw_data());
+            fftw_plan p = plan_cache::get().plan(transform::r2c, std::move(shape), in, out);
+            fftw_execute_dft_r2c(p, in, out);
+        }
+
+        template<std::size_t D>
+        void execute_r2c(const vec<D,double>& v, vec<D,complex<double>>& r) {
+            execute_r2c(v, r, full_shape(v.dims, transform::r2c));
+        }
+
+        // Complex to real backward transform, using a cached plan
+        // NB: the input array is destroyed
+        template<std::size_t D>
+        void execute_c2r(vec<D,complex<double>>& v, vec<D,double>& r, plan_shape shape) {
+            vif_check(r.dims == v.dims, "incompatible dimensions for input and output arrays (",
+                v.dims, " vs. ", r.dims, ")");
+
+            fftw_complex* in = reinterpret_cast<fftw_complex*>(v.raw_data());
+            double* out = r.raw_data();
+            fftw_plan p = plan_cache::get().plan(transform::c2r, std::move(shape), in, out);
+            fftw_execute_dft_c2r(p, in, out);
+        }
+
+        template<std::size_t D>
+        void execute_c2r(vec<D,complex<double>>& v, vec<D,double>& r) {
+            execute_c2r(v, r, full_shape(v.dims, transform::c2r));
+        }
+
+        // Complex to complex transform, using a cached plan (input and output may be the
+        // same array)
+        template<std::size_t D>
+        void execute_c2c(const vec<D,complex<double>>& v, vec<D,complex<double>>& r,
+            transform type, plan_shape shape) {
+            vif_check(r.dims == v.dims, "incompatible dimensions for input and output arrays (",
+                v.dims, " vs. ", r.dims, ")");
+
+            fftw_complex* in = const_cast<fftw_complex*>(
+                reinterpret_cast<const fftw_complex*>(v.raw_data()));
+            fftw_complex* out = reinterpret_cast<fftw_complex*>(r.raw_data());
+            fftw_plan p = plan_cache::get().plan(type, std::move(shape), in, out);
+            fftw_execute_dft(p, in, out);
+        }
+
+        template<std::size_t D>
+        void execute_c2c(const vec<D,complex<double>>& v, vec<D,complex<double>>& r,
+            transform type) {
+            execute_c2c(v, r, type, full_shape(v.dims, type));
+        }
+    }
+    }
+
+    // Choose the planning strategy for all subsequent FFTs (see fft_planner).
+    inline void fft_set_planner(fft_planner p) {
+        impl::fourier_impl::plan_cache::get().set_planner(p);
+    }
+
+    inline fft_planner fft_get_planner() {
+        return impl::fourier_impl::plan_cache::get().planner();
+    }
+
+    // Choose the number of threads used by FFTW to execute each transform. The default is one
+    // thread, unless the VIF_FFTW_THREADS environment variable is set. This has no effect if
+    // the FFTW threads library is not available (NO_FFTW_THREADS).
+    inline void fft_set_threads(uint_t nthread) {
+        impl::fourier_impl::plan_cache::get().set_threads(nthread);
+    }
+
+    inline uint_t fft_get_threads() {
+        return impl::fourier_impl::plan_cache::get().threads();
+    }
+
+    // Load FFTW wisdom from a file (e.g., saved by a previous run with 'fft_save_wisdom()'),
+    // so that plans created with the 'measure' or 'patient' strategies are obtained instantly.
+    inline bool fft_load_wisdom(const std::string& filename) {
+        return impl::fourier_impl::plan_cache::get().load_wisdom(filename);
+    }
+
+    // Save the accumulated FFTW wisdom to a file.
+    inline bool fft_save_wisdom(const std::string& filename) {
+        return impl::fourier_impl::plan_cache::get().save_wisdom(filename);
+    }
+
+    // Load FFTW wisdom from a file (if it exists), and save the accumulated wisdom back into
+    // this file when the program exits. This is done automatically if the VIF_FFTW_WISDOM
+    // environment variable is set.
+    inline void fft_set_wisdom_file(const std::string& filename) {
+        impl::fourier_impl::plan_cache::get().set_wisdom_file(filename);
+    }
+
+    // Destroy all the cached FFTW plans.
+    inline void fft_clear_plans() {
+        impl::fourier_impl::plan_cache::get().clear();
+    }
+
+    // Compute the Fast Fourier Transform (FFT) of the provided 2d array
+    inline void fft(const vec2d& v, vec2cd& r) {
+        impl::fourier_impl::execute_r2c(v, r);
     }
 
     // Compute the Fast Fourier Transform (FFT) of the provided 2d array
@@ -44,20 +473,7 @@ namespace vif {
 
     // Compute the Fast Fourier Transform (FFT) of the provided 2d complex array
     inline void fft_c2c(const vec2cd& v, vec2cd& r) {
-        fftw_plan p;
-        {
-            std::lock_guard<std::mutex> lock(impl::fftw_planner_mutex());
-            p = fftw_plan_dft_2d(v.dims[0], v.dims[1],
-                const_cast<fftw_complex*>(reinterpret_cast<const fftw_complex*>(v.raw_data())),
-                reinterpret_cast<fftw_complex*>(r.raw_data()), FFTW_FORWARD, FFTW_ESTIMATE);
-        }
-
-        fftw_execute(p);
-
-        {
-            std::lock_guard<std::mutex> lock(impl::fftw_planner_mutex());
-            fftw_destroy_plan(p);
-        }
+        impl::fourier_impl::execute_c2c(v, r, impl::fourier_impl::transform::c2c_forward);
     }
 
     // Compute the Fast Fourier Transform (FFT) of the provided 2d array
@@ -71,20 +487,7 @@ namespace vif {
     // NB: the FFTW routine does not preserve the data in input, so the
     // input array has to be copied
     inline void ifft(vec2cd v, vec2d& r) {
-        fftw_plan p;
-        {
-            std::lock_guard<std::mutex> lock(impl::fftw_planner_mutex());
-            p = fftw_plan_dft_c2r_2d(v.dims[0], v.dims[1],
-                reinterpret_cast<fftw_complex*>(v.raw_data()),
-                r.raw_data(), FFTW_ESTIMATE);
-        }
-
-        fftw_execute(p);
-
-        {
-            std::lock_guard<std::mutex> lock(impl::fftw_planner_mutex());
-            fftw_destroy_plan(p);
-        }
+        impl::fourier_impl::execute_c2r(v, r);
     }
 
     // Compute the Fast Fourier Transform (FFT) of the provided 2d array
@@ -92,38 +495,157 @@ namespace vif {
     // input array has to be copied
     inline vec2d ifft(vec2cd v) {
         vec2d r(v.dims);
-        ifft(v, r);
+        ifft(std::move(v), r);
         return r;
     }
 
     // Compute the Fast Fourier Transform (FFT) of the provided 2d array
-    // NB: the FFTW routine does not preserve the data in input, so the
-    // input array has to be copied
-    inline void ifft_c2c(vec2cd v, vec2cd& r) {
-        fftw_plan p;
-        {
-            std::lock_guard<std::mutex> lock(impl::fftw_planner_mutex());
-            p = fftw_plan_dft_2d(v.dims[0], v.dims[1],
-                reinterpret_cast<fftw_complex*>(v.raw_data()),
-                reinterpret_cast<fftw_complex*>(r.raw_data()), FFTW_BACKWARD, FFTW_ESTIMATE);
-        }
-
-        fftw_execute(p);
-
-        {
-            std::lock_guard<std::mutex> lock(impl::fftw_planner_mutex());
-            fftw_destroy_plan(p);
-        }
+    inline void ifft_c2c(const vec2cd& v, vec2cd& r) {
+        impl::fourier_impl::execute_c2c(v, r, impl::fourier_impl::transform::c2c_backward);
     }
 
     // Compute the Fast Fourier Transform (FFT) of the provided 2d array
-    // NB: the FFTW routine does not preserve the data in input, so the
-    // input array has to be copied
-    inline vec2cd ifft_c2c(vec2cd v) {
+    inline vec2cd ifft_c2c(const vec2cd& v) {
         vec2cd r(v.dims);
         ifft_c2c(v, r);
         return r;
     }
+
+    // N-dimensional versions of the above functions. As for the 2d case, the output of the
+    // real to complex transform has the same dimensions as the input, but only the first
+    // N0*N1*...*(Nn/2+1) values are used (the other half of the complex plane is redundant).
+    // Transforms are not normalized: ifft(fft(v)) == v*v.size().
+
+    template<std::size_t D>
+    void fft(const vec<D,double>& v, vec<D,complex<double>>& r) {
+        impl::fourier_impl::execute_r2c(v, r);
+    }
+
+    template<std::size_t D>
+    vec<D,complex<double>> fft(const vec<D,double>& v) {
+        vec<D,complex<double>> r(v.dims);
+        fft(v, r);
+        return r;
+    }
+
+    template<std::size_t D>
+    void fft_c2c(const vec<D,complex<double>>& v, vec<D,complex<double>>& r) {
+        impl::fourier_impl::execute_c2c(v, r, impl::fourier_impl::transform::c2c_forward);
+    }
+
+    template<std::size_t D>
+    vec<D,complex<double>> fft_c2c(const vec<D,complex<double>>& v) {
+        vec<D,complex<double>> r(v.dims);
+        fft_c2c(v, r);
+        return r;
+    }
+
+    // NB: the input array is copied (it would otherwise be destroyed by FFTW); pass it with
+    // std::move() to avoid the copy.
+    template<std::size_t D>
+    void ifft(vec<D,complex<double>> v, vec<D,double>& r) {
+        impl::fourier_impl::execute_c2r(v, r);
+    }
+
+    template<std::size_t D>
+    vec<D,double> ifft(vec<D,complex<double>> v) {
+        vec<D,double> r(v.dims);
+        ifft(std::move(v), r);
+        return r;
+    }
+
+    template<std::size_t D>
+    void ifft_c2c(const vec<D,complex<double>>& v, vec<D,complex<double>>& r) {
+        impl::fourier_impl::execute_c2c(v, r, impl::fourier_impl::transform::c2c_backward);
+    }
+
+    template<std::size_t D>
+    vec<D,complex<double>> ifft_c2c(const vec<D,complex<double>>& v) {
+        vec<D,complex<double>> r(v.dims);
+        ifft_c2c(v, r);
+        return r;
+    }
+
+    // Compute the complex Fast Fourier Transform of the provided array, in place
+    template<std::size_t D>
+    void inplace_fft_c2c(vec<D,complex<double>>& v) {
+        impl::fourier_impl::execute_c2c(v, v, impl::fourier_impl::transform::c2c_forward);
+    }
+
+    template<std::size_t D>
+    void inplace_ifft_c2c(vec<D,complex<double>>& v) {
+        impl::fourier_impl::execute_c2c(v, v, impl::fourier_impl::transform::c2c_backward);
+    }
+
+    // Batched 1d transforms: compute the FFT along the dimension 'axis' of the provided array,
+    // for all the positions in the other dimensions (e.g., the spectrum of each pixel of a
+    // data cube). The output has the same dimensions as the input; for the real to complex
+    // transform, only the first N/2+1 values along 'axis' are set, and the inverse transform
+    // only reads these values. All the 1d transforms are done in a single FFTW plan.
+
+    template<std::size_t D>
+    void fft_many(const vec<D,double>& v, vec<D,complex<double>>& r, uint_t axis) {
+        impl::fourier_impl::execute_r2c(v, r, impl::fourier_impl::axis_shape(v.dims, axis));
+    }
+
+    template<std::size_t D>
+    vec<D,complex<double>> fft_many(const vec<D,double>& v, uint_t axis) {
+        vec<D,complex<double>> r(v.dims);
+        fft_many(v, r, axis);
+        return r;
+    }
+
+    template<std::size_t D>
+    void fft_c2c_many(const vec<D,complex<double>>& v, vec<D,complex<double>>& r, uint_t axis) {
+        impl::fourier_impl::execute_c2c(v, r, impl::fourier_impl::transform::c2c_forward,
+            impl::fourier_impl::axis_shape(v.dims, axis));
+    }
+
+    template<std::size_t D>
+    vec<D,complex<double>> fft_c2c_many(const vec<D,complex<double>>& v, uint_t axis) {
+        vec<D,complex<double>> r(v.dims);
+        fft_c2c_many(v, r, axis);
+        return r;
+    }
+
+    // NB: the input array is copied (it would otherwise be destroyed by FFTW); pass it with
+    // std::move() to avoid the copy.
+    template<std::size_t D>
+    void ifft_many(vec<D,complex<double>> v, vec<D,double>& r, uint_t axis) {
+        impl::fourier_impl::execute_c2r(v, r, impl::fourier_impl::axis_shape(v.dims, axis));
+    }
+
+    template<std::size_t D>
+    vec<D,double> ifft_many(vec<D,complex<double>> v, uint_t axis) {
+        vec<D,double> r(v.dims);
+        ifft_many(std::move(v), r, axis);
+        return r;
+    }
+
+    template<std::size_t D>
+    void ifft_c2c_many(const vec<D,complex<double>>& v, vec<D,complex<double>>& r, uint_t axis) {
+        impl::fourier_impl::execute_c2c(v, r, impl::fourier_impl::transform::c2c_backward,
+            impl::fourier_impl::axis_shape(v.dims, axis));
+    }
+
+    template<std::size_t D>
+    vec<D,complex<double>> ifft_c2c_many(const vec<D,complex<double>>& v, uint_t axis) {
+        vec<D,complex<double>> r(v.dims);
+        ifft_c2c_many(v, r, axis);
+        return r;
+    }
+
+    template<std::size_t D>
+    void inplace_fft_c2c_many(vec<D,complex<double>>& v, uint_t axis) {
+        impl::fourier_impl::execute_c2c(v, v, impl::fourier_impl::transform::c2c_forward,
+            impl::fourier_impl::axis_shape(v.dims, axis));
+    }
+
+    template<std::size_t D>
+    void inplace_ifft_c2c_many(vec<D,complex<double>>& v, uint_t axis) {
+        impl::fourier_impl::execute_c2c(v, v, impl::fourier_impl::transform::c2c_backward,
+            impl::fourier_impl::axis_shape(v.dims, axis));
+    }
     #endif
 }
 
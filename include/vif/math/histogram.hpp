@@ -5,6 +5,7 @@
 #include "vif/core/range.hpp"
 #include "vif/core/error.hpp"
 #include "vif/utility/generic.hpp"
+#include "vif/utility/thread.hpp"
 #include "vif/math/base.hpp"
 
 namespace vif {
@@ -186,27 +187,171 @@ namespace vif {
         return b.safe[1] - b.safe[0];
     }
 
-    template<std::size_t Dim, typename Type, typename TypeB>
-    vec1u histogram(const vec<Dim,Type>& data, const vec<2,TypeB>& bins) {
-        vif_check(bins.dims[0] == 2, "can only be called with a bin vector (expected "
-            "dims=[2,...], got dims=[", bins.dims, "])");
+    namespace impl {
+        // Find the bin containing a given value, with the same convention as 'in_bin()'.
+        // If a value falls in multiple (overlapping) bins, the first one is returned, and if it
+        // falls in no bin, 'npos' is returned. The layout of the bins is analyzed once on
+        // construction, so that a value can be binned without scanning all the bins:
+        //  - for uniform bins (i.e., from 'make_bins()'), the bin index is computed directly,
+        //  - for log-uniform bins (i.e., 'e10(make_bins(...))'), the same is done in log space,
+        //  - for other sorted and non-overlapping bins, a binary search is used,
+        //  - otherwise, the bins are scanned one by one.
+        // In the first two cases, the computed index is always checked against the bin edges,
+        // so the result is exactly the same as that of a bin-by-bin comparison.
+        template<typename TypeB>
+        struct bin_finder {
+            using btype = meta::rtype_t<TypeB>;
+
+            enum class layout {
+                uniform, log_uniform, sorted, generic
+            };
+
+            vec<1,btype> lo, hi;
+            uint_t nbin = 0;
+            layout type = layout::generic;
+            double x0 = 0.0, dx = 1.0;
+
+            explicit bin_finder(const vec<2,TypeB>& bins) : lo(bins.safe(0,_)), hi(bins.safe(1,_)),
+                nbin(bins.dims[1]) {
+
+                if (nbin == 0) return;
+
+                // Check that bins are sorted and non-overlapping
+                for (uint_t i : range(nbin)) {
+                    if (!(lo.safe[i] < hi.safe[i]) || (i != 0 && !(hi.safe[i-1] <= lo.safe[i]))) {
+                        return;
+                    }
+                }
+
+                type = layout::sorted;
+
+                // Check if the bins are uniform, either in linear or in log space.
+                // This is only a guess to compute the index faster: it needs not be exact.
+                const double tol = 1e-3;
+                double l0 = lo.safe[0], l1 = hi.safe[nbin-1];
+                bool uniform = true;
+                dx = (l1 - l0)/nbin;
+                for (uint_t i : range(nbin)) {
+                    if (abs(double(lo.safe[i]) - (l0 + i*dx)) > tol*dx ||
+                        abs(double(hi.safe[i]) - (l0 + (i+1)*dx)) > tol*dx) {
+                        uniform = false;
+                        break;
+                    }
+                }
+
+                if (uniform && dx > 0.0 && is_finite(dx)) {
+                    type = layout::uniform;
+                    x0 = l0;
+                    return;
+                }
 
-        using rtype = meta::rtype_t<Type>;
-        vec<Dim,rtype> tmp = data;
+                if (l0 > 0.0) {
+                    l0 = log(l0);
+                    l1 = log(l1);
+                    dx = (l1 - l0)/nbin;
+                    uniform = true;
+                    for (uint_t i : range(nbin)) {
+                        if (abs(log(double(lo.safe[i])) - (l0 + i*dx)) > tol*dx ||
+                            abs(log(double(hi.safe[i])) - (l0 + (i+1)*dx)) > tol*dx) {
+                            uniform = false;
+                            break;
+                        }
+                    }
+
+                    if (uniform && dx > 0.0 && is_finite(dx)) {
+                        type = layout::log_uniform;
+                        x0 = l0;
+                        return;
+                    }
+                }
 
-        uint_t nbin = bins.dims[1];
-        vec1u counts(nbin);
+                dx = 1.0;
+            }
 
-        auto first = tmp.data.begin();
-        for (uint_t i : range(nbin)) {
-            auto last = std::partition(first, tmp.data.end(), [&bins,i](rtype t) {
-                return t >= bins.safe(0,i) && t < bins.safe(1,i);
-            });
+            template<typename T>
+            uint_t check_guess_(T t, double guess) const {
+                // Start from the guessed index and move to the right bin
+                uint_t i = (guess > 0.0 ? (guess < nbin ? uint_t(guess) : nbin-1) : 0);
+                while (i > 0 && t < lo.safe[i]) --i;
+                while (i < nbin-1 && t >= lo.safe[i+1]) ++i;
+                return (t >= lo.safe[i] && t < hi.safe[i]) ? i : npos;
+            }
 
-            counts.safe[i] = last - first;
-            first = last;
+            template<typename T>
+            uint_t operator() (T t) const {
+                switch (type) {
+                case layout::uniform : {
+                    double guess = floor((t - x0)/dx);
+                    if (is_nan(guess)) return npos;
+                    return check_guess_(t, guess);
+                }
+                case layout::log_uniform : {
+                    if (!(t > 0)) return npos;
+                    double guess = floor((log(double(t)) - x0)/dx);
+                    if (is_nan(guess)) return npos;
+                    return check_guess_(t, guess);
+                }
+                case layout::sorted : {
+                    auto iter = std::upper_bound(lo.data.begin(), lo.data.end(), t,
+                        [](T v, btype b) { return v < b; });
+                    if (iter == lo.data.begin()) return npos;
+                    uint_t i = (iter - lo.data.begin()) - 1;
+                    return (t >= lo.safe[i] && t < hi.safe[i]) ? i : npos;
+                }
+                default : {
+                    for (uint_t i : range(nbin)) {
+                        if (t >= lo.safe[i] && t < hi.safe[i]) return i;
+                    }
 
-            if (last == tmp.data.end()) break;
+                    return npos;
+                }
+                }
+            }
+        };
+
+        // Split the range [0,n) into 'nthread' chunks, and call 'func(i0, i1, counts)' for
+        // each chunk in a separate thread, with a thread-local 'counts' vector of 'nbin'
+        // elements. The results of all the threads are then summed, in a fixed order.
+        template<typename TypeC, typename F>
+        vec<1,TypeC> histogram_reduce_(uint_t n, uint_t nbin, uint_t nthread, F&& func) {
+            vec<1,TypeC> counts(nbin);
+            nthread = std::min(nthread, std::max(n/1024, uint_t(1)));
+
+            if (nthread <= 1) {
+                func(uint_t(0), n, counts);
+            } else {
+                std::vector<vec<1,TypeC>> tcounts(nthread, vec<1,TypeC>(nbin));
+                auto pool = thread::pool(nthread);
+                uint_t di = n/nthread + 1;
+                for (uint_t t : range(nthread)) {
+                    pool[t].start([&func,&tcounts,t,di,n]() {
+                        func(std::min(t*di, n), std::min((t+1)*di, n), tcounts[t]);
+                    });
+                }
+
+                for (auto& t : pool) {
+                    t.join();
+                }
+
+                for (auto& c : tcounts) {
+                    counts += c;
+                }
+            }
+
+            return counts;
+        }
+    }
+
+    template<std::size_t Dim, typename Type, typename TypeB>
+    vec1u histogram(const vec<Dim,Type>& data, const vec<2,TypeB>& bins) {
+        vif_check(bins.dims[0] == 2, "can only be called with a bin vector (expected "
+            "dims=[2,...], got dims=[", bins.dims, "])");
+
+        impl::bin_finder<TypeB> finder(bins);
+        vec1u counts(finder.nbin);
+        for (uint_t i : range(data)) {
+            uint_t b = finder(data.safe[i]);
+            if (b != npos) ++counts.safe[b];
         }
 
         return counts;
@@ -220,46 +365,120 @@ namespace vif {
         vif_check(data.dims == weight.dims, "incompatible dimensions for data and weight "
             "(", data.dims, " vs. ", weight.dims, ")");
 
-        vec1u ids = indgen<uint_t>(data.size());
+        impl::bin_finder<TypeB> finder(bins);
+        vec<1,meta::rtype_t<TypeW>> counts(finder.nbin);
+        for (uint_t i : range(data)) {
+            uint_t b = finder(data.safe[i]);
+            if (b != npos) counts.safe[b] += weight.safe[i];
+        }
 
-        uint_t nbin = bins.dims[1];
-        vec<1,meta::rtype_t<TypeW>> counts(nbin);
+        return counts;
+    }
 
-        auto first = ids.data.begin();
-        for (uint_t i : range(nbin)) {
-            auto last = std::partition(first, ids.data.end(), [&bins,&data,i](uint_t id) {
-                return data.safe[id] >= bins.safe(0,i) && data.safe[id] < bins.safe(1,i);
-            });
+    // Same as 'histogram()', but splitting the data among 'nthread' threads.
+    template<std::size_t Dim, typename Type, typename TypeB>
+    vec1u parallel_histogram(const vec<Dim,Type>& data, const vec<2,TypeB>& bins, uint_t nthread) {
+        vif_check(bins.dims[0] == 2, "can only be called with a bin vector (expected "
+            "dims=[2,...], got dims=[", bins.dims, "])");
 
-            for (; first != last; ++first) {
-                counts.safe[i] += weight.safe[*first];
+        impl::bin_finder<TypeB> finder(bins);
+        return impl::histogram_reduce_<uint_t>(data.size(), finder.nbin, nthread,
+            [&](uint_t i0, uint_t i1, vec1u& counts) {
+                for (uint_t i : range(i0, i1)) {
+                    uint_t b = finder(data.safe[i]);
+                    if (b != npos) ++counts.safe[b];
+                }
             }
+        );
+    }
 
-            if (last == ids.data.end()) break;
-        }
+    // Same as 'histogram()', but splitting the data among 'nthread' threads.
+    template<std::size_t Dim, typename Type, typename TypeB, typename TypeW>
+    vec<1,meta::rtype_t<TypeW>> parallel_histogram(const vec<Dim,Type>& data,
+        const vec<Dim,TypeW>& weight, const vec<2,TypeB>& bins, uint_t nthread) {
+        vif_check(bins.dims[0] == 2, "can only be called with a bin vector (expected "
+            "dims=[2, ...], got dims=[", bins.dims, "])");
+        vif_check(data.dims == weight.dims, "incompatible dimensions for data and weight "
+            "(", data.dims, " vs. ", weight.dims, ")");
 
-        return counts;
+        impl::bin_finder<TypeB> finder(bins);
+        return impl::histogram_reduce_<meta::rtype_t<TypeW>>(data.size(), finder.nbin, nthread,
+            [&](uint_t i0, uint_t i1, vec<1,meta::rtype_t<TypeW>>& counts) {
+                for (uint_t i : range(i0, i1)) {
+                    uint_t b = finder(data.safe[i]);
+                    if (b != npos) counts.safe[b] += weight.safe[i];
+                }
+            }
+        );
     }
 
     namespace impl {
+        // Sort the indices of the elements by bin using a counting sort, where 'find(i)'
+        // returns the bin of the element 'i' (or npos). On output, 'ids[off[b]:off[b+1]]'
+        // contains the indices of all the elements in bin 'b', in increasing order, and 'nin'
+        // is the total number of elements that fell in a bin. The bin of each element is
+        // computed twice rather than stored, to avoid allocating another index vector.
+        template<typename F>
+        void histogram_sort_(uint_t n, uint_t nbin, F&& find, vec1u& ids, vec1u& off) {
+            off = vec1u(nbin+1);
+            for (uint_t i : range(n)) {
+                uint_t b = find(i);
+                if (b != npos) ++off.safe[b+1];
+            }
+
+            for (uint_t b : range(nbin)) {
+                off.safe[b+1] += off.safe[b];
+            }
+
+            ids.resize(off.safe[nbin]);
+            vec1u pos = off;
+            for (uint_t i : range(n)) {
+                uint_t b = find(i);
+                if (b != npos) ids.safe[pos.safe[b]++] = i;
+            }
+        }
+
+        // Index of the last bin for which the callback functions are called in histograms.
+        // This mimics the historical behavior: bins are processed in order, stopping as soon
+        // as all the 'ntot' elements have been processed.
+        inline uint_t histogram_last_bin_(const vec1u& off, uint_t b0, uint_t nbin, uint_t ntot) {
+            if (off.safe[b0+nbin] - off.safe[b0] != ntot) {
+                return nbin - 1;
+            }
+
+            uint_t last = 0;
+            for (uint_t b : range(nbin)) {
+                if (off.safe[b0+b+1] != off.safe[b0+b]) last = b;
+            }
+
+            return last;
+        }
+
         template<std::size_t Dim, typename Type, typename TypeB, typename F>
         void histogram_impl(const vec<Dim,Type>& data, const vec<2,TypeB>& bins, F&& func) {
             vif_check(bins.dims[0] == 2, "can only be called with a bin vector (expected "
                 "dims=[2, ...], got dims=[", bins.dims, "])");
 
-            vec1u ids = indgen<uint_t>(data.size());
             using iterator = vec1u::const_iterator;
 
-            uint_t nbin = bins.dims[1];
-            auto first = ids.data.begin();
-            for (uint_t i : range(nbin)) {
-                auto last = std::partition(first, ids.data.end(), [&bins,&data,i](uint_t id) {
-                    return data.safe[id] >= bins.safe(0,i) && data.safe[id] < bins.safe(1,i);
-                });
+            impl::bin_finder<TypeB> finder(bins);
+            uint_t nbin = finder.nbin;
+            const uint_t n = data.size();
+
+            // Each element is reported in a single bin, the first that contains it (this
+            // matters only for overlapping bins). Bins are processed in order, stopping as soon
+            // as all the elements have been processed.
+            vec1u ids, off;
+            histogram_sort_(n, nbin, [&](uint_t k) {
+                return finder(data.safe[k]);
+            }, ids, off);
 
-                func(i, meta::add_const(ids), iterator{first}, iterator{last});
+            if (nbin == 0) return;
 
-                if (last == ids.data.end()) break;
+            uint_t last = histogram_last_bin_(off, 0, nbin, n);
+            for (uint_t i : range(last+1)) {
+                func(i, meta::add_const(ids), iterator{ids.data.begin() + off.safe[i]},
+                    iterator{ids.data.begin() + off.safe[i+1]});
             }
         }
     }
@@ -296,33 +515,50 @@ namespace vif {
             vif_check(x.dims == y.dims, "incompatible dimensions for x and y (", x.dims, " vs. ",
                 y.dims, ")");
 
-            vec1u ids = indgen<uint_t>(x.size());
-
-            uint_t nxbin = xbins.dims[1];
-            uint_t nybin = ybins.dims[1];
-
             using iterator = vec1u::const_iterator;
 
-            auto firstx = ids.data.begin();
-            for (uint_t i : range(nxbin)) {
-                auto lastx = std::partition(firstx, ids.data.end(), [&xbins,&x,i](uint_t id) {
-                    return x.safe[id] >= xbins.safe(0,i) && x.safe[id] < xbins.safe(1,i);
-                });
-
-                auto firsty = firstx;
-                for (uint_t j : range(nybin)) {
-                    auto lasty = std::partition(firsty, lastx, [&ybins,&y,j](uint_t id) {
-                        return y.safe[id] >= ybins.safe(0,j) && y.safe[id] < ybins.safe(1,j);
-                    });
-
-                    func(i, j, meta::add_const(ids), iterator{firsty}, iterator{lasty});
+            impl::bin_finder<TypeBX> xfinder(xbins);
+            impl::bin_finder<TypeBY> yfinder(ybins);
+            uint_t nxbin = xfinder.nbin;
+            uint_t nybin = yfinder.nbin;
+            if (nxbin == 0 || nybin == 0) return;
+
+            // Count the elements in each X bin, regardless of their Y bin
+            vec1u nx(nxbin);
+            uint_t nin = 0;
+            for (uint_t k : range(x)) {
+                uint_t bx = xfinder(x.safe[k]);
+                if (bx != npos) {
+                    ++nx.safe[bx];
+                    ++nin;
+                }
+            }
 
-                    if (lasty == lastx) break;
-                    firsty = lasty;
+            // Sort elements by (X,Y) bin
+            vec1u ids, off;
+            histogram_sort_(x.size(), nxbin*nybin, [&](uint_t k) {
+                uint_t bx = xfinder(x.safe[k]);
+                if (bx == npos) return npos;
+                uint_t by = yfinder(y.safe[k]);
+                if (by == npos) return npos;
+                return bx*nybin + by;
+            }, ids, off);
+
+            uint_t lastx = nxbin - 1;
+            if (nin == x.size()) {
+                lastx = 0;
+                for (uint_t i : range(nxbin)) {
+                    if (nx.safe[i] != 0) lastx = i;
                 }
+            }
 
-                if (lastx == ids.data.end()) break;
-                firstx = lastx;
+            for (uint_t i : range(lastx+1)) {
+                uint_t lasty = histogram_last_bin_(off, i*nybin, nybin, nx.safe[i]);
+                for (uint_t j : range(lasty+1)) {
+                    uint_t b = i*nybin + j;
+                    func(i, j, meta::add_const(ids), iterator{ids.data.begin() + off.safe[b]},
+                        iterator{ids.data.begin() + off.safe[b+1]});
+                }
             }
         }
     }
@@ -0,0 +1,216 @@
+#ifndef VIF_MATH_QUANTILE_HPP
+#define VIF_MATH_QUANTILE_HPP
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include "vif/core/vec.hpp"
+#include "vif/core/error.hpp"
+#include "vif/math/base.hpp"
+
+namespace vif {
+    // Streaming estimator of quantiles (t-digest, Dunning & Ertl 2019).
+    // Values are added one by one or in chunks, and are summarized into a small set of
+    // weighted centroids; the memory usage does not depend on the number of values. The
+    // centroids are smaller close to the edges of the distribution, so extreme quantiles
+    // are more accurate than the median. Two sketches can be merged, for example to combine
+    // the results of several threads or of several files. Larger values of 'compression'
+    // give more accurate results, at the expense of memory and speed. NaN values are ignored.
+    // The sketch is not thread-safe: use one sketch per thread, and merge them at the end.
+    class quantile_sketch {
+        struct centroid {
+            double mean;
+            double weight;
+
+            bool operator < (const centroid& c) const {
+                return mean < c.mean;
+            }
+        };
+
+        double compression_ = 200.0;
+        uint_t buffer_size_ = 1000;
+
+        mutable std::vector<centroid> centroids_;
+        mutable std::vector<centroid> buffer_;
+        mutable std::vector<centroid> scratch_;
+        double total_ = 0.0;
+        double min_ = dinf;
+        double max_ = -dinf;
+
+        // Scale function k_1: centroids may span at most one unit of k
+        double scale_(double q) const {
+            return compression_/(2.0*dpi)*std::asin(2.0*clamp(q, 0.0, 1.0) - 1.0);
+        }
+
+        // Merge the buffered values into the centroids
+        void flush_() const {
+            if (buffer_.empty()) return;
+
+            scratch_.clear();
+            scratch_.insert(scratch_.end(), centroids_.begin(), centroids_.end());
+            scratch_.insert(scratch_.end(), buffer_.begin(), buffer_.end());
+            buffer_.clear();
+            std::sort(scratch_.begin(), scratch_.end());
+
+            centroids_.clear();
+            centroid cur = scratch_[0];
+            double wsofar = 0.0;
+            double klow = scale_(0.0);
+            for (uint_t i = 1; i < scratch_.size(); ++i) {
+                const centroid& c = scratch_[i];
+                double w = cur.weight + c.weight;
+                if (scale_((wsofar + w)/total_) - klow <= 1.0) {
+                    // Absorb this value in the current centroid
+                    cur.mean += (c.mean - cur.mean)*c.weight/w;
+                    cur.weight = w;
+                } else {
+                    centroids_.push_back(cur);
+                    wsofar += cur.weight;
+                    klow = scale_(wsofar/total_);
+                    cur = c;
+                }
+            }
+
+            centroids_.push_back(cur);
+        }
+
+        void push_(double x, double w) {
+            buffer_.push_back(centroid{x, w});
+            total_ += w;
+            if (x < min_) min_ = x;
+            if (x > max_) max_ = x;
+
+            if (buffer_.size() >= buffer_size_) {
+                flush_();
+            }
+        }
+
+    public :
+
+        explicit quantile_sketch(double compression = 200.0) :
+            compression_(compression), buffer_size_(5*uint_t(std::max(compression, 10.0))) {
+            vif_check(compression > 0, "compression must be strictly positive (got ", compression, ")");
+            buffer_.reserve(buffer_size_);
+        }
+
+        // Add one value, with an optional weight
+        void add(double x, double w = 1.0) {
+            if (is_nan(x) || !(w > 0)) return;
+            push_(x, w);
+        }
+
+        // Add all the values of a vector
+        template<std::size_t Dim, typename Type>
+        void add(const vec<Dim,Type>& v) {
+            for (auto& t : v) {
+                if (!is_nan(t)) push_(t, 1.0);
+            }
+        }
+
+        // Add all the values of a vector with their weights
+        template<std::size_t Dim, typename Type, typename TypeW>
+        void add(const vec<Dim,Type>& v, const vec<Dim,TypeW>& w) {
+            vif_check(v.dims == w.dims, "incompatible dimensions between values and weights "
+                "(", v.dims, " vs. ", w.dims, ")");
+
+            for (uint_t i : range(v)) {
+                add(v.safe[i], w.safe[i]);
+            }
+        }
+
+        // Combine the values of another sketch into this one
+        void merge(const quantile_sketch& s) {
+            s.flush_();
+            for (auto& c : s.centroids_) {
+                buffer_.push_back(c);
+                total_ += c.weight;
+            }
+
+            min_ = std::min(min_, s.min_);
+            max_ = std::max(max_, s.max_);
+
+            flush_();
+        }
+
+        // Estimate the value below which a fraction 'p' of the values lie (NaN if empty)
+        double quantile(double p) const {
+            if (total_ == 0) return dnan;
+
+            flush_();
+
+            if (centroids_.size() == 1) return centroids_[0].mean;
+
+            double target = clamp(p, 0.0, 1.0)*total_;
+
+            // Left tail: interpolate between the minimum and the first centroid
+            const centroid& first = centroids_.front();
+            if (target < first.weight/2.0) {
+                return min_ + (first.mean - min_)*target/(first.weight/2.0);
+            }
+
+            // Right tail: interpolate between the last centroid and the maximum
+            const centroid& last = centroids_.back();
+            if (target > total_ - last.weight/2.0) {
+                return max_ - (max_ - last.mean)*(total_ - target)/(last.weight/2.0);
+            }
+
+            // Interpolate between the centers of the two neighboring centroids
+            double cum = first.weight/2.0;
+            for (uint_t i = 0; i + 1 < centroids_.size(); ++i) {
+                const centroid& c0 = centroids_[i];
+                const centroid& c1 = centroids_[i+1];
+                double dw = (c0.weight + c1.weight)/2.0;
+                if (cum + dw >= target) {
+                    return c0.mean + (c1.mean - c0.mean)*(target - cum)/dw;
+                }
+
+                cum += dw;
+            }
+
+            return max_;
+        }
+
+        template<std::size_t Dim, typename Type>
+        vec<Dim,double> quantiles(const vec<Dim,Type>& p) const {
+            vec<Dim,double> r(p.dims);
+            for (uint_t i : range(p)) {
+                r.safe[i] = quantile(p.safe[i]);
+            }
+
+            return r;
+        }
+
+        double median() const {
+            return quantile(0.5);
+        }
+
+        // Sum of the weights of all the values added so far
+        double count() const {
+            return total_;
+        }
+
+        double min() const {
+            return total_ == 0 ? dnan : min_;
+        }
+
+        double max() const {
+            return total_ == 0 ? dnan : max_;
+        }
+
+        // Number of centroids currently used to summarize the data
+        uint_t size() const {
+            flush_();
+            return centroids_.size();
+        }
+
+        void clear() {
+            centroids_.clear();
+            buffer_.clear();
+            total_ = 0.0;
+            min_ = dinf;
+            max_ = -dinf;
+        }
+    };
+}
+
+#endif
@@ -6,6 +6,7 @@
 #include "vif/core/error.hpp"
 #include "vif/core/string_conversion.hpp"
 #include "vif/utility/generic.hpp"
+#include "vif/utility/thread.hpp"
 #include "vif/math/base.hpp"
 #include "vif/math/interpolate.hpp"
 
@@ -17,39 +18,71 @@ namespace vif {
             double>::type;
     }
 
+    namespace impl {
+        template<std::size_t Dim, typename Type>
+        meta::total_return_type<meta::rtype_t<Type>> total_(const vec<Dim,Type>& v, std::false_type) {
+            meta::total_return_type<meta::rtype_t<Type>> total = 0;
+            for (auto& t : v) {
+                total += t;
+            }
+
+            return total;
+        }
+
+        template<std::size_t Dim, typename Type>
+        double total_(const vec<Dim,Type>& v, std::true_type) {
+            return simd_impl::sum(v.data.data(), v.size());
+        }
+
+        template<std::size_t Dim, typename Type>
+        double mean_(const vec<Dim,Type>& v, std::false_type) {
+            double total = 0.0;
+            for (auto& t : v) {
+                total += t;
+            }
+
+            return total/v.size();
+        }
+
+        template<std::size_t Dim, typename Type>
+        double mean_(const vec<Dim,Type>& v, std::true_type) {
+            return simd_impl::sum(v.data.data(), v.size())/v.size();
+        }
+
+        template<std::size_t Dim, typename Type>
+        uint_t count_(const vec<Dim,Type>& v, std::false_type) {
+            uint_t n = 0u;
+            for (bool b : v) {
+                if (b) ++n;
+            }
+
+            return n;
+        }
+
+        template<std::size_t Dim, typename Type>
+        uint_t count_(const vec<Dim,Type>& v, std::true_type) {
+            return simd_impl::count_nonzero(v.data.data(), v.size());
+        }
+    }
+
     template<std::size_t Dim, typename Type, typename enable = typename std::enable_if<
         std::is_arithmetic<meta::rtype_t<Type>>::value
     >::type>
     meta::total_return_type<meta::rtype_t<Type>> total(const vec<Dim,Type>& v) {
-        meta::total_return_type<meta::rtype_t<Type>> total = 0;
-        for (auto& t : v) {
-            total += t;
-        }
-
-        return total;
+        return impl::total_(v, impl::simd_impl::is_supported<Type>{});
     }
 
     template<std::size_t Dim = 1, typename Type = bool, typename enable =
         typename std::enable_if<std::is_same<meta::rtype_t<Type>, bool>::value>::type>
     uint_t count(const vec<Dim,Type>& v) {
-        uint_t n = 0u;
-        for (bool b : v) {
-            if (b) ++n;
-        }
-
-        return n;
+        return impl::count_(v, std::is_same<Type,bool>{});
     }
 
     template<std::size_t Dim, typename Type, typename enable = typename std::enable_if<
         std::is_arithmetic<meta::rtype_t<Type>>::value
     >::type>
     double mean(const vec<Dim,Type>& v) {
-        double total = 0.0;
-        for (auto& t : v) {
-            total += t;
-        }
-
-        return total/v.size();
+        return impl::mean_(v, impl::simd_impl::is_supported<Type>{});
     }
 
     template<std::size_t Dim, typename Type, typename TypeW, typename enable = typename std::enable_if<
@@ -137,7 +170,7 @@ namespace vif {
 
         // Inplace median for floating point types (can have NaN values)
         template<std::size_t Dim, typename Type>
-        uint_t count_nans_(const vec<Dim,Type>& v) {
+        uint_t count_nans_(const vec<Dim,Type>& v, std::false_type) {
             uint_t nwrong = 0;
             for (auto& t : v) {
                 nwrong += is_nan(t);
@@ -146,6 +179,16 @@ namespace vif {
             return nwrong;
         }
 
+        template<std::size_t Dim, typename Type>
+        uint_t count_nans_(const vec<Dim,Type>& v, std::true_type) {
+            return simd_impl::count_nan(v.data.data(), v.size());
+        }
+
+        template<std::size_t Dim, typename Type>
+        uint_t count_nans_(const vec<Dim,Type>& v) {
+            return count_nans_(v, simd_impl::is_supported<Type>{});
+        }
+
         // Inplace median for floating point types (can have NaN values)
         template<std::size_t Dim, typename Type>
         meta::rtype_t<Type> inplace_median_(vec<Dim,Type>& v, std::true_type) {
@@ -224,17 +267,66 @@ namespace vif {
     }
 
     namespace impl {
-        template<std::size_t Dim, typename Type>
-        void percentiles_(vec<1,meta::rtype_t<Type>>& r, uint_t i, vec<Dim,Type>& v, uint_t nwrong) {}
+        // Position of the percentile 'u' in a sorted vector of 'n' elements, 'nwrong' of which
+        // are NaN (and are sorted last)
+        template<typename U>
+        uint_t percentile_rank_(uint_t n, uint_t nwrong, const U& u) {
+            return clamp((n-nwrong)*u, 0u, n-1);
+        }
+
+        // Partially sort the range [first,last) so that the elements at the positions
+        // [r0,r1) (relative to 'begin', sorted and unique) are the ones of the fully sorted
+        // range. Each call to std::nth_element() only works on the interval between two
+        // positions that were already selected, so selecting k positions costs O(n*log(k))
+        // instead of O(n*k).
+        template<typename I, typename C>
+        void multi_select_(I begin, I first, I last, const uint_t* r0, const uint_t* r1, C comp) {
+            if (r0 == r1) return;
+
+            const uint_t* rm = r0 + (r1 - r0)/2;
+            I mid = begin + *rm;
+            std::nth_element(first, mid, last, comp);
+
+            multi_select_(begin, first, mid, r0, rm, comp);
+            multi_select_(begin, mid + 1, last, rm + 1, r1, comp);
+        }
+
+        template<typename I, typename C>
+        void multi_select_(I first, I last, std::vector<uint_t> ranks, C comp) {
+            std::sort(ranks.begin(), ranks.end());
+            ranks.erase(std::unique(ranks.begin(), ranks.end()), ranks.end());
+            multi_select_(first, first, last, ranks.data(), ranks.data() + ranks.size(), comp);
+        }
 
-        template<std::size_t Dim, typename Type, typename U, typename ... Args>
-        void percentiles_(vec<1,meta::rtype_t<Type>>& r, uint_t i, vec<Dim,Type>& v, uint_t nwrong,
+        inline void percentile_ranks_(std::vector<uint_t>& r, uint_t n, uint_t nwrong) {}
+
+        template<typename U, typename ... Args>
+        void percentile_ranks_(std::vector<uint_t>& r, uint_t n, uint_t nwrong,
             const U& u, const Args& ... args) {
 
-            r.safe[i] = nth_element_(v, clamp((v.size()-nwrong)*u, 0u, v.size()-1));
-            ++i;
+            r.push_back(percentile_rank_(n, nwrong, u));
+            percentile_ranks_(r, n, nwrong, args...);
+        }
+
+        // Median and median absolute deviation of the values in 'buf' (without NaN). The
+        // values are reordered, and replaced by their absolute deviation from the median.
+        template<typename T>
+        T median_mad_(std::vector<T>& buf, T& med) {
+            if (buf.empty()) {
+                med = T(dnan);
+                return T(dnan);
+            }
+
+            auto mid = buf.begin() + buf.size()/2;
+            std::nth_element(buf.begin(), mid, buf.end());
+            med = *mid;
 
-            percentiles_(r, i, v, nwrong, args...);
+            for (auto& t : buf) {
+                t = (t > med ? t - med : med - t);
+            }
+
+            std::nth_element(buf.begin(), mid, buf.end());
+            return *mid;
         }
     }
 
@@ -242,9 +334,20 @@ namespace vif {
     vec<1,meta::rtype_t<Type>> inplace_percentiles(vec<Dim,Type>& v, const Args& ... args) {
         vif_check(!v.empty(), "cannot find the percentiles of an empty vector");
 
-        vec<1,meta::rtype_t<Type>> r(sizeof...(Args));
         uint_t nwrong = impl::count_nans_(v);
-        impl::percentiles_(r, 0, v, nwrong, args...);
+        std::vector<uint_t> ranks;
+        ranks.reserve(sizeof...(Args));
+        impl::percentile_ranks_(ranks, v.size(), nwrong, args...);
+
+        // Select all the percentiles at once
+        impl::multi_select_(v.data.begin(), v.data.end(), ranks,
+            typename vec<Dim,Type>::comparator_less());
+
+        vec<1,meta::rtype_t<Type>> r(sizeof...(Args));
+        for (uint_t i : range(ranks)) {
+            r.safe[i] = *(v.begin() + ranks[i]);
+        }
+
         return r;
     }
 
@@ -253,22 +356,113 @@ namespace vif {
         return inplace_percentiles(v, args...);
     }
 
+    // Reusable workspace to compute medians and percentiles without modifying the input vector.
+    // The values of the vector are copied into an internal buffer (discarding NaN values),
+    // which is kept from one call to the next: once the buffer is large enough, computing a
+    // percentile does not allocate memory anymore. A workspace must not be shared between
+    // threads.
+    template<typename T>
+    class quantile_workspace {
+        std::vector<T> buffer_;
+        uint_t nvalue_ = 0;
+
+        template<std::size_t Dim, typename Type>
+        void load_(const vec<Dim,Type>& v) {
+            vif_check(!v.empty(), "cannot find the percentiles of an empty vector");
+
+            buffer_.clear();
+            buffer_.reserve(v.size());
+            for (auto& t : v) {
+                if (!is_nan(t)) buffer_.push_back(t);
+            }
+
+            nvalue_ = v.size();
+        }
+
+        T value_(uint_t rank) const {
+            // Same convention as percentile(): NaN values are sorted last
+            return rank < buffer_.size() ? buffer_[rank] : T(dnan);
+        }
+
+    public :
+
+        quantile_workspace() = default;
+
+        // Pre-allocate the buffer for vectors of up to 'n' elements
+        explicit quantile_workspace(uint_t n) {
+            buffer_.reserve(n);
+        }
+
+        template<std::size_t Dim, typename Type>
+        T median(const vec<Dim,Type>& v) {
+            load_(v);
+            if (buffer_.empty()) return T(dnan);
+
+            auto mid = buffer_.begin() + buffer_.size()/2;
+            std::nth_element(buffer_.begin(), mid, buffer_.end());
+            return *mid;
+        }
+
+        template<std::size_t Dim, typename Type, typename U, typename enable =
+            typename std::enable_if<std::is_arithmetic<U>::value>::type>
+        T percentile(const vec<Dim,Type>& v, const U& u) {
+            load_(v);
+
+            uint_t rank = impl::percentile_rank_(nvalue_, nvalue_ - buffer_.size(), u);
+            if (rank >= buffer_.size()) return T(dnan);
+
+            std::nth_element(buffer_.begin(), buffer_.begin() + rank, buffer_.end());
+            return buffer_[rank];
+        }
+
+        // Compute all the percentiles 'p' in a single partial sort
+        template<std::size_t Dim, typename Type, typename TypeP>
+        vec<1,T> percentiles(const vec<Dim,Type>& v, const vec<1,TypeP>& p) {
+            load_(v);
+
+            std::vector<uint_t> ranks(p.size());
+            for (uint_t i : range(p)) {
+                ranks[i] = impl::percentile_rank_(nvalue_, nvalue_ - buffer_.size(), p.safe[i]);
+            }
+
+            impl::multi_select_(buffer_.begin(), buffer_.end(), ranks, std::less<T>());
+
+            vec<1,T> r(p.size());
+            for (uint_t i : range(p)) {
+                r.safe[i] = value_(ranks[i]);
+            }
+
+            return r;
+        }
+
+        // Median absolute deviation, using a single copy of the input vector
+        template<std::size_t Dim, typename Type>
+        T mad(const vec<Dim,Type>& v) {
+            T med;
+            return mad(v, med);
+        }
+
+        // Same as above, also returning the median in 'med'
+        template<std::size_t Dim, typename Type>
+        T mad(const vec<Dim,Type>& v, T& med) {
+            load_(v);
+            return impl::median_mad_(buffer_, med);
+        }
+    };
+
     template<std::size_t Dim, typename Type, typename enable = typename std::enable_if<
         std::is_arithmetic<meta::rtype_t<Type>>::value
     >::type>
     vec<Dim,bool> sigma_clip(const vec<Dim,Type>& tv, double sigma) {
-        auto v = tv.concretise();
-        auto med = inplace_median(v);
-        auto mad = 1.48*median(abs(v - med));
-        // Note: cannot use 'v' below, since the order of the values has changed!
+        quantile_workspace<meta::rtype_t<Type>> w;
+        meta::rtype_t<Type> med;
+        auto mad = 1.48*w.mad(tv, med);
         return abs(tv - med) <= sigma*mad;
     }
 
     namespace impl {
         template<std::size_t Dim, typename Type>
-        typename vec<Dim,Type>::const_iterator min_(const vec<Dim,Type>& v) {
-            vif_check(!v.empty(), "cannot find the minimum of an empty vector");
-
+        typename vec<Dim,Type>::const_iterator min_(const vec<Dim,Type>& v, std::false_type) {
             auto iter = std::min_element(v.begin(), v.end(),
                 typename vec<Dim,Type>::comparator_less());
 
@@ -277,9 +471,23 @@ namespace vif {
         }
 
         template<std::size_t Dim, typename Type>
-        typename vec<Dim,Type>::const_iterator max_(const vec<Dim,Type>& v) {
-            vif_check(!v.empty(), "cannot find the maximum of an empty vector");
+        typename vec<Dim,Type>::const_iterator min_(const vec<Dim,Type>& v, std::true_type) {
+            // First pass to find the minimum value, second pass to find its position
+            uint_t i = simd_impl::find_first(v.data.data(), v.size(),
+                simd_impl::min_skip_nan(v.data.data(), v.size()));
+
+            if (i == npos) i = 0; // only NaN
+            return v.begin() + i;
+        }
+
+        template<std::size_t Dim, typename Type>
+        typename vec<Dim,Type>::const_iterator min_(const vec<Dim,Type>& v) {
+            vif_check(!v.empty(), "cannot find the minimum of an empty vector");
+            return min_(v, simd_impl::is_supported<Type>{});
+        }
 
+        template<std::size_t Dim, typename Type>
+        typename vec<Dim,Type>::const_iterator max_(const vec<Dim,Type>& v, std::false_type) {
             auto iter = std::min_element(v.begin(), v.end(),
                 typename vec<Dim,Type>::comparator_greater());
 
@@ -287,11 +495,39 @@ namespace vif {
             return iter;
         }
 
+        template<std::size_t Dim, typename Type>
+        typename vec<Dim,Type>::const_iterator max_(const vec<Dim,Type>& v, std::true_type) {
+            uint_t i = simd_impl::find_first(v.data.data(), v.size(),
+                simd_impl::max_skip_nan(v.data.data(), v.size()));
+
+            if (i == npos) i = 0; // only NaN
+            return v.begin() + i;
+        }
+
+        template<std::size_t Dim, typename Type>
+        typename vec<Dim,Type>::const_iterator max_(const vec<Dim,Type>& v) {
+            vif_check(!v.empty(), "cannot find the maximum of an empty vector");
+            return max_(v, simd_impl::is_supported<Type>{});
+        }
+
         template<std::size_t Dim, typename Type>
         std::pair<typename vec<Dim,Type>::const_iterator, typename vec<Dim,Type>::const_iterator>
-            minmax_(const vec<Dim,Type>& v) {
-            vif_check(!v.empty(), "cannot find the maximum/minimum of an empty vector");
+            minmax_(const vec<Dim,Type>& v, std::true_type) {
+            // Same convention as the generic version below: first minimum, last maximum
+            const Type* p = v.data.data();
+            uint_t i0 = simd_impl::find_first(p, v.size(), simd_impl::min_skip_nan(p, v.size()));
+            uint_t i1 = simd_impl::find_last(p, v.size(), simd_impl::max_skip_nan(p, v.size()));
+            if (i0 == npos || i1 == npos) {
+                // Only NaN
+                i0 = 0; i1 = 0;
+            }
 
+            return std::make_pair(v.begin() + i0, v.begin() + i1);
+        }
+
+        template<std::size_t Dim, typename Type>
+        std::pair<typename vec<Dim,Type>::const_iterator, typename vec<Dim,Type>::const_iterator>
+            minmax_(const vec<Dim,Type>& v, std::false_type) {
             // We cannot take care of NaN using std::minmax_element and the trick of
             // std::min_element and std::max_element. So we just roll our own...
             // This naive version performs slightly more comparisons than the standard
@@ -322,6 +558,13 @@ namespace vif {
 
             return res;
         }
+
+        template<std::size_t Dim, typename Type>
+        std::pair<typename vec<Dim,Type>::const_iterator, typename vec<Dim,Type>::const_iterator>
+            minmax_(const vec<Dim,Type>& v) {
+            vif_check(!v.empty(), "cannot find the maximum/minimum of an empty vector");
+            return minmax_(v, simd_impl::is_supported<Type>{});
+        }
     }
 
     template<std::size_t Dim, typename Type>
@@ -448,16 +691,28 @@ namespace vif {
         return r;
     }
 
+    namespace impl {
+        template<std::size_t Dim, typename Type>
+        double sum_sq_(const vec<Dim,Type>& v, std::false_type) {
+            double sum = 0;
+            for (auto& t : v) {
+                sum += t*t;
+            }
+
+            return sum;
+        }
+
+        template<std::size_t Dim, typename Type>
+        double sum_sq_(const vec<Dim,Type>& v, std::true_type) {
+            return simd_impl::sum_sq(v.data.data(), v.size());
+        }
+    }
+
     template<std::size_t Dim, typename Type, typename enable = typename std::enable_if<
         std::is_arithmetic<meta::rtype_t<Type>>::value
     >::type>
     double rms(const vec<Dim,Type>& v) {
-        double sum = 0;
-        for (auto& t : v) {
-            sum += t*t;
-        }
-
-        return sqrt(sum/v.size());
+        return sqrt(impl::sum_sq_(v, impl::simd_impl::is_supported<Type>{})/v.size());
     }
 
     template<std::size_t Dim, typename Type, typename enable = typename std::enable_if<
@@ -471,12 +726,153 @@ namespace vif {
         std::is_arithmetic<meta::rtype_t<Type>>::value
     >::type>
     meta::rtype_t<Type> mad(const vec<Dim,Type>& v) {
-        return median(abs(v - median(v)));
+        quantile_workspace<meta::rtype_t<Type>> w;
+        return w.mad(v);
     }
 
+    // Options of 'reduce()' and of the 'partial_...()' functions
+    struct reduce_params {
+        uint_t thread = 1; // number of threads, slices being split among them
+    };
+
     namespace impl {
+        namespace reduce_impl {
+            // True if the first argument given to a 'partial_...()' function is its options
+            template<typename ... Args>
+            struct starts_with_params : std::false_type {};
+
+            template<typename T, typename ... Args>
+            struct starts_with_params<T, Args...> :
+                std::is_same<typename std::decay<T>::type, reduce_params> {};
+
+            // Copy the slice starting at 'base' with a step of 'pitch' into 'tv'
+            template<std::size_t Dim, typename Type>
+            void gather(const vec<Dim,Type>& v, uint_t base, uint_t pitch,
+                vec<1,meta::rtype_t<Type>>& tv, std::false_type) {
+                if (pitch == 1) {
+                    // Contiguous slice
+                    std::copy(v.data.begin() + base, v.data.begin() + base + tv.size(),
+                        tv.data.begin());
+                } else {
+                    for (uint_t j : range(tv)) {
+                        tv.safe[j] = v.safe[base + j*pitch];
+                    }
+                }
+            }
+
+            template<std::size_t Dim, typename Type>
+            void gather(const vec<Dim,Type>& v, uint_t base, uint_t pitch,
+                vec<1,meta::rtype_t<Type>>& tv, std::true_type) {
+                // View: no contiguous storage
+                for (uint_t j : range(tv)) {
+                    tv.safe[j] = v.safe[base + j*pitch];
+                }
+            }
+
+            template<std::size_t Dim, typename Type>
+            void gather(const vec<Dim,Type>& v, uint_t base, uint_t pitch,
+                vec<1,meta::rtype_t<Type>>& tv) {
+                gather(v, base, pitch, tv, std::is_pointer<Type>{});
+            }
+
+            // Layout of the slices along dimension 'dim'
+            struct slice_layout {
+                uint_t nint = 1;   // number of elements in each slice
+                uint_t mpitch = 1; // distance between two consecutive elements of a slice
+                uint_t nslice = 1; // number of slices
+                uint_t ntile = 1;  // number of slices processed together (see below)
+
+                template<std::size_t Dim>
+                slice_layout(uint_t dim, const std::array<uint_t,Dim>& ds, uint_t elem_size) {
+                    nint = ds[dim];
+                    for (uint_t i : range(Dim)) {
+                        if (i != dim) nslice *= ds[i];
+                        if (i > dim) mpitch *= ds[i];
+                    }
+
+                    // Slices that are not contiguous are extracted in tiles of 'ntile'
+                    // neighboring slices. Each row of a tile is then read from one or two
+                    // cache lines, instead of reading one cache line per element.
+                    if (mpitch > 1) {
+                        ntile = std::min(mpitch, std::max(uint_t(1), uint_t(128/elem_size)));
+                    }
+                }
+
+                // Tiles do not cross the boundaries of the blocks of 'mpitch' slices
+                uint_t tiles_per_block() const {
+                    return (mpitch + ntile - 1)/ntile;
+                }
+
+                uint_t count_tiles() const {
+                    return (nslice/mpitch)*tiles_per_block();
+                }
+
+                void tile_range(uint_t t, uint_t& i0, uint_t& i1) const {
+                    uint_t tpb = tiles_per_block();
+                    uint_t block = t/tpb;
+                    i0 = block*mpitch + (t%tpb)*ntile;
+                    i1 = std::min(i0 + ntile, (block+1)*mpitch);
+                }
+
+                uint_t base(uint_t i) const {
+                    return (i%mpitch) + (i/mpitch)*nint*mpitch;
+                }
+            };
+
+            // Call 'func(i, tv)' for each slice 'i' of 'v' along the dimension 'dim', with 'tv'
+            // a 1D vector holding the values of the slice. The vectors 'tv' are scratch
+            // buffers that are reused from one slice to the next; 'func' may move from them,
+            // in which case they are allocated again for the next slice. If 'nthread' is
+            // larger than one, slices are processed concurrently, and 'func' must be
+            // thread-safe.
+            template<std::size_t Dim, typename Type, typename F>
+            void run_slices(uint_t dim, const vec<Dim,Type>& v, uint_t nthread, F&& func) {
+                using rtype = meta::rtype_t<Type>;
+                const slice_layout l(dim, v.dims, sizeof(rtype));
+                if (l.nslice == 0) return;
+
+                auto run_tiles = [&](uint_t t0, uint_t t1) {
+                    std::vector<vec<1,rtype>> tile(l.ntile, vec<1,rtype>(l.nint));
+                    for (uint_t t = t0; t < t1; ++t) {
+                        uint_t i0, i1;
+                        l.tile_range(t, i0, i1);
+
+                        for (uint_t k : range(i1 - i0)) {
+                            if (tile[k].data.size() != l.nint) tile[k].resize(l.nint);
+                        }
+
+                        if (i1 - i0 == 1) {
+                            gather(v, l.base(i0), l.mpitch, tile[0]);
+                        } else {
+                            // Read the rows of the tile one after the other
+                            uint_t base = l.base(i0);
+                            for (uint_t j : range(l.nint)) {
+                                for (uint_t k : range(i1 - i0)) {
+                                    tile[k].safe[j] = v.safe[base + k];
+                                }
+
+                                base += l.mpitch;
+                            }
+                        }
+
+                        for (uint_t i = i0; i < i1; ++i) {
+                            func(i, tile[i-i0]);
+                        }
+                    }
+                };
+
+                const uint_t ntiles = l.count_tiles();
+                if (nthread > 1 && ntiles > 1 && v.size() >= 16384) {
+                    thread::task_pool pool(nthread);
+                    pool.execute_chunks(run_tiles, 0, ntiles);
+                } else {
+                    run_tiles(0, ntiles);
+                }
+            }
+        }
+
         template<typename F, F f, std::size_t Dim, typename Type, typename ... Args>
-        auto run_index_(uint_t dim, const vec<Dim,Type>& v, Args&& ... args) ->
+        auto run_index_(uint_t dim, const vec<Dim,Type>& v, uint_t nthread, Args&& ... args) ->
         vec<Dim-1,typename meta::return_type<F>::type> {
 
             vec<Dim-1,typename meta::return_type<F>::type> r;
@@ -488,11 +884,6 @@ namespace vif {
             }
             r.resize();
 
-            uint_t mpitch = 1;
-            for (uint_t i = dim+1; i < Dim; ++i) {
-                mpitch *= v.dims[i];
-            }
-
         //  Example demonstration of the index computation:
         //
         //  Assume we have a 4D array of dimensions d1, d2, d3 and d4.
@@ -515,23 +906,19 @@ namespace vif {
         //
         //  Final recipe:
         //      ((u/mpitch)*dim[d] + i)*mpitch + (u%mpitch)
+        //
+        //  This is implemented in reduce_impl::slice_layout.
 
-            vec<1,meta::rtype_t<Type>> tmp(v.dims[dim]);
-            for (uint_t i : range(r)) {
-                uint_t base = (i%mpitch) + (i/mpitch)*v.dims[dim]*mpitch;
-                for (uint_t j : range(tmp)) {
-                    tmp.safe[j] = v.safe[base + j*mpitch];
-                }
-
-                r.safe[i] = (*f)(tmp, std::forward<Args>(args)...);
-            }
+            reduce_impl::run_slices(dim, v, nthread, [&](uint_t i, vec<1,meta::rtype_t<Type>>& tv) {
+                r.safe[i] = (*f)(tv, std::forward<Args>(args)...);
+            });
 
             return r;
         }
 
         template<std::size_t Dim, typename Type>
-        vec<1,meta::rtype_t<Type>> run_dim_apply_ids_(const vec1u& ids, const vec<Dim,Type>& v) {
-            return v.safe[ids].concretise();
+        vec<1,meta::rtype_t<Type>> run_dim_make_scratch_(uint_t n, const vec<Dim,Type>& v) {
+            return vec<1,meta::rtype_t<Type>>(n);
         }
 
         template<std::size_t Dim, typename Type, typename ... Args>
@@ -539,30 +926,27 @@ namespace vif {
             return v.dims;
         }
 
-        template<typename F, typename ... Args>
-        void run_dim_final_(uint_t dim, F&& func, const Args& ... vs) {
+        template<typename F, typename ... Args, std::size_t ... S>
+        void run_dim_final__(uint_t dim, F&& func, meta::seq_t<S...>, const Args& ... vs) {
             auto ds = run_dim_get_dim_(vs...);
-            const uint_t N = meta::array_size<decltype(ds)>::size;
-
-            uint_t nint = ds[dim];
-            uint_t mpitch = 1;
-            uint_t np = 1;
-            for (uint_t i : range(N)) {
-                if (i != dim) np *= ds[i];
-                if (i > dim) mpitch *= ds[i];
-            }
+            const reduce_impl::slice_layout l(dim, ds, 1);
 
-            vec1u ids(nint);
-            for (uint_t i : range(np)) {
-                uint_t base = (i%mpitch) + (i/mpitch)*nint*mpitch;
-                for (uint_t j : range(ids)) {
-                    ids.safe[j] = base + j*mpitch;
-                }
+            // One scratch buffer per input vector, reused for all slices
+            auto tvs = std::make_tuple(run_dim_make_scratch_(l.nint, vs)...);
+            for (uint_t i : range(l.nslice)) {
+                uint_t base = l.base(i);
+                bool dummy[] = {(reduce_impl::gather(vs, base, l.mpitch, std::get<S>(tvs)), true)...};
+                (void)dummy;
 
-                func(i, run_dim_apply_ids_<N>(ids, vs)...);
+                func(i, std::get<S>(tvs)...);
             }
         }
 
+        template<typename F, typename ... Args>
+        void run_dim_final_(uint_t dim, F&& func, const Args& ... vs) {
+            run_dim_final__(dim, std::forward<F>(func), meta::gen_seq_t<sizeof...(Args)>{}, vs...);
+        }
+
         template<typename ... Args1>
         struct run_dim_unroll_ {
             template<typename T>
@@ -605,8 +989,11 @@ namespace vif {
         impl::run_dim_unroll_<>::run(dim, _, std::forward<Args>(args)...);
     }
 
+    // Apply 'func' to each slice of 'v' along the dimension 'dim'. The slice is given to
+    // 'func' as an rvalue 1D vector, which it may keep or modify.
     template<typename F, std::size_t Dim, typename Type>
-    auto reduce(uint_t dim, const vec<Dim,Type>& v, F&& func) ->
+    auto reduce(uint_t dim, const vec<Dim,Type>& v, F&& func,
+        const reduce_params& params = reduce_params{}) ->
         vec<Dim-1,typename meta::return_type<F>::type> {
         vif_check(dim < Dim, "reduction dimension is incompatible with input vector "
             "(", dim, " vs. ", v.dims, ")");
@@ -621,7 +1008,7 @@ namespace vif {
 
         r.resize();
 
-        run_dim(dim, v, [&](uint_t i, vec<1,meta::rtype_t<Type>> tv) {
+        impl::reduce_impl::run_slices(dim, v, params.thread, [&](uint_t i, vec<1,meta::rtype_t<Type>>& tv) {
             r.safe[i] = func(std::move(tv));
         });
 
@@ -638,13 +1025,22 @@ namespace vif {
         }; \
         \
         template<std::size_t Dim, typename Type, typename ... Args> \
-        auto partial_ ## func (uint_t dim, const vec<Dim,Type>& v, Args&& ... args) -> \
+        auto partial_ ## func (uint_t dim, const vec<Dim,Type>& v, const reduce_params& params, \
+            Args&& ... args) -> \
         vec<Dim-1, decltype(func(std::declval<vec<1,meta::rtype_t<Type>>>(), std::forward<Args>(args)...))> { \
             vif_check(dim < Dim, "reduction dimension is incompatible with input vector " \
                 "(", dim, " vs. ", v.dims, ")"); \
             using wrapper = func ## _run_index_wrapper_<meta::rtype_t<Type>, Args...>; \
             using fptr = decltype(&wrapper::run); \
-            return impl::run_index_<fptr, &wrapper::run>(dim, v, std::forward<Args>(args)...); \
+            return impl::run_index_<fptr, &wrapper::run>(dim, v, params.thread, \
+                std::forward<Args>(args)...); \
+        } \
+        \
+        template<std::size_t Dim, typename Type, typename ... Args, typename enable = \
+            typename std::enable_if<!impl::reduce_impl::starts_with_params<Args...>::value>::type> \
+        auto partial_ ## func (uint_t dim, const vec<Dim,Type>& v, Args&& ... args) -> \
+        vec<Dim-1, decltype(func(std::declval<vec<1,meta::rtype_t<Type>>>(), std::forward<Args>(args)...))> { \
+            return partial_ ## func(dim, v, reduce_params{}, std::forward<Args>(args)...); \
         }
 
     MAKE_PARTIAL(total);
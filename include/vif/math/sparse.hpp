@@ -0,0 +1,406 @@
+#ifndef VIF_MATH_SPARSE_HPP
+#define VIF_MATH_SPARSE_HPP
+
+#include <algorithm>
+#include "vif/core/vec.hpp"
+#include "vif/core/error.hpp"
+#include "vif/core/range.hpp"
+#include "vif/math/base.hpp"
+#include "vif/math/matrix.hpp"
+
+namespace vif {
+namespace matrix {
+    // Sparse symmetric matrix. Elements are first accumulated with 'add()' in any order, then
+    // 'compress()' must be called before the matrix is used. Both triangles are stored (in
+    // compressed rows, with column indices in increasing order), so that all the non-zero
+    // elements of a row are readily available.
+    struct sparse_symmetric {
+        uint_t n = 0;
+
+        // Compressed rows: elements of row 'i' are 'col[k]' and 'val[k]' for
+        // 'k' in [row[i], row[i+1])
+        vec1u row, col;
+        vec1d val;
+
+    private :
+        struct triplet {
+            uint_t i, j;
+            double v;
+        };
+
+        std::vector<triplet> pending_;
+
+    public :
+        sparse_symmetric() = default;
+        explicit sparse_symmetric(uint_t tn) : n(tn), row(tn+1) {}
+
+        // Add 'v' to the elements (i,j) and (j,i)
+        void add(uint_t i, uint_t j, double v) {
+            vif_check(i < n && j < n, "element (", i, ",", j, ") is out of the matrix (",
+                n, "x", n, ")");
+
+            pending_.push_back(triplet{i, j, v});
+            if (i != j) {
+                pending_.push_back(triplet{j, i, v});
+            }
+        }
+
+        // Merge the elements added with 'add()' into the matrix
+        void compress() {
+            if (pending_.empty()) return;
+
+            for (uint_t i : range(n)) {
+                for (uint_t k = row.safe[i]; k < row.safe[i+1]; ++k) {
+                    pending_.push_back(triplet{i, col.safe[k], val.safe[k]});
+                }
+            }
+
+            std::stable_sort(pending_.begin(), pending_.end(),
+                [](const triplet& t1, const triplet& t2) {
+                    return t1.i < t2.i || (t1.i == t2.i && t1.j < t2.j);
+                }
+            );
+
+            col.clear(); val.clear();
+            col.reserve(pending_.size()); val.reserve(pending_.size());
+            row[_] = 0;
+            for (const triplet& t : pending_) {
+                if (!col.empty() && row.safe[t.i+1] != 0 && col.back() == t.j) {
+                    val.back() += t.v;
+                } else {
+                    col.push_back(t.j);
+                    val.push_back(t.v);
+                    ++row.safe[t.i+1];
+                }
+            }
+
+            for (uint_t i : range(n)) {
+                row.safe[i+1] += row.safe[i];
+            }
+
+            pending_.clear();
+            pending_.shrink_to_fit();
+        }
+
+        // Number of stored elements (counting both triangles)
+        uint_t nonzeros() const {
+            return col.size();
+        }
+
+        // Value of the element (i,j), zero if not stored
+        double operator () (uint_t i, uint_t j) const {
+            auto b = col.data.begin() + row.safe[i], e = col.data.begin() + row.safe[i+1];
+            auto iter = std::lower_bound(b, e, j);
+            return (iter != e && *iter == j ? val.safe[iter - col.data.begin()] : 0.0);
+        }
+
+        // Matrix-vector product
+        vec1d product(const vec1d& x) const {
+            vif_check(x.size() == n, "matrix and vector must have the same dimensions (",
+                "got ", n, " and ", x.size(), ")");
+
+            vec1d r(n);
+            for (uint_t i : range(n))
+            for (uint_t k = row.safe[i]; k < row.safe[i+1]; ++k) {
+                r.safe[i] += val.safe[k]*x.safe[col.safe[k]];
+            }
+
+            return r;
+        }
+
+        mat2d dense() const {
+            mat2d r(n, n);
+            for (uint_t i : range(n))
+            for (uint_t k = row.safe[i]; k < row.safe[i+1]; ++k) {
+                r.safe(i,col.safe[k]) = val.safe[k];
+            }
+
+            return r;
+        }
+    };
+
+    namespace impl {
+        inline void nested_dissection_(const sparse_symmetric& a, const vec1d& x,
+            const vec1d& y, std::vector<uint_t>& ids, std::vector<char>& mark, vec1u& order) {
+
+            const uint_t leaf = 64;
+            if (ids.size() <= leaf) {
+                for (uint_t i : ids) {
+                    order.push_back(i);
+                }
+
+                return;
+            }
+
+            // Split the nodes in two halves along the longest axis
+            double x0 = dinf, x1 = -dinf, y0 = dinf, y1 = -dinf;
+            for (uint_t i : ids) {
+                x0 = std::min(x0, x.safe[i]); x1 = std::max(x1, x.safe[i]);
+                y0 = std::min(y0, y.safe[i]); y1 = std::max(y1, y.safe[i]);
+            }
+
+            const vec1d& c = (x1 - x0 > y1 - y0 ? x : y);
+            const uint_t m = ids.size()/2;
+            std::nth_element(ids.begin(), ids.begin() + m, ids.end(),
+                [&](uint_t i, uint_t j) {
+                    return c.safe[i] < c.safe[j] || (c.safe[i] == c.safe[j] && i < j);
+                }
+            );
+
+            // The separator is made of the nodes of the first half that are connected to the
+            // second half
+            for (uint_t k : range(m, ids.size())) {
+                mark[ids[k]] = 1;
+            }
+
+            std::vector<uint_t> left, right(ids.begin() + m, ids.end()), sep;
+            for (uint_t k : range(m)) {
+                uint_t i = ids[k];
+                bool connected = false;
+                for (uint_t p = a.row.safe[i]; p < a.row.safe[i+1]; ++p) {
+                    if (mark[a.col.safe[p]] == 1) {
+                        connected = true;
+                        break;
+                    }
+                }
+
+                (connected ? sep : left).push_back(i);
+            }
+
+            for (uint_t k : range(m, ids.size())) {
+                mark[ids[k]] = 0;
+            }
+
+            ids.clear();
+            ids.shrink_to_fit();
+
+            nested_dissection_(a, x, y, left, mark, order);
+            nested_dissection_(a, x, y, right, mark, order);
+            for (uint_t i : sep) {
+                order.push_back(i);
+            }
+        }
+    }
+
+    // Compute a fill-reducing ordering of the rows of a sparse symmetric matrix, for
+    // matrices whose elements connect nodes that are close to one another in a 2D space
+    // (e.g., overlapping sources in an image) at positions (x,y). The nodes are recursively
+    // split in two halves, and the nodes that connect the two halves are ordered last.
+    // Nodes with non-finite positions are put at the very end.
+    inline vec1u nested_dissection_order(const sparse_symmetric& a, const vec1d& x,
+        const vec1d& y) {
+
+        vif_check(x.size() == a.n && y.size() == a.n, "incompatible dimensions between matrix "
+            "and positions (", a.n, " vs. ", x.size(), " and ", y.size(), ")");
+
+        std::vector<uint_t> ids;
+        ids.reserve(a.n);
+        vec1u last;
+        for (uint_t i : range(a.n)) {
+            if (is_finite(x.safe[i]) && is_finite(y.safe[i])) {
+                ids.push_back(i);
+            } else {
+                last.push_back(i);
+            }
+        }
+
+        vec1u order;
+        order.reserve(a.n);
+        std::vector<char> mark(a.n, 0);
+        impl::nested_dissection_(a, x, y, ids, mark, order);
+        append(order, last);
+
+        return order;
+    }
+
+    // Sparse LDL^T decomposition of a symmetric matrix, in a user-provided order of the rows
+    // (see 'nested_dissection_order()'). Can be used to solve linear systems and to compute
+    // the diagonal of the inverse matrix. There is no pivoting, so the decomposition is only
+    // guaranteed to be stable for positive definite matrices.
+    // Source of the algorithm is adapted from the LDL package of T. A. Davis:
+    // "Algorithm 849: A concise sparse Cholesky factorization package", ACM TOMS 31, 4 (2005)
+    struct decompose_sparse_ldl {
+        // Outputs
+        vec1u perm, iperm;   // row order, and its inverse
+        vec1u lp, li;        // compressed columns of L (below diagonal)
+        vec1d lx, d;         // values of L and D
+
+    public :
+        uint_t size() const {
+            return d.size();
+        }
+
+        bool decompose(const sparse_symmetric& a, const vec1u& order) {
+            vif_check(order.size() == a.n, "incompatible dimensions between matrix and order (",
+                a.n, " vs. ", order.size(), ")");
+
+            const uint_t n = a.n;
+            perm = order;
+            iperm.resize(n);
+            for (uint_t k : range(n)) {
+                iperm.safe[perm.safe[k]] = k;
+            }
+
+            // Symbolic factorization: elimination tree and number of elements per column
+            vec1u parent(n), lnz(n), flag(n);
+            for (uint_t k : range(n)) {
+                parent.safe[k] = npos;
+                flag.safe[k] = k;
+                uint_t ok = perm.safe[k];
+                for (uint_t p = a.row.safe[ok]; p < a.row.safe[ok+1]; ++p) {
+                    uint_t i = iperm.safe[a.col.safe[p]];
+                    if (i >= k) continue;
+
+                    for (; flag.safe[i] != k; i = parent.safe[i]) {
+                        if (parent.safe[i] == npos) parent.safe[i] = k;
+                        ++lnz.safe[i];
+                        flag.safe[i] = k;
+                    }
+                }
+            }
+
+            lp.resize(n+1);
+            for (uint_t k : range(n)) {
+                lp.safe[k+1] = lp.safe[k] + lnz.safe[k];
+            }
+
+            // Numeric factorization, one row of L at a time
+            li.resize(lp.safe[n]);
+            lx.resize(lp.safe[n]);
+            d.resize(n);
+
+            vec1d yv(n);
+            vec1u pattern(n);
+            lnz[_] = 0;
+            for (uint_t k : range(n)) {
+                uint_t top = n;
+                flag.safe[k] = k;
+                uint_t ok = perm.safe[k];
+                double akk = 0.0;
+                for (uint_t p = a.row.safe[ok]; p < a.row.safe[ok+1]; ++p) {
+                    uint_t i = iperm.safe[a.col.safe[p]];
+                    if (i > k) continue;
+                    if (i == k) akk = a.val.safe[p];
+
+                    yv.safe[i] += a.val.safe[p];
+
+                    uint_t len = 0;
+                    for (; flag.safe[i] != k; i = parent.safe[i]) {
+                        pattern.safe[len++] = i;
+                        flag.safe[i] = k;
+                    }
+
+                    while (len > 0) {
+                        pattern.safe[--top] = pattern.safe[--len];
+                    }
+                }
+
+                d.safe[k] = yv.safe[k];
+                yv.safe[k] = 0.0;
+                for (; top < n; ++top) {
+                    uint_t i = pattern.safe[top];
+                    double yi = yv.safe[i];
+                    yv.safe[i] = 0.0;
+
+                    uint_t p2 = lp.safe[i] + lnz.safe[i];
+                    for (uint_t p = lp.safe[i]; p < p2; ++p) {
+                        yv.safe[li.safe[p]] -= lx.safe[p]*yi;
+                    }
+
+                    double lki = yi/d.safe[i];
+                    d.safe[k] -= lki*yi;
+                    li.safe[p2] = k;
+                    lx.safe[p2] = lki;
+                    ++lnz.safe[i];
+                }
+
+                // The matrix is singular
+                if (!(abs(d.safe[k]) > 1e-13*abs(akk))) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        vec1d solve(const vec1d& b) const {
+            const uint_t n = size();
+            vif_check(b.size() == n, "matrix and vector must have the same dimensions (",
+                "got ", n, " and ", b.size(), ")");
+
+            vec1d x(n);
+            for (uint_t k : range(n)) {
+                x.safe[k] = b.safe[perm.safe[k]];
+            }
+
+            // Solve L*y = b
+            for (uint_t j : range(n))
+            for (uint_t p = lp.safe[j]; p < lp.safe[j+1]; ++p) {
+                x.safe[li.safe[p]] -= lx.safe[p]*x.safe[j];
+            }
+
+            // Solve D*z = y
+            x /= d;
+
+            // Solve L^T*x = z
+            for (uint_t j = n; j-- > 0;)
+            for (uint_t p = lp.safe[j]; p < lp.safe[j+1]; ++p) {
+                x.safe[j] -= lx.safe[p]*x.safe[li.safe[p]];
+            }
+
+            vec1d r(n);
+            for (uint_t k : range(n)) {
+                r.safe[perm.safe[k]] = x.safe[k];
+            }
+
+            return r;
+        }
+
+        // Compute the diagonal of the inverse matrix, without computing the whole inverse.
+        // Uses the Takahashi recurrence, which only needs the elements of the inverse that
+        // are in the sparsity pattern of L.
+        vec1d invert_diagonal() const {
+            const uint_t n = size();
+            vec1d zx(lx.size()), zd(n);
+
+            // Element (i,j) of the inverse, with i > j and (i,j) in the pattern of L
+            auto zij = [&](uint_t i, uint_t j) {
+                if (i == j) return zd.safe[i];
+                if (i < j) std::swap(i, j);
+                auto b = li.data.begin() + lp.safe[j], e = li.data.begin() + lp.safe[j+1];
+                auto iter = std::lower_bound(b, e, i);
+                return zx.safe[iter - li.data.begin()];
+            };
+
+            for (uint_t j = n; j-- > 0;) {
+                const uint_t p0 = lp.safe[j], p1 = lp.safe[j+1];
+                for (uint_t p = p1; p-- > p0;) {
+                    uint_t i = li.safe[p];
+                    double z = 0.0;
+                    for (uint_t q = p0; q < p1; ++q) {
+                        z -= lx.safe[q]*zij(i, li.safe[q]);
+                    }
+
+                    zx.safe[p] = z;
+                }
+
+                double z = 1.0/d.safe[j];
+                for (uint_t q = p0; q < p1; ++q) {
+                    z -= lx.safe[q]*zx.safe[q];
+                }
+
+                zd.safe[j] = z;
+            }
+
+            vec1d r(n);
+            for (uint_t k : range(n)) {
+                r.safe[perm.safe[k]] = zd.safe[k];
+            }
+
+            return r;
+        }
+    };
+}
+}
+
+#endif
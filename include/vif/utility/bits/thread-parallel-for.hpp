@@ -13,62 +13,12 @@ namespace thread {
 
     private :
 
-        struct worker_t {
-            thread_t thread;
-            parallel_for& pfor;
-
-            explicit worker_t(parallel_for& p) : pfor(p) {}
-
-            worker_t(worker_t&& w) : pfor(w.pfor) {}
-
-            worker_t(const worker_t& w) = delete;
-
-            template<typename F>
-            void start(const F& f, bool verbose) {
-                thread.start([this,&f,verbose]() {
-                    uint_t i0, i1;
-                    while (pfor.query_chunk(i0, i1)) {
-                        for (uint_t i : range(i0, i1)) {
-                            f(i);
-                            if (verbose) {
-                                ++pfor.iter;
-                            }
-                        }
-                    }
-                });
-            }
-
-            void join() {
-                thread.join();
-            }
-        };
-
         // Workers
-        std::vector<parallel_for::worker_t> workers;
+        std::unique_ptr<task_pool> own_pool;
+        task_pool* pool = nullptr;
 
         // Internal
-        std::mutex query_mutex;
         std::atomic<uint_t> iter;
-        uint_t n, i0, i1, di;
-
-        bool query_chunk(uint_t& oi0, uint_t& oi1) {
-            std::unique_lock<std::mutex> l(query_mutex);
-
-            if (i0 == n) {
-                return false;
-            }
-
-            oi0 = i0;
-            oi1 = i1;
-
-            i0 = i1;
-            i1 += di;
-            if (i1 > n) {
-                i1 = n;
-            }
-
-            return true;
-        }
 
     public :
 
@@ -76,17 +26,24 @@ namespace thread {
         parallel_for(const parallel_for&) = delete;
         parallel_for(parallel_for&&) = delete;
 
+        // Create a new pool of 'nthread' threads, which will be reused for all calls to
+        // 'execute()'. With zero threads, loops are executed in the calling thread.
         explicit parallel_for(uint_t nthread) {
-            for (uint_t i = 0; i < nthread; ++i) {
-                workers.emplace_back(*this);
+            if (nthread > 0) {
+                own_pool.reset(new task_pool(nthread));
+                pool = own_pool.get();
             }
         }
 
+        // Use an existing pool of threads, which can be shared with other 'parallel_for'
+        // instances. This allows nesting parallel loops without creating more threads.
+        explicit parallel_for(task_pool& p) : pool(&p) {}
+
         template<typename F>
         void execute(const F& f, uint_t ifirst, uint_t ilast) {
-            n = ilast - ifirst;
+            uint_t n = ilast - ifirst;
 
-            if (workers.empty()) {
+            if (!pool || pool->size() == 0) {
                 // Single-threaded execution
                 auto pg = progress_start(n);
                 for (uint_t i : range(ifirst, ilast)) {
@@ -97,40 +54,31 @@ namespace thread {
                 }
             } else {
                 // Multi-threaded execution
-                uint_t nchunk = (chunk_size == 0 ?
-                    workers.size() : std::max(workers.size(), n/chunk_size));
-
-                // Setup chunks
-                di = n/nchunk + 1;
-                i0 = ifirst;
-                i1 = ifirst + di;
                 iter = 0;
 
-                // Launch threads
-                for (auto& t : workers) {
-                    t.start(f, verbose);
-                }
-
                 progress_t pg;
                 if (verbose) {
                     pg = progress_start(n);
                 }
 
-                // Wait for all threads to finish before returning
-                if (verbose) {
-                    while (iter < n) {
-                        thread::sleep_for(update_rate);
-                        print_progress(pg, iter);
+                auto run = [this,&f](uint_t i0, uint_t i1) {
+                    for (uint_t i : range(i0, i1)) {
+                        f(i);
                     }
-                }
 
-                // Join all
-                for (auto& t : workers) {
-                    t.join();
-                }
+                    if (verbose) {
+                        iter += i1 - i0;
+                    }
+                };
 
                 if (verbose) {
+                    pool->execute_chunks(run, ifirst, ilast, chunk_size, [this,&pg]() {
+                        print_progress(pg, iter);
+                    }, update_rate);
+
                     print_progress(pg, iter);
+                } else {
+                    pool->execute_chunks(run, ifirst, ilast, chunk_size);
                 }
             }
         }
@@ -141,7 +89,7 @@ namespace thread {
         }
 
         uint_t size() const {
-            return workers.size();
+            return pool ? pool->size() : 0;
         }
     };
 }
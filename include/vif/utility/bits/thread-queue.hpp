@@ -123,5 +123,114 @@ namespace thread {
             last_ = dummy_ = first_;
         }
     };
+
+    /// Thread-safe bounded FIFO queue, stored in a ring buffer.
+    /// Multiple Producers, Multiple Consumers (MPMC).
+    /** Contrary to 'lock_free_queue', pushing an element does not allocate memory, and
+        the number of elements in the queue is limited to a fixed capacity. Pushing to a full
+        queue blocks until an element is popped, and popping from an empty queue blocks until
+        an element is pushed, or until the queue is closed. Waiting threads are put to sleep.
+    **/
+    template<typename T>
+    class bounded_queue {
+        std::vector<T>          buffer_;
+        uint_t                  head_ = 0;
+        uint_t                  size_ = 0;
+        bool                    closed_ = false;
+        mutable std::mutex      mutex_;
+        std::condition_variable not_empty_;
+        std::condition_variable not_full_;
+
+        template<typename U>
+        void push_(U&& t) {
+            buffer_[(head_ + size_) % buffer_.size()] = std::forward<U>(t);
+            ++size_;
+            not_empty_.notify_one();
+        }
+
+        void pop_(T& t) {
+            t = std::move(buffer_[head_]);
+            head_ = (head_ + 1) % buffer_.size();
+            --size_;
+            not_full_.notify_one();
+        }
+
+    public :
+        explicit bounded_queue(uint_t capacity) : buffer_(std::max(capacity, uint_t(1))) {}
+
+        bounded_queue(const bounded_queue& q) = delete;
+        bounded_queue& operator = (const bounded_queue& q) = delete;
+
+        /// Push a new element at the back of the queue, waiting if the queue is full.
+        /** Returns false if the queue was closed, in which case the element is discarded.
+        **/
+        template<typename U>
+        bool push(U&& t) {
+            std::unique_lock<std::mutex> l(mutex_);
+            not_full_.wait(l, [this]() { return closed_ || size_ < buffer_.size(); });
+            if (closed_) return false;
+            push_(std::forward<U>(t));
+            return true;
+        }
+
+        /// Push a new element at the back of the queue, if the queue is not full.
+        /** Returns false if the queue was full or closed, in which case the element is
+            discarded.
+        **/
+        template<typename U>
+        bool try_push(U&& t) {
+            std::lock_guard<std::mutex> l(mutex_);
+            if (closed_ || size_ == buffer_.size()) return false;
+            push_(std::forward<U>(t));
+            return true;
+        }
+
+        /// Pop an element from the front of the queue, waiting if the queue is empty.
+        /** Returns false if the queue is empty and was closed.
+        **/
+        bool pop(T& t) {
+            std::unique_lock<std::mutex> l(mutex_);
+            not_empty_.wait(l, [this]() { return closed_ || size_ != 0; });
+            if (size_ == 0) return false;
+            pop_(t);
+            return true;
+        }
+
+        /// Pop an element from the front of the queue, if the queue is not empty.
+        bool try_pop(T& t) {
+            std::lock_guard<std::mutex> l(mutex_);
+            if (size_ == 0) return false;
+            pop_(t);
+            return true;
+        }
+
+        /// Close the queue: no element can be pushed anymore, and threads waiting for new
+        /// elements are woken up. The elements remaining in the queue can still be popped.
+        void close() {
+            std::lock_guard<std::mutex> l(mutex_);
+            closed_ = true;
+            not_empty_.notify_all();
+            not_full_.notify_all();
+        }
+
+        /// Re-open a closed queue.
+        void reopen() {
+            std::lock_guard<std::mutex> l(mutex_);
+            closed_ = false;
+        }
+
+        std::size_t size() const {
+            std::lock_guard<std::mutex> l(mutex_);
+            return size_;
+        }
+
+        bool empty() const {
+            return size() == 0;
+        }
+
+        std::size_t capacity() const {
+            return buffer_.size();
+        }
+    };
 }
 }
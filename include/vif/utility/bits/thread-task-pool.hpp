@@ -0,0 +1,284 @@
+#ifndef VIF_INCLUDING_THREAD_BITS
+#error this file is not meant to be included separately, include "vif/utilty/thread.hpp" instead
+#endif
+
+namespace vif {
+namespace thread {
+    /// Persistent pool of threads executing loops with work stealing.
+    /** The threads are created once on construction, and are reused for all subsequent calls
+        to 'execute()'. When there is nothing to do, threads go to sleep and do not consume
+        CPU. Each thread owns a queue of tasks, each task being a range of loop iterations.
+        When a thread picks a task, it recursively splits it in two, leaving the upper half
+        in its queue and processing the lower half. Idle threads steal the largest tasks from
+        the other queues, so that the work load is balanced even when the cost of each
+        iteration varies.
+        'execute()' can be called from within a task (nested parallelism): the calling thread
+        then processes pending tasks while waiting for the nested loop to finish.
+    **/
+    class task_pool {
+        struct job_t {
+            std::function<void(uint_t,uint_t)> run;
+            uint_t grain = 1;
+            uint_t remaining = 0;
+            std::mutex mutex;
+            std::condition_variable cv;
+
+            void finish(uint_t n) {
+                // Must be done under the lock: the waiting thread may destroy the job as soon
+                // as it sees there is no iteration remaining.
+                std::lock_guard<std::mutex> l(mutex);
+                remaining -= n;
+                if (remaining == 0) {
+                    cv.notify_all();
+                }
+            }
+
+            bool done() {
+                std::lock_guard<std::mutex> l(mutex);
+                return remaining == 0;
+            }
+        };
+
+        struct task_t {
+            job_t* job;
+            uint_t i0, i1;
+        };
+
+        struct queue_t {
+            std::mutex mutex;
+            std::deque<task_t> tasks;
+        };
+
+        const uint_t nthread_;
+        std::vector<std::thread> threads_;
+        std::vector<std::unique_ptr<queue_t>> queues_; // one per thread, plus one for others
+        std::atomic<uint_t> ntask_;
+        std::atomic<uint_t> nsleeping_;
+        std::atomic<bool> stop_;
+        std::mutex sleep_mutex_;
+        std::condition_variable sleep_cv_;
+
+        // Index of the calling thread in the pool, or npos if not part of the pool
+        uint_t this_worker_() const {
+            auto id = std::this_thread::get_id();
+            for (uint_t w : range(threads_)) {
+                if (threads_[w].get_id() == id) return w;
+            }
+
+            return npos;
+        }
+
+        queue_t& queue_(uint_t w) {
+            return *queues_[w == npos ? nthread_ : w];
+        }
+
+        void push_(uint_t w, const task_t& t) {
+            {
+                auto& q = queue_(w);
+                std::lock_guard<std::mutex> l(q.mutex);
+                q.tasks.push_back(t);
+            }
+
+            ++ntask_;
+            if (nsleeping_ > 0) {
+                std::lock_guard<std::mutex> l(sleep_mutex_);
+                sleep_cv_.notify_one();
+            }
+        }
+
+        bool pop_back_(queue_t& q, task_t& t) {
+            std::lock_guard<std::mutex> l(q.mutex);
+            if (q.tasks.empty()) return false;
+            t = q.tasks.back();
+            q.tasks.pop_back();
+            --ntask_;
+            return true;
+        }
+
+        bool pop_front_(queue_t& q, task_t& t) {
+            std::lock_guard<std::mutex> l(q.mutex);
+            if (q.tasks.empty()) return false;
+            t = q.tasks.front();
+            q.tasks.pop_front();
+            --ntask_;
+            return true;
+        }
+
+        bool find_task_(uint_t w, task_t& t) {
+            if (ntask_ == 0) return false;
+
+            // Most recent task of our own queue first (best cache locality)
+            if (w != npos && pop_back_(queue_(w), t)) return true;
+
+            // Then the tasks submitted from outside the pool
+            if (pop_front_(queue_(npos), t)) return true;
+
+            // Then steal the oldest (i.e., largest) task of the other threads
+            for (uint_t k : range(nthread_)) {
+                uint_t o = (w == npos ? k : (w + 1 + k) % nthread_);
+                if (o != w && pop_front_(queue_(o), t)) return true;
+            }
+
+            return false;
+        }
+
+        void run_task_(uint_t w, task_t t) {
+            while (t.i1 - t.i0 > t.job->grain) {
+                uint_t mid = t.i0 + (t.i1 - t.i0)/2;
+                push_(w, task_t{t.job, mid, t.i1});
+                t.i1 = mid;
+            }
+
+            t.job->run(t.i0, t.i1);
+            t.job->finish(t.i1 - t.i0);
+        }
+
+        // Index of the calling thread in the pool it belongs to (any pool), or npos
+        static uint_t& current_worker_() {
+            static thread_local uint_t w = npos;
+            return w;
+        }
+
+        void worker_loop_(uint_t w) {
+            current_worker_() = w;
+
+            task_t t;
+            while (true) {
+                if (find_task_(w, t)) {
+                    run_task_(w, t);
+                    continue;
+                }
+
+                std::unique_lock<std::mutex> l(sleep_mutex_);
+                ++nsleeping_;
+                sleep_cv_.wait(l, [this]() { return stop_ || ntask_ > 0; });
+                --nsleeping_;
+
+                if (stop_ && ntask_ == 0) break;
+            }
+        }
+
+    public :
+
+        explicit task_pool(uint_t nthread) : nthread_(nthread), ntask_(0), nsleeping_(0),
+            stop_(false) {
+
+            for (uint_t w = 0; w <= nthread_; ++w) {
+                queues_.emplace_back(new queue_t());
+            }
+
+            threads_.reserve(nthread_);
+            for (uint_t w = 0; w < nthread_; ++w) {
+                threads_.emplace_back(&task_pool::worker_loop_, this, w);
+            }
+        }
+
+        task_pool(const task_pool&) = delete;
+        task_pool(task_pool&&) = delete;
+        task_pool& operator = (const task_pool&) = delete;
+        task_pool& operator = (task_pool&&) = delete;
+
+        ~task_pool() {
+            {
+                std::lock_guard<std::mutex> l(sleep_mutex_);
+                stop_ = true;
+                sleep_cv_.notify_all();
+            }
+
+            for (auto& t : threads_) {
+                t.join();
+            }
+        }
+
+        /// Call 'f(j0,j1)' over chunks of the range [i0,i1), in parallel, and return
+        /// when all the chunks have been processed. Chunks are never larger than 'grain'
+        /// iterations, and are split in halves until they fit; if 'grain' is zero, a value is
+        /// chosen automatically. When called from outside of the pool, 'on_wait()' (if
+        /// provided) is called every 'wait_step' seconds until the loop is finished.
+        template<typename F>
+        void execute_chunks(const F& f, uint_t i0, uint_t i1, uint_t grain = 0,
+            const std::function<void()>& on_wait = {}, double wait_step = 0.1) {
+
+            if (i1 <= i0) return;
+
+            const uint_t n = i1 - i0;
+            if (grain == 0) {
+                grain = std::max(uint_t(1), n/(16*std::max(size(), uint_t(1))));
+            }
+
+            job_t job;
+            job.run = [&f](uint_t j0, uint_t j1) { f(j0, j1); };
+            job.grain = grain;
+            job.remaining = n;
+
+            uint_t w = this_worker_();
+            if (nthread_ == 0) {
+                // No thread in the pool, just execute in the current thread
+                job.run(i0, i1);
+            } else if (w == npos) {
+                // Submit and wait for the job to be finished
+                push_(w, task_t{&job, i0, i1});
+
+                std::unique_lock<std::mutex> l(job.mutex);
+                if (on_wait) {
+                    auto duration = std::chrono::microseconds(uint_t(wait_step*1e6));
+                    while (!job.cv.wait_for(l, duration, [&job]() {
+                        return job.remaining == 0;
+                    })) {
+                        l.unlock();
+                        on_wait();
+                        l.lock();
+                    }
+                } else {
+                    job.cv.wait(l, [&job]() { return job.remaining == 0; });
+                }
+            } else {
+                // Nested call from one of our threads: contribute to the work instead of
+                // blocking, until the job is finished
+                push_(w, task_t{&job, i0, i1});
+
+                task_t t;
+                while (!job.done()) {
+                    if (find_task_(w, t)) {
+                        run_task_(w, t);
+                        continue;
+                    }
+
+                    // Nothing to do: the last chunks are processed by other threads. Sleep until
+                    // they are done, waking up regularly in case they push new tasks.
+                    std::unique_lock<std::mutex> l(job.mutex);
+                    job.cv.wait_for(l, std::chrono::milliseconds(1), [&job]() {
+                        return job.remaining == 0;
+                    });
+                }
+            }
+        }
+
+        /// Call 'f(i)' for each 'i' in [i0,i1), in parallel, and return when all the
+        /// iterations have been processed (see 'execute_chunks()').
+        template<typename F>
+        void execute(const F& f, uint_t i0, uint_t i1, uint_t grain = 0) {
+            execute_chunks([&f](uint_t j0, uint_t j1) {
+                for (uint_t i = j0; i < j1; ++i) {
+                    f(i);
+                }
+            }, i0, i1, grain);
+        }
+
+        template<typename F>
+        void execute(const F& f, uint_t i1) {
+            execute(f, 0, i1);
+        }
+
+        uint_t size() const {
+            return nthread_;
+        }
+
+        /// Index of the calling thread in the task pool that runs it, in [0,size()), or npos
+        /// if the calling thread does not belong to any task pool.
+        static uint_t worker_index() {
+            return current_worker_();
+        }
+    };
+}
+}
@@ -162,3 +162,210 @@ namespace thread {
     };
 }
 }
+
+namespace vif {
+namespace impl {
+namespace thread_impl {
+    // Counts the items that are queued or being processed by a pool, and wakes up
+    // the threads waiting for the pool to become idle.
+    struct bounded_pool_state {
+        std::atomic<uint_t>     pending;
+        std::mutex              mutex;
+        std::condition_variable idle;
+
+        bounded_pool_state() : pending(0) {}
+
+        void finish() {
+            if (--pending == 0) {
+                std::lock_guard<std::mutex> l(mutex);
+                idle.notify_all();
+            }
+        }
+
+        void wait_idle() {
+            std::unique_lock<std::mutex> l(mutex);
+            idle.wait(l, [this]() { return pending == 0; });
+        }
+    };
+
+    template<typename W, typename T>
+    struct bounded_worker_with_workspace {
+        vif::thread::bounded_queue<T> input;
+        std::atomic<uint_t>           load;
+        W                             wsp;
+        std::thread                   impl;
+
+        template<typename F, typename ... Args>
+        explicit bounded_worker_with_workspace(bounded_pool_state& state, uint_t capacity,
+            const F& f, const Args&... args) : input(capacity), load(0), wsp(args...),
+            impl([this,&state,f]() {
+
+            T t;
+            while (input.pop(t)) {
+                f(wsp, t);
+                --load;
+                state.finish();
+            }
+        }) {}
+
+        ~bounded_worker_with_workspace() {
+            join();
+        }
+
+        void join() {
+            input.close();
+            if (impl.joinable()) {
+                impl.join();
+            }
+        }
+
+        uint_t workload() const {
+            return load;
+        }
+    };
+
+    template<typename T>
+    struct bounded_worker_no_workspace {
+        vif::thread::bounded_queue<T> input;
+        std::atomic<uint_t>           load;
+        std::thread                   impl;
+
+        template<typename F>
+        explicit bounded_worker_no_workspace(bounded_pool_state& state, uint_t capacity,
+            const F& f) : input(capacity), load(0), impl([this,&state,f]() {
+
+            T t;
+            while (input.pop(t)) {
+                f(t);
+                --load;
+                state.finish();
+            }
+        }) {}
+
+        ~bounded_worker_no_workspace() {
+            join();
+        }
+
+        void join() {
+            input.close();
+            if (impl.joinable()) {
+                impl.join();
+            }
+        }
+
+        uint_t workload() const {
+            return load;
+        }
+    };
+}
+}
+}
+
+namespace vif {
+namespace thread {
+    /// Pool of workers with bounded input queues.
+    /** This pool has the same interface as 'worker_pool', with the following differences.
+        Idle workers sleep until new items are available, instead of polling their queue.
+        Each worker can only hold 'queue_size' items: if the producer calls 'process()' while
+        the queues are full, it waits until some items are processed, so that the memory
+        usage remains bounded. New items are sent to the least loaded worker. Lastly,
+        'wait_idle()' sleeps until all the items have been processed.
+    **/
+    template<typename T, typename W = void>
+    struct bounded_worker_pool {
+        using worker = typename std::conditional<std::is_same<W, void>::value,
+            impl::thread_impl::bounded_worker_no_workspace<T>,
+            impl::thread_impl::bounded_worker_with_workspace<W,T>
+        >::type;
+
+        // Setup
+        uint_t queue_size = 64;
+
+        std::vector<std::unique_ptr<worker>> workers;
+        impl::thread_impl::bounded_pool_state state;
+        uint_t last_push = 0;
+
+        bounded_worker_pool() = default;
+
+        template<typename F, typename ... Args>
+        explicit bounded_worker_pool(uint_t nthread, const F& f, const Args&... args) {
+            start(nthread, f, args...);
+        }
+
+        ~bounded_worker_pool() {
+            join();
+        }
+
+        template<typename F, typename ... Args>
+        void start(uint_t nthread, const F& f, const Args&... args) {
+            join();
+
+            workers.clear();
+            workers.reserve(nthread);
+            for (uint_t i = 0; i < nthread; ++i) {
+                workers.emplace_back(new worker(state, queue_size, f, args...));
+            }
+
+            last_push = 0;
+        }
+
+        // Wait for all the items to be processed, and stop the workers
+        void join() {
+            for (uint_t i : range(workers)) {
+                workers[i]->join();
+            }
+        }
+
+        void process(T t) {
+            vif_check(!workers.empty(), "bounded_worker_pool has no worker, call start() first");
+
+            // Find the least loaded worker. Start the search after the last worker that
+            // received an item, so that the load is spread when all workers are equally busy.
+            uint_t best = last_push;
+            uint_t best_load = npos;
+            for (uint_t k : range(workers)) {
+                uint_t i = (last_push + 1 + k) % workers.size();
+                uint_t l = workers[i]->workload();
+                if (l < best_load) {
+                    best_load = l;
+                    best = i;
+                    if (l == 0) break;
+                }
+            }
+
+            last_push = best;
+            process(best, std::move(t));
+        }
+
+        void process(uint_t i, T t) {
+            vif_check(i < workers.size(), "bounded_worker_pool has no worker ", i, " (only ",
+                workers.size(), " were started)");
+
+            ++state.pending;
+            ++workers[i]->load;
+            if (!workers[i]->input.push(std::move(t))) {
+                // Worker was stopped, the item is discarded
+                --workers[i]->load;
+                state.finish();
+            }
+        }
+
+        // Wait until all the items sent to the pool have been processed
+        void wait_idle() {
+            state.wait_idle();
+        }
+
+        void consume_all() {
+            wait_idle();
+        }
+
+        uint_t size() const {
+            return workers.size();
+        }
+
+        uint_t remaining() const {
+            return state.pending;
+        }
+    };
+}
+}
@@ -4,8 +4,11 @@
 #include <thread>
 #include <atomic>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
 #include <functional>
 #include "vif/core/vec.hpp"
+#include "vif/utility/time.hpp"
 
 #define VIF_INCLUDING_THREAD_BITS
 #include "vif/utility/bits/thread-thread.hpp"
@@ -13,6 +16,7 @@
 #include "vif/utility/bits/thread-queue.hpp"
 #include "vif/utility/bits/thread-worker.hpp"
 #include "vif/utility/bits/thread-worker-pool.hpp"
+#include "vif/utility/bits/thread-task-pool.hpp"
 #include "vif/utility/bits/thread-parallel-for.hpp"
 #undef VIF_INCLUDING_THREAD_BITS
 
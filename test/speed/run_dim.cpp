@@ -4,9 +4,9 @@ using namespace vif;
 
 namespace speed_test {
     template<std::size_t Dim, typename Type>
-    vec<Dim-1,rtype_t<Type>> median1(const vec<Dim,Type>& v, uint_t dim) {
-        using fptr = rtype_t<Type> (*)(vec<1,rtype_t<Type>>);
-        return run_index_<fptr, &median<1,rtype_t<Type>>>(v, dim);
+    vec<Dim-1,meta::rtype_t<Type>> median1(const vec<Dim,Type>& v, uint_t dim,
+        const reduce_params& params) {
+        return partial_median(dim, v, params);
     }
 
     template<typename I>
@@ -99,8 +99,8 @@ namespace std {
 
 namespace speed_test {
     template<std::size_t Dim, typename Type>
-    vec<Dim-1,rtype_t<Type>> median2(vec<Dim,Type> v, uint_t dim) {
-        vec<Dim-1,rtype_t<Type>> r;
+    vec<Dim-1,meta::rtype_t<Type>> median2(vec<Dim,Type> v, uint_t dim) {
+        vec<Dim-1,meta::rtype_t<Type>> r;
         for (uint_t i = 0; i < dim; ++i) {
             r.dims[i] = v.dims[i];
         }
@@ -129,7 +129,7 @@ namespace speed_test {
             } else {
                 std::ptrdiff_t offset = (v.dims[dim]-nwrong)/2;
                 std::nth_element(p.first, p.first + offset, p.second,
-                    [](rtype_t<Type> x0, rtype_t<Type> x1) {
+                    [](meta::rtype_t<Type> x0, meta::rtype_t<Type> x1) {
                         if (is_nan(x0)) return false;
                         if (is_nan(x1)) return true;
                         return x0 < x1;
@@ -147,9 +147,13 @@ namespace speed_test {
 int vif_main(int argc, char* argv[]) {
     uint_t nsrc = 10000;
     uint_t navg = 1;
+    uint_t threads = 1;
     bool check = false;
 
-    read_args(argc, argv, arg_list(nsrc, navg, check));
+    read_args(argc, argv, arg_list(nsrc, navg, threads, check));
+
+    reduce_params params;
+    params.thread = threads;
 
     auto seed = make_seed(42);
 
@@ -158,7 +162,7 @@ int vif_main(int argc, char* argv[]) {
 
         for (uint_t i : range(navg)) {
             vec3d data = randomn(seed, nsrc, 61, 61);
-            vec2d ref = speed_test::median1(data, 0);
+            vec2d ref = speed_test::median1(data, 0, params);
             bad2 += total(speed_test::median2(data, 0) != ref);
         }
 
@@ -172,8 +176,8 @@ int vif_main(int argc, char* argv[]) {
         double t;
 
         res[_] = 0.0;
-        t = profile([&data,&res]() {
-            res += speed_test::median1(data, 0);
+        t = profile([&data,&res,&params]() {
+            res += speed_test::median1(data, 0, params);
         }, navg);
 
         print(t);
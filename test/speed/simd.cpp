@@ -0,0 +1,123 @@
+#include <vif.hpp>
+
+using namespace vif;
+
+namespace speed_test {
+    // Run the same function with the scalar loops and with the vectorized kernels
+    template<typename F>
+    void compare(const std::string& name, uint_t navg, F&& func) {
+        simd_level level = simd_get_level();
+
+        simd_set_level(simd_level::none);
+        double t0 = profile(func, navg);
+        simd_set_level(level);
+        double t1 = profile(func, navg);
+
+        print(name, ": ", t0, " ", t1, " (x", t0/t1, ")");
+    }
+
+    template<typename T, typename F>
+    uint_t check(F&& func) {
+        simd_level level = simd_get_level();
+
+        simd_set_level(simd_level::none);
+        T r0 = func();
+        simd_set_level(level);
+        T r1 = func();
+
+        // NaN values compare unequal to themselves
+        return count(r0 != r1) - count(r0 != r0 && r1 != r1);
+    }
+}
+
+int vif_main(int argc, char* argv[]) {
+    uint_t nsrc = 1000000;
+    uint_t navg = 10;
+    bool check = false;
+    bool single = false;
+
+    read_args(argc, argv, arg_list(nsrc, navg, check, single));
+
+    print("instruction set: ", simd_get_level() == simd_level::avx512 ? "avx512" :
+        simd_get_level() == simd_level::avx2 ? "avx2" :
+        simd_get_level() == simd_level::neon ? "neon" : "none");
+
+    auto seed = make_seed(42);
+    vec1d data1 = randomn(seed, nsrc);
+    vec1d data2 = randomn(seed, nsrc);
+    vec1u id = randomi(seed, 0, nsrc-1, nsrc/10);
+    data1[id] = dnan;
+
+    if (!check) {
+        // Time
+        double res = 0.0;
+
+        if (single) {
+            vec1f fdata1 = data1;
+            vec1f fdata2 = data2;
+
+            speed_test::compare("f v+v  ", navg, [&]() { vec1f r = fdata1 + fdata2; res += r[0]; });
+            speed_test::compare("f v*s  ", navg, [&]() { vec1f r = fdata1*2.0f; res += r[0]; });
+            speed_test::compare("f v<v  ", navg, [&]() { vec1b r = fdata1 < fdata2; res += r[0]; });
+            speed_test::compare("f total", navg, [&]() { res += total(fdata2); });
+            speed_test::compare("f min  ", navg, [&]() { res += min(fdata1); });
+            speed_test::compare("f minmx", navg, [&]() { res += minmax(fdata1).second; });
+            speed_test::compare("f nan  ", navg, [&]() { res += count(is_nan(fdata1)); });
+            speed_test::compare("f exp  ", navg, [&]() { vec1f r = fast_exp(fdata2); res += r[0]; });
+            speed_test::compare("f axpy ", navg, [&]() {
+                vec1d r(nsrc);
+                impl::simd_impl::axpy(0.5, fdata2.data.data(), r.data.data(), nsrc);
+                res += r[0];
+            });
+        } else {
+            speed_test::compare("d v+v  ", navg, [&]() { vec1d r = data1 + data2; res += r[0]; });
+            speed_test::compare("d v*s  ", navg, [&]() { vec1d r = data1*2.0; res += r[0]; });
+            speed_test::compare("d v<v  ", navg, [&]() { vec1b r = data1 < data2; res += r[0]; });
+            speed_test::compare("d total", navg, [&]() { res += total(data2); });
+            speed_test::compare("d mean ", navg, [&]() { res += mean(data2); });
+            speed_test::compare("d rms  ", navg, [&]() { res += rms(data2); });
+            speed_test::compare("d min  ", navg, [&]() { res += min(data1); });
+            speed_test::compare("d max  ", navg, [&]() { res += max(data1); });
+            speed_test::compare("d minmx", navg, [&]() { res += minmax(data1).second; });
+            speed_test::compare("d nan  ", navg, [&]() { res += count(is_nan(data1)); });
+            speed_test::compare("d fin  ", navg, [&]() { res += count(is_finite(data1)); });
+            speed_test::compare("d dot  ", navg, [&]() {
+                res += impl::simd_impl::dot(data1.data.data(), data2.data.data(), nsrc);
+            });
+        }
+
+        print(res);
+    } else {
+        // Check (total, mean, rms and dot are not bitwise reproducible)
+        uint_t bad = 0;
+        bad += speed_test::check<vec1d>([&]() { return data1 + data2; });
+        bad += speed_test::check<vec1d>([&]() { return 2.0/data1; });
+        bad += speed_test::check<vec1b>([&]() { return data1 >= data2; });
+        bad += speed_test::check<vec1b>([&]() { return is_nan(data1); });
+        bad += speed_test::check<vec1u>([&]() { return vec1u{min_id(data1), max_id(data1)}; });
+        bad += speed_test::check<vec1u>([&]() { return vec1u{count(is_finite(data1))}; });
+        // axpy may differ by one ulp when the compiler uses fused multiply-add
+        bad += speed_test::check<vec1b>([&]() {
+            vec1f x = data2;
+            vec1d r = data1;
+            impl::simd_impl::axpy(0.3, x.data.data(), r.data.data(), nsrc);
+            impl::simd_impl::axpy_sq(0.7, data2.data.data(), r.data.data(), nsrc);
+            vec1d t1 = 0.3*vec1d(x), t2 = 0.7*sqr(data2);
+            return abs(r - (data1 + t1 + t2)) > 1e-12*(abs(data1) + abs(t1) + t2);
+        });
+        bad += speed_test::check<vec1b>([&]() {
+            vec1f x = data2;
+            double d = impl::simd_impl::dot(x.data.data(), x.data.data(), nsrc);
+            return vec1b{abs(d/total(sqr(data2)) - 1.0) > 1e-6};
+        });
+        // fast_exp may differ by one ulp when the compiler uses fused multiply-add
+        bad += speed_test::check<vec1b>([&]() {
+            vec1f x = data2;
+            return abs(fast_exp(x)/exp(x) - 1.0) > 0.01;
+        });
+
+        print(bad);
+    }
+
+    return 0;
+}
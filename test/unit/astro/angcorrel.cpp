@@ -0,0 +1,52 @@
+#include <vif.hpp>
+#include <vif/test/unit_test.hpp>
+
+using namespace vif;
+using namespace vif::astro;
+
+int vif_main(int argc, char* argv[]) {
+    auto seed = make_seed(42);
+
+    // Field crossing RA=0, with some duplicate positions
+    vec1d ra = 2.0*(randomu(seed, 2000) - 0.5);
+    vec1d dec = 10.0 + 0.5*randomu(seed, 2000);
+    ra = ra + 360.0*(ra < 0.0);
+    ra[_-99] = ra[1000-_-1099];
+    dec[_-99] = dec[1000-_-1099];
+
+    vec1d rra = 2.0*(randomu(seed, 5000) - 0.5);
+    vec1d rdec = 10.0 + 0.5*randomu(seed, 5000);
+    rra = rra + 360.0*(rra < 0.0);
+
+    vec2d bins = make_bins(0.0, 300.0, 10);
+
+    angcorrel_params p;
+    p.brute_force = true;
+    vec1d wb = angcorrel(ra, dec, rra, rdec, bins, p);
+
+    p.brute_force = false;
+    vec1d wg = angcorrel(ra, dec, rra, rdec, bins, p);
+    check(wg, wb);
+
+    p.thread = 4;
+    wg = angcorrel(ra, dec, rra, rdec, bins, p);
+    check(wg, wb);
+
+    // Field around the north pole
+    dec = 89.8 + 0.2*randomu(seed, 2000);
+    ra = 360.0*randomu(seed, 2000);
+    rdec = 89.8 + 0.2*randomu(seed, 5000);
+    rra = 360.0*randomu(seed, 5000);
+
+    p.brute_force = true;
+    wb = angcorrel(ra, dec, rra, rdec, bins, p);
+
+    p.brute_force = false;
+    wg = angcorrel(ra, dec, rra, rdec, bins, p);
+    check(wg, wb);
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
@@ -0,0 +1,36 @@
+#include <vif.hpp>
+#include <vif/test/unit_test.hpp>
+
+using namespace vif;
+using namespace vif::astro;
+
+int vif_main(int argc, char* argv[]) {
+    auto seed = make_seed(42);
+
+    vec2d img = randomn(seed, 150, 170);
+    vec2d kernel = gaussian_profile({{11, 15}}, 2.0, 5, 7);
+    kernel(2,3) = 0.5;
+
+    vec2d ref = convolve2d(img, kernel);
+
+    convolve2d_tiled_params p;
+    p.tile_size = 32;
+    vec2d res = convolve2d_tiled(img, kernel, p);
+    check(res.dims, img.dims);
+    check(max(abs(res - ref)) < 1e-10, true);
+
+    // Same result with multiple threads
+    p.thread = 3;
+    vec2d res2 = convolve2d_tiled(img, kernel, p);
+    check(count(res2 != res), 0u);
+
+    // A single tile
+    p.tile_size = 1024;
+    res = convolve2d_tiled(img, kernel, p);
+    check(max(abs(res - ref)) < 1e-10, true);
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
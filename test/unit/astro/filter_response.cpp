@@ -0,0 +1,71 @@
+#include <vif.hpp>
+#include <vif/astro/template_fit.hpp>
+#include <vif/test/unit_test.hpp>
+
+using namespace vif;
+using namespace vif::astro;
+
+int vif_main(int argc, char* argv[]) {
+    auto seed = make_seed(42);
+
+    // Irregular SED wavelength grid and a batch of random SEDs
+    const uint_t nlam = 500;
+    const uint_t nsed = 40;
+    vec1d lam = 0.1 + 0.03*indgen<double>(nlam) + 0.02*randomu(seed, nlam);
+    vec2d sed = 1.0 + randomu(seed, nsed, nlam);
+
+    // Filters with their own sampling, one of them outside of the SED grid
+    vec<1,filter_t> filters(6);
+    vec1d l0 = {0.5, 1.234, 3.0, 10.0, 0.05, lam.back() - 0.2};
+    for (uint_t f : range(filters)) {
+        filters[f].lam = l0[f]*(0.9 + 0.2*indgen<double>(37)/36.0);
+        filters[f].res = exp(-sqr(filters[f].lam/l0[f] - 1.0)/0.002);
+        filters[f].res /= integrate(filters[f].lam, filters[f].res);
+    }
+
+    // Filter entirely within a single SED interval
+    filters[5].lam = lam[100] + (lam[101] - lam[100])*vec1d{0.1, 0.5, 0.9};
+    filters[5].res = {1.0, 2.0, 1.0};
+
+    vec2d expected(nsed, filters.size());
+    for (uint_t f : range(filters)) {
+        for (uint_t s : range(nsed)) {
+            expected(s,f) = sed2flux(filters[f], lam, sed(s,_).concretise());
+        }
+    }
+
+    filter_response resp(filters, lam);
+    check(resp.size(), filters.size());
+
+    vec2d flux = resp.apply(sed);
+    vec1u idf = where(is_finite(expected(0,_)));
+    check(idf.size(), 5u);
+    check(count(is_finite(flux)), nsed*5);
+    check(max(abs(flux(_,idf) - expected(_,idf))/abs(expected(_,idf))) < 1e-12, true);
+
+    // Threaded and single-SED versions agree
+    filter_response_params p;
+    p.thread = 3;
+    check(resp.apply(sed, p), flux);
+    check(resp.apply(sed(7,_).concretise()), flux(7,_).concretise());
+
+    // Library with a common wavelength grid goes through the operator
+    struct {
+        vec2d lam, sed;
+    } lib;
+
+    lib.lam = replicate(lam, nsed);
+    lib.sed = sed;
+    vec2d obs = template_observed(lib, filters);
+    check(max(abs(obs(_,idf) - expected(_,idf))/abs(expected(_,idf))) < 1e-12, true);
+
+    // ... and otherwise falls back to 'sed2flux'
+    lib.lam(3,_) *= 1.0001;
+    obs = template_observed(lib, filters);
+    check(obs(0,idf), expected(0,idf));
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
@@ -0,0 +1,66 @@
+#include <vif.hpp>
+#include <vif/test/unit_test.hpp>
+
+using namespace vif;
+using namespace vif::astro;
+
+int vif_main(int argc, char* argv[]) {
+    auto seed = make_seed(42);
+
+    // Smooth non-linear mapping: rotation, scaling and some distortion
+    auto func = [](const vec1d& x, const vec1d& y, vec1d& tx, vec1d& ty) {
+        tx = 10.0 + 0.8*x - 0.3*y + 2e-4*x*y + 1e-7*x*x*x;
+        ty = -5.0 + 0.3*x + 0.8*y + 3e-4*y*y + 1e-6*sin(0.01*x)*y*y;
+    };
+
+    vec1u sdims = {300, 400};
+    vec1u ddims = {350, 420};
+
+    vec1d x = randomu(seed, 10000)*400 - 0.5;
+    vec1d y = randomu(seed, 10000)*300 - 0.5;
+    vec1d ex, ey;
+    func(x, y, ex, ey);
+
+    for (double tol : {1e-2, 1e-4, 1e-6}) {
+        pixel_transform_params p;
+        p.tolerance = tol;
+        pixel_transform tr(func, sdims, ddims, p);
+        check(tr.max_error <= tol, true);
+
+        // Error is actually bounded everywhere by the error measured between the grid nodes
+        double err = 0.0;
+        for (uint_t i : range(x)) {
+            double tx, ty;
+            tr.map(x[i], y[i], tx, ty);
+            err = std::max(err, sqrt(sqr(tx - ex[i]) + sqr(ty - ey[i])));
+        }
+
+        check(err <= tr.max_error, true);
+    }
+
+    {
+        // Integer shift, for which regridding is exact
+        auto shift = [](const vec1d& x, const vec1d& y, vec1d& tx, vec1d& ty) {
+            tx = x + 3.0;
+            ty = y - 2.0;
+        };
+
+        pixel_transform tr(shift, sdims, sdims);
+        check(tr.step, 64.0);
+
+        vec2d img = randomn(seed, 300, 400);
+        vec2d wei;
+        vec2d res = regrid_drizzle(img, tr, wei);
+        check(max(abs(res(1-_-297,3-_-398) - img(3-_-299,0-_-395))) < 1e-6, true);
+        check(max(abs(wei(1-_-297,3-_-398) - 1.0)) < 1e-6, true);
+
+        pixel_transform itr(shift, sdims, sdims);
+        res = regrid_interpolate(img, itr);
+        check(max(abs(res(2-_-299,0-_-396) - img(0-_-297,3-_-399))) < 1e-6, true);
+    }
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
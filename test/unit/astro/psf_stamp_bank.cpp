@@ -0,0 +1,68 @@
+#include <vif.hpp>
+#include <vif/test/unit_test.hpp>
+
+using namespace vif;
+using namespace vif::astro;
+
+int vif_main(int argc, char* argv[]) {
+    auto seed = make_seed(42);
+
+    vec2d psf = gaussian_profile({{31, 31}}, 2.5);
+    psf /= max(psf);
+
+    psf_stamp_bank_params p;
+    p.phases = 16;
+    psf_stamp_bank bank(psf, p);
+    check(bank.max_offset_error, 0.5/16);
+    check(bank.max_error > 0.0 && bank.max_error < 0.02, true);
+
+    // Exact on the phases
+    check(max(abs(bank.stamp(0.0, 0.0) - psf)), 0.0);
+    check(max(abs(bank.stamp(0.25, -0.125) - translate(psf, 0.25, -0.125))) < 1e-12, true);
+    check(&bank.stamp(0.26, -0.13) == &bank.stamp(0.25, -0.125), true);
+
+    // Error is bounded in between
+    double err = 0.0;
+    vec1d dx = randomu(seed, 200) - 0.5, dy = randomu(seed, 200) - 0.5;
+    for (uint_t i : range(dx)) {
+        err = std::max(err, max(abs(bank.stamp(dx[i], dy[i]) - translate(psf, dx[i], dy[i]))));
+    }
+
+    check(err <= bank.max_error*(1.0 + 1e-6), true);
+
+    // Finer phases give smaller errors
+    p.phases = 64;
+    psf_stamp_bank fbank(psf, p);
+    check(fbank.max_error < 0.3*bank.max_error, true);
+
+    p.bicubic = true;
+    psf_stamp_bank cbank(psf, p);
+    check(max(abs(cbank.stamp(0.25, -0.125) - translate_bicubic(psf, 0.25, -0.125))) < 1e-12, true);
+
+    // Without phases, shifts are exact
+    p.phases = 0;
+    p.bicubic = false;
+    psf_stamp_bank ebank(psf, p);
+    check(ebank.max_error, 0.0);
+    check(max(abs(ebank.shift(dx[0], dy[0]) - translate(psf, dx[0], dy[0]))), 0.0);
+    check(max(abs(bank.shift(0.26, -0.13) - bank.stamp(0.25, -0.125))), 0.0);
+
+    // Weighted stamp, with pixels falling outside of the error map
+    vec2d emap = randomu(seed, 50, 60) + 0.5;
+    vec2d ws = bank.weighted_stamp(emap, 5, 40, 0.25, -0.125);
+    vec1u idi, idp;
+    subregion(emap, {5-15, 40-15, 5+15, 40+15}, idi, idp);
+    vec2d ews(psf.dims);
+    ews[idp] = bank.stamp(0.25, -0.125)[idp]/emap[idi];
+    check(max(abs(ws - ews)), 0.0);
+    check(count(ws[complement(ws, idp)] != 0.0), 0u);
+
+    ws = ebank.weighted_stamp(emap, 5, 40, 0.3, -0.2);
+    ews[idp] = translate(psf, 0.3, -0.2)[idp]/emap[idi];
+    check(max(abs(ws - ews)), 0.0);
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
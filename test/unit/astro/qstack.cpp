@@ -0,0 +1,168 @@
+#include <vif.hpp>
+#include <vif/astro/qstack.hpp>
+#include <vif/test/unit_test.hpp>
+
+using namespace vif;
+using namespace vif::astro;
+
+int vif_main(int argc, char* argv[]) {
+    auto seed = make_seed(42);
+
+    make_wcs_header_params wp;
+    wp.pixel_scale = 0.3;
+    wp.sky_ref_ra = 150.1;
+    wp.sky_ref_dec = 2.2;
+    wp.pixel_ref_x = 150.5;
+    wp.pixel_ref_y = 115.5;
+    wp.dims_x = 300;
+    wp.dims_y = 230;
+
+    fits::header hdr;
+    make_wcs_header(wp, hdr);
+
+    vec2f img = randomn(seed, 230, 300);
+    img[randomi(seed, 0, img.size()-1, 20)] = fnan;
+    vec2f wht = 1.0 + randomu(seed, 230, 300);
+    fits::write("qstack_img.fits", img, hdr);
+    fits::write("qstack_wht.fits", wht, hdr);
+
+    // Random sources, some of them on the edges or outside of the image, plus a few
+    // positions at the exact limits of the image
+    const uint_t hsize = 6;
+    vec1d x = randomu(seed, 400)*330 - 15;
+    vec1d y = randomu(seed, 400)*260 - 15;
+    append(x, vec1d{1.0, 300.0, 300.0 + hsize, 1.0 - hsize, 1.0 - hsize - 1, 150.0, dnan});
+    append(y, vec1d{1.0, 230.0, 100.0, 100.0, 100.0, 230.0 + hsize, 100.0});
+
+    astro::wcs w(hdr);
+    vec1d ra, dec;
+    xy2ad(w, x, y, ra, dec);
+
+    // Reference: previous serial extraction, one cutout at a time, on the image in memory
+    auto same = [](const vec3f& a, const vec3f& b) {
+        return a.dims == b.dims && count(a != b && !(is_nan(a) && is_nan(b))) == 0u;
+    };
+
+    auto reference = [&](const vec2f& map, bool edges, bool keep_nan, vec3f& cube, vec1u& ids,
+        vec1d& dx, vec1d& dy) {
+
+        const long width = map.dims[1], height = map.dims[0];
+        const long size = 2*hsize+1;
+        vec1d tx, ty;
+        ad2xy(w, ra, dec, tx, ty);
+        cube.clear();
+        cube.dims[1] = cube.dims[2] = size;
+        for (uint_t i : range(tx)) {
+            if (!is_finite(tx[i]) || !is_finite(ty[i])) continue;
+
+            long x0 = round(tx[i] - hsize), y0 = round(ty[i] - hsize);
+            long x1 = x0 + size - 1, y1 = y0 + size - 1;
+            if (x1 < 1 || x0 >= width || y1 < 1 || y0 >= height) continue;
+            if (!edges && (x0 < 1 || x1 >= width || y0 < 1 || y1 >= height)) continue;
+
+            vec2f cut = replicate(fnan, size, size);
+            for (long j : range(size))
+            for (long k : range(size)) {
+                long px = x0 + k, py = y0 + j;
+                if (px >= 1 && px <= width && py >= 1 && py <= height) {
+                    cut(j,k) = map(py-1,px-1);
+                }
+            }
+
+            if (!keep_nan && count(!is_finite(cut)) != 0) continue;
+
+            cube.push_back(cut);
+            ids.push_back(i);
+            dx.push_back(tx[i] - round(tx[i]));
+            dy.push_back(ty[i] - round(ty[i]));
+        }
+    };
+
+    for (bool keep_nan : {false, true}) {
+        vec3f rcube;
+        vec1u rids;
+        vec1d rdx, rdy;
+        reference(img, true, keep_nan, rcube, rids, rdx, rdy);
+
+        for (uint_t nthread : {1, 4}) {
+            qstack_params p;
+            p.keep_nan = keep_nan;
+            p.save_offsets = true;
+            p.thread = nthread;
+            // Small buffers, so that the cutouts are spread over many bands
+            p.buffer_size = 20*300*sizeof(float);
+
+            vec3f cube;
+            vec1u ids;
+            qstack_output out = qstack(ra, dec, "qstack_img.fits", hsize, cube, ids, p);
+            check(ids, rids);
+            check(same(cube, rcube), true);
+            check(out.dx, rdx);
+            check(out.dy, rdy);
+
+            // Appending to an existing cube
+            qstack(ra, dec, "qstack_img.fits", hsize, cube, ids, p);
+            check(ids.size(), 2*rids.size());
+            check(ids[rids.size()-_], rids);
+            check(same(cube(rids.size()-_,_,_), rcube), true);
+        }
+    }
+
+    {
+        // With a weight map, only sources fully inside the image are kept
+        vec3f rcube, rwcube;
+        vec1u rids, rwids;
+        vec1d rdx, rdy, rwdx, rwdy;
+        reference(img, false, false, rcube, rids, rdx, rdy);
+        reference(wht, false, false, rwcube, rwids, rwdx, rwdy);
+        vec1u id1, id2;
+        match(rids, rwids, id1, id2);
+        check(id1.size(), rids.size());
+        rwcube = rwcube(id2,_,_);
+
+        for (uint_t nthread : {1, 4}) {
+            qstack_params p;
+            p.thread = nthread;
+            p.buffer_size = 20*300*sizeof(float);
+
+            vec3f cube, wcube;
+            vec1u ids;
+            qstack(ra, dec, "qstack_img.fits", "qstack_wht.fits", hsize, cube, wcube, ids, p);
+            check(ids, rids);
+            check(same(cube, rcube), true);
+            check(same(wcube, rwcube), true);
+        }
+    }
+
+    {
+        // Streaming into reducers, with one reducer per thread merged at the end
+        qstack_mean_reducer rmean(hsize);
+        qstack_median_reducer rmed(hsize);
+        vec1u rids;
+        qstack_params p;
+        p.buffer_size = 20*300*sizeof(float);
+        qstack_reduce(ra, dec, "qstack_img.fits", "qstack_wht.fits", hsize, rmean, rids, p);
+        rids.clear();
+        qstack_reduce(ra, dec, "qstack_img.fits", hsize, rmed, rids, p);
+
+        p.thread = 4;
+        qstack_mean_reducer tmean(hsize);
+        qstack_median_reducer tmed(hsize);
+        vec1u ids;
+        qstack_reduce(ra, dec, "qstack_img.fits", "qstack_wht.fits", hsize, tmean, ids, p);
+        ids.clear();
+        qstack_reduce(ra, dec, "qstack_img.fits", hsize, tmed, ids, p);
+        check(tmean.count(), rmean.count());
+        check(max(abs(tmean.mean() - rmean.mean())) < 1e-6, true);
+        check(tmed.count(), rmed.count());
+        check(max(abs(tmed.median() - rmed.median())) < 0.1, true);
+    }
+
+    file::remove("qstack_img.fits");
+    file::remove("qstack_wht.fits");
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
@@ -0,0 +1,80 @@
+#include <vif.hpp>
+#include <vif/astro/qstack.hpp>
+#include <vif/test/unit_test.hpp>
+
+using namespace vif;
+using namespace vif::astro;
+
+int vif_main(int argc, char* argv[]) {
+    auto seed = make_seed(42);
+
+    const uint_t hsize = 3;
+    const uint_t nsrc = 2000;
+    vec3f cube = randomn(seed, nsrc, 2*hsize+1, 2*hsize+1);
+    vec3f wcube = randomu(seed, nsrc, 2*hsize+1, 2*hsize+1) + 0.5;
+    cube(10,2,3) = fnan;
+
+    {
+        // Same result as the cube functions, with all the cutouts in one reducer or split
+        // in two reducers that are merged
+        qstack_mean_reducer r1(hsize, 20);
+        qstack_mean_reducer r2 = r1.empty_clone();
+        qstack_mean_reducer r3 = r1.empty_clone();
+        for (uint_t i : range(nsrc)) {
+            vec2f c = cube(i,_,_);
+            r1.add(i, c);
+            (i % 3 == 0 ? r2 : r3).add(i, c);
+        }
+
+        r2.merge(r3);
+
+        vec3f tcube = cube;
+        tcube(10,2,3) = 0.0;
+        vec2d m = partial_mean(0, tcube);
+        m(2,3) *= nsrc/(nsrc - 1.0);
+
+        check(r1.count(), nsrc);
+        check(max(abs(r1.mean() - m)) < 1e-6, true);
+        check(max(abs(r2.mean() - r1.mean())) < 1e-12, true);
+        check(max(abs(r2.variance() - r1.variance())) < 1e-12, true);
+        check(max(abs(r1.variance() - 1.0)) < 0.15, true);
+
+        // The bootstrap does not depend on the order of the cutouts
+        vec3d bs = r1.bootstrap();
+        check(bs.dims, (std::array<uint_t,3>{{20, 2*hsize+1, 2*hsize+1}}));
+        check(max(abs(r2.bootstrap() - bs)) < 1e-12, true);
+        check(abs(mean(partial_stddev(0, bs)) - sqrt(2.0/nsrc)) < 0.01, true);
+    }
+
+    {
+        // Weighted mean
+        qstack_mean_reducer r(hsize);
+        for (uint_t i : range(nsrc)) {
+            r.add(i, cube(i,_,_).concretise(), wcube(i,_,_).concretise());
+        }
+
+        vec3f tcube = cube;
+        tcube(10,2,3) = 0.0;
+        vec3f twcube = wcube;
+        twcube(10,2,3) = 0.0;
+        check(max(abs(r.mean() - qstack_mean(tcube, twcube))) < 1e-6, true);
+    }
+
+    {
+        // Approximate median
+        qstack_median_reducer r(hsize);
+        for (uint_t i : range(nsrc)) {
+            r.add(i, cube(i,_,_).concretise());
+        }
+
+        vec3f tcube = cube;
+        tcube(10,2,3) = 0.0;
+        check(r.count(), nsrc);
+        check(max(abs(r.median() - qstack_median(tcube))) < 0.05, true);
+    }
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
@@ -0,0 +1,199 @@
+#include <vif.hpp>
+#include <vif/astro/qxmatch.hpp>
+#include <vif/test/unit_test.hpp>
+
+using namespace vif;
+using namespace vif::astro;
+
+int vif_main(int argc, char* argv[]) {
+    auto seed = make_seed(42);
+
+    for (uint_t t : range(3)) {
+        vec1d ra1, dec1, ra2, dec2;
+        if (t == 0) {
+            // All sky
+            ra1 = 360.0*randomu(seed, 2000);
+            dec1 = asin(2.0*randomu(seed, 2000) - 1.0)*180.0/dpi;
+            ra2 = 360.0*randomu(seed, 3000);
+            dec2 = asin(2.0*randomu(seed, 3000) - 1.0)*180.0/dpi;
+        } else if (t == 1) {
+            // Around the north pole
+            ra1 = 360.0*randomu(seed, 2000);
+            dec1 = 89.5 + 0.5*randomu(seed, 2000);
+            ra2 = 360.0*randomu(seed, 3000);
+            dec2 = 89.5 + 0.5*randomu(seed, 3000);
+        } else {
+            // Field crossing RA=0, with some duplicate positions
+            ra1 = 2.0*(randomu(seed, 2000) - 0.5);
+            dec1 = 0.5*randomu(seed, 2000);
+            ra1 = ra1 + 360.0*(ra1 < 0.0);
+            ra2 = 2.0*(randomu(seed, 3000) - 0.5);
+            dec2 = 0.5*randomu(seed, 3000);
+            ra2 = ra2 + 360.0*(ra2 < 0.0);
+            ra2[_-99] = ra1[1000-_-1099];
+            dec2[_-99] = dec1[1000-_-1099];
+        }
+
+        for (uint_t nthread : {1, 3}) {
+            qxmatch_params p;
+            p.nth = 3;
+            p.thread = nthread;
+            p.brute_force = true;
+            auto rb = qxmatch(ra1, dec1, ra2, dec2, p);
+            auto sb = qxmatch(ra1, dec1, p);
+
+            p.brute_force = false;
+            auto rs = qxmatch(ra1, dec1, ra2, dec2, p);
+            auto ss = qxmatch(ra1, dec1, p);
+
+            check(count(abs(rs.d - rb.d) > 1e-6), 0u);
+            check(count(abs(rs.rd - rb.rd) > 1e-6), 0u);
+            check(count(abs(ss.d - sb.d) > 1e-6), 0u);
+            check(count(ss.id(0,_) == indgen<uint_t>(ra1.size())), 0u);
+        }
+    }
+
+    {
+        // Direct use of the index
+        vec1d ra = {0.0, 0.0, 90.0, 180.0, 359.9999};
+        vec1d dec = {90.0, -90.0, 0.0, 0.0, 0.0};
+        sky_index idx(ra, dec);
+        check(idx.size(), 5u);
+
+        vec1u id;
+        vec1d d;
+        idx.nearest(0.0001, 0.0, 2, id, d);
+        check(id, (vec1u{4, 2}));
+        check(abs(d[0] - 0.72) < 1e-4, true);
+
+        idx.nearest(123.0, 89.999, 1, id, d);
+        check(id, (vec1u{0}));
+    }
+
+    {
+        // Saved index, radius queries
+        vec1d ra1 = 360.0*randomu(seed, 2000);
+        vec1d dec1 = asin(2.0*randomu(seed, 2000) - 1.0)*180.0/dpi;
+        vec1d ra2 = 360.0*randomu(seed, 5000);
+        vec1d dec2 = asin(2.0*randomu(seed, 5000) - 1.0)*180.0/dpi;
+
+        std::string filename = "sky_index_test.idx";
+        sky_index(ra2, dec2).save(filename);
+        sky_index idx(filename);
+        check(idx.mapped(), true);
+        check(idx.size(), ra2.size());
+
+        qxmatch_params p;
+        p.nth = 2;
+        auto rb = qxmatch(ra1, dec1, ra2, dec2, p);
+        auto ri = qxmatch(ra1, dec1, idx, p);
+        check(ri.id, rb.id);
+        check(count(abs(ri.d - rb.d) > 1e-6), 0u);
+        check(ri.rid, rb.rid);
+
+        double radius = 3600.0;
+        uint_t nbad = 0;
+        for (uint_t i : range(100)) {
+            vec1u id;
+            vec1d d;
+            idx.within(ra1[i], dec1[i], radius, id, d);
+
+            vec1d dd = angdist(ra2, dec2, ra1[i], dec1[i]);
+            vec1u idb = where(dd <= radius);
+            idb = idb[sort(dd[idb])];
+            if (id.size() != idb.size() || count(id != idb) != 0 ||
+                count(abs(d - dd[idb]) > 1e-6) != 0) ++nbad;
+        }
+
+        check(nbad, 0u);
+
+        double d;
+        check(idx.nearest(ra1[0], dec1[0], d), rb.id(0,0));
+        check(abs(d - rb.d(0,0)) < 1e-6, true);
+
+        // Moving keeps the mapping, and empties the moved-from index
+        sky_index moved = std::move(idx);
+        check(moved.mapped(), true);
+        check(moved.nearest(ra1[0], dec1[0], d), rb.id(0,0));
+        check(idx.mapped(), false);
+        check(idx.size(), 0u);
+
+        file::remove(filename);
+    }
+
+    {
+        // Radius cross-match, in one go or in chunks
+        vec1d ra1 = 2.0*(randomu(seed, 3000) - 0.5);
+        vec1d dec1 = 89.0 + randomu(seed, 3000);
+        ra1 = ra1 + 360.0*(ra1 < 0.0);
+        vec1d ra2 = 360.0*randomu(seed, 5000);
+        vec1d dec2 = 89.0 + randomu(seed, 5000);
+        double radius = 60.0;
+
+        qxmatch_params p;
+        p.thread = 2;
+        auto r = qxmatch_radius(ra1, dec1, ra2, dec2, radius, p);
+        check(r.start.size(), ra1.size()+1);
+        check(r.start[0], 0u);
+        check(r.start.back(), r.id.size());
+        check(r.d.size(), r.id.size());
+
+        uint_t nbad = 0;
+        for (uint_t i : range(ra1)) {
+            vec1d dd = angdist(ra2, dec2, ra1[i], dec1[i]);
+            vec1u idb = where(dd <= radius);
+            idb = idb[sort(dd[idb])];
+            vec1u ids = r.start[i] + indgen<uint_t>(r.count(i));
+            if (idb.size() != ids.size() || count(r.id[ids] != idb) != 0 ||
+                count(abs(r.d[ids] - dd[idb]) > 1e-6) != 0) ++nbad;
+        }
+
+        check(nbad, 0u);
+
+        // Self match
+        auto rs = qxmatch_radius(ra1, dec1, radius, p);
+        nbad = 0;
+        for (uint_t i : range(ra1)) {
+            vec1d dd = angdist(ra1, dec1, ra1[i], dec1[i]);
+            vec1u idb = where(dd <= radius);
+            idb = idb[where(idb != i)];
+            vec1u ids = rs.start[i] + indgen<uint_t>(rs.count(i));
+            if (idb.size() != ids.size() || count(rs.d[ids] > radius) != 0) ++nbad;
+        }
+
+        check(nbad, 0u);
+
+        // Streaming, should give the same pairs
+        sky_index idx(ra2, dec2);
+        vec1u id1, id2;
+        vec1d d;
+        uint_t nmatch = qxmatch_radius_stream(ra1.size(),
+            [&](uint_t i0, uint_t i1, vec1d& tra, vec1d& tdec) {
+                tra = ra1[i0 + indgen<uint_t>(i1 - i0)];
+                tdec = dec1[i0 + indgen<uint_t>(i1 - i0)];
+            }, idx, radius, [&](uint_t i0, const qxmatch_radius_res& tr) {
+                for (uint_t i : range(tr.start.size()-1)) {
+                    append(id1, replicate(i0 + i, tr.count(i)));
+                }
+
+                append(id2, tr.id);
+                append(d, tr.d);
+            }, p, 700);
+
+        check(nmatch, r.id.size());
+        check(id2, r.id);
+        check(d, r.d);
+
+        vec1u ref1;
+        for (uint_t i : range(ra1)) {
+            append(ref1, replicate(i, r.count(i)));
+        }
+
+        check(id1, ref1);
+    }
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
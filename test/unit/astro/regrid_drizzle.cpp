@@ -0,0 +1,52 @@
+#include <vif.hpp>
+#include <vif/test/unit_test.hpp>
+
+using namespace vif;
+using namespace vif::astro;
+
+int vif_main(int argc, char* argv[]) {
+    auto seed = make_seed(42);
+
+    // Rotation, scaling and some distortion
+    auto func = [](const vec1d& x, const vec1d& y, vec1d& tx, vec1d& ty) {
+        tx = 10.0 + 0.8*x - 0.3*y + 2e-4*x*y;
+        ty = -5.0 + 0.3*x + 0.8*y + 3e-4*y*y;
+    };
+
+    pixel_transform tr(func, {300, 400}, {350, 420});
+
+    vec2d img = randomn(seed, 300, 400);
+    vec3d cube = randomn(seed, 3, 300, 400);
+    cube(1,_,_) = img;
+
+    for (double pixfrac : {1.0, 0.6}) {
+        regrid_drizzle_params p;
+        p.pixfrac = pixfrac;
+        vec2d wei1, wei2, wei3;
+        vec2d res1 = regrid_drizzle(img, tr, wei1, p);
+
+        // Multithreaded version gives the same result regardless of the number of threads
+        p.thread = 3;
+        p.tile_size = 37;
+        vec2d res2 = regrid_drizzle(img, tr, wei2, p);
+        p.thread = 5;
+        vec2d res3 = regrid_drizzle(img, tr, wei3, p);
+
+        vec1u idf = where(is_finite(res1));
+        check(idf.size() > 50000, true);
+        check(where(is_finite(res2)), idf);
+        check(max(abs(res2[idf] - res1[idf])) < 1e-10, true);
+        check(max(abs(wei2 - wei1)) < 1e-10, true);
+        check(count(res3[idf] != res2[idf]), 0);
+        check(count(wei3 != wei2), 0);
+
+        // Same with multiple planes
+        vec3d cres = regrid_drizzle(cube, tr, p);
+        check(count(cres(1,_,_)[idf] != res2[idf]), 0);
+    }
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
@@ -0,0 +1,117 @@
+#include <vif.hpp>
+#include <vif/test/unit_test.hpp>
+
+using namespace vif;
+using namespace vif::astro;
+
+int vif_main(int argc, char* argv[]) {
+    auto seed = make_seed(42);
+
+    // Random discs and isolated pixels on a mask, with a few segments spanning many rows
+    vec2d img = randomu(seed, 301, 257);
+    vec2b mask = img < 0.05;
+    vec2d ix = generate_img(mask.dims, [](double, double x) { return x; });
+    vec2d iy = generate_img(mask.dims, [](double y, double) { return y; });
+    for (uint_t i = 0; i < 80; ++i) {
+        double x0 = 257*randomu(seed), y0 = 301*randomu(seed), r = 2.0 + 8.0*randomu(seed);
+        mask = mask || (sqr(ix - x0) + sqr(iy - y0) < r*r);
+    }
+
+    mask(_,100) = true;
+    mask(_,0) = false;
+    mask(150,_) = true;
+    mask(0,_) = false;
+
+    // Reference labelling with a simple flood fill
+    vec2u ref(mask.dims);
+    vec1u rarea, rorigin;
+    vec1d rpx, rpy;
+    {
+        uint_t id = 1;
+        std::vector<uint_t> oy, ox;
+        for (uint_t y : range(mask.dims[0]))
+        for (uint_t x : range(mask.dims[1])) {
+            if (!mask(y,x) || ref(y,x) != 0) continue;
+
+            rorigin.push_back(flat_id(mask, y, x));
+            rarea.push_back(0u);
+            rpx.push_back(0.0);
+            rpy.push_back(0.0);
+
+            ref(y,x) = id;
+            oy = {y}; ox = {x};
+            while (!ox.empty()) {
+                uint_t ty = oy.back(); oy.pop_back();
+                uint_t tx = ox.back(); ox.pop_back();
+                rarea.back() += 1u;
+                rpx.back() += tx;
+                rpy.back() += ty;
+
+                auto add = [&](uint_t tty, uint_t ttx) {
+                    if (mask(tty,ttx) && ref(tty,ttx) == 0) {
+                        ref(tty,ttx) = id;
+                        oy.push_back(tty); ox.push_back(ttx);
+                    }
+                };
+
+                if (ty != 0)              add(ty-1,tx);
+                if (ty != mask.dims[0]-1) add(ty+1,tx);
+                if (tx != 0)              add(ty,tx-1);
+                if (tx != mask.dims[1]-1) add(ty,tx+1);
+            }
+
+            ++id;
+        }
+
+        rpx /= rarea;
+        rpy /= rarea;
+    }
+
+    check(rarea.size() > 20, true);
+
+    for (uint_t nthread : {1, 4}) {
+        segment_params p;
+        p.thread = nthread;
+        segment_output out;
+        vec2u seg = segment(mask, out, p);
+        check(seg, ref);
+        check(out.id, indgen(rarea.size()) + 1);
+        check(out.area, rarea);
+        check(out.origin, rorigin);
+        check(max(abs(out.px - rpx)) < 1e-9 && max(abs(out.py - rpy)) < 1e-9, true);
+    }
+
+    // Minimum area, with IDs of erased segments not reused
+    segment_params p;
+    p.min_area = 10;
+    p.first_id = 5;
+    p.thread = 3;
+    segment_output out;
+    vec2u seg = segment(img*mask, out, p);
+    vec1u keep = where(rarea >= 10u);
+    check(out.id, keep + 5);
+    check(out.area, rarea[keep]);
+    check(count(seg != 0u), total(rarea[keep]));
+
+    // Streaming mode
+    segment_stream stream(mask.dims[1]);
+    vec2u lab(mask.dims);
+    for (uint_t y : range(mask.dims[0])) {
+        lab(y,_) = stream.push_row(mask(y,_).concretise());
+    }
+
+    segment_output sout;
+    stream.finish(sout, p);
+    for (uint_t y : range(mask.dims[0])) {
+        lab(y,_) = stream.relabel(lab(y,_).concretise());
+    }
+
+    check(lab, seg);
+    check(sout.area, out.area);
+    check(sout.origin, out.origin);
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
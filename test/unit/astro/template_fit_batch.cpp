@@ -0,0 +1,192 @@
+#include <vif.hpp>
+#include <vif/astro/template_fit.hpp>
+#include <vif/test/unit_test.hpp>
+
+using namespace vif;
+using namespace vif::astro;
+
+int vif_main(int argc, char* argv[]) {
+    auto seed = make_seed(42);
+
+    // Library of smooth SEDs, and a set of top-hat filters
+    struct {
+        vec2d lam, sed;
+    } lib;
+
+    const uint_t nsed = 40;
+    vec1d lam = rgen_log(0.1, 100.0, 500);
+    lib.lam.resize(nsed, lam.size());
+    lib.sed.resize(nsed, lam.size());
+    for (uint_t t : range(nsed)) {
+        double slope = -2.0 + 3.0*t/(nsed - 1.0);
+        lib.lam(t,_) = lam;
+        lib.sed(t,_) = pow(lam, slope)*exp(-sqr(log(lam/(0.3 + 0.1*t)))/2.0) + 1e-3;
+    }
+
+    vec<1,filter_t> filters(8);
+    for (uint_t f : range(filters)) {
+        double l0 = 0.5*pow(1.5, f);
+        filters[f].lam = rgen(l0, 1.3*l0, 30);
+        filters[f].res = replicate(1.0/(0.3*l0), 30);
+        filters[f].rlam = 1.15*l0;
+    }
+
+    vec1d z = {0.5, 1.0, 1.5, 2.0};
+    vec1d d = {2900.0, 6700.0, 11000.0, 15800.0};
+
+    template_flux_cube cube(lib, z, d, filters, 3);
+    check(cube.nz(), 4u);
+    check(cube.nsed(), nsed);
+    check(cube.nfilter(), filters.size());
+    check(max(abs(cube.model(2,7) - template_observed(lib, z[2], d[2], filters)(7,_))) <
+        1e-6*max(cube.model(2,7)), true);
+
+    // Simulated catalog
+    const uint_t nobj = 50;
+    vec2d flux(nobj, filters.size()), err(nobj, filters.size());
+    for (uint_t i : range(nobj)) {
+        uint_t iz = i % z.size(), t = (7*i) % nsed;
+        vec1d m = template_observed(lib, z[iz], d[iz], filters)(t,_);
+        err(i,_) = 0.05*max(m);
+        flux(i,_) = (1.0 + 0.2*(i % 3))*m + err(i,_)*randomn(seed, filters.size());
+    }
+
+    flux(3,2) = dnan;
+
+    for (bool renorm : {false, true}) {
+        // Same result as template_fit() at each redshift
+        template_fit_batch_params p;
+        p.renorm = renorm;
+        p.chi2_grid = true;
+        auto res = template_fit_batch(cube, seed, flux, err, p);
+
+        uint_t nbad = 0;
+        for (uint_t i : range(nobj)) {
+            vec1u idf = where(is_finite(flux(i,_)));
+            vec<1,filter_t> tfilters = filters[idf];
+            template_fit_params tp;
+            tp.renorm = renorm;
+            tp.nsim = 1;
+
+            for (uint_t iz : range(z)) {
+                auto tres = template_fit(lib, seed, z[iz], d[iz], vec1d{flux(i,idf)},
+                    vec1d{err(i,idf)}, tfilters, tp);
+
+                if (abs(res.chi2_z(i,iz) - tres.chi2[tres.bfit]) > 1e-4*(1.0 + tres.chi2[tres.bfit])) {
+                    ++nbad;
+                }
+
+                if (iz == res.bfit_z[i] && (tres.bfit != res.bfit[i] ||
+                    abs(tres.amp[tres.bfit] - res.amp[i]) > 1e-4*abs(res.amp[i]))) {
+                    ++nbad;
+                }
+            }
+        }
+
+        check(nbad, 0u);
+        check(max(abs(res.chi2 - partial_min(1, res.chi2_z))), 0.0);
+    }
+
+    {
+        // Error realizations, independent of the number of threads
+        template_fit_batch_params p;
+        p.renorm = true;
+        p.nsim = 20;
+        auto seed1 = make_seed(1), seed2 = make_seed(1);
+        auto res1 = template_fit_batch(cube, seed1, flux, err, p);
+        p.thread = 3;
+        auto res2 = template_fit_batch(cube, seed2, flux, err, p);
+        check(res1.z_sim, res2.z_sim);
+        check(res1.sed_sim, res2.sed_sim);
+        check(res1.amp_sim, res2.amp_sim);
+        check(count(res1.z_sim >= cube.nz() || res1.sed_sim >= nsed), 0u);
+    }
+
+    {
+        // Upper limits, compared to the mpfit solution
+        vec2d uerr = err;
+        vec2d uflux = flux;
+        for (uint_t i : range(nobj)) {
+            uflux(i,0) = 3.0*err(i,0);
+            uerr(i,0) = -err(i,0);
+        }
+
+        template_fit_batch_params p;
+        p.renorm = true;
+        p.ulim = true;
+        auto res = template_fit_batch(cube, seed, uflux, uerr, p);
+
+        uint_t nbad = 0;
+        for (uint_t i : range(nobj)) {
+            vec1u idf = where(is_finite(uflux(i,_)));
+            vec<1,filter_t> tfilters = filters[idf];
+            template_fit_params tp;
+            tp.renorm = true;
+            tp.ulim = true;
+            tp.nsim = 1;
+
+            uint_t iz = res.bfit_z[i];
+            auto tres = template_fit(lib, seed, z[iz], d[iz], vec1d{uflux(i,idf)},
+                vec1d{uerr(i,idf)}, tfilters, tp);
+
+            if (tres.chi2[tres.bfit] < res.chi2[i] - 1e-4*(1.0 + res.chi2[i]) ||
+                abs(tres.amp[res.bfit[i]] - res.amp[i]) > 1e-3*abs(res.amp[i])) {
+                ++nbad;
+            }
+        }
+
+        check(nbad, 0u);
+    }
+
+    {
+        // High signal to noise: the chi2 of an exact match is not lost to cancellation
+        vec2d hflux(2, filters.size()), herr(2, filters.size());
+        hflux(0,_) = 3.0*cube.model(1,5);
+        hflux(1,_) = cube.model(2,11);
+        herr = 1e-8*hflux;
+
+        for (bool renorm : {false, true}) {
+            template_fit_batch_params p;
+            p.renorm = renorm;
+            auto res = template_fit_batch(cube, seed, hflux, herr, p);
+            check(res.bfit_z[1], 2u);
+            check(res.bfit[1], 11u);
+            check(res.chi2[1] < 1e-6, true);
+            if (renorm) {
+                check(res.bfit_z[0], 1u);
+                check(res.bfit[0], 5u);
+                check(res.chi2[0] < 1e-6, true);
+            }
+        }
+    }
+
+    {
+        // Save and open again
+        cube.save("template_fit_batch.cube");
+        template_flux_cube mcube("template_fit_batch.cube");
+        check(mcube.mapped(), true);
+        check(mcube.nz(), cube.nz());
+        check(mcube.z(1), z[1]);
+
+        template_fit_batch_params p;
+        p.renorm = true;
+        auto seed1 = make_seed(1), seed2 = make_seed(1);
+        auto res1 = template_fit_batch(cube, seed1, flux, err, p);
+        auto res2 = template_fit_batch(mcube, seed2, flux, err, p);
+        check(res1.bfit, res2.bfit);
+        check(res1.chi2, res2.chi2);
+
+        template_flux_cube moved = std::move(mcube);
+        check(moved.mapped(), true);
+        check(moved.z(1), z[1]);
+        check(moved.model(2,7), cube.model(2,7));
+        check(mcube.mapped(), false);
+        check(mcube.nz(), 0u);
+        file::remove("template_fit_batch.cube");
+    }
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
@@ -0,0 +1,107 @@
+#include <vif.hpp>
+#include <vif/astro/wcs.hpp>
+#include <vif/test/unit_test.hpp>
+
+using namespace vif;
+using namespace vif::astro;
+
+int vif_main(int argc, char* argv[]) {
+    auto seed = make_seed(42);
+
+    make_wcs_header_params p;
+    p.pixel_scale = 0.06;
+    p.sky_ref_ra = 53.1;
+    p.sky_ref_dec = -27.8;
+    p.pixel_ref_x = 500.5;
+    p.pixel_ref_y = 400.5;
+    p.dims_x = 1000;
+    p.dims_y = 800;
+
+    fits::header tan;
+    make_wcs_header(p, tan);
+
+    fits::header sin = tan;
+    fits::setkey(sin, "CTYPE1", "'RA---SIN'");
+    fits::setkey(sin, "CTYPE2", "'DEC--SIN'");
+    fits::setkey(sin, "CROTA2", 25.0);
+
+    fits::header car = tan;
+    fits::setkey(car, "CTYPE1", "'RA---CAR'");
+    fits::setkey(car, "CTYPE2", "'DEC--CAR'");
+    fits::setkey(car, "CDELT1", -0.01);
+    fits::setkey(car, "CDELT2", 0.01);
+
+    vec1d x = randomu(seed, 1000)*1100 - 50;
+    vec1d y = randomu(seed, 1000)*900 - 50;
+
+    for (auto& hdr : {tan, sin, car}) {
+        // Native implementation gives the same result as WCSlib
+        astro::wcs w(hdr);
+        astro::wcs wl(hdr);
+        wl.native = impl::wcs_impl::native_projection{};
+        check(w.native.valid(), true);
+        check(wl.native.valid(), false);
+
+        vec1d ra, dec, ral, decl;
+        xy2ad(w, x, y, ra, dec);
+        xy2ad(wl, x, y, ral, decl);
+        check(max(abs(ra - ral)) < 1e-10, true);
+        check(max(abs(dec - decl)) < 1e-10, true);
+
+        vec1d tx, ty, txl, tyl;
+        ad2xy(w, ra, dec, tx, ty);
+        ad2xy(wl, ra, dec, txl, tyl);
+        check(max(abs(tx - x)) < 1e-8, true);
+        check(max(abs(ty - y)) < 1e-8, true);
+        check(max(abs(tx - txl)) < 1e-8, true);
+        check(max(abs(ty - tyl)) < 1e-8, true);
+
+        // Scalar version
+        double sra, sdec, sx, sy;
+        xy2ad(w, x[10], y[10], sra, sdec);
+        ad2xy(w, sra, sdec, sx, sy);
+        check(sra == ra[10] && sdec == dec[10], true);
+        check(sx == tx[10] && sy == ty[10], true);
+    }
+
+    {
+        // SIP distortions
+        fits::header sip = tan;
+        fits::setkey(sip, "CTYPE1", "'RA---TAN-SIP'");
+        fits::setkey(sip, "CTYPE2", "'DEC--TAN-SIP'");
+        fits::setkey(sip, "A_ORDER", 2);
+        fits::setkey(sip, "A_2_0", 2e-5);
+        fits::setkey(sip, "B_ORDER", 2);
+        fits::setkey(sip, "B_1_1", -1e-5);
+
+        astro::wcs w(sip);
+        astro::wcs wt(tan);
+        check(w.native.valid(), true);
+
+        vec1d ra, dec, rat, dect;
+        xy2ad(w, x, y, ra, dec);
+        vec1d u = x - p.pixel_ref_x, v = y - p.pixel_ref_y;
+        xy2ad(wt, x + 2e-5*u*u, y - 1e-5*u*v, rat, dect);
+        check(max(abs(ra - rat)) < 1e-10, true);
+        check(max(abs(dec - dect)) < 1e-10, true);
+
+        vec1d tx, ty;
+        ad2xy(w, ra, dec, tx, ty);
+        check(max(abs(tx - x)) < 1e-8, true);
+        check(max(abs(ty - y)) < 1e-8, true);
+
+        // Distortions are kept when the WCS is updated
+        w.flag_dirty();
+        w.update();
+        check(w.native.valid(), true);
+        vec1d ra2, dec2;
+        xy2ad(w, x, y, ra2, dec2);
+        check(max(abs(ra2 - ra)), 0.0);
+        check(max(abs(dec2 - dec)), 0.0);
+    }
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
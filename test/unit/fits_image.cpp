@@ -0,0 +1,92 @@
+#include <vif.hpp>
+#include <vif/test/unit_test.hpp>
+
+using namespace vif;
+
+int vif_main(int argc, char* argv[]) {
+    auto seed = make_seed(42);
+
+    {
+        // Floating point image, read with and without memory map
+        vec2f img = randomn(seed, 53, 37);
+        img[randomi(seed, 0, img.size()-1, 20)] = fnan;
+        fits::write("fits_image_float.fits", img);
+
+        fits::input_image iimg("fits_image_float.fits");
+        fits::mapped_image mimg("fits_image_float.fits");
+        check(mimg.is_mapped(), true);
+        check(mimg.image_dims(), iimg.image_dims());
+
+        vec2f r1, r2;
+        iimg.read(r1);
+        mimg.read(r2);
+        check(r2.dims, img.dims);
+        check(count(r1 == r2 || (!is_finite(r1) && !is_finite(r2))), img.size());
+
+        vec2f s1, s2;
+        iimg.read_subset(s1, 3-_-20, 5-_-30);
+        mimg.read_subset(s2, 3-_-20, 5-_-30);
+        check(s2.dims, s1.dims);
+        check(count(s1 == s2 || (!is_finite(s1) && !is_finite(s2))), s1.size());
+
+        iimg.read_subset(s1, 7, _);
+        mimg.read_subset(s2, 7, _);
+        check(count(s1 == s2 || (!is_finite(s1) && !is_finite(s2))), s1.size());
+
+        check(mimg.read_pixel<float>({10, 4}), img(10, 4));
+        check(mimg.mapped_data<float>() != nullptr, impl::fits_impl::native_big_endian);
+
+        // Narrowing conversion must be explicitly allowed
+        fits::write("fits_image_double.fits", vec2d{img});
+        fits::mapped_image dimg("fits_image_double.fits");
+        dimg.allow_narrow();
+        dimg.read(r2);
+        check(count(r2 == img || (!is_finite(r2) && !is_finite(img))), img.size());
+    }
+
+    {
+        // Integer cube
+        vec3i cube = randomi(seed, -1000000, 1000000, 5, 7, 11);
+        fits::write("fits_image_int.fits", cube);
+
+        fits::mapped_image mimg("fits_image_int.fits");
+        vec3i r;
+        mimg.read(r);
+        check(r, cube);
+
+        vec3d s;
+        mimg.read_subset(s, 1-_-3, 2, 4-_-9);
+        check(s, vec3d{cube(1-_-3, 2-_-2, 4-_-9)});
+
+        // Through the convenience functions
+        vec3i rr = fits::read<3,int_t>("fits_image_int.fits");
+        check(rr, cube);
+    }
+
+    {
+        // Scaled integer image: conversion to an integer type rounds to the nearest value
+        vec<2,short> raw = randomi(seed, -1000, 1000, 13, 17);
+        {
+            fits::output_image oimg("fits_image_scaled.fits");
+            oimg.write(raw);
+            oimg.write_keyword("BSCALE", 0.3);
+            oimg.write_keyword("BZERO", 0.2);
+        }
+
+        vec2d expected = raw*0.3 + 0.2;
+
+        fits::mapped_image mimg("fits_image_scaled.fits");
+        vec2d rd;
+        mimg.read(rd);
+        check(max(abs(rd - expected)) < 1e-6, true);
+
+        vec2i ri;
+        mimg.read(ri);
+        check(ri, vec2i{round(expected)});
+    }
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
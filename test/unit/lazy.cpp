@@ -0,0 +1,49 @@
+#include <vif.hpp>
+#include <vif/test/unit_test.hpp>
+
+using namespace vif;
+
+int vif_main(int argc, char* argv[]) {
+    vec1d x1 = {1.0, 2.0, 3.0, 4.0};
+    vec1d y1 = {0.5, -1.0, 2.0, 0.0};
+    vec1d x2 = {4.0, 3.0, 2.0, 1.0};
+    vec1d y2 = {1.0, 1.0, -2.0, 3.0};
+    vec1d w  = {0.5, 1.0, 2.0, 4.0};
+
+    // Same result as eager evaluation
+    vec1d d = sqrt(sqr(lazy(x1) - x2) + sqr(lazy(y1) - y2))*w;
+    check(d, sqrt(sqr(x1 - x2) + sqr(y1 - y2))*w);
+
+    // Scalars on both sides, unary minus, functions with extra arguments
+    vec1d r = 2.0*pow(lazy(x1), 2) - (-lazy(y1))/4.0 + atan2(1.0, lazy(x2));
+    check(r, 2.0*pow(x1, 2) + y1/4.0 + atan2(1.0, x2));
+
+    // Comparisons
+    vec1b m = lazy(x1) > 1.5;
+    check(m, x1 > 1.5);
+
+    // Assignment to a vector used in the expression
+    vec1d t = x1;
+    t = lazy(t)*2.0 + t;
+    check(t, x1*3.0);
+    t += lazy(x1)*x1;
+    check(t, x1*3.0 + x1*x1);
+
+    // Assignment to and from views
+    vec2d img = {{1.0, 2.0}, {3.0, 4.0}, {5.0, 6.0}};
+    img(_,0) = lazy(img(_,1))*10.0;
+    check(img, vec2d({{20.0, 2.0}, {40.0, 4.0}, {60.0, 6.0}}));
+    img(_,1) -= lazy(img(_,0));
+    check(img, vec2d({{20.0, -18.0}, {40.0, -36.0}, {60.0, -54.0}}));
+    img = lazy(transpose(img)) + 1.0;
+    check(img, vec2d({{21.0, 41.0, 61.0}, {-17.0, -35.0, -53.0}}));
+
+    // Explicit evaluation
+    auto e = lazy(x1) + 1.0;
+    check(mean(e.concretise()), mean(x1 + 1.0));
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
@@ -1,7 +1,8 @@
 #include <vif.hpp>
-#include <vif/unit_test.hpp>
+#include <vif/test/unit_test.hpp>
 
 using namespace vif;
+using namespace vif::astro;
 
 int vif_main(int argc, char* argv[]) {
     vec2d v = gaussian_profile({{41,41}}, 4.0) + 0.1*gaussian_profile({{41,41}}, 10.0);
@@ -12,7 +13,64 @@ int vif_main(int argc, char* argv[]) {
         check(v[i], iv[i]);
     }
 
+    // Plans are cached, and can be re-created with a more thorough planner
+    vec2cd cv2 = fft(v);
+    for (uint_t i : range(cv)) {
+        check(cv2[i] == cv[i], true);
+    }
+
+    fft_set_planner(fft_planner::measure);
+    cv2 = fft(v);
+    iv = ifft(cv2)/v.size();
+    for (uint_t i : range(v)) {
+        check(v[i], iv[i]);
+    }
+
+    fft_set_planner(fft_planner::estimate);
+
     auto seed = make_seed(42);
+
+    // 1D and 3D transforms
+    vec1d x = randomn(seed, 9);
+    vec1cd cx = fft(x);
+    for (uint_t k : range(x.size()/2+1)) {
+        complex<double> s = 0;
+        for (uint_t j : range(x)) {
+            s += x[j]*std::polar(1.0, -2*dpi*j*k/x.size());
+        }
+
+        check(abs(cx[k] - s) < 1e-10, true);
+    }
+
+    vec3d cube = randomn(seed, 6, 4, 5);
+    vec3d icube = ifft(fft(cube))/cube.size();
+    for (uint_t i : range(cube)) {
+        check(icube[i], cube[i]);
+    }
+
+    // Batched 1D transforms along one axis
+    vec3cd ccube = fft_many(cube, 0);
+    for (uint_t y : range(cube.dims[1]))
+    for (uint_t z : range(cube.dims[2])) {
+        vec1cd s = fft(vec1d(cube(_,y,z)));
+        for (uint_t k : range(cube.dims[0]/2+1)) {
+            check(abs(ccube(k,y,z) - s[k]) < 1e-10, true);
+        }
+    }
+
+    icube = ifft_many(ccube, 0)/cube.dims[0];
+    for (uint_t i : range(cube)) {
+        check(icube[i], cube[i]);
+    }
+
+    // In place transforms
+    vec3cd ccube2 = cube;
+    inplace_fft_c2c_many(ccube2, 2);
+    inplace_ifft_c2c_many(ccube2, 2);
+    for (uint_t i : range(cube)) {
+        check(ccube2[i].real()/cube.dims[2], cube[i]);
+    }
+
     vec2d img = randomn(seed, 1000, 1000);
     vec2d psf = v;
 
@@ -31,5 +89,8 @@ int vif_main(int argc, char* argv[]) {
     print("fast version: ", fast);
     print("slow version: ", slow);
 
-    return 0;
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
 }
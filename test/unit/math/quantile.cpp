@@ -0,0 +1,81 @@
+#include <vif.hpp>
+#include <vif/test/unit_test.hpp>
+
+using namespace vif;
+
+int vif_main(int argc, char* argv[]) {
+    auto seed = make_seed(42);
+
+    {
+        // Exact percentiles, all at once
+        vec1d v = randomn(seed, 10001);
+        v[randomi(seed, 0, v.size()-1, 100)] = dnan;
+
+        vec1d p = percentiles(v, 0.5, 0.1, 0.9, 0.5, 0.0, 1.0);
+        check(p[0], median(v));
+        check(p[1], percentile(v, 0.1));
+        check(p[2], percentile(v, 0.9));
+        check(p[3], p[0]);
+        check(p[4], min(v));
+        check(p[5], dnan);
+
+        // Same values with a reusable workspace, which does not modify the input
+        vec1d ov = v;
+        quantile_workspace<double> w;
+        vec1d pw = w.percentiles(v, vec1d{0.5, 0.1, 0.9, 0.5, 0.0, 1.0});
+        check(count(v == ov), v.size() - 100);
+        check(pw[_-4], p[_-4]);
+        check(pw[5], dnan);
+        check(w.median(v), median(v));
+        check(w.percentile(v, 0.25), percentile(v, 0.25));
+        check(w.mad(v), median(abs(v - median(v))));
+        check(mad(v), median(abs(v - median(v))));
+
+        vec1d nv = replicate(dnan, 10);
+        check(w.median(nv), dnan);
+        check(mad(nv), dnan);
+
+        vec1i iv = {5, 1, 4, 2, 3};
+        check(mad(iv), 1);
+        check(percentiles(iv, 0.0, 0.5, 0.99), (vec1i{1, 3, 5}));
+    }
+
+    {
+        // Approximate percentiles, with data arriving in chunks
+        vec1d v = randomn(seed, 200000);
+        quantile_sketch s1, s2;
+        for (uint_t i : range(10)) {
+            vec1d chunk = v[i*10000 + indgen<uint_t>(10000)];
+            s1.add(chunk);
+        }
+
+        s2.add(v[100000-_]);
+        s1.merge(s2);
+        s1.add(dnan);
+
+        check(s1.count(), v.size());
+        check(s1.min(), min(v));
+        check(s1.max(), max(v));
+        check(s1.size() < 1000, true);
+
+        vec1d p = {0.001, 0.01, 0.1, 0.25, 0.5, 0.75, 0.9, 0.99, 0.999};
+        vec1d exact = percentiles(v, 0.001, 0.01, 0.1, 0.25, 0.5, 0.75, 0.9, 0.99, 0.999);
+        vec1d approx = s1.quantiles(p);
+        for (uint_t i : range(p)) {
+            // Error on the quantile smaller than 0.1% (absolute)
+            double pa = count(v < approx[i])/double(v.size());
+            check(abs(pa - p[i]) < 1e-3, true);
+            check(abs(approx[i] - exact[i]) < 0.02, true);
+        }
+
+        quantile_sketch s3;
+        check(s3.median(), dnan);
+        s3.add(3.0);
+        check(s3.median(), 3.0);
+    }
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
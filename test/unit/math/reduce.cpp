@@ -0,0 +1,44 @@
+#include <vif.hpp>
+#include <vif/test/unit_test.hpp>
+
+using namespace vif;
+
+int vif_main(int argc, char* argv[]) {
+    auto seed = make_seed(42);
+
+    // Large enough to be split among threads
+    vec3d v = randomn(seed, 40, 30, 50);
+    v[randomi(seed, 0, v.size()-1, 100)] = dnan;
+
+    reduce_params p;
+    p.thread = 4;
+
+    for (uint_t d : range(3)) {
+        // Same result with and without threads
+        check(partial_median(d, v, p), partial_median(d, v));
+        check(partial_percentile(d, v, p, 0.3), partial_percentile(d, v, 0.3));
+        check(partial_max(d, v, p), partial_max(d, v));
+
+        // Slices are given as rvalues, and can be moved from
+        auto r1 = reduce(d, v, [](vec1d&& tv) {
+            vec1d w = std::move(tv);
+            return w.size();
+        }, p);
+        check(count(r1 != v.dims[d]), 0u);
+
+        auto r2 = reduce(d, v, [](vec1d tv) {
+            return max(tv);
+        });
+        check(r2, partial_max(d, v));
+
+        auto r3 = reduce(d, v, [](const vec1d& tv) {
+            return median(tv);
+        }, p);
+        check(r3, partial_median(d, v));
+    }
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
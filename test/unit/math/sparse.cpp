@@ -0,0 +1,80 @@
+#include <vif.hpp>
+#include <vif/test/unit_test.hpp>
+
+using namespace vif;
+
+int vif_main(int argc, char* argv[]) {
+    auto seed = make_seed(42);
+
+    // Normal matrix of overlapping sources scattered on an image, plus a constant background
+    // that is connected to all sources
+    const uint_t nsrc = 600;
+    const uint_t n = nsrc + 1;
+    vec1d x = randomu(seed, nsrc)*500.0;
+    vec1d y = randomu(seed, nsrc)*300.0;
+
+    matrix::sparse_symmetric a(n);
+    for (uint_t i : range(nsrc)) {
+        a.add(i, i, 2.0 + randomu(seed));
+        a.add(i, nsrc, 0.05);
+        for (uint_t j : range(i+1, nsrc)) {
+            double d2 = sqr(x[i] - x[j]) + sqr(y[i] - y[j]);
+            if (d2 < 15.0*15.0) {
+                // Added in two parts to check accumulation
+                a.add(i, j, 0.25*exp(-d2/100.0));
+                a.add(j, i, 0.25*exp(-d2/100.0));
+            }
+        }
+    }
+
+    a.add(nsrc, nsrc, 50.0);
+    a.compress();
+
+    matrix::mat2d da = a.dense();
+    check(da.base, transpose(da.base));
+    check(a(0,nsrc), 0.05);
+    check(a(nsrc,0), 0.05);
+    check(a.nonzeros(), count(da.base != 0.0));
+
+    vec1d b = randomn(seed, n);
+    check(max(abs(a.product(b) - da*b)) < 1e-12, true);
+
+    // Solve and invert, compared to the dense matrix
+    append(x, vec1d{dnan});
+    append(y, vec1d{dnan});
+    vec1u order = matrix::nested_dissection_order(a, x, y);
+    check(order.size(), n);
+    check(order.back(), nsrc);
+    check(order[sort(order)], indgen(n));
+
+    matrix::decompose_sparse_ldl ldl;
+    check(ldl.decompose(a, order), true);
+    check(ldl.lx.size() < n*(n-1)/2, true);
+
+    vec1d s = ldl.solve(b);
+    check(max(abs(a.product(s) - b)) < 1e-10, true);
+
+    matrix::mat2d ia;
+    check(matrix::invert_symmetric(da, ia), true);
+    vec1d di = ldl.invert_diagonal();
+    double err = 0.0;
+    for (uint_t i : range(n)) {
+        err = std::max(err, abs(di[i] - ia(i,i)));
+    }
+
+    check(err < 1e-10, true);
+
+    // Singular matrix
+    matrix::sparse_symmetric na(3);
+    na.add(0, 0, 1.0);
+    na.add(1, 1, 1.0);
+    na.add(0, 1, 1.0);
+    na.add(2, 2, 1.0);
+    na.compress();
+    check(ldl.decompose(na, indgen(3)), false);
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
@@ -0,0 +1,122 @@
+#include <vif.hpp>
+#include <vif/test/unit_test.hpp>
+
+using namespace vif;
+
+int vif_main(int argc, char* argv[]) {
+    const uint_t n = 2000;
+    std::vector<std::atomic<uint_t>> hits(n);
+    auto reset = [&]() {
+        for (auto& h : hits) h = 0;
+    };
+    auto count_bad = [&]() {
+        uint_t nbad = 0;
+        for (auto& h : hits) {
+            if (h != 1) ++nbad;
+        }
+
+        return nbad;
+    };
+
+    thread::task_pool pool(4);
+    check(pool.size(), 4u);
+
+    // Uneven cost per iteration: every index is processed exactly once, and the pool is reused
+    for (uint_t k : range(3)) {
+        reset();
+        pool.execute([&](uint_t i) {
+            if (i % 100 == k) {
+                std::this_thread::sleep_for(std::chrono::microseconds(500));
+            }
+
+            ++hits[i];
+        }, n);
+
+        check(count_bad(), 0u);
+    }
+
+    // Chunks cover the range without overlap, and are not larger than the grain
+    reset();
+    std::atomic<uint_t> nlarge(0);
+    pool.execute_chunks([&](uint_t i0, uint_t i1) {
+        if (i1 - i0 > 7) ++nlarge;
+        for (uint_t i : range(i0, i1)) {
+            ++hits[i];
+        }
+    }, 0, n, 7);
+
+    check(count_bad(), 0u);
+    check(nlarge.load(), 0u);
+
+    // Nested loops from within a task
+    const uint_t nouter = 20, ninner = 100;
+    reset();
+    pool.execute([&](uint_t i) {
+        pool.execute([&](uint_t j) {
+            if (j % 10 == 0) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+
+            ++hits[i*ninner + j];
+        }, ninner);
+    }, nouter);
+
+    check(count_bad(), 0u);
+
+    // Progress callback while waiting
+    reset();
+    std::atomic<uint_t> nwait(0);
+    pool.execute_chunks([&](uint_t i0, uint_t i1) {
+        for (uint_t i : range(i0, i1)) {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+            ++hits[i];
+        }
+    }, 0, n, 0, [&]() { ++nwait; }, 0.001);
+
+    check(count_bad(), 0u);
+    check(nwait > 0, true);
+
+    // Index of the worker threads
+    check(thread::task_pool::worker_index(), npos);
+    std::atomic<uint_t> nbad(0);
+    pool.execute([&](uint_t) {
+        if (thread::task_pool::worker_index() >= pool.size()) ++nbad;
+    }, n);
+
+    check(nbad.load(), 0u);
+
+    // parallel_for, with its own pool or sharing one
+    {
+        thread::parallel_for pf(3);
+        check(pf.size(), 3u);
+        for (uint_t k : range(2)) {
+            reset();
+            pf.execute([&](uint_t i) {
+                if (i % 100 == k) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(500));
+                }
+
+                ++hits[i];
+            }, n);
+            check(count_bad(), 0u);
+        }
+
+        thread::parallel_for pfs(pool), pfi(pool);
+        reset();
+        pfs.execute([&](uint_t i) {
+            pfi.execute([&](uint_t j) { ++hits[i*ninner + j]; }, ninner);
+        }, nouter);
+        check(count_bad(), 0u);
+
+        thread::parallel_for pf0(0);
+        check(pf0.size(), 0u);
+        reset();
+        pf0.execute([&](uint_t i) { ++hits[i]; }, n);
+        check(count_bad(), 0u);
+    }
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
@@ -0,0 +1,161 @@
+#include <vif.hpp>
+#include <vif/test/unit_test.hpp>
+
+using namespace vif;
+
+int vif_main(int argc, char* argv[]) {
+    const auto short_wait = std::chrono::milliseconds(50);
+
+    {
+        // Bounded queue: 'push' blocks while the queue is full
+        thread::bounded_queue<int> q(2);
+        check(q.capacity(), 2u);
+        check(q.push(1), true);
+        check(q.push(2), true);
+        check(q.try_push(3), false);
+
+        std::atomic<bool> pushed(false);
+        std::thread producer([&]() {
+            q.push(3);
+            pushed = true;
+        });
+
+        std::this_thread::sleep_for(short_wait);
+        check(pushed.load(), false);
+
+        int t = 0;
+        check(q.pop(t), true);
+        check(t, 1);
+        producer.join();
+        check(pushed.load(), true);
+        check(q.size(), 2u);
+
+        // Close: remaining elements can be popped, nothing can be pushed
+        q.close();
+        check(q.push(4), false);
+        check(q.try_push(4), false);
+        check(q.pop(t), true);
+        check(t, 2);
+        check(q.pop(t), true);
+        check(t, 3);
+        check(q.pop(t), false);
+        check(q.try_pop(t), false);
+
+        // Threads waiting for elements are woken up on close
+        q.reopen();
+        std::atomic<bool> popped(true);
+        std::thread consumer([&]() {
+            int v;
+            popped = q.pop(v);
+        });
+
+        std::this_thread::sleep_for(short_wait);
+        check(popped.load(), true);
+        q.close();
+        consumer.join();
+        check(popped.load(), false);
+
+        // Reopen
+        q.reopen();
+        check(q.push(5), true);
+        check(q.pop(t), true);
+        check(t, 5);
+        check(q.empty(), true);
+    }
+
+    {
+        // Bounded worker pool; items wait for 'open' before being processed
+        std::atomic<bool> open(false);
+        std::atomic<uint_t> nprocessed(0);
+
+        thread::bounded_worker_pool<int> pool;
+        pool.queue_size = 1;
+        pool.start(3, [&](int) {
+            while (!open) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            ++nprocessed;
+        });
+
+        check(pool.size(), 3u);
+
+        // Items go to the least loaded worker
+        pool.process(0, 0);
+        pool.process(0, 0);
+        pool.process(1);
+        pool.process(2);
+        check(pool.workers[0]->workload(), 2u);
+        check(pool.workers[1]->workload(), 1u);
+        check(pool.workers[2]->workload(), 1u);
+
+        pool.process(3);
+        pool.process(4);
+        check(pool.workers[0]->workload(), 2u);
+        check(pool.workers[1]->workload(), 2u);
+        check(pool.workers[2]->workload(), 2u);
+        check(pool.remaining(), 6u);
+
+        // Each worker is processing one item and holds another in its queue: it is full
+        std::atomic<bool> pushed(false);
+        std::thread producer([&]() {
+            pool.process(5);
+            pushed = true;
+        });
+
+        std::this_thread::sleep_for(short_wait);
+        check(pushed.load(), false);
+        check(nprocessed.load(), 0u);
+
+        open = true;
+        producer.join();
+        check(pushed.load(), true);
+
+        // Only returns once every item is processed
+        for (uint_t i : range(50)) {
+            pool.process(i);
+        }
+
+        pool.wait_idle();
+        check(nprocessed.load(), 57u);
+        check(pool.remaining(), 0u);
+
+        // Items sent after the workers are stopped are discarded
+        pool.join();
+        pool.process(0);
+        check(pool.remaining(), 0u);
+        check(nprocessed.load(), 57u);
+    }
+
+    {
+        // Workers with a workspace, and restarting a pool
+        thread::bounded_worker_pool<uint_t, vec1u> pool(2, [](vec1u& w, uint_t i) {
+            w.push_back(i);
+        });
+
+        for (uint_t i : range(100)) {
+            pool.process(i);
+        }
+
+        pool.wait_idle();
+        vec1u all = pool.workers[0]->wsp;
+        append(all, pool.workers[1]->wsp);
+        inplace_sort(all);
+        check(all, indgen<uint_t>(100));
+
+        std::atomic<uint_t> nprocessed(0);
+        pool.start(4, [&](vec1u&, uint_t) { ++nprocessed; });
+        for (uint_t i : range(100)) {
+            pool.process(i);
+        }
+
+        pool.wait_idle();
+        check(nprocessed.load(), 100u);
+    }
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
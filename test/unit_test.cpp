@@ -411,6 +411,49 @@ int vif_main(int argc, char* argv[]) {
         w[7] = 1; w[9] = 5;
         wcounts = histogram(t, w, bins);
         check(wcounts, "{1, 4, 5, 2, 0}");
+
+        counts = parallel_histogram(t, bins, 4);
+        check(counts, "{1, 4, 5, 2, 0}");
+
+        counts = histogram(t, make_bins(0.0, 10.0, 5));
+        check(counts, "{1, 2, 5, 2, 2}");
+
+        counts = histogram(t, e10(make_bins(0.0, 1.0, 2)));
+        check(counts, "{3, 9}");
+
+        vec2d obins = {{0,4,2}, {5,6,8}};
+        counts = histogram(t, obins);
+        check(counts, "{5, 3, 2}");
+
+        // Callbacks report each element once, in the first bin that contains it, and stop
+        // after the last non-empty bin
+        vec1u cids, cbins;
+        histogram(t, obins, [&](uint_t i, vec1u ids) {
+            cbins.push_back(i);
+            counts[i] = ids.size();
+            append(cids, ids);
+        });
+        check(counts, "{5, 3, 2}");
+        check(cbins, "{0, 1, 2}");
+        check(cids, "{0, 1, 2, 3, 12, 4, 5, 10, 8, 11}");
+
+        cbins.clear();
+        vec1d tf = {1, 3, 2};
+        histogram(tf, bins, [&](uint_t i, vec1u ids) {
+            cbins.push_back(i);
+        });
+        check(cbins, "{0, 1}");
+
+        // Large enough to use several threads
+        auto seed = make_seed(42);
+        vec1d tl = 12.0*randomu(seed, 10000) - 1.0;
+        tl[randomi(seed, 0, tl.size()-1, 50)] = dnan;
+        vec1d wl = randomu(seed, tl.size());
+        vec1u pcounts = parallel_histogram(tl, bins, 4);
+        check(count(pcounts != histogram(tl, bins)), "0");
+        check(total(pcounts) == count(tl >= 0.0), "1");
+        vec1d pwcounts = parallel_histogram(tl, wl, bins, 4);
+        check(max(abs(pwcounts - histogram(tl, wl, bins))) < 1e-9, "1");
     }
 
     {
@@ -25,8 +25,11 @@ int vif_main(int argc, char* argv[]) {
     uint_t nbin = 10;
     std::string out_file = "angcorrel.fits";
     uint_t tseed = 42;
+    uint_t nthread = 1;
+    bool verbose = false;
 
-    read_args(argc-2, argv+2, arg_list(range, nbin, name(out_file, "out"), name(tseed, "seed")));
+    read_args(argc-2, argv+2, arg_list(range, nbin, name(out_file, "out"), name(tseed, "seed"),
+        name(nthread, "thread"), verbose));
 
     vec2d bins = e10(make_bins(log10(range[0]), log10(range[1]), nbin));
     vec1d ang = 0.5*(bins(0,_) + bins(1,_));
@@ -53,7 +56,11 @@ int vif_main(int argc, char* argv[]) {
         return 1;
     }
 
-    vec1d w = angcorrel(cat.ra, cat.dec, rra, rdec, bins);
+    angcorrel_params params;
+    params.thread = nthread;
+    params.verbose = verbose;
+
+    vec1d w = angcorrel(cat.ra, cat.dec, rra, rdec, bins, params);
 
     fits::write_table(out_file, ftable(bins, w, ang));
 
@@ -64,7 +71,7 @@ void print_help() {
     using namespace terminal_format;
 
     print("angcorrel v1.0");
-    paragraph("usage: angcorrel cat.fits refcat.fits [range,nbin,out,seed]");
+    paragraph("usage: angcorrel cat.fits refcat.fits [range,nbin,out,seed,thread,verbose]");
     paragraph("Compute the angular two point correlation function of a given catalog "
         "'cat.fits'. The correlation is calculated using the Landy-Szalay estimator, by "
         "comparing against a random uniform distribution of points generated within the "
@@ -78,4 +85,7 @@ void print_help() {
     bullet("out", "[string] output file name (default: angcorrel.fits)");
     bullet("seed", "[unsigned integer] random seed for the generation of the random "
         "uniform positions (default: 42)");
+    bullet("thread", "[unsigned integer] number of threads to use to count pairs "
+        "(default: 1)");
+    bullet("verbose", "[flag] show a progress bar to estimate computing time");
 }
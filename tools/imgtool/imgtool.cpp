@@ -54,6 +54,9 @@ void print_convolve_help() {
 
     header("List of available command line options:");
     bullet("normalize", "[flag] normalize kernel to unit integral before convolution");
+    bullet("tile", "[uint] if set, convolve the map in tiles of this size read from and written "
+        "to disk one at a time, so that the map is never loaded in memory");
+    bullet("thread", "[uint] number of threads to use to convolve the tiles (default: 1)");
     bullet("help", "[flag] print this text");
     print("");
 }
@@ -66,22 +69,33 @@ bool convolve(int argc, char* argv[]) {
 
     bool help = false;
     bool normalize = false;
-    read_args(argc-3, argv+3, arg_list(help, normalize));
+    uint_t tile = 0;
+    uint_t thread = 1;
+    read_args(argc-3, argv+3, arg_list(help, normalize, tile, thread));
 
     if (help) {
         print_convolve_help();
         return true;
     }
 
-    vec2d map = fits::read(argv[1]);
     vec2d kernel = fits::read(argv[2]);
     if (normalize) {
         kernel /= total(kernel);
     }
 
+    file::mkdir(file::get_directory(argv[3]));
+
+    if (tile > 0) {
+        astro::convolve2d_tiled_params opts;
+        opts.tile_size = tile;
+        opts.thread = thread;
+        astro::convolve2d_tiled(argv[1], kernel, argv[3], opts);
+        return true;
+    }
+
+    vec2d map = fits::read(argv[1]);
     map = convolve2d(map, kernel);
 
-    file::mkdir(file::get_directory(argv[3]));
     fits::write(argv[3], map);
 
     return true;
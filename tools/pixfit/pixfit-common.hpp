@@ -279,6 +279,22 @@ vec2d read_psf(const map_info& map, int_t& hsize) {
     return read_psf(map.psf, map.beam_smear, hsize);
 }
 
+// Precompute the PSF shifted at 'phases' sub-pixel offsets per pixel, so that placing
+// the PSF on a source does not require interpolating it again. With zero phases, the PSF
+// is shifted exactly for each source instead.
+psf_stamp_bank make_psf_bank(const vec2d& psf, uint_t phases, bool verbose) {
+    psf_stamp_bank_params p;
+    p.phases = phases;
+    psf_stamp_bank bank(psf, p);
+
+    if (verbose && phases != 0) {
+        note("PSF sampled at 1/", phases, " pixel, maximum error ",
+            bank.max_error*100.0, "% of the peak");
+    }
+
+    return bank;
+}
+
 // Find the first value in 'x' where 'y' equals zero, linearly interpolating between
 // the gridded data points
 template<typename TypeX, typename TypeY>
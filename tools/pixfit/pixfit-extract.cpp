@@ -45,6 +45,9 @@ int vif_main(int argc, char* argv[]) {
     float beam_flux = 1.0;
     // Number of threads the program can use
     uint_t nthread = 1;
+    // Number of sub-pixel positions per pixel at which the PSF is precomputed
+    // (0: shift the PSF exactly for each source)
+    uint_t psf_phases = 0;
     // Display help
     bool help = false;
 
@@ -55,7 +58,7 @@ int vif_main(int argc, char* argv[]) {
         help, fconv, verbose, fixed_bg, save_covariance, cell_approx, flux_prior,
         make_groups, group_fit_threshold, group_aper_threshold, group_aper_size,
         group_cov_threshold, group_post_process, name(nthread, "threads"),
-        beam_smeared, beam_size, trim_image, beam_flux
+        beam_smeared, beam_size, trim_image, beam_flux, psf_phases
     ));
 
     if (argc == 1 || help) {
@@ -218,6 +221,8 @@ int vif_main(int argc, char* argv[]) {
         map.fconv /= map.beam_flux;
         psf /= map.beam_flux;
 
+        psf_stamp_bank bank = make_psf_bank(psf, psf_phases, verbose);
+
         // Read image
         if (verbose) {
             print("reading map", (map.band.empty() ? "" : " for band "+map.band), " in memory...");
@@ -576,78 +581,147 @@ int vif_main(int argc, char* argv[]) {
 
         uint_t nelem = nobs + (free_bg ? 1 : 0);
 
-        matrix::mat2d alpha(nelem, nelem);
+        matrix::sparse_symmetric alpha(nelem);
         vec1d beta(nelem);
 
-        // Alpha is symmetric, so only compute one side
+        // Alpha is symmetric, and sparse since each source only overlaps with its close
+        // neighbors (and the background)
         // This matrix measures the overlap between the different fit components
         // Beta measures the product of each component with the actual data
 
+        // Run a function over all the sources, possibly in parallel
+        auto run_sources = [&](const std::function<void(uint_t,uint_t)>& func) {
+            auto pg = progress_start(nobs);
+            if (nthread > 1) {
+                std::atomic<uint_t> ndone(0);
+                thread::task_pool pool(nthread);
+                pool.execute_chunks([&](uint_t i0, uint_t i1) {
+                    func(i0, i1);
+                    ndone += i1 - i0;
+                }, 0, nobs, 0, [&]() {
+                    if (verbose) print_progress(pg, ndone.load());
+                });
+
+                if (verbose) print_progress(pg, nobs);
+            } else {
+                for (uint_t i : range(nobs)) {
+                    func(i, i+1);
+                    if (verbose) progress(pg, 1123);
+                }
+            }
+        };
+
         // Source terms
         vec1f local_error(nsrc);
 
-        auto pg = progress_start(nobs*(nobs-1)/2);
-        for (uint_t i : range(nobs)) {
-            // TODO: for groups, build a combined PSF instead of just using a PSF at the center
+        // Get the weighted PSF of each source, only once
+        const uint_t psize = 2*hsize+1;
+        std::vector<vec2d> wpsf(nobs);
+        vec1d alpha_diag(nobs), alpha_bg(nobs);
+        run_sources([&](uint_t i0, uint_t i1) {
+            for (uint_t i = i0; i < i1; ++i) {
+                // TODO: for groups, build a combined PSF instead of just using a PSF at the center
+
+                vec2d tpsf2 = bank.weighted_stamp(err, iy[i], ix[i], dy[i], dx[i]);
+                vec1u idi, idp;
+                subregion(snr, {iy[i]-hsize, ix[i]-hsize, iy[i]+hsize, ix[i]+hsize}, idi, idp);
+
+                vec1f terr = err[idi];
+                vec1d tpsf = tpsf2[idp];
 
-            // Get the weighted PSF of source 'i'
-            vec2d tpsf2 = translate(psf, dy[i], dx[i]);
-            vec1u idi, idp;
-            subregion(snr, {iy[i]-hsize, ix[i]-hsize, iy[i]+hsize, ix[i]+hsize}, idi, idp);
+                // Compute the local RMS of the map
+                local_error[idin[i]] = 1.0/sqrt(total(sqr(tpsf)));
 
-            vec1u idpc = complement(tpsf2, idp);
-            vec1f terr = err[idi];
-            tpsf2[idp] /= terr;
-            tpsf2[idpc] = 0;
-            vec1d tpsf = tpsf2[idp];
+                // Beta term: beta[i] = x[i]*image/err^2
+                beta[i] = total(snr[idi]*tpsf);
 
-            // Compute the local RMS of the map
-            local_error[idin[i]] = 1.0/sqrt(total(sqr(tpsf)));
+                // Alpha terms
+                // The source with itself: alpha(i,i) = (x[i]/err)^2
+                alpha_diag[i] = total(sqr(tpsf));
 
-            // Beta term: beta[i] = x[i]*image/err^2
-            beta[i] = total(snr[idi]*tpsf);
+                if (flux_prior) {
+                    // If requested, add a prior on the flux of each source
+                    beta[i] += fprior[i]/sqr(fprior_err[i]);
+                    alpha_diag[i] += 1.0/sqr(fprior_err[i]);
+                }
 
-            // Alpha terms
-            // The source with itself: alpha(i,i) = (x[i]/err)^2
-            alpha(i,i) = total(sqr(tpsf));
+                if (free_bg) {
+                    // Source x Background: alpha(i,bg) = x[i]/err^2
+                    alpha_bg[i] = total(tpsf/terr);
+                }
 
-            if (flux_prior) {
-                // If requested, add a prior on the flux of each source
-                beta[i] += fprior[i]/sqr(fprior_err[i]);
-                alpha(i,i) += 1.0/sqr(fprior_err[i]);
+                wpsf[i] = std::move(tpsf2);
+            }
+        });
+
+        // Sort the sources in a grid with cells as large as the PSF, so that overlapping
+        // sources are always found in neighboring cells
+        int_t gx0 = 0, gy0 = 0;
+        uint_t gnx = 0, gny = 0;
+        vec1u cell_ids, cell_start;
+        if (nobs > 0) {
+            gx0 = min(ix); gy0 = min(iy);
+            gnx = (max(ix) - gx0)/psize + 1;
+            gny = (max(iy) - gy0)/psize + 1;
+
+            vec1u cell = ((iy - gy0)/psize)*gnx + (ix - gx0)/psize;
+            cell_ids = sort(cell);
+            cell_start.resize(gnx*gny+1);
+            for (uint_t c : cell) {
+                ++cell_start.safe[c+1];
             }
 
-            if (free_bg) {
-                // Source x Background: alpha(i,bg) = x[i]/err^2
-                alpha(i,nobs) = alpha(nobs,i) = total(tpsf/terr);
+            for (uint_t c : range(gnx*gny)) {
+                cell_start.safe[c+1] += cell_start.safe[c];
             }
+        }
 
-            // Source x Source: alpha(j,i) = x[i]*x[j]/err^2
-            for (uint_t j : range(i+1, nobs)) {
-                int_t idx = ix[i]-ix[j], idy = iy[i]-iy[j];
-
-                if (abs(idx) <= 2*hsize && abs(idy) <= 2*hsize) {
-                    vec1u pidi, pidj;
-                    subregion(psf, {idy, idx, idy+2*hsize, idx+2*hsize}, pidj, pidi);
-                    if (!pidi.empty()) {
-                        // Get the weighted PSF of source 'j'
-                        vec2d tpsf2_j; {
-                            tpsf2_j = translate(psf, dy[j], dx[j]);
-                            vec1u idi_j, idp_j;
-                            subregion(snr, {iy[j]-hsize, ix[j]-hsize, iy[j]+hsize, ix[j]+hsize},
-                                idi_j, idp_j);
-
-                            vec1u idpc_j = complement(tpsf2_j, idp_j);
-                            tpsf2_j[idp_j] /= err[idi_j];
-                            tpsf2_j[idpc_j] = 0;
+        // Source x Source: alpha(j,i) = x[i]*x[j]/err^2
+        std::vector<vec1u> pair_id(nobs);
+        std::vector<vec1d> pair_val(nobs);
+        run_sources([&](uint_t i0, uint_t i1) {
+            for (uint_t i = i0; i < i1; ++i) {
+                const int_t ps = psize;
+                uint_t cx = (ix[i] - gx0)/psize, cy = (iy[i] - gy0)/psize;
+                for (uint_t ty = (cy > 0 ? cy-1 : 0); ty <= std::min(cy+1, gny-1); ++ty)
+                for (uint_t tx = (cx > 0 ? cx-1 : 0); tx <= std::min(cx+1, gnx-1); ++tx) {
+                    uint_t c = ty*gnx + tx;
+                    for (uint_t k = cell_start.safe[c]; k < cell_start.safe[c+1]; ++k) {
+                        uint_t j = cell_ids.safe[k];
+                        int_t idx = ix[i]-ix[j], idy = iy[i]-iy[j];
+                        if (j <= i || abs(idx) > 2*hsize || abs(idy) > 2*hsize) continue;
+
+                        // Pixel (py,px) of the stamp of 'i' is pixel (py+idy,px+idx) of 'j'
+                        const vec2d& si = wpsf[i];
+                        const vec2d& sj = wpsf[j];
+                        double v = 0.0;
+                        for (int_t py = std::max(int_t(0), -idy); py < std::min(ps, ps-idy); ++py)
+                        for (int_t px = std::max(int_t(0), -idx); px < std::min(ps, ps-idx); ++px) {
+                            v += si.safe(py,px)*sj.safe(py+idy,px+idx);
                         }
 
-                        alpha(j,i) = alpha(i,j) = total(tpsf2_j[pidj]*tpsf2[pidi]);
+                        pair_id[i].push_back(j);
+                        pair_val[i].push_back(v);
                     }
                 }
+            }
+        });
+
+        wpsf.clear();
+        wpsf.shrink_to_fit();
+
+        for (uint_t i : range(nobs)) {
+            alpha.add(i, i, alpha_diag[i]);
+            if (free_bg) {
+                alpha.add(i, nobs, alpha_bg[i]);
+            }
 
-                if (verbose) progress(pg, 1123);
+            for (uint_t k : range(pair_id[i])) {
+                alpha.add(i, pair_id[i][k], pair_val[i][k]);
             }
+
+            pair_id[i].clear();
+            pair_val[i].clear();
         }
 
         // Pure Background terms
@@ -656,7 +730,29 @@ int vif_main(int argc, char* argv[]) {
             beta[nobs] = total(snr/err);
 
             // Background x Background: alpha(bg,bg) = 1/err^2
-            alpha(nobs, nobs) = total(1.0/sqr(err));
+            alpha.add(nobs, nobs, total(1.0/sqr(err)));
+        }
+
+        alpha.compress();
+
+        // Factorize the matrix, ordering the sources so as to limit the fill-in
+        if (verbose) {
+            print("factorize matrix (", alpha.nonzeros(), " non-zero elements)...");
+        }
+
+        matrix::decompose_sparse_ldl ldl; {
+            vec1d ox = x, oy = y;
+            if (free_bg) {
+                ox.push_back(dnan);
+                oy.push_back(dnan);
+            }
+
+            if (!ldl.decompose(alpha, matrix::nested_dissection_order(alpha, ox, oy))) {
+                error("could not invert covariance matrix, it is singular");
+                note("there are probably some prior source positions which are too close and "
+                    "cannot be deblended");
+                return 1;
+            }
         }
 
         // Solve the system
@@ -692,12 +788,6 @@ int vif_main(int argc, char* argv[]) {
             ));
         };
 
-        matrix::mat2d covar;
-        if (has_groups) {
-            covar = alpha;
-            inplace_symmetrize(covar);
-        }
-
         if (cell_approx) {
             if (verbose) {
                 print("compute approximated covariance errors...");
@@ -710,8 +800,9 @@ int vif_main(int argc, char* argv[]) {
                 idn.clear();
 
                 uint_t ii = npos;
-                for (uint_t j : range(nobs)) {
-                    if (alpha(i,j) > 1e-3*sqrt(alpha(i,i)*alpha(j,j))) {
+                for (uint_t k = alpha.row[i]; k < alpha.row[i+1]; ++k) {
+                    uint_t j = alpha.col[k];
+                    if (j < nobs && alpha.val[k] > 1e-3*sqrt(alpha(i,i)*alpha(j,j))) {
                         if (j == i) ii = idn.size();
                         idn.push_back(j);
                     }
@@ -754,15 +845,7 @@ int vif_main(int argc, char* argv[]) {
                 print("solve system...");
             }
 
-            if (!inplace_solve_symmetric(alpha, beta)) {
-                error("could not solve the linear problem");
-                note("there are probably some prior source positions which are too close and "
-                    "cannot be deblended");
-                return 1;
-            }
-
-            // The best fit values are now stored in beta
-            best_fit = beta;
+            best_fit = ldl.solve(beta);
 
             // Extract the background value if needed
             if (free_bg) {
@@ -780,22 +863,13 @@ int vif_main(int argc, char* argv[]) {
             save_fit_basics();
         } else {
             if (verbose) {
-                print("invert matrix...");
-            }
-
-            if (!inplace_invert_symmetric(alpha)) {
-                error("could not invert covariance matrix, it is singular");
-                note("there are probably some prior source positions which are too close and "
-                    "cannot be deblended");
-                return 1;
+                print("solve system...");
             }
 
-            // Compute covariance matrix to get the errors
-            inplace_symmetrize(alpha);
-
-            // Multiply the inverted alpha with beta to get the best fit values
-            best_fit = alpha*beta;
-            best_fit_err = sqrt(diagonal(alpha));
+            // Solve the system to get the best fit values, and only compute the diagonal
+            // of the inverted alpha to get the errors
+            best_fit = ldl.solve(beta);
+            best_fit_err = sqrt(ldl.invert_diagonal());
 
             // Extract the background value if needed
             if (free_bg) {
@@ -814,8 +888,23 @@ int vif_main(int argc, char* argv[]) {
             save_fit_basics();
 
             if (save_covariance) {
+                // The full covariance matrix is dense, so it has to be computed explicitly
+                if (verbose) {
+                    print("invert matrix...");
+                }
+
+                matrix::mat2d covar = alpha.dense();
+                if (!inplace_invert_symmetric(covar)) {
+                    error("could not invert covariance matrix, it is singular");
+                    note("there are probably some prior source positions which are too close "
+                        "and cannot be deblended");
+                    return 1;
+                }
+
+                inplace_symmetrize(covar);
+
                 vec2d covariance(nsrc, nsrc);
-                covariance(idin,idin) = alpha(_-(nobs-1), _-(nobs-1));
+                covariance(idin,idin) = covar(_-(nobs-1), _-(nobs-1));
 
                 if (make_groups && !id_new.empty()) {
                     // Ungroup grouped sources
@@ -843,9 +932,13 @@ int vif_main(int argc, char* argv[]) {
                     // Find a group to place this source and its neighbors in
                     uint_t gid = npos;
 
+                    // Only the neighbors of 'i' have a non-zero covariance
                     double bcov = group_cov_threshold;
-                    for (uint_t j : range(nobs)) {
-                        double tcov = covar(i,j)/sqrt(covar(i,i)*covar(j,j));
+                    for (uint_t k = alpha.row[i]; k < alpha.row[i+1]; ++k) {
+                        uint_t j = alpha.col[k];
+                        if (j >= nobs) continue;
+
+                        double tcov = alpha.val[k]/sqrt(alpha(i,i)*alpha(j,j));
                         if (tcov > bcov && is_grouped[j]) {
                             // We found one, but keep on going to make sure we pick the group
                             // that has the highest covariance
@@ -868,8 +961,12 @@ int vif_main(int argc, char* argv[]) {
 
                     // Notify sources of their new group
                     vec1u nidg;
-                    for (uint_t j : range(nobs)) {
-                        if (covar(i,j)/sqrt(covar(i,i)*covar(j,j)) > group_cov_threshold && !is_grouped[j]) {
+                    for (uint_t k = alpha.row[i]; k < alpha.row[i+1]; ++k) {
+                        uint_t j = alpha.col[k];
+                        if (j >= nobs) continue;
+
+                        double tcov = alpha.val[k]/sqrt(alpha(i,i)*alpha(j,j));
+                        if (tcov > group_cov_threshold && !is_grouped[j]) {
                             if (group_fit_id[j] != npos) {
                                 vec1u idg = where(old_cat.group_fit_id == group_fit_id[j]);
                                 old_cat.group_aper_id[idg] = gid;
@@ -912,7 +1009,7 @@ int vif_main(int argc, char* argv[]) {
                 if (is_grouped[i]) continue;
 
                 // Subtract the rest
-                vec2f tpsf = translate(psf, dy[i], dx[i]);
+                vec2d tpsf = bank.shift(dy[i], dx[i]);
                 vec1u idi, idp;
                 subregion(img, {iy[i]-hsize, ix[i]-hsize, iy[i]+hsize, ix[i]+hsize}, idi, idp);
 
@@ -1027,7 +1124,7 @@ int vif_main(int argc, char* argv[]) {
                 // Compute the fraction of flux contained in the mask for each source
                 for (uint_t j : id) {
                     // Create the model PSF for this source
-                    vec1f tpsf = flatten(translate(psf, tdy[j], tdx[j]));
+                    vec2d tpsf = bank.shift(tdy[j], tdx[j]);
                     vec1u idi, idp;
                     subregion(mask, {tiy[j]-hsize, tix[j]-hsize, tiy[j]+hsize, tix[j]+hsize}, idi, idp);
 
@@ -1093,7 +1190,7 @@ int vif_main(int argc, char* argv[]) {
             auto tpg = progress_start(nobs);
             for (uint_t i : range(nobs)) {
                 // Subtract the source
-                vec1f tpsf = flatten(translate(psf, dy[i], dx[i]));
+                vec2d tpsf = bank.shift(dy[i], dx[i]);
                 vec1u idi, idp;
                 subregion(img, {iy[i]-hsize, ix[i]-hsize, iy[i]+hsize, ix[i]+hsize}, idi, idp);
 
@@ -1120,7 +1217,7 @@ int vif_main(int argc, char* argv[]) {
             vec2d mod = img*0;
             auto tpg = progress_start(nobs);
             for (uint_t i : range(nobs)) {
-                vec1f tpsf = flatten(translate(psf, dy[i], dx[i]));
+                vec2d tpsf = bank.shift(dy[i], dx[i]);
                 vec1u idi, idp;
                 subregion(mod, {iy[i]-hsize, ix[i]-hsize, iy[i]+hsize, ix[i]+hsize}, idi, idp);
 
@@ -1162,5 +1259,9 @@ void print_help() {
         "catalog (default: no)");
     bullet("cell_approx", "[flag] use a fitting approximation for non blended sources "
         "to make the fit significantly faster (default: no)");
+    bullet("psf_phases", "[int] number of sub-pixel positions per pixel at which the PSF is "
+        "precomputed, which is faster but quantises the PSF positions; 0 shifts the PSF exactly "
+        "for each source (default: 0)");
+    bullet("threads", "[int] number of threads to use to build the matrix (default: 1)");
     print("");
 }
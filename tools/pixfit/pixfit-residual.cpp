@@ -4,8 +4,10 @@ int vif_main(int argc, char* argv[]) {
     std::string map_file;
     std::string cat_file;
     double snr_min = dnan;
+    uint_t psf_phases = 0;
 
-    read_args(argc, argv, arg_list(name(map_file, "maps"), name(cat_file, "cat"), snr_min));
+    read_args(argc, argv, arg_list(name(map_file, "maps"), name(cat_file, "cat"), snr_min,
+        psf_phases));
 
     bool bad = false;
     if (map_file.empty()) {
@@ -50,6 +52,7 @@ int vif_main(int argc, char* argv[]) {
         // Read PSF
         int_t hsize;
         vec2d psf = read_psf(map, hsize);
+        psf_stamp_bank bank = make_psf_bank(psf, psf_phases, false);
 
         // Get pixel coordinates
         vec1d x, y;
@@ -68,7 +71,7 @@ int vif_main(int argc, char* argv[]) {
 
         // Remove the sources from the map
         for (uint_t i : range(x)) {
-            vec1f tpsf = flatten(translate(psf, dy[i], dx[i]));
+            vec2d tpsf = bank.shift(dy[i], dx[i]);
             vec1u idi, idp;
             subregion(img, {iy[i]-hsize, ix[i]-hsize, iy[i]+hsize, ix[i]+hsize}, idi, idp);
 
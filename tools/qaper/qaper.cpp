@@ -254,7 +254,7 @@ int vif_main(int argc, char* argv[]) {
         if (ends_with(imgf, "-psf.fits")) continue;
 
         // Read image
-        fits::input_image fimg(imgf);
+        fits::mapped_image fimg(imgf);
         if (fimg.axis_count() != 2) continue;
 
         imgfile.push_back(imgf);
@@ -13,7 +13,10 @@ void print_help() {
         "to 2 x radius [pixels] (or [arcsec] if the 'arcsec' keyword is provided), and "
         "save the result in a new FITS file.\n\n"
         "Alternatively, one may provide a 'kernel' image in FITS format which will be "
-        "used directly to perform the convolution."
+        "used directly to perform the convolution.\n\n"
+        "For large images, set 'tile' to convolve the image in tiles of this size, which are "
+        "read from and written to disk one at a time, so that the image never needs to fit "
+        "in memory. The tiles can be processed in parallel using 'thread' threads."
     );
 }
 
@@ -28,9 +31,11 @@ int vif_main(int argc, char* argv[]) {
     std::string kernel_file = "";
     double radius = 1.0;
     bool arcsec = false;
+    uint_t tile = 0;
+    uint_t thread = 1;
 
     read_args(argc-1, argv+1, arg_list(
-        name(fout, "out"), radius, arcsec, name(kernel_file, "kernel")
+        name(fout, "out"), radius, arcsec, name(kernel_file, "kernel"), tile, thread
     ));
 
     if (fout.empty()) {
@@ -84,6 +89,14 @@ int vif_main(int argc, char* argv[]) {
         beam /= total(beam);
     }
 
+    if (tile > 0) {
+        astro::convolve2d_tiled_params opts;
+        opts.tile_size = tile;
+        opts.thread = thread;
+        astro::convolve2d_tiled(fimg, beam, fout, opts);
+        return 0;
+    }
+
     vec2d img;
     fits::header hdr;
     fits::read(fimg, img, hdr);
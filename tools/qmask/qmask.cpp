@@ -135,7 +135,7 @@ int vif_main(int argc, char* argv[]) {
     std::string out_file = (argc > 3 ? argv[3] : file::remove_extension(img_file)+"_msk.fits");
 
     // Read image
-    fits::input_image fimg(img_file);
+    fits::mapped_image fimg(img_file);
     if (fimg.axis_count() != 2) return 1;
 
     vec2d img;
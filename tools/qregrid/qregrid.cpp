@@ -20,8 +20,11 @@ int vif_main(int argc, char* argv[]) {
     std::string weight;
     std::string method = "drizzle";
     bool conserve_flux = false;
+    double tolerance = dnan;
+    uint_t thread = 1;
     read_args(argc-2, argv+2, arg_list(
-        verbose, name(tpl, "template"), aspix, ratio, method, conserve_flux, weight, pixfrac, fast
+        verbose, name(tpl, "template"), aspix, ratio, method, conserve_flux, weight, pixfrac, fast,
+        tolerance, thread
     ));
 
     // Forward options
@@ -31,6 +34,7 @@ int vif_main(int argc, char* argv[]) {
     dopts.verbose = verbose;
     iopts.conserve_flux = conserve_flux;
     dopts.pixfrac = pixfrac;
+    dopts.thread = thread;
 
     if (fast) {
         dopts.dest_pixfrac = true;
@@ -154,7 +158,18 @@ int vif_main(int argc, char* argv[]) {
 
     // Regrid
     vec2d wei, res;
-    if (method == "drizzle") {
+    if (is_finite(tolerance)) {
+        // Approximate the WCS transform with the requested accuracy (in pixels)
+        astro::pixel_transform_params topts;
+        topts.tolerance = tolerance;
+        topts.verbose = verbose;
+
+        if (method == "drizzle") {
+            res = astro::regrid_drizzle(imgs, astro::pixel_transform(astros, astrod, topts), wei, dopts);
+        } else {
+            res = astro::regrid_interpolate(imgs, astro::pixel_transform(astrod, astros, topts), iopts);
+        }
+    } else if (method == "drizzle") {
         res = astro::regrid_drizzle(imgs, astros, astrod, wei, dopts);
     } else {
         res = astro::regrid_interpolate(imgs, astros, astrod, iopts);
@@ -42,9 +42,20 @@ void print_help() {
     bullet("keepnan", "[flag] do not reject sources with NaN pixels");
     bullet("bstrap", "[flag] perform bootstraping and save the resulting cube");
     bullet("nbstrap", "[unsigned integer, optional] number of boostraping realisations");
-    bullet("sbstrap", "[unsigned integer, optional] size of a boostraping realisation");
+    bullet("sbstrap", "[unsigned integer, optional] size of a boostraping realisation (default: "
+        "half of the stacked sources)");
+    bullet("stream", "[flag] when stacking from a catalog, also stack the cutouts as they are "
+        "extracted (without storing the cube of cutouts in memory) for median stacking and "
+        "bootstraping. The median is then approximate (to a small fraction of the pixel "
+        "dispersion), and each source enters a bootstrap realisation a random number of times, "
+        "drawn from a Poisson distribution of mean 0.5. Not used if 'cube' or 'sbstrap' are set, "
+        "or for median bootstraping");
+    bullet("   ", "note: mean stacking from a catalog without bootstraping or 'keepnan' is always "
+        "done as the cutouts are extracted, since the result is the same");
     bullet("randomize", "[flag] when stacking from a catalog, randomize the positions inside the "
         "area that is covered by the selected sources");
+    bullet("thread", "[unsigned integer, optional] number of threads used to extract the "
+        "cutouts (default: 1)");
     bullet("verbose", "[flag] print some information about the stacking process");
     print("");
 
@@ -104,18 +115,20 @@ int vif_main(int argc, char* argv[]) {
     bool verbose = false;
     bool bstrap = false;
     bool subpixel = false;
+    bool stream = false;
     uint_t randomize = 0;
     bool tcube = false;
     bool keepnan = false;
     uint_t nbstrap = 200;
     uint_t sbstrap = 0;
     uint_t tseed = 42;
+    uint_t thread = 1;
     vec1s cids;
 
     read_args(argc, argv, arg_list(
         out, cat, img, wht, err, pos, hsize, median, mean, bstrap, nbstrap, sbstrap,
         randomize, name(tseed, "seed"), name(tcube, "cube"), subpixel, verbose, keepnan,
-        name(cids, "ids")
+        name(cids, "ids"), thread, stream
     ));
 
     auto seed = make_seed(tseed);
@@ -236,8 +249,56 @@ int vif_main(int argc, char* argv[]) {
     params.keep_nan = keepnan;
     params.verbose = verbose;
     params.save_offsets = subpixel;
+    params.thread = thread;
 
-    if ((wht.empty() && err.empty()) || median) {
+    // Stack the cutouts as they are extracted, without building the cube. This gives the same
+    // mean, but the median and bootstrap realisations are approximate, so these need 'stream'.
+    if (!cat.empty() && !tcube) {
+        if (stream) {
+            stream = !(bstrap && (median || sbstrap != 0));
+        } else {
+            stream = mean && !bstrap && !keepnan;
+        }
+    } else {
+        stream = false;
+    }
+
+    if (stream) {
+        if (img.size() != 1) {
+            error("catalog stacking needs a single image");
+            return 1;
+        }
+
+        auto shift = [&](const qstack_cutout& c, vec2f& flux) {
+            if (subpixel) flux = translate(flux, c.dy, c.dx);
+        };
+
+        vec1u ids;
+        if (median) {
+            qstack_median_reducer red(hsize);
+            qstack_reduce(fcat.ra, fcat.dec, img[0], hsize, red, ids, shift, params);
+            stack = red.median();
+        } else {
+            qstack_mean_reducer red(hsize, bstrap ? nbstrap : 0, 0.5, tseed);
+            if (wht.empty() && err.empty()) {
+                qstack_reduce(fcat.ra, fcat.dec, img[0], hsize, red, ids, shift, params);
+            } else {
+                bool is_err = wht.empty();
+                qstack_reduce(fcat.ra, fcat.dec, img[0], is_err ? err[0] : wht[0], hsize, red, ids,
+                    [&](const qstack_cutout& c, vec2f& flux, vec2f& weight) {
+                        shift(c, flux);
+                        if (is_err) weight = invsqr(weight);
+                    }, params);
+            }
+
+            stack = red.mean();
+            if (bstrap) {
+                bs = red.bootstrap();
+            }
+        }
+
+        if (verbose) print("stacking ", ids.size(), "/", fcat.ra.size(), " sources");
+    } else if ((wht.empty() && err.empty()) || median) {
         if (cat.empty()) {
             fits::read(img[0], cube);
 
@@ -37,6 +37,14 @@ void print_help() {
         "n'th nearest neighbors for each source within this catalog."
     );
 
+    paragraph(
+        "When the same catalog is used repeatedly as the second catalog, the 'index' option "
+        "can be used to save its spatial index in a file. If this file already exists, the "
+        "index is loaded from it and the second catalog is not read at all (it can then be "
+        "omitted from 'cats'). The index file is only valid for the catalog (and the "
+        "'pos' and 'radec2' options) it was created with."
+    );
+
     header("List of available command line options:");
     bullet("verbose", "set this flag to print additional information in the standard output");
     bullet("nth", "[number] set this value to the number of closest neighbors you want to retrieve "
@@ -49,6 +57,14 @@ void print_help() {
         "catalog (default: [ra,dec])");
     bullet("thread", "[number]: set this value to the number of concurrent threads you want to run "
         "(default: 1).");
+    bullet("index", "[string]: file in which to save (or from which to load) the spatial index "
+        "of the second catalog (default: none).");
+    bullet("radius", "[number]: if set, find all the counterparts within this radius (in "
+        "arcsec) instead of the 'nth' closest neighbors. The first catalog is then read in chunks "
+        "and can be larger than the available memory; the output file contains one row per "
+        "pair, with the columns ID1, ID2 and D (distance in arcsec).");
+    bullet("chunk", "[number]: number of sources of the first catalog to read at once in "
+        "'radius' mode (default: 1000000).");
     print("");
 
     paragraph("Copyright (c) 2013 C. Schreiber (corentin.schreiber@cea.fr)");
@@ -84,14 +100,18 @@ int vif_main(int argc, char* argv[]) {
     bool   quiet = false;
     bool   brute = false;
     bool   no_mirror = false;
+    std::string index;
+    double radius = 0.0;
+    uint_t chunk = 1000000;
 
     read_args(argc, argv, arg_list(
-        cats, output, nth, thread, verbose, quiet, pos, radec1, radec2, brute, no_mirror
+        cats, output, nth, thread, verbose, quiet, pos, radec1, radec2, brute, no_mirror, index,
+        radius, chunk
     ));
 
     if (quiet) verbose = false;
 
-    if (output.empty()) {
+    if (output.empty() || cats.empty() || cats.size() > 2) {
         if (!quiet) print_help();
         return 0;
     }
@@ -100,14 +120,84 @@ int vif_main(int argc, char* argv[]) {
         vec1d ra, dec;
     };
 
+    if (pos.size() == 1) pos = replicate(pos[0], 2);
+    else if (pos.empty()) pos = {"", ""};
+    vec1u idne = where(!empty(pos));
+    pos[idne] += ".";
+
+    // Load or build the spatial index of the second catalog (or of the only catalog for
+    // self matches)
+    bool self = cats.size() == 1 && (index.empty() || !file::exists(index));
+    auto get_index = [&]() -> sky_index {
+        sky_index idx;
+        if (!index.empty() && file::exists(index)) {
+            if (verbose) print("qxmatch: loading index from '", index, "'...");
+            idx = sky_index(index);
+        } else {
+            coord_t cat2;
+            if (self) {
+                fits::read_table(cats[0], pos[0]+radec1[0], cat2.ra, pos[0]+radec1[1], cat2.dec);
+            } else {
+                fits::read_table(cats[1], pos[1]+radec2[0], cat2.ra, pos[1]+radec2[1], cat2.dec);
+            }
+
+            if (cat2.ra.size() == 0 || cat2.dec.size() == 0) {
+                error("qxmatch: ", self ? "catalog" : "second catalog", " is empty");
+            }
+
+            if (verbose) print("qxmatch: building index...");
+            idx = sky_index(cat2.ra, cat2.dec, thread);
+
+            if (!index.empty()) {
+                if (verbose) print("qxmatch: saving index to '", index, "'...");
+                idx.save(index);
+            }
+        }
+
+        return idx;
+    };
+
+    qxmatch_params p; p.nth = nth; p.thread = thread; p.verbose = verbose; p.no_mirror = no_mirror;
+    p.brute_force = brute;
+
+    if (radius > 0) {
+        // Radius search: the first catalog is streamed from the disk in chunks, and the
+        // counterparts are written as they are found
+        sky_index idx = get_index();
+        p.self = self;
+
+        if (verbose) {
+            print("qxmatch: finding all counterparts within ", radius, "\" of the sources from '",
+                cats[0], "' among ", idx.size(), " sources...");
+        }
+
+        uint_t nmatch = qxmatch_radius_stream(cats[0], pos[0]+radec1[0], pos[0]+radec1[1],
+            idx, radius, output, p, chunk);
+
+        if (verbose) print("qxmatch: found ", nmatch, " pairs");
+
+        return 0;
+    }
+
     qxmatch_res res;
 
-    if (cats.size() == 2) {
-        if (pos.size() == 1) pos = replicate(pos[0], 2);
-        else if (pos.empty()) pos = {"", ""};
-        vec1u idne = where(!empty(pos));
-        pos[idne] += ".";
+    if (!index.empty() && (cats.size() == 2 || file::exists(index))) {
+        coord_t cat1;
+        fits::read_table(cats[0], pos[0]+radec1[0], cat1.ra, pos[0]+radec1[1], cat1.dec);
+
+        if (cat1.ra.size() == 0 || cat1.dec.size() == 0) {
+            error("qxmatch: first catalog is empty");
+        }
+
+        sky_index idx = get_index();
+
+        if (verbose) {
+            print("qxmatch: crossmatching ", cat1.ra.size(), " sources from '", cats[0],
+                "' with ", idx.size(), " sources from the index...");
+        }
 
+        res = qxmatch(cat1.ra, cat1.dec, idx, p);
+    } else if (cats.size() == 2) {
         coord_t cat1, cat2;
         fits::read_table(cats[0], pos[0]+radec1[0], cat1.ra, pos[0]+radec1[1], cat1.dec);
         fits::read_table(cats[1], pos[1]+radec2[0], cat2.ra, pos[1]+radec2[1], cat2.dec);
@@ -125,13 +215,8 @@ int vif_main(int argc, char* argv[]) {
                 "' with ", cat2.ra.size(), " sources from '", cats[1], "'...");
         }
 
-        qxmatch_params p; p.nth = nth; p.thread = thread; p.verbose = verbose; p.no_mirror = no_mirror;
-        p.brute_force = brute;
         res = qxmatch(cat1, cat2, p);
-    } else if (cats.size() == 1) {
-        if (pos.empty()) pos = {""};
-        if (!pos[0].empty()) pos += ".";
-
+    } else {
         coord_t cat;
         fits::read_table(cats[0], pos[0]+radec1[0], cat.ra, pos[0]+radec1[1], cat.dec);
 
@@ -143,12 +228,7 @@ int vif_main(int argc, char* argv[]) {
             print("qxmatch: self matching ", cat.ra.size(), " sources from '", cats[0], "'...");
         }
 
-        qxmatch_params p; p.nth = nth; p.thread = thread; p.verbose = verbose; p.no_mirror = no_mirror;
-        p.brute_force = brute;
         res = qxmatch(cat, p);
-    } else {
-        if (!quiet) print_help();
-        return 0;
     }
 
     qxmatch_save(output, res);
@@ -16,8 +16,10 @@ int vif_main(int argc, char* argv[]) {
     vec1u include, exclude;
     std::string out, reg;
     double fconv = 1.0;
+    uint_t psf_phases = 0;
     read_args(argc-2, argv+2, arg_list(
-        bands_notes, bands, notes, name(psf_model, "psf"), include, exclude, out, fconv, reg
+        bands_notes, bands, notes, name(psf_model, "psf"), include, exclude, out, fconv, reg,
+        psf_phases
     ));
 
     if (psf_model.empty()) {
@@ -135,15 +137,40 @@ int vif_main(int argc, char* argv[]) {
     vec1d x, y;
     astro::ad2xy(w, cat.ra, cat.dec, x, y);
 
-    vec2d psf(img.dims);
-    auto pg = progress_start(cat.ra.size());
-    for (uint_t i : range(cat.ra)) {
-        if (!make_psf({{img.dims[0], img.dims[1]}}, y[i]-1, x[i]-1, psf_model, psf)) {
-            return 1;
+    vec1s psf_params = trim(split(psf_model, ","));
+    if (psf_params[0] == "file" && psf_params.size() == 2) {
+        // Read the PSF only once, and precompute its sub-pixel shifts if asked to
+        psf_stamp_bank_params p;
+        p.phases = psf_phases;
+        psf_stamp_bank bank(read_psf_stamp(psf_params[1]), p);
+        if (psf_phases != 0) {
+            note("PSF sampled at 1/", psf_phases, " pixel, maximum error ",
+                bank.max_error*100.0, "% of the peak");
         }
 
-        img -= psf*cat.flux[i]/fconv;
-        progress(pg);
+        vec1d x0 = y - 1, y0 = x - 1;
+        vec1i ix0 = round(x0), iy0 = round(y0);
+        auto pg = progress_start(cat.ra.size());
+        for (uint_t i : range(cat.ra)) {
+            vec2d psf = bank.shift(x0[i] - ix0[i], y0[i] - iy0[i]);
+            int_t hsize = psf.dims[0]/2;
+
+            vec1u idi, idp;
+            subregion(img, {ix0[i]-hsize, iy0[i]-hsize, ix0[i]+hsize, iy0[i]+hsize}, idi, idp);
+            img[idi] -= psf[idp]*cat.flux[i]/fconv;
+            progress(pg);
+        }
+    } else {
+        vec2d psf(img.dims);
+        auto pg = progress_start(cat.ra.size());
+        for (uint_t i : range(cat.ra)) {
+            if (!make_psf({{img.dims[0], img.dims[1]}}, y[i]-1, x[i]-1, psf_model, psf)) {
+                return 1;
+            }
+
+            img -= psf*cat.flux[i]/fconv;
+            progress(pg);
+        }
     }
 
     if (out.empty()) {
@@ -164,4 +191,7 @@ void print_help() {
 
     print("subsrc v1.0");
     paragraph("usage: subsrc img.fits srcs.[fits/cat] [psf=...,out=...]");
+    paragraph("with psf=file,<psf.fits>, the PSF is shifted exactly on each source, unless "
+        "psf_phases is set: it is then precomputed at psf_phases sub-pixel positions per pixel, "
+        "which is faster but quantises the source positions (default: 0)");
 }